@@ -0,0 +1,94 @@
+#!/bin/sh
+# Round trip generated inputs through every compressor mode and lzh8_dec,
+# make check runs this. Run from this directory after building.
+# Inputs that fail are left in the scratch directory.
+
+EXE_EXT=${EXE_EXT:-}
+DIR=${1:-check_tmp}
+HERE=$(pwd)
+
+rm -rf "$DIR" && mkdir "$DIR" || exit 1
+cd "$DIR" || exit 1
+
+# nothing, and less than a backreference
+: > empty
+printf 'abc' > three
+
+# one long zero run, backreferences at displacement 0 (the memset) all
+# the way to an end that isn't a multiple of the copy size, so the last
+# copy runs into the output slack
+head -c 100001 /dev/zero > zeros
+{ printf 'x'; head -c 65535 /dev/zero; printf 'yz'; head -c 4099 /dev/zero; } > zero_runs
+
+# overlapping short periods, then 8 and 16 byte copies
+yes abc | head -c 30001 > period4
+yes 123456789 | head -c 30002 > period10
+yes 'a line long enough for sixteen byte copies' | head -c 30003 > period44
+
+# repeats at six distances that need different displacement lengths and
+# nothing else, a displacement length table whose last entry ends inside a
+# byte that's already been read
+LC_ALL=C awk 'BEGIN {
+    srand(6)
+    split("20 40 100 200 600 3000", distance, " ")
+    for (k = 1; k <= 6; k++) {
+        for (i = 0; i < 16; i++) repeat[i] = 1 + int(rand() * 255)
+        for (i = 0; i < 16; i++) printf "%c", repeat[i]
+        for (i = 16; i < distance[k]; i++) printf "%c", 1 + int(rand() * 255)
+        for (i = 0; i < 16; i++) printf "%c", repeat[i]
+    }
+}' > six_displens
+
+# something realistic, and something that doesn't compress
+cat "$HERE"/*.c "$HERE"/*.h > text
+head -c 100000 /dev/urandom > random
+
+# more than one 512K chunk for -j, with the chunk boundaries inside
+# matches and inside incompressible stretches
+: > mixed
+i=0
+while [ $i -lt 12 ]
+do
+    cat text >> mixed
+    head -c 20000 /dev/urandom >> mixed
+    head -c 3000 /dev/zero >> mixed
+    i=$((i + 1))
+done
+
+status=0
+for input in empty three zeros zero_runs period4 period10 period44 six_displens text random mixed
+do
+    for mode in "lzh8_cmp" "lzh8_cmp_nonstrict" "lzh8_cmp_nonstrict -O" \
+                "lzh8_cmp_nonstrict -j 3" "lzh8_cmp_nonstrict -O -j 3"
+    do
+        set -- $mode
+        compressor=$1
+        shift
+        if ! "$HERE/$compressor$EXE_EXT" "$@" "$input" "$input.lz" > log 2>&1
+        then
+            echo "$input: $mode failed"
+            cat log
+            status=1
+        elif ! "$HERE/lzh8_dec$EXE_EXT" "$input.lz" "$input.out" > log 2>&1
+        then
+            echo "$input: lzh8_dec failed on the output of $mode"
+            cat log
+            status=1
+        elif ! cmp -s "$input" "$input.out"
+        then
+            echo "$input: $mode didn't round trip"
+            status=1
+        fi
+    done
+    [ $status -eq 0 ] && rm -f "$input.lz" "$input.out"
+done
+
+if [ $status -eq 0 ]
+then
+    echo "all modes round trip"
+    cd "$HERE" && rm -rf "$DIR"
+else
+    echo "failures left in $DIR"
+fi
+
+exit $status
@@ -26,14 +26,21 @@
    This software is released to the public domain as of November 2, 2009.
 */
 
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
 #include "util.h"
 #include "error_stuff.h"
 
-#define VERSION "0.8 "
+#define VERSION "0.9 "
 #ifndef LZH8_NONSTRICT
 #define BUILD_STRING VERSION __DATE__
 #else
@@ -65,23 +72,64 @@
 #define STRICT_COMPRESSION  0
 #endif
 
-void LZH8_compress(FILE *infile, FILE *outfile, long file_length);
+/* Optimal parsing (nonstrict only) */
+
+/* passes of parsing, each priced with the Huffman codes of the last */
+#define OPTIMAL_PASSES      3
+
+/* Multithreaded LZSS (nonstrict only): input is split into chunks of this
+   size, each seeded with the window before it */
+#define LZSS_CHUNK_SIZE     0x80000l
+
+void LZH8_compress(FILE *infile, FILE *outfile, long file_length,
+        bool optimal_parse, int threads);
 
 int main(int argc, char **argv)
 {
-    if (argc != 3)
+    bool optimal_parse = false;
+    int threads = 1;
+    int arg_idx = 1;
+
+#if !STRICT_COMPRESSION
+    while (argc - arg_idx > 2)
+    {
+        if (0 == strcmp(argv[arg_idx], "-O"))
+        {
+            optimal_parse = true;
+            arg_idx ++;
+        }
+        else if (0 == strcmp(argv[arg_idx], "-j"))
+        {
+            threads = read_long(argv[arg_idx+1]);
+            CHECK_ERROR(threads < 1, "thread count must be at least 1");
+            arg_idx += 2;
+        }
+        else
+        {
+            break;
+        }
+    }
+#endif
+
+    if (argc - arg_idx != 2)
     {
         printf("lzh8_cmp " BUILD_STRING "\n\n");
+#if !STRICT_COMPRESSION
+        printf("Usage: %s [-O] [-j threads] infile outfile\n",argv[0]);
+        printf("    -O  optimal parsing: smaller output, but slower\n");
+        printf("    -j  compress chunks of the input on this many threads\n");
+#else
         printf("Usage: %s infile outfile\n",argv[0]);
+#endif
         exit(EXIT_FAILURE);
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
+    FILE *infile = fopen(argv[arg_idx], "rb");
     CHECK_ERRNO(!infile, "fopen");
 
-    FILE *outfile = fopen(argv[2], "wb");
-    CHECK_ERRNO(!infile, "fopen");
+    FILE *outfile = fopen(argv[arg_idx+1], "wb");
+    CHECK_ERRNO(!outfile, "fopen");
 
     /* get file size */
     CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
@@ -90,7 +138,7 @@ int main(int argc, char **argv)
 
     rewind(infile);
 
-    LZH8_compress(infile, outfile, file_length);
+    LZH8_compress(infile, outfile, file_length, optimal_parse, threads);
 
     CHECK_ERRNO(fclose(outfile) == EOF, "fclose");
 
@@ -158,12 +206,38 @@ int LZH8_displen_length(uint16_t displacement);
 
 void LZH8_LZSS_compress(
         unsigned char *input_data,
+        long dictionary_length,
         long input_length,
         struct lzss_symbol **lzss_stream_p,
-        long *lzss_length_p);
+        long *lzss_length_p,
+        bool report_progress);
+
+#if !STRICT_COMPRESSION
+void LZH8_LZSS_compress_optimal(
+        unsigned char *input_data,
+        long dictionary_length,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        bool report_progress);
+
+void LZH8_LZSS_compress_parallel(
+        unsigned char *input_data,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        bool optimal_parse,
+        int threads);
+#endif
 
 /* Huffman prototypes */
 
+void LZH8_Huff_count_frequencies(
+        const struct lzss_symbol * const lzss_stream,
+        long lzss_length,
+        long *length_freq,
+        long *displen_freq);
+
 void LZH8_Huff_produce_encodings(
         struct lzss_symbol * const lzss_stream,
         long lzss_length,
@@ -272,7 +346,8 @@ static inline void write_bits(
 
 /* Main LZH8 compression function */
 
-void LZH8_compress(FILE *infile, FILE *outfile, long file_length)
+void LZH8_compress(FILE *infile, FILE *outfile, long file_length,
+        bool optimal_parse, int threads)
 {
     long output_offset = 0;
 
@@ -317,7 +392,23 @@ void LZH8_compress(FILE *infile, FILE *outfile, long file_length)
 
         get_bytes_seek(0, infile, input_data, file_length);
 
-        LZH8_LZSS_compress(input_data, file_length, &lzss_stream, &lzss_length);
+#if !STRICT_COMPRESSION
+        if (threads > 1)
+        {
+            LZH8_LZSS_compress_parallel(input_data, file_length,
+                    &lzss_stream, &lzss_length, optimal_parse, threads);
+        }
+        else if (optimal_parse)
+        {
+            LZH8_LZSS_compress_optimal(input_data, 0, file_length,
+                    &lzss_stream, &lzss_length, true);
+        }
+        else
+#endif
+        {
+            LZH8_LZSS_compress(input_data, 0, file_length,
+                    &lzss_stream, &lzss_length, true);
+        }
 
 #if MAKE_DUMP
         // temp, dump LZSS stuff to file
@@ -424,6 +515,9 @@ void LZH8_compress(FILE *infile, FILE *outfile, long file_length)
 }
 
 
+/* The LZSS functions encode input_data from dictionary_length up to
+   input_length, anything before that is only there to be referred back to. */
+
 #if LZSS_HASH
 
 /* LZSS with hashing */
@@ -441,9 +535,11 @@ static inline int LZSS_hash(unsigned char *input, int length, int hash_size)
 
 void LZH8_LZSS_compress(
         unsigned char *input_data,
+        long dictionary_length,
         long input_length,
         struct lzss_symbol **lzss_stream_p,
-        long *lzss_length_p)
+        long *lzss_length_p,
+        bool report_progress)
 {
     /* POLICY: parameters for this coding */
     const int min_length = 3;
@@ -508,7 +604,7 @@ void LZH8_LZSS_compress(
         long longest_match_offset = 0;
 
 #if REPORT_PROGRESS
-        if (bytes_done - last_report >= 0x40000l)
+        if (report_progress && bytes_done - last_report >= 0x40000l)
         {
             fprintf(stderr,"%ld bytes done (%.0f%%)\n", bytes_done, (float)bytes_done/input_length*100);
             last_report = bytes_done;
@@ -523,7 +619,8 @@ void LZH8_LZSS_compress(
         }
 
         /* enough bytes for a match remaining in input? */
-        if ( bytes_done + min_length <= input_length )
+        if ( bytes_done >= dictionary_length &&
+             bytes_done + min_length <= input_length )
         {
             /* search for a match among strings with same hash as next
                 min_length bytes, linked list is in most-recent-first order */
@@ -578,7 +675,12 @@ void LZH8_LZSS_compress(
         long bytes_in_this_symbol;
 
         /* record the new symbol */
-        if (longest_match < min_length)
+        if (bytes_done < dictionary_length)
+        {
+            /* only filling in the window */
+            bytes_in_this_symbol = dictionary_length - bytes_done;
+        }
+        else if (longest_match < min_length)
         {
             /* no backreference possible */
             lzss_stream[lzss_length].is_reference = 0;
@@ -670,9 +772,11 @@ void LZH8_LZSS_compress(
 /* LZSS with dumb linear search */
 void LZH8_LZSS_compress(
         unsigned char *input_data,
+        long dictionary_length,
         long input_length,
         struct lzss_symbol **lzss_stream_p,
-        long *lzss_length_p)
+        long *lzss_length_p,
+        bool report_progress)
 {
     /* POLICY: parameters for this coding */
     const int min_length = 3;
@@ -700,7 +804,7 @@ void LZH8_LZSS_compress(
         long longest_match_offset = 0;
 
 #if REPORT_PROGRESS
-        if (0 == lzss_length % (5*0x400))
+        if (report_progress && 0 == lzss_length % (5*0x400))
         {
             fprintf(stderr,"%ld bytes done (%f%%)\n", bytes_done, (float)bytes_done/input_length*100);
         }
@@ -713,6 +817,13 @@ void LZH8_LZSS_compress(
             next_input_offset = input_length;
         }
 
+        /* nothing to search for in the dictionary, only back into it */
+        if (bytes_done < dictionary_length)
+        {
+            bytes_done = dictionary_length;
+            continue;
+        }
+
         /* consider window */
         window_size = bytes_done;
         if (max_window_size < window_size)
@@ -763,7 +874,12 @@ void LZH8_LZSS_compress(
         long bytes_in_this_symbol;
 
         /* record the new symbol */
-        if (longest_match < min_length)
+        if (bytes_done < dictionary_length)
+        {
+            /* only filling in the window */
+            bytes_in_this_symbol = dictionary_length - bytes_done;
+        }
+        else if (longest_match < min_length)
         {
             /* no backreference possible */
             lzss_stream[lzss_length].is_reference = 0;
@@ -790,6 +906,625 @@ void LZH8_LZSS_compress(
 }
 #endif
 
+#if !STRICT_COMPRESSION
+
+/* Optimal parsing
+
+   Rather than taking the longest match at each position, find the
+   cheapest way to code each block of input, by the bit lengths of the
+   Huffman codes. The codes depend on the parse, so this is repeated with
+   the codes that the last pass produced (the first pass gets flat codes).
+
+   Matches come from a binary tree match finder: every position in the
+   window is a node in a tree sorted by the string starting there, with the
+   most recent position at the root of the tree for its hash. Searching for
+   the current string walks down from the root and re-links the tree with
+   the current position as the new root, so searching is also insertion.
+   The walk is cut off after BT_MAX_DEPTH nodes, which bounds the work at
+   each position however repetitive the input.
+*/
+
+enum {BT_HASH_BITS = 16};
+enum {BT_CYCLE = 1 << 17};      /* power of 2, larger than the window */
+enum {BT_MAX_DEPTH = 48};
+
+/* matches at least this long are taken right away */
+enum {OPTIMAL_NICE_LENGTH = 128};
+/* positions parsed before forcing a choice */
+enum {OPTIMAL_BLOCK = 0x10000};
+
+struct lzss_match
+{
+    int length;
+    long distance;
+};
+
+struct bt_match_finder
+{
+    const unsigned char *input_data;
+    long input_length;
+    long max_window_size;
+    /* most recent position with each hash, -1 for none */
+    long *head;
+    /* pairs of smaller and larger children of each position, by position
+       modulo BT_CYCLE, -1 for none */
+    long *son;
+};
+
+static inline uint32_t BT_hash(const unsigned char *input)
+{
+    const uint32_t key =
+        ((uint32_t)input[0] << 16) | ((uint32_t)input[1] << 8) | input[2];
+
+    return (key * UINT32_C(2654435761)) >> (32 - BT_HASH_BITS);
+}
+
+/* Find the matches for the string at pos, and insert it in the tree. Fills
+   in matches with increasing lengths (at least min_length), each at the
+   nearest distance found for that length; returns how many. */
+static int BT_find_matches(
+        struct bt_match_finder * const mf,
+        const long pos,
+        const int min_length,
+        const int max_length,
+        struct lzss_match * const matches)
+{
+    long length_limit = mf->input_length - pos;
+    if (length_limit > max_length)
+    {
+        length_limit = max_length;
+    }
+    if (length_limit < min_length)
+    {
+        /* too close to the end for a match, no need to insert either */
+        return 0;
+    }
+
+    const unsigned char * const cur = mf->input_data + pos;
+    const uint32_t key = BT_hash(cur);
+    long cur_match = mf->head[key];
+    mf->head[key] = pos;
+
+    /* where to link the next smaller and larger nodes found */
+    long *smaller_p = &mf->son[(pos & (BT_CYCLE-1)) * 2];
+    long *larger_p = &mf->son[(pos & (BT_CYCLE-1)) * 2 + 1];
+    /* everything under smaller_p and larger_p matches at least this much */
+    long smaller_length = 0, larger_length = 0;
+
+    long longest_match = min_length - 1;
+    int match_count = 0;
+
+    for (int depth = 0; ; depth ++)
+    {
+        if (cur_match < 0 || pos - cur_match > mf->max_window_size ||
+                BT_MAX_DEPTH == depth)
+        {
+            *smaller_p = -1;
+            *larger_p = -1;
+            break;
+        }
+
+        long * const pair = &mf->son[(cur_match & (BT_CYCLE-1)) * 2];
+        const unsigned char * const match = mf->input_data + cur_match;
+        long match_length = (smaller_length < larger_length) ?
+            smaller_length : larger_length;
+
+        if (match[match_length] == cur[match_length])
+        {
+            while (++match_length < length_limit &&
+                    match[match_length] == cur[match_length])
+            {}
+
+            if (match_length > longest_match)
+            {
+                longest_match = match_length;
+                matches[match_count].length = match_length;
+                matches[match_count].distance = pos - cur_match;
+                match_count ++;
+
+                if (match_length == length_limit)
+                {
+                    /* can't tell it apart from this string, replace it */
+                    *smaller_p = pair[0];
+                    *larger_p = pair[1];
+                    break;
+                }
+            }
+        }
+
+        if (match[match_length] < cur[match_length])
+        {
+            *smaller_p = cur_match;
+            smaller_p = &pair[1];
+            cur_match = *smaller_p;
+            smaller_length = match_length;
+        }
+        else
+        {
+            *larger_p = cur_match;
+            larger_p = &pair[0];
+            cur_match = *larger_p;
+            larger_length = match_length;
+        }
+    }
+
+    return match_count;
+}
+
+static inline void append_lzss_symbol(
+        struct lzss_symbol ** const lzss_stream_p,
+        long * const lzss_length_p,
+        long * const lzss_stream_capacity_p,
+        const uint8_t is_reference,
+        const uint8_t length_or_literal,
+        const uint16_t offset)
+{
+    /* check that there's room for a new symbol */
+    if (*lzss_length_p >= *lzss_stream_capacity_p)
+    {
+        if (0 == *lzss_stream_capacity_p)
+            *lzss_stream_capacity_p = 0x800;
+        else
+            *lzss_stream_capacity_p *= 2;
+        *lzss_stream_p = realloc(*lzss_stream_p,
+                *lzss_stream_capacity_p*sizeof(struct lzss_symbol));
+        CHECK_ERRNO( NULL == *lzss_stream_p, "realloc" );
+    }
+
+    struct lzss_symbol * const symbol = &(*lzss_stream_p)[*lzss_length_p];
+    symbol->is_reference = is_reference;
+    symbol->length_or_literal = length_or_literal;
+    symbol->offset = offset;
+    (*lzss_length_p) ++;
+}
+
+/* Bits it would take to code each symbol with the codes built for a
+   stream. Unused symbols are given one bit more than the longest code. */
+static void LZH8_optimal_prices(
+        const struct lzss_symbol * const lzss_stream,
+        long lzss_length,
+        uint32_t *litlen_price,
+        uint32_t *displen_price)
+{
+    long length_freq[LENCNT*2-1] = {0};
+    long displen_freq[DISPCNT*2-1] = {0};
+
+    LZH8_Huff_count_frequencies(lzss_stream, lzss_length,
+            length_freq, displen_freq);
+
+    {
+        int node_remains[LENCNT*2-1];
+        struct huff_node node_array[LENCNT*2-1];
+        struct huff_symbol litlen_table[LENCNT] = {{0}};
+        int root_idx = LZH8_Huff_build_Huffman_tree(
+                node_remains, length_freq, node_array, LENCNT);
+        LZH8_Huff_compute_prefix(node_array, root_idx, litlen_table, 0, 0);
+
+        uint32_t longest = 0;
+        for (int i = 0; i < LENCNT; i++)
+        {
+            if (litlen_table[i].key_len > longest)
+                longest = litlen_table[i].key_len;
+        }
+        for (int i = 0; i < LENCNT; i++)
+        {
+            litlen_price[i] = (0 != litlen_table[i].key_len) ?
+                litlen_table[i].key_len : longest + 1;
+        }
+    }
+
+    {
+        int node_remains[DISPCNT*2-1];
+        struct huff_node node_array[DISPCNT*2-1];
+        struct huff_symbol displen_table[DISPCNT] = {{0}};
+        int root_idx = LZH8_Huff_build_Huffman_tree(
+                node_remains, displen_freq, node_array, DISPCNT);
+        LZH8_Huff_compute_prefix(node_array, root_idx, displen_table, 0, 0);
+
+        uint32_t longest = 0;
+        for (int i = 0; i < DISPCNT; i++)
+        {
+            if (displen_table[i].key_len > longest)
+                longest = displen_table[i].key_len;
+        }
+        for (int i = 0; i < DISPCNT; i++)
+        {
+            displen_price[i] = (0 != displen_table[i].key_len) ?
+                displen_table[i].key_len : longest + 1;
+        }
+    }
+}
+
+void LZH8_LZSS_compress_optimal(
+        unsigned char *input_data,
+        long dictionary_length,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        bool report_progress)
+{
+    /* POLICY: parameters for this coding */
+    const int min_length = 3;
+    const int max_length = (1 << 8) - 1 + 3;
+    const long max_window_size = (1l << 16);
+
+    CHECK_ERROR( NULL != *lzss_stream_p || 0 != *lzss_length_p,
+            "should start with nothing");
+
+    struct bt_match_finder mf;
+    mf.input_data = input_data;
+    mf.input_length = input_length;
+    mf.max_window_size = max_window_size;
+    mf.head = malloc((1l << BT_HASH_BITS) * sizeof(long));
+    CHECK_ERRNO( NULL == mf.head, "malloc" );
+    mf.son = malloc(BT_CYCLE * 2 * sizeof(long));
+    CHECK_ERRNO( NULL == mf.son, "malloc" );
+
+    /* cheapest way found to reach each position in the block */
+    uint32_t *price = malloc((OPTIMAL_BLOCK + 1) * sizeof(uint32_t));
+    CHECK_ERRNO( NULL == price, "malloc" );
+    /* the last symbol on that way: length 1 for a literal */
+    struct lzss_match *from = malloc((OPTIMAL_BLOCK + 1) * sizeof(*from));
+    CHECK_ERRNO( NULL == from, "malloc" );
+    /* positions on the chosen way, back to front */
+    long *path = malloc((OPTIMAL_BLOCK + 1) * sizeof(long));
+    CHECK_ERRNO( NULL == path, "malloc" );
+
+    struct lzss_match matches[(1 << 8) + 3];
+
+    uint32_t litlen_price[LENCNT];
+    uint32_t displen_price[DISPCNT];
+
+    /* flat codes to start */
+    for (int i = 0; i < LENCNT; i++)
+    {
+        litlen_price[i] = LENBITS;
+    }
+    for (int i = 0; i < DISPCNT; i++)
+    {
+        displen_price[i] = DISPBITS;
+    }
+
+    struct lzss_symbol *lzss_stream = NULL;
+    long lzss_length = 0;
+
+    for (int pass = 0; pass < OPTIMAL_PASSES; pass++)
+    {
+        if (0 != pass)
+        {
+            LZH8_optimal_prices(lzss_stream, lzss_length,
+                    litlen_price, displen_price);
+        }
+
+        free(lzss_stream);
+        lzss_stream = NULL;
+        lzss_length = 0;
+        long lzss_stream_capacity = 0;
+
+        for (long i = 0; i < (1l << BT_HASH_BITS); i++)
+        {
+            mf.head[i] = -1;
+        }
+
+        /* only filling in the window */
+        for (long i = 0; i < dictionary_length; i++)
+        {
+            BT_find_matches(&mf, i, min_length, max_length, matches);
+        }
+
+#if REPORT_PROGRESS
+        long last_report = -0x40000l;
+#endif
+        for (long block_start = dictionary_length; block_start < input_length; )
+        {
+            long block_size = input_length - block_start;
+            if (block_size > OPTIMAL_BLOCK)
+            {
+                block_size = OPTIMAL_BLOCK;
+            }
+
+#if REPORT_PROGRESS
+            if (report_progress && block_start - last_report >= 0x40000l)
+            {
+                fprintf(stderr,"pass %d: %ld bytes done (%.0f%%)\n", pass+1,
+                        block_start, (float)block_start/input_length*100);
+                last_report = block_start;
+            }
+#endif
+
+            price[0] = 0;
+            for (long i = 1; i <= block_size; i++)
+            {
+                price[i] = UINT32_MAX;
+            }
+
+            /* a long match found at the end of the path, if any */
+            struct lzss_match nice_match = {0, 0};
+            long block_end;
+
+            for (block_end = 0; block_end < block_size; block_end++)
+            {
+                const long pos = block_start + block_end;
+                const int match_count = BT_find_matches(&mf, pos,
+                        min_length, max_length, matches);
+
+                if (0 != match_count &&
+                    matches[match_count-1].length >= OPTIMAL_NICE_LENGTH)
+                {
+                    nice_match = matches[match_count-1];
+                    break;
+                }
+
+                /* literal */
+                {
+                    const uint32_t new_price =
+                        price[block_end] + litlen_price[input_data[pos]];
+                    if (new_price < price[block_end+1])
+                    {
+                        price[block_end+1] = new_price;
+                        from[block_end+1].length = 1;
+                    }
+                }
+
+                /* backreferences, each length at the nearest distance */
+                int length = min_length;
+                for (int i = 0; i < match_count; i++)
+                {
+                    const int displen =
+                        LZH8_displen_length(matches[i].distance - 1);
+                    const uint32_t distance_price = price[block_end] +
+                        displen_price[displen] + (displen > 1 ? displen-1 : 0);
+
+                    for ( ; length <= matches[i].length &&
+                            block_end + length <= block_size; length++)
+                    {
+                        const uint32_t new_price = distance_price +
+                            litlen_price[0x100 + length - 3];
+                        if (new_price < price[block_end+length])
+                        {
+                            price[block_end+length] = new_price;
+                            from[block_end+length].length = length;
+                            from[block_end+length].distance =
+                                matches[i].distance;
+                        }
+                    }
+                }
+            }
+
+            /* trace back the cheapest way to block_end */
+            long path_length = 0;
+            for (long i = block_end; i > 0; i -= from[i].length)
+            {
+                path[path_length++] = i;
+            }
+
+            while (path_length > 0)
+            {
+                const long i = path[--path_length];
+                if (1 == from[i].length)
+                {
+                    append_lzss_symbol(&lzss_stream, &lzss_length,
+                            &lzss_stream_capacity,
+                            0, input_data[block_start+i-1], 0);
+                }
+                else
+                {
+                    append_lzss_symbol(&lzss_stream, &lzss_length,
+                            &lzss_stream_capacity,
+                            1, from[i].length - 3, from[i].distance - 1);
+                }
+            }
+
+            block_start += block_end;
+
+            if (0 != nice_match.length)
+            {
+                append_lzss_symbol(&lzss_stream, &lzss_length,
+                        &lzss_stream_capacity,
+                        1, nice_match.length - 3, nice_match.distance - 1);
+
+                /* the tree still needs the positions that were skipped */
+                for (long i = 1; i < nice_match.length; i++)
+                {
+                    BT_find_matches(&mf, block_start + i,
+                            min_length, max_length, matches);
+                }
+                block_start += nice_match.length;
+            }
+        }
+    }
+
+    *lzss_length_p = lzss_length;
+    *lzss_stream_p = lzss_stream;
+
+    free(mf.head);
+    free(mf.son);
+    free(price);
+    free(from);
+    free(path);
+}
+
+/* Multithreaded LZSS
+
+   Chunks are compressed independently, each with the max_window_size
+   bytes before it as the dictionary, so the streams can just be joined.
+   Nothing refers past the start of the window or runs past the end of its
+   chunk; what is lost is only matches that would have crossed a chunk
+   boundary. The chunking doesn't depend on the thread count, so neither
+   does the output.
+*/
+
+struct lzss_chunk
+{
+    long start, end;
+    struct lzss_symbol *lzss_stream;
+    long lzss_length;
+};
+
+struct lzss_chunk_pool
+{
+    unsigned char *input_data;
+    long input_length;
+    bool optimal_parse;
+
+    struct lzss_chunk *chunks;
+    long chunk_count;
+    long next_chunk;
+    long bytes_done;
+#ifndef __MINGW32__
+    pthread_mutex_t lock;
+#endif
+};
+
+static void *LZH8_LZSS_chunk_worker(void *pool_v)
+{
+    struct lzss_chunk_pool * const pool = pool_v;
+    const long max_window_size = (1l << 16);
+
+    for (;;)
+    {
+        long i;
+#ifndef __MINGW32__
+        CHECK_ERROR(pthread_mutex_lock(&pool->lock) != 0, "pthread_mutex_lock");
+#endif
+        i = pool->next_chunk++;
+#ifndef __MINGW32__
+        CHECK_ERROR(pthread_mutex_unlock(&pool->lock) != 0, "pthread_mutex_unlock");
+#endif
+
+        if (i >= pool->chunk_count) break;
+
+        struct lzss_chunk * const chunk = &pool->chunks[i];
+        const long dictionary_start = (chunk->start > max_window_size) ?
+            chunk->start - max_window_size : 0;
+
+        if (pool->optimal_parse)
+        {
+            LZH8_LZSS_compress_optimal(pool->input_data + dictionary_start,
+                    chunk->start - dictionary_start,
+                    chunk->end - dictionary_start,
+                    &chunk->lzss_stream, &chunk->lzss_length, false);
+        }
+        else
+        {
+            LZH8_LZSS_compress(pool->input_data + dictionary_start,
+                    chunk->start - dictionary_start,
+                    chunk->end - dictionary_start,
+                    &chunk->lzss_stream, &chunk->lzss_length, false);
+        }
+
+#ifndef __MINGW32__
+        CHECK_ERROR(pthread_mutex_lock(&pool->lock) != 0, "pthread_mutex_lock");
+#endif
+        pool->bytes_done += chunk->end - chunk->start;
+#if REPORT_PROGRESS
+        fprintf(stderr,"%ld bytes done (%.0f%%)\n", pool->bytes_done,
+                (float)pool->bytes_done/pool->input_length*100);
+#endif
+#ifndef __MINGW32__
+        CHECK_ERROR(pthread_mutex_unlock(&pool->lock) != 0, "pthread_mutex_unlock");
+#endif
+    }
+
+    return NULL;
+}
+
+void LZH8_LZSS_compress_parallel(
+        unsigned char *input_data,
+        long input_length,
+        struct lzss_symbol **lzss_stream_p,
+        long *lzss_length_p,
+        bool optimal_parse,
+        int threads)
+{
+    struct lzss_chunk_pool pool;
+
+    CHECK_ERROR( NULL != *lzss_stream_p || 0 != *lzss_length_p,
+            "should start with nothing");
+
+    pool.input_data = input_data;
+    pool.input_length = input_length;
+    pool.optimal_parse = optimal_parse;
+    pool.chunk_count = (input_length + LZSS_CHUNK_SIZE - 1) / LZSS_CHUNK_SIZE;
+    pool.next_chunk = 0;
+    pool.bytes_done = 0;
+
+    pool.chunks = malloc((pool.chunk_count + 1) * sizeof(struct lzss_chunk));
+    CHECK_ERRNO( NULL == pool.chunks, "malloc" );
+    for (long i = 0; i < pool.chunk_count; i++)
+    {
+        pool.chunks[i].start = i * LZSS_CHUNK_SIZE;
+        pool.chunks[i].end = (i + 1) * LZSS_CHUNK_SIZE;
+        if (pool.chunks[i].end > input_length)
+        {
+            pool.chunks[i].end = input_length;
+        }
+        pool.chunks[i].lzss_stream = NULL;
+        pool.chunks[i].lzss_length = 0;
+    }
+
+    /* no more threads than chunks */
+    if (threads > pool.chunk_count)
+    {
+        threads = pool.chunk_count;
+    }
+
+#ifndef __MINGW32__
+    CHECK_ERROR(pthread_mutex_init(&pool.lock, NULL) != 0, "pthread_mutex_init");
+    if (threads > 1)
+    {
+        pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+        CHECK_ERRNO( NULL == thread_ids, "malloc" );
+
+        for (int i = 0; i < threads; i++)
+        {
+            CHECK_ERROR(pthread_create(&thread_ids[i], NULL,
+                        LZH8_LZSS_chunk_worker, &pool) != 0, "pthread_create");
+        }
+        for (int i = 0; i < threads; i++)
+        {
+            CHECK_ERROR(pthread_join(thread_ids[i], NULL) != 0, "pthread_join");
+        }
+
+        free(thread_ids);
+    }
+    else
+#endif
+    {
+        LZH8_LZSS_chunk_worker(&pool);
+    }
+#ifndef __MINGW32__
+    pthread_mutex_destroy(&pool.lock);
+#endif
+
+    /* join the streams */
+    long lzss_length = 0;
+    for (long i = 0; i < pool.chunk_count; i++)
+    {
+        lzss_length += pool.chunks[i].lzss_length;
+    }
+
+    struct lzss_symbol *lzss_stream =
+        malloc((lzss_length + 1) * sizeof(struct lzss_symbol));
+    CHECK_ERRNO( NULL == lzss_stream, "malloc" );
+
+    lzss_length = 0;
+    for (long i = 0; i < pool.chunk_count; i++)
+    {
+        memcpy(&lzss_stream[lzss_length], pool.chunks[i].lzss_stream,
+                pool.chunks[i].lzss_length * sizeof(struct lzss_symbol));
+        lzss_length += pool.chunks[i].lzss_length;
+        free(pool.chunks[i].lzss_stream);
+    }
+
+    free(pool.chunks);
+
+    *lzss_length_p = lzss_length;
+    *lzss_stream_p = lzss_stream;
+}
+
+#endif /* !STRICT_COMPRESSION */
+
 int LZH8_displen_length(uint16_t displacement)
 {
     int bits = 0;
@@ -802,6 +1537,25 @@ int LZH8_displen_length(uint16_t displacement)
     return bits;
 }
 
+/* Count uses of each symbol, the arrays should start zeroed */
+void LZH8_Huff_count_frequencies(
+        const struct lzss_symbol * const lzss_stream,
+        long lzss_length,
+        long *length_freq,
+        long *displen_freq)
+{
+    for (long i=0; i < lzss_length; i++)
+    {
+        length_freq[ (lzss_stream[i].is_reference << 8) |
+                      lzss_stream[i].length_or_literal ] ++;
+
+        if (lzss_stream[i].is_reference)
+        {
+            displen_freq[ LZH8_displen_length(lzss_stream[i].offset) ] ++;
+        }
+    }
+}
+
 /* Build the Huffman code to be used for this file. Also produce the
    flattened tables and output them. */
 void LZH8_Huff_produce_encodings(
@@ -816,16 +1570,8 @@ void LZH8_Huff_produce_encodings(
     long length_freq[LENCNT*2-1] = {0};
     long displen_freq[DISPCNT*2-1] = {0};
 
-    for (long i=0; i < lzss_length; i++)
-    {
-        length_freq[ (lzss_stream[i].is_reference << 8) |
-                      lzss_stream[i].length_or_literal ] ++;
-
-        if (lzss_stream[i].is_reference)
-        {
-            displen_freq[ LZH8_displen_length(lzss_stream[i].offset) ] ++;
-        }
-    }
+    LZH8_Huff_count_frequencies(lzss_stream, lzss_length,
+            length_freq, displen_freq);
 
 #if SHOW_FREQUENCIES
     for (int i=0; i < LENCNT; i++)
@@ -41,7 +41,7 @@
 #include "util.h"
 #include "error_stuff.h"
 
-#define VERSION "0.8 " __DATE__
+#define VERSION "0.9 " __DATE__
 
 /* debug output options */
 #define SHOW_SYMBOLS        0
@@ -55,7 +55,37 @@ enum {DISPBITS = 5};
 enum {LENCNT = (1 << LENBITS)};
 enum {DISPCNT = (1 << DISPBITS)};
 
-void analyze_LZH8(FILE *infile, FILE *outfile, long file_length);
+/* Decoding is done with lookup tables rather than by walking the trees a
+   bit at a time. The first level is indexed by the next LOOKUP_*_BITS bits
+   of input, codes that are longer than that link to further tables of
+   LOOKUP_SUB_BITS each. */
+enum {LOOKUP_LENGTH_BITS = 11};
+enum {LOOKUP_DISPLEN_BITS = 8};
+enum {LOOKUP_SUB_BITS = 4};
+
+/* Two literals are decoded with one lookup where both fit in the first
+   level, that gets in the way of the debug output. */
+#define PAIR_LITERALS !(SHOW_SYMBOLS || SHOW_TREE || SHOW_FREQUENCIES)
+
+/* Lookup table entries:
+   bits 0-8:    symbol, or for a link the offset of the next table (0-16)
+   bits 9-16:   second literal byte of a pair
+   bits 17-20:  bits used by the (first) symbol
+   bits 21-24:  bits used by the entry: both symbols of a pair, or for a
+                link all of the bits of this table */
+#define LOOKUP_LINK     UINT32_C(0x80000000)
+#define LOOKUP_PAIR     UINT32_C(0x40000000)
+#define LOOKUP_SYMBOL(entry)        ((entry) & 0x1FF)
+#define LOOKUP_OFFSET(entry)        ((entry) & 0x1FFFF)
+#define LOOKUP_LITERAL2(entry)      (((entry) >> 9) & 0xFF)
+#define LOOKUP_SYMBOL_BITS(entry)   (((entry) >> 17) & 0xF)
+#define LOOKUP_ENTRY_BITS(entry)    (((entry) >> 21) & 0xF)
+
+/* room past the end of the output for copies that overshoot: one more
+   than the longest backreference, rounded up to the widest copy */
+enum {OUTPUT_SLACK = 0x120};
+
+void analyze_LZH8(const uint8_t *in, long in_size, FILE *outfile);
 
 int main(int argc, char **argv)
 {
@@ -71,7 +101,7 @@ int main(int argc, char **argv)
     CHECK_ERRNO(!infile, "fopen");
 
     FILE *outfile = fopen(argv[2], "wb");
-    CHECK_ERRNO(!infile, "fopen");
+    CHECK_ERRNO(!outfile, "fopen");
 
     /* get file size */
     CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
@@ -80,18 +110,26 @@ int main(int argc, char **argv)
 
     rewind(infile);
 
-    analyze_LZH8(infile, outfile, file_length);
+    /* read it all in, decoding works from memory */
+    uint8_t * const inbuf = malloc(file_length > 0 ? file_length : 1);
+    CHECK_ERRNO(NULL == inbuf, "malloc");
+    get_bytes(infile, inbuf, file_length);
+
+    CHECK_ERRNO(fclose(infile) == EOF, "fclose");
+
+    analyze_LZH8(inbuf, file_length, outfile);
 
     CHECK_ERRNO(fclose(outfile) == EOF, "fclose");
 
-    CHECK_ERRNO(fclose(infile) == EOF, "fclose");
+    free(inbuf);
 
     exit(EXIT_SUCCESS);
 }
 
-/* read MSB->LSB order */
+/* read MSB->LSB order, used for the tree tables */
 static inline uint16_t get_next_bits(
-        FILE *infile,
+        const uint8_t * const in,
+        const long in_size,
         long * const offset_p,
         uint8_t * const bit_pool_p,
         int * const bits_left_p,
@@ -103,7 +141,8 @@ static inline uint16_t get_next_bits(
     {
         if (0 == *bits_left_p)
         {
-            *bit_pool_p = get_byte_seek(*offset_p, infile);
+            CHECK_ERROR(*offset_p >= in_size, "unexpected end of input");
+            *bit_pool_p = in[*offset_p];
             *bits_left_p = 8;
             ++*offset_p;
         }
@@ -127,9 +166,230 @@ static inline uint16_t get_next_bits(
 }
 
 #define GET_NEXT_BITS(bit_count) \
-    get_next_bits(infile, &input_offset, &bit_pool, &bits_left, bit_count)
+    get_next_bits(in, in_size, &input_offset, &bit_pool, &bits_left, bit_count)
+
+/* bitstream for the compressed data, MSB first, topped up 64 bits at a time */
+struct bit_reader
+{
+    const uint8_t *in;
+    long in_size;
+    long offset;        /* next byte to load, may run past the end */
+    uint64_t bits;      /* next bit is the top bit */
+    int count;          /* valid bits in bits */
+};
+
+static inline uint64_t load_64_be(const uint8_t *p)
+{
+    return  (uint64_t)p[0] << 56 | (uint64_t)p[1] << 48 |
+            (uint64_t)p[2] << 40 | (uint64_t)p[3] << 32 |
+            (uint64_t)p[4] << 24 | (uint64_t)p[5] << 16 |
+            (uint64_t)p[6] << 8  | (uint64_t)p[7];
+}
+
+static inline int used_past_end(const struct bit_reader * const br)
+{
+    return br->offset * 8 - br->count > br->in_size * 8;
+}
+
+/* leaves at least 56 bits; past the end of the input zeros are read,
+   used_past_end catches when any of those are actually used */
+static inline void refill(struct bit_reader * const br)
+{
+    if (br->offset + 8 <= br->in_size)
+    {
+        /* bits already in the buffer are loaded again, which is harmless */
+        br->bits |= load_64_be(br->in + br->offset) >> br->count;
+        br->offset += (63 - br->count) >> 3;
+        br->count |= 56;
+    }
+    else
+    {
+        while (br->count <= 56)
+        {
+            if (br->offset < br->in_size)
+            {
+                br->bits |=
+                    (uint64_t)br->in[br->offset] << (56 - br->count);
+            }
+            br->offset ++;
+            br->count += 8;
+        }
+        CHECK_ERROR(used_past_end(br), "unexpected end of input");
+    }
+}
+
+static inline void skip_bits(struct bit_reader * const br, const int bit_count)
+{
+    br->bits <<= bit_count;
+    br->count -= bit_count;
+}
+
+/* continue a lookup into the tables for longer codes, returns the leaf */
+static inline uint32_t follow_links(
+        const uint32_t * const table,
+        uint32_t entry,
+        struct bit_reader * const br)
+{
+    while (entry & LOOKUP_LINK)
+    {
+        skip_bits(br, LOOKUP_ENTRY_BITS(entry));
+        if (br->count < 32)
+        {
+            refill(br);
+        }
+        entry = table[LOOKUP_OFFSET(entry) +
+            (br->bits >> (64 - LOOKUP_SUB_BITS))];
+    }
+
+    return entry;
+}
+
+/* a flattened tree as stored in the file, see the top of the file */
+struct decode_tree
+{
+    const uint16_t *nodes;
+    unsigned int node_count;    /* nodes that were read in */
+    unsigned int payload_mask;
+    unsigned int left_leaf;     /* flag for a leaf left child, >> 1 for right */
+};
+
+struct lookup_table
+{
+    uint32_t *entries;
+    long used;
+    long allocated;
+};
+
+static long add_lookup_level(struct lookup_table *table,
+        const struct decode_tree *tree, int width, unsigned int node);
+
+/* fill in the entries for the subtree at node, code is the path to node
+   from the root of this level, depth its length */
+static void fill_lookup_level(struct lookup_table *table,
+        const struct decode_tree *tree, long base, int width,
+        unsigned int node, unsigned int code, int depth)
+{
+    for (unsigned int child = 0; child < 2; child++)
+    {
+        const unsigned int next_node =
+            (node / 2 * 2) +
+            ((tree->nodes[node] & tree->payload_mask) + 1) * 2 +
+            child;
+        const unsigned int next_code = code * 2 + child;
+
+        CHECK_ERROR(next_node >= tree->node_count, "decode table is broken");
+
+        if (tree->nodes[node] & (tree->left_leaf >> child))
+        {
+            /* leaf, repeat for all of the bits after it */
+            const uint32_t entry = tree->nodes[next_node] |
+                (uint32_t)(depth + 1) << 17 |
+                (uint32_t)(depth + 1) << 21;
+            const long first = base + ((long)next_code << (width - depth - 1));
+            const long repeats = 1l << (width - depth - 1);
+
+            for (long i = 0; i < repeats; i++)
+            {
+                table->entries[first + i] = entry;
+            }
+        }
+        else if (depth + 1 == width)
+        {
+            /* out of bits, code continues in a new table */
+            const long sub_base =
+                add_lookup_level(table, tree, LOOKUP_SUB_BITS, next_node);
+
+            table->entries[base + next_code] =
+                LOOKUP_LINK | (uint32_t)sub_base | (uint32_t)width << 21;
+        }
+        else
+        {
+            fill_lookup_level(table, tree, base, width,
+                    next_node, next_code, depth + 1);
+        }
+    }
+}
 
-void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
+/* returns the offset of a new table of 2^width entries for the subtree
+   at node */
+static long add_lookup_level(struct lookup_table *table,
+        const struct decode_tree *tree, int width, unsigned int node)
+{
+    const long base = table->used;
+
+    table->used += 1l << width;
+    CHECK_ERROR(table->used > LOOKUP_OFFSET(~UINT32_C(0)) + 1,
+            "lookup table too big");
+    if (table->used > table->allocated)
+    {
+        table->allocated = table->used * 2;
+        table->entries = realloc(table->entries,
+                table->allocated * sizeof(uint32_t));
+        CHECK_ERRNO(NULL == table->entries, "realloc");
+    }
+
+    fill_lookup_level(table, tree, base, width, node, 0, 0);
+
+    return base;
+}
+
+static uint32_t *build_lookup_table(const struct decode_tree *tree, int width)
+{
+    struct lookup_table table = {NULL, 0, 0};
+
+    add_lookup_level(&table, tree, width, 1);
+
+    return table.entries;
+}
+
+#if PAIR_LITERALS
+/* Where a literal is followed by another literal whose code fits in the
+   rest of the first level's bits, decode both at once. */
+static void pair_literals(uint32_t * const table, const int width)
+{
+    const long count = 1l << width;
+    uint32_t * const single = malloc(count * sizeof(uint32_t));
+    CHECK_ERRNO(NULL == single, "malloc");
+    memcpy(single, table, count * sizeof(uint32_t));
+
+    for (long i = 0; i < count; i++)
+    {
+        const uint32_t first = single[i];
+        if ((first & LOOKUP_LINK) || LOOKUP_SYMBOL(first) >= 0x100)
+        {
+            continue;
+        }
+
+        const int first_bits = LOOKUP_SYMBOL_BITS(first);
+        const uint32_t second = single[(i << first_bits) & (count - 1)];
+        if ((second & LOOKUP_LINK) || LOOKUP_SYMBOL(second) >= 0x100 ||
+                first_bits + LOOKUP_SYMBOL_BITS(second) > width)
+        {
+            continue;
+        }
+
+        table[i] = LOOKUP_PAIR | (first & ~(UINT32_C(0xF) << 21)) |
+            (uint32_t)LOOKUP_SYMBOL(second) << 9 |
+            (uint32_t)(first_bits + LOOKUP_SYMBOL_BITS(second)) << 21;
+    }
+
+    free(single);
+}
+#endif
+
+#if SHOW_TREE
+static void show_key(uint64_t key_bits, int key_len)
+{
+    for (int i = 0; i < key_len; i++)
+    {
+        printf("%c", (key_bits & (UINT64_C(1) << (63 - i))) ? '1' : '0');
+    }
+    printf("\n");
+    fflush(stdout);
+}
+#endif
+
+void analyze_LZH8(const uint8_t *in, long in_size, FILE *outfile)
 {
     unsigned long uncompressed_length;
 
@@ -139,30 +399,35 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
 
     /* read header */
     {
+        CHECK_ERROR(in_size < 4, "unexpected end of input");
         uint32_t header;
-        header = get_32_le_seek(input_offset, infile);
+        header = read_32_le((unsigned char *)in + input_offset);
         input_offset += 4;
         CHECK_ERROR ((header & 0xFF) != 0x40, "not LZH8");
         uncompressed_length = header >> 8;
         if (0 == uncompressed_length)
         {
-            uncompressed_length = get_32_le_seek(input_offset, infile);
+            CHECK_ERROR(in_size < 8, "unexpected end of input");
+            uncompressed_length =
+                read_32_le((unsigned char *)in + input_offset);
             input_offset += 4;
         }
     }
 
     /* allocate output buffer */
-    uint8_t * const outbuf = malloc(uncompressed_length);
+    uint8_t * const outbuf = malloc(uncompressed_length + OUTPUT_SLACK);
     CHECK_ERRNO(NULL == outbuf, "malloc");
 
     /* allocate backreference length decode table */
+    CHECK_ERROR(in_size < input_offset + 2, "unexpected end of input");
     const uint32_t length_table_bytes =
-        (get_16_le_seek(input_offset, infile) + 1) * 4;
+        (read_16_le((unsigned char *)in + input_offset) + 1) * 4;
     input_offset += 2;
     const long length_decode_table_size = LENCNT * 2;
     uint16_t * const length_decode_table =
         malloc(length_decode_table_size*sizeof(uint16_t));
     CHECK_ERRNO(NULL == length_decode_table, "malloc");
+    struct decode_tree length_tree = {length_decode_table, 0, 0x7F, 0x100};
 
     /* read backreference length decode table */
 #if SHOW_TABLE
@@ -172,7 +437,10 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
         long start_input_offset = input_offset-2;
         long i = 1;
         bits_left = 0;
-        while (input_offset - start_input_offset < length_table_bytes)
+        /* by bits, not bytes: the last entry can end in a byte that's
+           already been read */
+        while ((input_offset - start_input_offset) * 8 - bits_left + LENBITS <=
+                length_table_bytes * 8)
         {
             if (i >= length_decode_table_size)
             {
@@ -185,6 +453,7 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
         }
         input_offset = start_input_offset + length_table_bytes;
         bits_left = 0;
+        length_tree.node_count = i;
     }
 #if SHOW_TABLE
     printf("done at 0x%lx\n", (unsigned long)input_offset);
@@ -192,13 +461,14 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
 #endif
 
     /* allocate backreference displacement length decode table */
-    const uint32_t displen_table_bytes =
-        (get_byte_seek(input_offset, infile) + 1) * 4;
+    CHECK_ERROR(input_offset >= in_size, "unexpected end of input");
+    const uint32_t displen_table_bytes = (in[input_offset] + 1) * 4;
     input_offset ++;
     const long displen_decode_table_size = DISPCNT * 2;
-    uint8_t * const displen_decode_table =
-        malloc(displen_decode_table_size*sizeof(uint8_t));
+    uint16_t * const displen_decode_table =
+        malloc(displen_decode_table_size*sizeof(uint16_t));
     CHECK_ERRNO(NULL == displen_decode_table, "malloc");
+    struct decode_tree displen_tree = {displen_decode_table, 0, 0x7, 0x10};
 
     /* read backreference displacement length decode table */
 #if SHOW_TABLE
@@ -208,9 +478,10 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
         long start_input_offset = input_offset-1;
         long i = 1;
         bits_left = 0;
-        while (input_offset - start_input_offset < displen_table_bytes)
+        while ((input_offset - start_input_offset) * 8 - bits_left + DISPBITS <=
+                displen_table_bytes * 8)
         {
-            if (i >= length_decode_table_size)
+            if (i >= displen_decode_table_size)
             {
                 break;
             }
@@ -221,6 +492,7 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
         }
         input_offset = start_input_offset + displen_table_bytes;
         bits_left = 0;
+        displen_tree.node_count = i;
     }
 #if SHOW_TABLE
     printf("done at 0x%lx\n", (unsigned long)input_offset);
@@ -229,6 +501,20 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
 
     unsigned long bytes_decoded = 0;
 
+    /* expand the trees, only if there is anything to decode: the tables
+       of an empty file needn't hold a whole tree */
+    uint32_t *length_lookup = NULL;
+    uint32_t *displen_lookup = NULL;
+    if (uncompressed_length > 0)
+    {
+        length_lookup = build_lookup_table(&length_tree, LOOKUP_LENGTH_BITS);
+#if PAIR_LITERALS
+        pair_literals(length_lookup, LOOKUP_LENGTH_BITS);
+#endif
+    }
+
+    struct bit_reader br = {in, in_size, input_offset, 0, 0};
+
 #if SHOW_FREQUENCIES
     long back_length_count[LENCNT] = {0};
     long back_displen_count[DISPCNT] = {0};
@@ -241,175 +527,176 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
     /* main decode loop */
     while ( bytes_decoded < uncompressed_length )
     {
-        unsigned int length_table_offset = 1;
+        refill(&br);
 #if SHOW_TREE
-        uint16_t length_key_bits = 0;
-        uint8_t length_key_len = 0;
+        const uint64_t length_key_bits = br.bits;
 #endif
 
         /* get next backreference length or literal byte */
-        for (;;)
+        uint32_t entry = length_lookup[br.bits >> (64 - LOOKUP_LENGTH_BITS)];
+
+#if PAIR_LITERALS
+        if ((entry & LOOKUP_PAIR) && bytes_decoded + 2 <= uncompressed_length)
         {
-            unsigned int next_length_child = GET_NEXT_BITS(1);
-#if SHOW_TREE
-            length_key_bits = (length_key_bits << 1) | next_length_child;
-            length_key_len ++;
+            outbuf[bytes_decoded] = LOOKUP_SYMBOL(entry);
+            outbuf[bytes_decoded+1] = LOOKUP_LITERAL2(entry);
+            bytes_decoded += 2;
+            skip_bits(&br, LOOKUP_ENTRY_BITS(entry));
+            continue;
+        }
 #endif
-            unsigned int length_node_payload =
-                length_decode_table[length_table_offset] & 0x7F;
-            unsigned int next_length_table_offset = 
-                (length_table_offset / 2 * 2) +
-                (length_node_payload + 1) * 2 +
-                (next_length_child ? 1 : 0);
-            unsigned int next_length_child_isleaf =
-                length_decode_table[length_table_offset] &
-                (0x100 >> next_length_child);
-
-            if (next_length_child_isleaf)
-            {
+
+        entry = follow_links(length_lookup, entry, &br);
+        skip_bits(&br, LOOKUP_SYMBOL_BITS(entry));
+
 #if SHOW_SYMBOLS
-                printf("%08lx symbol %d: ",
-                        (unsigned long)bytes_decoded, symbol_count);
+        printf("%08lx symbol %d: ",
+                (unsigned long)bytes_decoded, symbol_count);
 #endif
-                uint16_t length = length_decode_table[next_length_table_offset];
+        uint16_t length = LOOKUP_SYMBOL(entry);
 #if SHOW_FREQUENCIES
-                back_length_count[length] ++;
+        back_length_count[length] ++;
 #endif
 #if SHOW_TREE
-                printf("%d: ", length);
-                for (int i=length_key_len-1; i>=0; i--)
-                {
-                    printf("%c", (length_key_bits&(1<<i)) ? '1' : '0');
-                }
-                printf("\n");
-                fflush(stdout);
+        printf("%d: ", length);
+        if (entry == length_lookup[length_key_bits >> (64 - LOOKUP_LENGTH_BITS)])
+        {
+            show_key(length_key_bits, LOOKUP_SYMBOL_BITS(entry));
+        }
+        else
+        {
+            printf("(long code)\n");
+        }
 #endif
 
-                if ( 0x100 > length )
-                {
+        if ( 0x100 > length )
+        {
 #if SHOW_SYMBOLS
-                    printf("literal %02"PRIX8"\n", length);
+            printf("literal %02"PRIX8"\n", length);
 #endif
-                    /* literal byte */
-                    outbuf[bytes_decoded] = length;
-                    bytes_decoded++;
-                }
-                else
-                {
-                    /* backreference */
-                    length = (length & 0xFF) + 3;
+            /* literal byte */
+            outbuf[bytes_decoded] = length;
+            bytes_decoded++;
+        }
+        else
+        {
+            /* backreference */
+            length = (length & 0xFF) + 3;
 
-                    unsigned int displen_table_offset = 1;
-#if SHOW_TREE
-                    uint16_t displen_key_bits = 0;
-                    uint8_t displen_key_len = 0;
-#endif
-                    /* get backreference displacement length */
-                    for (;;)
-                    {
-                        unsigned int next_displen_child = GET_NEXT_BITS(1);
+            if (NULL == displen_lookup)
+            {
+                displen_lookup =
+                    build_lookup_table(&displen_tree, LOOKUP_DISPLEN_BITS);
+            }
+
+            /* get backreference displacement length */
+            if (br.count < 32)
+            {
+                refill(&br);
+            }
 #if SHOW_TREE
-                        displen_key_bits =
-                            (displen_key_bits << 1) | next_displen_child;
-                        displen_key_len ++;
+            const uint64_t displen_key_bits = br.bits;
 #endif
-                        unsigned int displen_node_payload =
-                            displen_decode_table[displen_table_offset] & 0x7;
-                        unsigned int next_displen_table_offset =
-                            (displen_table_offset / 2 * 2) +
-                            (displen_node_payload + 1) * 2 +
-                            (next_displen_child ? 1 : 0);
-                        unsigned int next_displen_child_isleaf =
-                            displen_decode_table[displen_table_offset] &
-                            (0x10 >> next_displen_child);
-
-                        if (next_displen_child_isleaf)
-                        {
-                            uint16_t displen =
-                                displen_decode_table[next_displen_table_offset];
-                            uint16_t displacement = 0;
+            entry = displen_lookup[br.bits >> (64 - LOOKUP_DISPLEN_BITS)];
+            entry = follow_links(displen_lookup, entry, &br);
+            skip_bits(&br, LOOKUP_SYMBOL_BITS(entry));
+
+            const unsigned int displen = LOOKUP_SYMBOL(entry);
+            unsigned long displacement = 0;
 
 #if SHOW_FREQUENCIES
-                            back_displen_count[displen] ++;
+            back_displen_count[displen] ++;
 #endif
 #if SHOW_TREE
-                            printf("displen: %d: ", displen);
-                            for (int i=displen_key_len-1; i>=0; i--)
-                            {
-                                printf("%c",
-                                        (displen_key_bits&(1<<i)) ? '1' : '0');
-                            }
-                            printf("\n");
-                            fflush(stdout);
+            printf("displen: %d: ", displen);
+            if (entry == displen_lookup[
+                        displen_key_bits >> (64 - LOOKUP_DISPLEN_BITS)])
+            {
+                show_key(displen_key_bits, LOOKUP_SYMBOL_BITS(entry));
+            }
+            else
+            {
+                printf("(long code)\n");
+            }
+            printf("displacement: ");
 #endif
+            if ( displen != 0 )
+            {
+                /* normalized, the top 1 bit isn't stored */
+                const int extra_bits = displen - 1;
 
-
-#if SHOW_TREE
-                            printf("displacement: ");
-#endif
-                            if ( displen != 0 )
-                            {
-                                displacement = 1;   /* normalized */
-
-                                /* collect the bits */
-                                for (uint16_t i = displen-1; i > 0; i--)
-                                {
-                                    displacement *= 2;
-                                    int next_bit = GET_NEXT_BITS(1);
+                displacement = 1;
+                if (extra_bits > 0)
+                {
+                    refill(&br);
 #if SHOW_TREE
-                                    printf("%c", next_bit ? '1':'0');
+                    show_key(br.bits, extra_bits);
 #endif
-                                    displacement |= next_bit;
-                                }
+                    displacement = (1ul << extra_bits) |
+                        (unsigned long)(br.bits >> (64 - extra_bits));
+                    skip_bits(&br, extra_bits);
+                }
+            }
 #if SHOW_TREE
-                                printf("\n");
-                                fflush(stdout);
+            else
+            {
+                printf("\n");
+            }
 #endif
-                            }
 #if SHOW_SYMBOLS
-                            printf("%d bytes, offset %d\n",
-                                    length,displacement+1);
-                            fflush(stdout);
+            printf("%d bytes, offset %lu\n",
+                    length,displacement+1);
+            fflush(stdout);
 #endif
 
-                            /* apply backreference */
-                            for (long i = 0;
-                                    i < length &&
-                                    bytes_decoded < uncompressed_length;
-                                    bytes_decoded ++, i ++)
-                            {
-                                outbuf[bytes_decoded] = 
-                                    outbuf[bytes_decoded - displacement - 1];
-                            }
-
-                            break; /* break out of displen tree traversal loop*/
-                        }
-                        else
-                        {
-
-                            CHECK_ERROR (
-                              next_displen_table_offset == displen_table_offset,
-                              "stuck in a loop somehow");
-                            displen_table_offset = next_displen_table_offset;
-                        }
-                    }   /* end of displen tree traversal loop */
-                } /* end of if backreference !(0x100 > length)*/
-                break; /* break out of length tree traversal loop */
+            /* apply backreference, the slack at the end of outbuf takes
+               whatever goes past the end */
+            CHECK_ERROR(displacement >= bytes_decoded,
+                    "backreference before start of output");
+            uint8_t * const dst = outbuf + bytes_decoded;
+            const uint8_t * const src = dst - displacement - 1;
+
+            if (displacement >= 15)
+            {
+                for (int i = 0; i < length; i += 16)
+                {
+                    memcpy(dst + i, src + i, 16);
+                }
+            }
+            else if (displacement >= 7)
+            {
+                for (int i = 0; i < length; i += 8)
+                {
+                    memcpy(dst + i, src + i, 8);
+                }
+            }
+            else if (displacement == 0)
+            {
+                memset(dst, src[0], length);
             }
             else
             {
+                /* overlapping, repeats a short pattern */
+                for (int i = 0; i < length; i++)
+                {
+                    dst[i] = src[i];
+                }
+            }
 
-                CHECK_ERROR (next_length_table_offset == length_table_offset,
-                        "stuck in a loop somehow");
-                length_table_offset = next_length_table_offset;
+            bytes_decoded += length;
+            if (bytes_decoded > uncompressed_length)
+            {
+                bytes_decoded = uncompressed_length;
             }
-        }   /* end of length tree traversal */
+        } /* end of if backreference !(0x100 > length)*/
 
 #if SHOW_SYMBOLS
         symbol_count ++;
 #endif
     }   /* end of main decode loop */
 
+    CHECK_ERROR(used_past_end(&br), "unexpected end of input");
+
 #if SHOW_FREQUENCIES
     for (int i = 0; i < LENCNT; i++)
     {
@@ -426,4 +713,6 @@ void analyze_LZH8(FILE *infile, FILE *outfile, long file_length)
     free(outbuf);
     free(length_decode_table);
     free(displen_decode_table);
+    free(length_lookup);
+    free(displen_lookup);
 }
@@ -1,29 +1,86 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
-/* romchu 0.6 */
+/* romchu 0.8 */
 /* a decompressor for type 2 romc */
 /* reversed by hcs from the Wii VC wad for Super Smash Bros EU. */
 /* this code is public domain, have at it */
 
-#define VERSION "0.6"
+#define VERSION "0.8"
 
 struct bitstream;
 
 struct bitstream *init_bitstream(const unsigned char *pool, unsigned long pool_size);
 uint32_t get_bits(struct bitstream *bs, int bits);
 int bitstream_eof(struct bitstream *bs);
+/* bad data doesn't exit, the first problem is kept here and reads give 0 */
+const char *bitstream_error(const struct bitstream *bs);
 void free_bitstream(struct bitstream *bs);
 
+/* faster reader for block bodies, same bit order as get_bits */
+struct bitcache
+{
+    const unsigned char *pool;  /* needs BITCACHE_PAD readable bytes past the end */
+    uint64_t cache;             /* next bit is the low bit */
+    int cache_bits;
+    long bits_left;             /* in the stream, including those in cache */
+    const char *error;          /* as for bitstream_error, also ends the stream */
+};
+
+/* a refill can start up to 4 bytes past the end and loads 8 */
+enum {BITCACHE_PAD = 16};
+
+void init_bitcache(struct bitcache *bc, const unsigned char *pool, unsigned long pool_size);
+static inline uint32_t cache_bits(struct bitcache *bc, int bits);
+
 struct huftable;
 
+/* NULL if the table is bad, see bitstream_error */
 struct huftable *load_table(struct bitstream *bs, int symbols);
-int huf_lookup(struct bitstream *bs, struct huftable *ht);
+static inline int huf_lookup(struct bitcache *bc, const struct huftable *ht);
 void free_table(struct huftable *);
 
+/* the farthest a backreference can reach */
+enum {WINDOW_SIZE = 0x8000};
+/* longest backreference, and room for copying it in 8 byte pieces */
+enum {MAX_BACKREF_LEN = 258};
+enum {OUT_SLACK = MAX_BACKREF_LEN + 8};
+
+static void grow_buffer(unsigned char **buf, size_t *capacity, size_t needed, const char *what);
+
+static uint32_t parse_block_header(const unsigned char head_buf[4],
+        int *compression_flag, uint32_t *payload_bytes, int *payload_bits);
+static const char *load_block_tables(const unsigned char *payload_buf,
+        uint32_t payload_bytes, int payload_bits,
+        struct huftable **table1, struct huftable **table2, struct bitcache *bc);
+static inline int decode_symbol(struct bitcache *bc,
+        const struct huftable *table1, const struct huftable *table2,
+        unsigned int *len, unsigned int *disp);
+static inline void copy_backref(unsigned char *dst, unsigned int disp, unsigned int len);
+static int write_block(FILE *outfile, unsigned char *out_buf,
+        size_t *out_offset, size_t block_start);
+
+/* blocks decoded at once per thread in the two pass mode */
+enum {BLOCKS_PER_THREAD = 4};
+
+static int decode_blocks_parallel(FILE *infile, FILE *outfile,
+        uint64_t nominal_size, int threads,
+        int *block_count, uint64_t *out_total);
+
 struct {
     unsigned int bits;
     unsigned int base;
@@ -34,32 +91,67 @@ int main(int argc, char **argv)
     FILE *infile;
     FILE *outfile;
     unsigned char head_buf[4];
-    unsigned char payload_buf[0x10000];
+    /* grown as needed, reused for each block */
+    unsigned char *payload_buf = NULL;
+    size_t payload_capacity = 0;
     int block_count = 0;
-    unsigned char *out_buf;
-    long out_offset = 0;
+    /* the last WINDOW_SIZE bytes of output, then the current block's */
+    unsigned char *out_buf = NULL;
+    size_t out_capacity = 0;
+    size_t out_offset = 0;
+    uint64_t out_total = 0;
+    int use_stdout;
+
+    int threads = 1;
+    int arg_idx = 1;
 
     uint64_t nominal_size;
     int romc_type;
 
-    if (argc != 3)
+    while (argc - arg_idx > 2 && 0 == strcmp(argv[arg_idx], "-j"))
+    {
+        char *end;
+        long value = strtol(argv[arg_idx+1], &end, 10);
+        if (*end != '\0' || value < 1 || value > 1024)
+        {
+            fprintf(stderr, "thread count must be from 1 to 1024\n");
+            return 1;
+        }
+        threads = value;
+        arg_idx += 2;
+    }
+
+    if (argc - arg_idx != 2)
     {
         fprintf(stderr, "romchu " VERSION" - romc type 2 decompressor\n");
-        fprintf(stderr, "usage: romchu romc out.n64\n");
+        fprintf(stderr, "usage: romchu [-j threads] romc out.n64\n");
+        fprintf(stderr, "       out.n64 can be - for stdout\n");
+        fprintf(stderr, "       -j decodes blocks on this many threads\n");
         return 1;
     }
 
-    infile = fopen(argv[1], "rb");
+    infile = fopen(argv[arg_idx], "rb");
     if (!infile)
     {
         perror("fopen input");
         return 1;
     }
-    outfile = fopen(argv[2], "wb");
-    if (!outfile)
+    use_stdout = (0 == strcmp(argv[arg_idx+1], "-"));
+    if (use_stdout)
     {
-        perror("fopen output");
-        return 1;
+#ifdef _WIN32
+        _setmode(_fileno(stdout), _O_BINARY);
+#endif
+        outfile = stdout;
+    }
+    else
+    {
+        outfile = fopen(argv[arg_idx+1], "wb");
+        if (!outfile)
+        {
+            perror("fopen output");
+            return 1;
+        }
     }
 
     // read header
@@ -134,24 +226,29 @@ int main(int argc, char **argv)
         }
     }
 
-    // be lazy and just allocate memory for the whole file
-    out_buf = malloc(nominal_size);
-    if (!out_buf)
+    // output is written a block at a time, keeping enough for backreferences
+    out_offset = 0;
+
+    if (threads > 1)
     {
-        perror("malloc big outbuf buffer");
-        return 1;
+        // index the blocks, then decode them in batches
+        if (0 != decode_blocks_parallel(infile, outfile, nominal_size, threads,
+                    &block_count, &out_total))
+        {
+            return 1;
+        }
     }
-    out_offset = 0;
 
     // decode each block
-    while (1 == fread(head_buf, 4, 1, infile))
+    while (threads == 1 && 1 == fread(head_buf, 4, 1, infile))
     {
         int compression_flag;
         uint32_t payload_bytes;
         int payload_bits;
         uint32_t read_size;
-
-        struct bitstream *head_bs;
+        /* where this block's output starts, and how far it may go */
+        const size_t block_start = out_offset;
+        const size_t block_limit = out_offset + (nominal_size - out_total);
 
 #if 0
         printf("%08lx=%08lx\n",
@@ -159,50 +256,14 @@ int main(int argc, char **argv)
             (unsigned long)block_count*block_mult);
 #endif
 
-        head_bs = init_bitstream(head_buf, 4*8);
-
-        compression_flag = get_bits(head_bs, 1);
-        if (compression_flag)
-        {
-            /* compressed */
-
-            uint32_t block_size;
-
-            /* bits, including this header */
-            block_size = get_bits(head_bs, 31) - 32;
-
-            payload_bytes = block_size/8;
-            payload_bits = block_size%8;
-        }
-        else
-        {
-            /* uncompressed */
-
-            uint32_t block_size;
-
-            /* bytes */
-            block_size = get_bits(head_bs, 31);
-
-            payload_bytes = block_size;
-            payload_bits = 0;
-        }
-
-        free_bitstream(head_bs);
-        head_bs = NULL;
+        read_size = parse_block_header(head_buf,
+                &compression_flag, &payload_bytes, &payload_bits);
 
         /* read payload */
-        read_size = payload_bytes;
-        if (payload_bits > 0)
-        {
-            read_size ++;
-        }
-
-        if (read_size > sizeof(payload_buf))
-        {
-            fprintf(stderr, "payload too large\n");
-            return 1;
-        }
-        if (1 != fread(payload_buf, read_size, 1, infile))
+        grow_buffer(&payload_buf, &payload_capacity,
+                (size_t)read_size + BITCACHE_PAD, "payload");
+        memset(payload_buf + read_size, 0, BITCACHE_PAD);
+        if (read_size > 0 && 1 != fread(payload_buf, read_size, 1, infile))
         {
             int save_errno = errno;
             if (feof(infile))
@@ -221,48 +282,41 @@ int main(int argc, char **argv)
 
         if (compression_flag)
         {
-            uint16_t tab1_size, tab2_size;
-            uint32_t body_size;
-            unsigned long tab1_offset, tab2_offset, body_offset;
-            struct bitstream *bs;
+            struct bitcache bc;
             struct huftable *table1, *table2;
-            
-            /* read table 1 size */
-            tab1_offset = 0;
-            bs = init_bitstream(payload_buf + tab1_offset, payload_bytes*8+payload_bits);
-            tab1_size = get_bits(bs, 16);
-            free_bitstream(bs);
-
-            /* load table 1 */
-            bs = init_bitstream(payload_buf + tab1_offset + 2, tab1_size);
-            table1 = load_table(bs, 0x11D);
-            free_bitstream(bs);
-
-            /* read table 2 size */
-            tab2_offset = tab1_offset + 2 + (tab1_size+7) / 8;
-            bs = init_bitstream(payload_buf + tab2_offset, 2*8);
-            tab2_size = get_bits(bs, 16);
-            free_bitstream(bs);
-
-            /* load table 2 */
-            bs = init_bitstream(payload_buf + tab2_offset + 2, tab2_size);
-            table2 = load_table(bs, 0x1E);
-            free_bitstream(bs);
-
-            /* decode body */
-            body_offset = tab2_offset + 2 + (tab2_size+7) / 8;
-            body_size = payload_bytes*8 + payload_bits - body_offset*8;
-            bs = init_bitstream(payload_buf + body_offset, body_size);
-
-            while (!bitstream_eof(bs))
-            {
-                int symbol = huf_lookup(bs, table1);
+            const char *error;
+
+            error = load_block_tables(payload_buf, payload_bytes, payload_bits,
+                    &table1, &table2, &bc);
+            if (error)
+            {
+                fprintf(stderr, "%s\n", error);
+                return 1;
+            }
+
+            while (bc.bits_left > 0)
+            {
+                unsigned int len, disp;
+
+                if (out_offset + OUT_SLACK > out_capacity)
+                {
+                    grow_buffer(&out_buf, &out_capacity,
+                            out_offset + OUT_SLACK, "output");
+                }
+
+                int symbol = decode_symbol(&bc, table1, table2, &len, &disp);
+
+                if (bc.error)
+                {
+                    fprintf(stderr, "%s\n", bc.error);
+                    return 1;
+                }
 
                 if (symbol < 0x100)
                 {
                     /* byte literal */
                     unsigned char b = symbol;
-                    if (out_offset >= nominal_size)
+                    if (out_offset >= block_limit)
                     {
                         fprintf(stderr, "generated too many bytes\n");
                         return 1;
@@ -272,79 +326,675 @@ int main(int argc, char **argv)
                 else
                 {
                     /* backreference */
-                    unsigned int len_bits = backref_len[symbol-0x100].bits;
-                    unsigned int len = backref_len[symbol-0x100].base;
-                    if (len_bits > 0)
-                    {
-                        len += get_bits(bs, len_bits);
-                    }
-                    len += 3;
-
-                    int symbol2 = huf_lookup(bs, table2);
-
-                    unsigned int disp_bits = backref_disp[symbol2].bits;
-                    unsigned int disp = backref_disp[symbol2].base;
-                    if (disp_bits > 0)
-                    {
-                        disp += get_bits(bs, disp_bits);
-                    }
-                    disp ++;
-
                     if (disp > out_offset)
                     {
                         fprintf(stderr, "backreference too far\n");
                         return 1;
                     }
-                    if (out_offset+len > nominal_size)
+                    if (out_offset+len > block_limit)
                     {
                         fprintf(stderr, "generated too many bytes\n");
                         return 1;
                     }
-                    for (unsigned int i = 0; i < len; i++, out_offset++)
-                    {
-                        out_buf[out_offset] = out_buf[out_offset-disp];
-                    }
+
+                    copy_backref(out_buf + out_offset, disp, len);
+                    out_offset += len;
                 }
             }
 
             free_table(table1);
             free_table(table2);
-            free_bitstream(bs);
         }
         else
         {
-            if (out_offset + payload_bytes > nominal_size)
+            if (out_offset + payload_bytes > block_limit)
             {
                 fprintf(stderr, "generated too many bytes\n");
                 return 1;
             }
+            grow_buffer(&out_buf, &out_capacity,
+                    out_offset + payload_bytes, "output");
             memcpy(out_buf+out_offset, payload_buf, payload_bytes);
             out_offset += payload_bytes;
         }
 
+        out_total += out_offset - block_start;
+        if (0 != write_block(outfile, out_buf, &out_offset, block_start))
+        {
+            return 1;
+        }
+
         block_count ++;
     }
 
-    if (out_offset != nominal_size)
+    if (out_total != nominal_size)
     {
         fprintf(stderr, "size mismatch\n");
         return 1;
     }
 
-    if (1 != fwrite(out_buf, nominal_size, 1, outfile))
+    free(out_buf);
+    free(payload_buf);
+    if (use_stdout ? (EOF == fflush(outfile)) : (EOF == fclose(outfile)))
+    {
+        perror("fclose output");
+    }
+
+    fclose(infile);
+
+    fprintf(use_stdout ? stderr : stdout, "ok!\n");
+
+    return 0;
+}
+
+static void grow_buffer(unsigned char **buf, size_t *capacity, size_t needed, const char *what)
+{
+    if (needed <= *capacity)
+    {
+        return;
+    }
+
+    size_t new_capacity = (*capacity > 0) ? *capacity : 0x10000;
+    while (new_capacity < needed)
+    {
+        new_capacity *= 2;
+    }
+
+    unsigned char *new_buf = realloc(*buf, new_capacity);
+    if (!new_buf)
+    {
+        fprintf(stderr, "realloc %s buffer: %s\n", what, strerror(errno));
+        exit(EXIT_FAILURE);
+    }
+
+    *buf = new_buf;
+    *capacity = new_capacity;
+}
+
+/* returns the number of bytes of payload that follow the header */
+static uint32_t parse_block_header(const unsigned char head_buf[4],
+        int *compression_flag, uint32_t *payload_bytes, int *payload_bits)
+{
+    struct bitstream *head_bs;
+    uint32_t read_size;
+
+    head_bs = init_bitstream(head_buf, 4*8);
+
+    *compression_flag = get_bits(head_bs, 1);
+    if (*compression_flag)
+    {
+        /* compressed */
+
+        uint32_t block_size;
+
+        /* bits, including this header */
+        block_size = get_bits(head_bs, 31) - 32;
+
+        *payload_bytes = block_size/8;
+        *payload_bits = block_size%8;
+    }
+    else
+    {
+        /* uncompressed */
+
+        uint32_t block_size;
+
+        /* bytes */
+        block_size = get_bits(head_bs, 31);
+
+        *payload_bytes = block_size;
+        *payload_bits = 0;
+    }
+
+    free_bitstream(head_bs);
+
+    read_size = *payload_bytes;
+    if (*payload_bits > 0)
+    {
+        read_size ++;
+    }
+
+    return read_size;
+}
+
+/* load both tables of a compressed block, and set up bc to read the body;
+   returns an error message if the block is bad, with no tables loaded */
+static const char *load_block_tables(const unsigned char *payload_buf,
+        uint32_t payload_bytes, int payload_bits,
+        struct huftable **table1, struct huftable **table2, struct bitcache *bc)
+{
+    uint16_t tab1_size, tab2_size;
+    uint32_t body_size;
+    unsigned long tab1_offset, tab2_offset, body_offset;
+    const unsigned long payload_size = (unsigned long)payload_bytes*8 + payload_bits;
+    struct bitstream *bs;
+    const char *error;
+
+    *table1 = *table2 = NULL;
+
+    /* read table 1 size */
+    tab1_offset = 0;
+    bs = init_bitstream(payload_buf + tab1_offset, payload_size);
+    tab1_size = get_bits(bs, 16);
+    error = bitstream_error(bs);
+    free_bitstream(bs);
+    if (error) return error;
+
+    tab2_offset = tab1_offset + 2 + (tab1_size+7) / 8;
+    if ((tab2_offset + 2) * 8 > payload_size) return "table 1 runs past the block";
+
+    /* load table 1 */
+    bs = init_bitstream(payload_buf + tab1_offset + 2, tab1_size);
+    *table1 = load_table(bs, 0x11D);
+    error = bitstream_error(bs);
+    free_bitstream(bs);
+    if (error) return error;
+
+    /* read table 2 size */
+    bs = init_bitstream(payload_buf + tab2_offset, 2*8);
+    tab2_size = get_bits(bs, 16);
+    free_bitstream(bs);
+
+    body_offset = tab2_offset + 2 + (tab2_size+7) / 8;
+    if (body_offset * 8 > payload_size)
+    {
+        free_table(*table1);
+        *table1 = NULL;
+        return "table 2 runs past the block";
+    }
+
+    /* load table 2 */
+    bs = init_bitstream(payload_buf + tab2_offset + 2, tab2_size);
+    *table2 = load_table(bs, 0x1E);
+    error = bitstream_error(bs);
+    free_bitstream(bs);
+
+    /* body */
+    body_size = payload_size - body_offset*8;
+    if (!error)
+    {
+        /* (only to check the padding) */
+        bs = init_bitstream(payload_buf + body_offset, body_size);
+        error = bitstream_error(bs);
+        free_bitstream(bs);
+    }
+    if (error)
+    {
+        free_table(*table1);
+        free_table(*table2);
+        *table1 = *table2 = NULL;
+        return error;
+    }
+
+    init_bitcache(bc, payload_buf + body_offset, body_size);
+
+    return NULL;
+}
+
+/* returns a literal byte, or 0x100 for a backreference of len from disp back;
+   check bc->error after */
+static inline int decode_symbol(struct bitcache *bc,
+        const struct huftable *table1, const struct huftable *table2,
+        unsigned int *len, unsigned int *disp)
+{
+    int symbol = huf_lookup(bc, table1);
+
+    if (symbol < 0x100)
+    {
+        return symbol;
+    }
+
+    unsigned int len_bits = backref_len[symbol-0x100].bits;
+    *len = backref_len[symbol-0x100].base;
+    if (len_bits > 0)
+    {
+        *len += cache_bits(bc, len_bits);
+    }
+    *len += 3;
+
+    int symbol2 = huf_lookup(bc, table2);
+
+    unsigned int disp_bits = backref_disp[symbol2].bits;
+    *disp = backref_disp[symbol2].base;
+    if (disp_bits > 0)
+    {
+        *disp += cache_bits(bc, disp_bits);
+    }
+    *disp += 1;
+
+    return 0x100;
+}
+
+/* overlapping copies repeat the last disp bytes, so only copy 8 at a time
+   when they're far enough back; OUT_SLACK past dst+len takes the overshoot */
+static inline void copy_backref(unsigned char *dst, unsigned int disp, unsigned int len)
+{
+    const unsigned char *src = dst - disp;
+    if (disp >= 8)
+    {
+        for (unsigned int i = 0; i < len; i += 8)
+        {
+            memcpy(dst + i, src + i, 8);
+        }
+    }
+    else if (disp == 1)
+    {
+        memset(dst, src[0], len);
+    }
+    else
+    {
+        for (unsigned int i = 0; i < len; i++)
+        {
+            dst[i] = src[i];
+        }
+    }
+}
+
+/* write out what the block added after block_start, keep the window */
+static int write_block(FILE *outfile, unsigned char *out_buf,
+        size_t *out_offset, size_t block_start)
+{
+    if (*out_offset > block_start &&
+        1 != fwrite(out_buf + block_start, *out_offset - block_start, 1, outfile))
     {
         perror("fwrite output");
         return 1;
     }
-    free(out_buf);
-    if (EOF == fclose(outfile))
+
+    if (*out_offset > WINDOW_SIZE)
     {
-        perror("fclose output");
+        memmove(out_buf, out_buf + *out_offset - WINDOW_SIZE, WINDOW_SIZE);
+        *out_offset = WINDOW_SIZE;
     }
 
-    fclose(infile);
+    return 0;
+}
+
+/* two pass decoding */
+
+/* where to find a block, from the first pass */
+struct romc_block
+{
+    long offset;    /* of the payload */
+    int compression_flag;
+    uint32_t payload_bytes;
+    int payload_bits;
+    uint32_t read_size;
+};
+
+/* a block read in and entropy decoded, waiting for its backreferences */
+struct block_slot
+{
+    const struct romc_block *block;
+    unsigned char *payload_buf;
+    size_t payload_capacity;
+
+    /* literal bytes, or len<<16 | disp for backreferences */
+    uint32_t *tokens;
+    size_t token_count;
+    size_t token_capacity;
+    uint64_t out_bytes;
+
+    /* why decoding stopped early, reported once the tokens are resolved */
+    const char *error;
+};
+
+struct block_pool
+{
+    struct block_slot *slots;
+    int slot_count;
+    int next_slot;
+    /* past this much output a block is certainly bad, stop decoding it */
+    uint64_t max_out_bytes;
+#ifndef __MINGW32__
+    pthread_mutex_t lock;
+#endif
+};
+
+static void *block_worker(void *pool_v)
+{
+    struct block_pool * const pool = pool_v;
+
+    for (;;)
+    {
+        int i;
+#ifndef __MINGW32__
+        if (0 != pthread_mutex_lock(&pool->lock))
+        {
+            fprintf(stderr, "pthread_mutex_lock failed\n");
+            exit(EXIT_FAILURE);
+        }
+#endif
+        i = pool->next_slot++;
+#ifndef __MINGW32__
+        if (0 != pthread_mutex_unlock(&pool->lock))
+        {
+            fprintf(stderr, "pthread_mutex_unlock failed\n");
+            exit(EXIT_FAILURE);
+        }
+#endif
+
+        if (i >= pool->slot_count) break;
+
+        struct block_slot * const slot = &pool->slots[i];
+        const struct romc_block * const block = slot->block;
+
+        slot->token_count = 0;
+        slot->error = NULL;
+
+        if (!block->compression_flag)
+        {
+            slot->out_bytes = block->payload_bytes;
+            continue;
+        }
+
+        struct bitcache bc;
+        struct huftable *table1, *table2;
+
+        slot->out_bytes = 0;
+        slot->error = load_block_tables(slot->payload_buf,
+                block->payload_bytes, block->payload_bits,
+                &table1, &table2, &bc);
+        if (slot->error)
+        {
+            continue;
+        }
+
+        while (bc.bits_left > 0 && slot->out_bytes <= pool->max_out_bytes)
+        {
+            unsigned int len, disp;
+
+            if (slot->token_count == slot->token_capacity)
+            {
+                slot->token_capacity = (slot->token_capacity > 0) ?
+                    slot->token_capacity * 2 : 0x4000;
+                slot->tokens = realloc(slot->tokens,
+                        sizeof(uint32_t) * slot->token_capacity);
+                if (!slot->tokens)
+                {
+                    perror("realloc tokens");
+                    exit(EXIT_FAILURE);
+                }
+            }
+
+            int symbol = decode_symbol(&bc, table1, table2, &len, &disp);
+
+            if (bc.error)
+            {
+                slot->error = bc.error;
+                break;
+            }
+
+            if (symbol < 0x100)
+            {
+                slot->tokens[slot->token_count++] = symbol;
+                slot->out_bytes ++;
+            }
+            else
+            {
+                /* len >= 3 keeps these clear of literals */
+                slot->tokens[slot->token_count++] = (uint32_t)len << 16 | disp;
+                slot->out_bytes += len;
+            }
+        }
 
-    printf("ok!\n");
+        free_table(table1);
+        free_table(table2);
+    }
+
+    return NULL;
+}
+
+/* second half of the second pass, with the same checks as decoding directly */
+static int resolve_block(const struct block_slot *slot,
+        unsigned char **out_buf, size_t *out_capacity, size_t *out_offset,
+        size_t block_limit)
+{
+    const struct romc_block * const block = slot->block;
+    uint64_t out_end = *out_offset + slot->out_bytes;
+
+    if (out_end > block_limit)
+    {
+        out_end = block_limit;
+    }
+    grow_buffer(out_buf, out_capacity, out_end + OUT_SLACK, "output");
+
+    if (!block->compression_flag)
+    {
+        if (*out_offset + block->payload_bytes > block_limit)
+        {
+            fprintf(stderr, "generated too many bytes\n");
+            return 1;
+        }
+        memcpy(*out_buf + *out_offset, slot->payload_buf, block->payload_bytes);
+        *out_offset += block->payload_bytes;
+
+        return 0;
+    }
+
+    unsigned char * const buf = *out_buf;
+    size_t offset = *out_offset;
+
+    for (size_t i = 0; i < slot->token_count; i++)
+    {
+        const uint32_t token = slot->tokens[i];
+
+        if (token < 0x100)
+        {
+            /* byte literal */
+            if (offset >= block_limit)
+            {
+                fprintf(stderr, "generated too many bytes\n");
+                return 1;
+            }
+            buf[offset++] = token;
+        }
+        else
+        {
+            /* backreference */
+            const unsigned int len = token >> 16;
+            const unsigned int disp = token & 0xFFFF;
+
+            if (disp > offset)
+            {
+                fprintf(stderr, "backreference too far\n");
+                return 1;
+            }
+            if (offset+len > block_limit)
+            {
+                fprintf(stderr, "generated too many bytes\n");
+                return 1;
+            }
+
+            copy_backref(buf + offset, disp, len);
+            offset += len;
+        }
+    }
+
+    *out_offset = offset;
+
+    /* everything before the bad spot went out, as it would decoding directly */
+    if (slot->error)
+    {
+        fprintf(stderr, "%s\n", slot->error);
+        return 1;
+    }
+
+    return 0;
+}
+
+/* First pass: read just the block headers, to index where the payloads are.
+   Second pass: read a batch of payloads and decode their Huffman codes on
+   threads (the tables are per block), then resolve the backreferences in
+   order and write out the batch. Workers don't exit on bad data, the error
+   is kept with the block and reported when it is reached, so output and
+   errors are as with one thread. */
+static int decode_blocks_parallel(FILE *infile, FILE *outfile,
+        uint64_t nominal_size, int threads,
+        int *block_count, uint64_t *out_total)
+{
+    unsigned char head_buf[4];
+    struct romc_block *blocks = NULL;
+    long blocks_allocated = 0;
+    long total_blocks = 0;
+
+    unsigned char *out_buf = NULL;
+    size_t out_capacity = 0;
+    size_t out_offset = 0;
+
+    struct block_pool pool;
+
+    /* first pass */
+    while (1 == fread(head_buf, 4, 1, infile))
+    {
+        if (total_blocks == blocks_allocated)
+        {
+            blocks_allocated = (blocks_allocated > 0) ? blocks_allocated * 2 : 0x100;
+            blocks = realloc(blocks, sizeof(struct romc_block) * blocks_allocated);
+            if (!blocks)
+            {
+                perror("realloc block index");
+                exit(EXIT_FAILURE);
+            }
+        }
+
+        struct romc_block * const block = &blocks[total_blocks++];
+
+        block->read_size = parse_block_header(head_buf,
+                &block->compression_flag, &block->payload_bytes, &block->payload_bits);
+        block->offset = ftell(infile);
+        if (block->offset < 0 || 0 != fseek(infile, block->read_size, SEEK_CUR))
+        {
+            perror("seeking past payload");
+            return 1;
+        }
+    }
+
+    /* second pass */
+    pool.slot_count = 0;
+    pool.max_out_bytes = nominal_size;
+    pool.slots = calloc(threads * BLOCKS_PER_THREAD, sizeof(struct block_slot));
+    if (!pool.slots)
+    {
+        perror("calloc block slots");
+        exit(EXIT_FAILURE);
+    }
+#ifndef __MINGW32__
+    if (0 != pthread_mutex_init(&pool.lock, NULL))
+    {
+        fprintf(stderr, "pthread_mutex_init failed\n");
+        exit(EXIT_FAILURE);
+    }
+#endif
+
+    for (long first = 0; first < total_blocks; first += pool.slot_count)
+    {
+        int read_failed = 0;
+        int save_errno = 0;
+
+        /* read in a batch, up to a bad payload */
+        pool.slot_count = 0;
+        pool.next_slot = 0;
+        while (pool.slot_count < threads * BLOCKS_PER_THREAD &&
+               first + pool.slot_count < total_blocks)
+        {
+            struct block_slot * const slot = &pool.slots[pool.slot_count];
+            const struct romc_block * const block = &blocks[first + pool.slot_count];
+
+            slot->block = block;
+            grow_buffer(&slot->payload_buf, &slot->payload_capacity,
+                    (size_t)block->read_size + BITCACHE_PAD, "payload");
+            memset(slot->payload_buf + block->read_size, 0, BITCACHE_PAD);
+            if (block->read_size > 0 &&
+                (0 != fseek(infile, block->offset, SEEK_SET) ||
+                 1 != fread(slot->payload_buf, block->read_size, 1, infile)))
+            {
+                save_errno = errno;
+                read_failed = 1;
+                break;
+            }
+
+            pool.slot_count ++;
+        }
+
+        int batch_threads = (threads < pool.slot_count) ? threads : pool.slot_count;
+
+#ifndef __MINGW32__
+        if (batch_threads > 1)
+        {
+            pthread_t thread_ids[batch_threads];
+
+            for (int i = 0; i < batch_threads; i++)
+            {
+                if (0 != pthread_create(&thread_ids[i], NULL, block_worker, &pool))
+                {
+                    fprintf(stderr, "pthread_create failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+            for (int i = 0; i < batch_threads; i++)
+            {
+                if (0 != pthread_join(thread_ids[i], NULL))
+                {
+                    fprintf(stderr, "pthread_join failed\n");
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+        else
+#endif
+        {
+            block_worker(&pool);
+        }
+
+        /* resolve and write in order */
+        for (int i = 0; i < pool.slot_count; i++)
+        {
+            const size_t block_start = out_offset;
+            const size_t block_limit = out_offset + (nominal_size - *out_total);
+
+            if (0 != resolve_block(&pool.slots[i],
+                        &out_buf, &out_capacity, &out_offset, block_limit))
+            {
+                /* the serial path doesn't write a block that fails */
+                return 1;
+            }
+
+            *out_total += out_offset - block_start;
+            if (0 != write_block(outfile, out_buf, &out_offset, block_start))
+            {
+                return 1;
+            }
+
+            (*block_count) ++;
+        }
+
+        if (read_failed)
+        {
+            if (feof(infile))
+            {
+                fprintf(stderr, "fread of payload: unexpected EOF\n");
+            }
+            else
+            {
+                errno = save_errno;
+                perror("fread of payload");
+            }
+            return 1;
+        }
+    }
+
+#ifndef __MINGW32__
+    pthread_mutex_destroy(&pool.lock);
+#endif
+    for (int i = 0; i < threads * BLOCKS_PER_THREAD; i++)
+    {
+        free(pool.slots[i].payload_buf);
+        free(pool.slots[i].tokens);
+    }
+    free(pool.slots);
+    free(blocks);
+    free(out_buf);
 
     return 0;
 }
@@ -356,6 +1006,7 @@ struct bitstream
     long bits_left;
     uint8_t first_byte;
     int first_byte_bits;
+    const char *error;
 };
 
 struct bitstream *init_bitstream(const unsigned char *pool, unsigned long pool_size)
@@ -370,14 +1021,14 @@ struct bitstream *init_bitstream(const unsigned char *pool, unsigned long pool_s
     bs->pool = pool;
     bs->bits_left = pool_size;
     bs->first_byte_bits = 0;
+    bs->error = NULL;
 
     /* check that padding bits are 0 (to ensure we aren't ignoring anything) */
     if (pool_size%8)
     {
         if (pool[pool_size/8] & ~((1<<(pool_size%8))-1))
         {
-            fprintf(stderr, "nonzero padding at end of bitstream\n");
-            exit(EXIT_FAILURE);
+            bs->error = "nonzero padding at end of bitstream";
         }
     }
 
@@ -393,10 +1044,14 @@ uint32_t get_bits(struct bitstream *bs, int bits)
         fprintf(stderr, "get_bits() supports max 32\n");
         exit(EXIT_FAILURE);
     }
+    if (bs->error)
+    {
+        return 0;
+    }
     if (bits > bs->bits_left + bs->first_byte_bits)
     {
-        fprintf(stderr, "get_bits() underflow\n");
-        exit(EXIT_FAILURE);
+        bs->error = "get_bits() underflow";
+        return 0;
     }
 
     for (int i = 0; i < bits; i++)
@@ -418,7 +1073,7 @@ uint32_t get_bits(struct bitstream *bs, int bits)
         }
 
         accum >>= 1;
-        accum |= (bs->first_byte & 1)<<31;
+        accum |= (uint32_t)(bs->first_byte & 1)<<31;
         bs->first_byte >>= 1;
         bs->first_byte_bits --;
     }
@@ -431,11 +1086,72 @@ int bitstream_eof(struct bitstream *bs)
     return (bs->bits_left + bs->first_byte_bits == 0);
 }
 
+const char *bitstream_error(const struct bitstream *bs)
+{
+    return bs->error;
+}
+
 void free_bitstream(struct bitstream *bs)
 {
     free(bs);
 }
 
+void init_bitcache(struct bitcache *bc, const unsigned char *pool, unsigned long pool_size)
+{
+    bc->pool = pool;
+    bc->cache = 0;
+    bc->cache_bits = 0;
+    bc->bits_left = pool_size;
+    bc->error = NULL;
+}
+
+/* leaves at least 56 bits in the cache, some may be past the end */
+static inline void refill_bitcache(struct bitcache *bc)
+{
+    uint64_t next = 0;
+
+    for (int i = 7; i >= 0; i--)
+    {
+        next = (next << 8) | bc->pool[i];
+    }
+
+    /* bits already in the cache are loaded again, which is harmless */
+    bc->cache |= next << bc->cache_bits;
+    bc->pool += (63 - bc->cache_bits) >> 3;
+    bc->cache_bits |= 56;
+}
+
+static inline void skip_cache_bits(struct bitcache *bc, int bits)
+{
+    if (bits > bc->bits_left)
+    {
+        if (!bc->error)
+        {
+            bc->error = "get_bits() underflow";
+        }
+        bc->bits_left = 0;
+        return;
+    }
+
+    bc->cache >>= bits;
+    bc->cache_bits -= bits;
+    bc->bits_left -= bits;
+}
+
+/* up to 32 bits, like get_bits */
+static inline uint32_t cache_bits(struct bitcache *bc, int bits)
+{
+    if (bc->cache_bits < bits)
+    {
+        refill_bitcache(bc);
+    }
+
+    uint32_t value = bc->cache & ((UINT64_C(1) << bits) - 1);
+    skip_cache_bits(bc, bits);
+
+    return value;
+}
+
 /* Huffman code handling */
 struct hufnode {
     int is_leaf;
@@ -451,8 +1167,25 @@ struct hufnode {
 struct huftable {
     int symbols;
     struct hufnode *t;
+    /* the tree expanded for decoding several bits at a time, see below */
+    uint32_t *lookup;
+    long lookup_used;
+    long lookup_allocated;
 };
 
+/* The first lookup level is indexed by the next HUF_LOOKUP_BITS bits,
+   longer codes link to tables of HUF_SUB_BITS more. Entries hold the
+   symbol, or for a link the offset of the next table, and the bits used. */
+enum {HUF_LOOKUP_BITS = 10};
+enum {HUF_SUB_BITS = 4};
+
+#define HUF_LINK                UINT32_C(0x80000000)
+#define HUF_INVALID             UINT32_C(0x40000000)
+#define HUF_VALUE(entry)        ((entry) & 0xFFFF)
+#define HUF_BITS(entry)         (((entry) >> 16) & 0x1F)
+
+static long add_lookup_level(struct huftable *ht, int width, int node);
+
 struct huftable *load_table(struct bitstream *bs, int symbols)
 {
     int len_count[32] = {0};
@@ -469,6 +1202,15 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
             int count = get_bits(bs, 7) + 2;
             int length = get_bits(bs, 5);
 
+            if (i + count > symbols)
+            {
+                if (!bs->error)
+                {
+                    bs->error = "too many code lengths in table";
+                }
+                return NULL;
+            }
+
             len_count[length] += count;
             for (int j = 0; j < count; j++, i++)
             {
@@ -480,6 +1222,15 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
             /* set of inequal lengths */
             int count = get_bits(bs, 7) + 1;
 
+            if (i + count > symbols)
+            {
+                if (!bs->error)
+                {
+                    bs->error = "too many code lengths in table";
+                }
+                return NULL;
+            }
+
             for (int j = 0; j < count; j++, i++)
             {
                 int length = get_bits(bs, 5);
@@ -489,10 +1240,14 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
         }
     }
 
+    if (bitstream_error(bs))
+    {
+        return NULL;
+    }
     if (!bitstream_eof(bs))
     {
-        fprintf(stderr, "did not exhaust bitstream reading table\n");
-        exit(EXIT_FAILURE);
+        bs->error = "did not exhaust bitstream reading table";
+        return NULL;
     }
 
     /* compute the first canonical Huffman code for each length */
@@ -510,6 +1265,9 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
         exit(EXIT_FAILURE);
     }
     ht->symbols = symbols;
+    ht->lookup = NULL;
+    ht->lookup_used = 0;
+    ht->lookup_allocated = 0;
     ht->t = malloc(sizeof(struct hufnode) * symbols * 2);
     if (!ht->t)
     {
@@ -538,8 +1296,16 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
             int next;
             if (ht->t[cur].is_leaf)
             {
-                fprintf(stderr, "oops, walked onto a leaf\n");
-                exit(EXIT_FAILURE);
+                bs->error = "oops, walked onto a leaf";
+                free_table(ht);
+                return NULL;
+            }
+            /* only possible if the lengths don't make a proper code */
+            if (next_free_node >= symbols*2)
+            {
+                bs->error = "too many nodes in Huffman tree";
+                free_table(ht);
+                return NULL;
             }
 
             if (codes[length_of[i]]&(1<<j))
@@ -570,27 +1336,125 @@ struct huftable *load_table(struct bitstream *bs, int symbols)
         codes[length_of[i]] ++;
     }
 
+    if (add_lookup_level(ht, HUF_LOOKUP_BITS, 0) < 0)
+    {
+        bs->error = "Huffman lookup table too big";
+        free_table(ht);
+        return NULL;
+    }
+
     return ht;
 }
 
-int huf_lookup(struct bitstream *bs, struct huftable *ht)
+/* Fill in entries for the subtree at node. code is the path from the root
+   of this level, first bit lowest as it comes out of the bitstream.
+   Returns -1 if the tables would get too big. */
+static int fill_lookup_level(struct huftable *ht, long base, int width,
+        int node, uint32_t code, int depth)
 {
-    int cur = 0;
-    while (!ht->t[cur].is_leaf)
+    for (int bit = 0; bit < 2; bit++)
     {
-        if (get_bits(bs, 1))
+        const int next = bit ? ht->t[node].u.inner.right : ht->t[node].u.inner.left;
+        const uint32_t next_code = code | ((uint32_t)bit << depth);
+
+        if (0 == next || ht->t[next].is_leaf)
+        {
+            /* repeat for all of the bits after it */
+            const uint32_t entry = (0 == next) ? HUF_INVALID :
+                ((uint32_t)ht->t[next].u.leaf.symbol |
+                 (uint32_t)(depth + 1) << 16);
+
+            for (uint32_t i = next_code; i < (UINT32_C(1) << width);
+                    i += (UINT32_C(1) << (depth + 1)))
+            {
+                ht->lookup[base + i] = entry;
+            }
+        }
+        else if (depth + 1 == width)
+        {
+            /* out of bits, continue in a new table */
+            const long sub_base = add_lookup_level(ht, HUF_SUB_BITS, next);
+            if (sub_base < 0)
+            {
+                return -1;
+            }
+
+            ht->lookup[base + next_code] =
+                HUF_LINK | (uint32_t)sub_base | (uint32_t)width << 16;
+        }
+        else if (fill_lookup_level(ht, base, width, next, next_code, depth + 1) < 0)
         {
-            // 1 == right
-            cur = ht->t[cur].u.inner.right;
+            return -1;
         }
-        else
+    }
+
+    return 0;
+}
+
+/* returns the offset of a new table of 2^width entries for node's subtree,
+   or -1 if there are already too many */
+static long add_lookup_level(struct huftable *ht, int width, int node)
+{
+    const long base = ht->lookup_used;
+
+    ht->lookup_used += 1l << width;
+    if (ht->lookup_used > 0x10000)
+    {
+        return -1;
+    }
+    if (ht->lookup_used > ht->lookup_allocated)
+    {
+        ht->lookup_allocated = ht->lookup_used * 2;
+        ht->lookup = realloc(ht->lookup, sizeof(uint32_t) * ht->lookup_allocated);
+        if (!ht->lookup)
+        {
+            perror("realloc of Huffman lookup");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (fill_lookup_level(ht, base, width, node, 0, 0) < 0)
+    {
+        return -1;
+    }
+
+    return base;
+}
+
+static inline int huf_lookup(struct bitcache *bc, const struct huftable *ht)
+{
+    if (bc->cache_bits < 32)
+    {
+        refill_bitcache(bc);
+    }
+
+    uint32_t entry =
+        ht->lookup[bc->cache & ((UINT32_C(1) << HUF_LOOKUP_BITS) - 1)];
+
+    while (entry & HUF_LINK)
+    {
+        skip_cache_bits(bc, HUF_BITS(entry));
+        if (bc->cache_bits < 32)
         {
-            // 0 == left
-            cur = ht->t[cur].u.inner.left;
+            refill_bitcache(bc);
         }
+        entry = ht->lookup[HUF_VALUE(entry) +
+            (bc->cache & ((UINT32_C(1) << HUF_SUB_BITS) - 1))];
     }
 
-    return ht->t[cur].u.leaf.symbol;
+    if (entry & HUF_INVALID)
+    {
+        if (!bc->error)
+        {
+            bc->error = "no symbol for Huffman code";
+        }
+        bc->bits_left = 0;
+        return 0;
+    }
+
+    skip_cache_bits(bc, HUF_BITS(entry));
+
+    return HUF_VALUE(entry);
 }
 
 void free_table(struct huftable *ht)
@@ -598,6 +1462,7 @@ void free_table(struct huftable *ht)
     if (ht)
     {
         free(ht->t);
+        free(ht->lookup);
     }
     free(ht);
 }
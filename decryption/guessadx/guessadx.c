@@ -1,5 +1,5 @@
 /*
- * guessadx 0.4
+ * guessadx 0.5
  * by hcs
  *
  * find all possible encryption keys for an ADX file
@@ -7,6 +7,10 @@
  * Search is restricted to prime multipliers and increments.
  */
 
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
@@ -14,6 +18,14 @@
 #include <limits.h>
 #include <time.h>
 #include <errno.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 enum {PRIMES_UP_TO = 0x8000};   /* noninclusive */
 
@@ -26,9 +38,12 @@ int read32(unsigned char * buf) {
 }
 
 void usage(const char * binname) {
-    fprintf(stderr,"guessadx 0.4\n");
-    fprintf(stderr,"usage: %s infile.adx [node_id total_nodes]\n",binname);
+    fprintf(stderr,"guessadx 0.5\n");
+    fprintf(stderr,"usage: %s [-j threads] [-c checkpoint [--resume]] infile.adx [node_id total_nodes]\n",binname);
     fprintf(stderr,
+" -j searches on that many threads.\n"
+" -c saves progress to the checkpoint file every minute, --resume picks up\n"
+" from it.\n"
 " For parallel processing, total_nodes is the number of guessadx instances,\n"
 " and node_id is an integer from 0 to total_nodes-1 uniquely identifying this\n"
 " instance.\n\n");
@@ -46,6 +61,413 @@ int score(int start, int mult, int add, unsigned short * scales, int scalecount)
     return total;
 }
 
+/* a key that fits every scale */
+struct key_s {
+    int start, mult, add;
+    int error;
+    int scale;      /* the guess at start's low bits it was found under */
+};
+
+enum {SCALE_GUESSES = 0x2000};
+enum {PROGRESS_SECONDS = 10};
+enum {CHECKPOINT_SECONDS = 60};
+
+/* everything the search threads share */
+struct search_s {
+    /* the run of scales checked, and the scales before it */
+    unsigned short * scales;
+    int scales_to_do;
+    unsigned short * prescales;
+    int bruteframe;
+
+    int * primes;
+    int primecount;
+    /* the primes again as increments, padded out to whole groups of lanes */
+    unsigned short * adds;
+    int add_groups;
+    unsigned int last_group_valid;
+
+    int start_scale, end_scale;
+
+#ifndef __MINGW32__
+    pthread_mutex_t lock;
+#endif
+    int next_scale;
+    int scales_done;
+    int scales_done_here;   /* not counting those from a checkpoint */
+    unsigned char done[SCALE_GUESSES];
+    time_t starttime;
+    time_t last_progress;
+
+    const char * checkpoint_name;
+    unsigned long scales_hash;
+    time_t last_checkpoint;
+
+    struct key_s * keys;
+    int key_count;
+    int keys_allocated;
+};
+
+#if defined(__AVX2__)
+enum {LANES = 16};
+#else
+enum {LANES = 8};
+#endif
+
+/* Run the LCG from start with one multiplier and LANES increments at once,
+ * in 16 bits as only the low 15 matter. Returns a bit for each lane that
+ * matched the known bits of every scale, valid has a bit for each lane
+ * holding a real increment. Almost every lane fails within a few scales,
+ * so this stops as soon as they all have. The vector paths are only built
+ * for x86. */
+static unsigned int match_lanes(const unsigned short * scales, int scales_to_do,
+        int start, int mult, const unsigned short * adds, unsigned int valid) {
+    unsigned int matched = 0;
+    int s, k;
+#if defined(__AVX2__)
+    const __m256i m = _mm256_set1_epi16(mult);
+    const __m256i a = _mm256_loadu_si256((const __m256i *)adds);
+    const __m256i known_bits = _mm256_set1_epi16(0x6000);
+    __m256i xor = _mm256_set1_epi16(start);
+    /* movemask gives two bits per lane */
+    unsigned int alive = 0;
+    for (k=0;k<LANES;k++) {
+        if (valid & (1u<<k)) alive |= 3u<<(2*k);
+    }
+    for (s=1;s<scales_to_do && alive;s++) {
+        xor = _mm256_add_epi16(_mm256_mullo_epi16(xor, m), a);
+        alive &= (unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi16(
+                    _mm256_and_si256(xor, known_bits),
+                    _mm256_set1_epi16(scales[s]&0x6000)));
+    }
+    for (k=0;k<LANES;k++) {
+        if (alive & (1u<<(2*k))) matched |= 1u<<k;
+    }
+#elif defined(__SSE2__)
+    const __m128i m = _mm_set1_epi16(mult);
+    const __m128i a = _mm_loadu_si128((const __m128i *)adds);
+    const __m128i known_bits = _mm_set1_epi16(0x6000);
+    __m128i xor = _mm_set1_epi16(start);
+    /* movemask gives two bits per lane */
+    unsigned int alive = 0;
+    for (k=0;k<LANES;k++) {
+        if (valid & (1u<<k)) alive |= 3u<<(2*k);
+    }
+    for (s=1;s<scales_to_do && alive;s++) {
+        xor = _mm_add_epi16(_mm_mullo_epi16(xor, m), a);
+        alive &= (unsigned int)_mm_movemask_epi8(_mm_cmpeq_epi16(
+                    _mm_and_si128(xor, known_bits),
+                    _mm_set1_epi16(scales[s]&0x6000)));
+    }
+    for (k=0;k<LANES;k++) {
+        if (alive & (1u<<(2*k))) matched |= 1u<<k;
+    }
+#else
+    unsigned short xor[LANES];
+    unsigned int alive = valid;
+    for (k=0;k<LANES;k++) xor[k] = start;
+    for (s=1;s<scales_to_do && alive;s++) {
+        const int known = scales[s]&0x6000;
+        for (k=0;k<LANES;k++) {
+            xor[k] = xor[k] * mult + adds[k];
+            if ((xor[k]&0x6000) != known) alive &= ~(1u<<k);
+        }
+    }
+    matched = alive;
+#endif
+    return matched;
+}
+
+static void lock_search(struct search_s * sr) {
+#ifndef __MINGW32__
+    if (0 != pthread_mutex_lock(&sr->lock)) {
+        fprintf(stderr,"pthread_mutex_lock failed\n");
+        exit(1);
+    }
+#endif
+}
+
+static void unlock_search(struct search_s * sr) {
+#ifndef __MINGW32__
+    if (0 != pthread_mutex_unlock(&sr->lock)) {
+        fprintf(stderr,"pthread_mutex_unlock failed\n");
+        exit(1);
+    }
+#endif
+}
+
+/* keys from a checkpoint are already known, so they aren't noted again */
+static void store_key(struct search_s * sr, int scale, int start, int mult, int add, int error) {
+
+    if (sr->key_count == sr->keys_allocated) {
+        sr->keys_allocated = sr->keys_allocated ? sr->keys_allocated*2 : 16;
+        sr->keys = realloc(sr->keys, sr->keys_allocated*sizeof(struct key_s));
+        if (!sr->keys) {
+            fprintf(stderr,"error allocating memory for keys\n");
+            exit(1);
+        }
+    }
+    sr->keys[sr->key_count].start = start;
+    sr->keys[sr->key_count].mult = mult;
+    sr->keys[sr->key_count].add = add;
+    sr->keys[sr->key_count].error = error;
+    sr->keys[sr->key_count].scale = scale;
+    sr->key_count++;
+}
+
+static void add_key(struct search_s * sr, int scale, int start, int mult, int add, int error) {
+    lock_search(sr);
+
+    store_key(sr, scale, start, mult, add, error);
+
+    /* the list is printed at the end, this is just so there's news */
+    fprintf(stderr,"found -s %4x -m %4x -a %4x (error %d)\n",start,mult,add,error);
+    fflush(stderr);
+
+    unlock_search(sr);
+}
+
+/* mult and add work from start on, record the keys */
+static void found_match(struct search_s * sr, int start, int mult, int add) {
+    const int scale = start & (SCALE_GUESSES-1);
+
+    /* if our "start" isn't actually on the first frame,
+     * find possible real start values */
+    if (sr->bruteframe>0) {
+        int realstart;
+        int i;
+        for (realstart = 0; realstart < 0x7fff; realstart++) {
+            int xor = realstart;
+            for (i=0;i<sr->bruteframe &&
+                    ((sr->prescales[i]&0x6000)==(xor&0x6000) ||
+                     sr->prescales[i]==0);
+                    i++) {
+                xor = xor * mult + add;
+            }
+
+            if (i==sr->bruteframe && (xor&0x7fff)==start) {
+                add_key(sr,scale,realstart,mult,add,
+                        score(start,mult,add,sr->scales,sr->scales_to_do)+
+                        score(realstart,mult,add,sr->prescales,sr->bruteframe));
+            }
+        }
+    } else {
+        add_key(sr,scale,start,mult,add,score(start,mult,add,sr->scales,sr->scales_to_do));
+    }
+}
+
+/* every multiplier and increment for one guess at the low bits of start */
+static void search_scale(struct search_s * sr, int i) {
+    const int start = i+(sr->scales[0]&0x6000);
+    const unsigned int all_valid = (1u<<LANES)-1;
+
+    /* guess multiplier */
+    /* it is assumed that only prime multipliers are used */
+    for (int j=0;j<sr->primecount;j++) {
+        const int mult = sr->primes[j];
+
+        /* guess increments, a group of lanes at a time */
+        for (int g=0;g<sr->add_groups;g++) {
+            const unsigned short * adds = sr->adds + g*LANES;
+            unsigned int matched = match_lanes(sr->scales, sr->scales_to_do,
+                    start, mult, adds,
+                    g==sr->add_groups-1 ? sr->last_group_valid : all_valid);
+
+            for (int k=0;matched;k++,matched>>=1) {
+                if (matched&1) found_match(sr, start, mult, adds[k]);
+            }
+        }
+    }
+}
+
+/* One line of key=value pairs, for whatever is keeping an eye on things.
+ * Times are in seconds, the rate is keys tried per second by this run. */
+static void report_progress(struct search_s * sr) {
+    const int total = sr->end_scale - sr->start_scale;
+    const time_t now = time(NULL);
+    const long elapsed = now - sr->starttime;
+    const double candidates = (double)sr->scales_done_here*sr->primecount*sr->primecount;
+    long eta = -1;
+
+    if (sr->scales_done_here > 0) {
+        eta = (long)((double)elapsed*(total-sr->scales_done)/sr->scales_done_here);
+    }
+
+    fprintf(stderr,"progress done=%d total=%d percent=%.2f keys=%d rate=%.0f elapsed=%ld eta=%ld\n",
+            sr->scales_done, total,
+            total ? sr->scales_done*100.0/total : 100.0,
+            sr->key_count,
+            elapsed > 0 ? candidates/elapsed : 0.0,
+            elapsed, eta);
+    fflush(stderr);
+
+    sr->last_progress = now;
+}
+
+/* FNV-1a over the scales, so a checkpoint can't be resumed against the
+ * wrong file */
+static unsigned long hash_scales(const unsigned short * scales, int count, unsigned long h) {
+    for (int i=0;i<count;i++) {
+        h = ((h ^ (scales[i]>>8)) * 16777619UL) & 0xffffffffUL;
+        h = ((h ^ (scales[i]&0xff)) * 16777619UL) & 0xffffffffUL;
+    }
+    return h;
+}
+
+/* The checkpoint is text: what was searched, then the finished guesses as
+ * ranges and the keys found under them, all in hex but for the error.
+ * Written to a temporary and renamed over, so it's never half there. */
+static void write_checkpoint(struct search_s * sr) {
+    const size_t name_len = strlen(sr->checkpoint_name);
+    char * temp_name = malloc(name_len+5);
+    FILE * outfile;
+
+    if (!temp_name) {
+        fprintf(stderr,"error allocating memory for checkpoint name\n");
+        exit(1);
+    }
+    sprintf(temp_name,"%s.tmp",sr->checkpoint_name);
+
+    outfile = fopen(temp_name,"w");
+    if (!outfile) {
+        fprintf(stderr,"error opening %s\n",temp_name);
+        exit(1);
+    }
+
+    fprintf(outfile,"guessadx checkpoint\n");
+    fprintf(outfile,"scales %x %x %lx\n",sr->scales_to_do,sr->bruteframe,sr->scales_hash);
+    fprintf(outfile,"range %x %x\n",sr->start_scale,sr->end_scale);
+    for (int i=sr->start_scale;i<sr->end_scale;i++) {
+        if (sr->done[i]) {
+            int j;
+            for (j=i;j+1<sr->end_scale && sr->done[j+1];j++) {}
+            fprintf(outfile,"done %x %x\n",i,j);
+            i = j;
+        }
+    }
+    for (int k=0;k<sr->key_count;k++) {
+        const struct key_s * key = &sr->keys[k];
+        /* ones from unfinished guesses will turn up again */
+        if (sr->done[key->scale]) {
+            fprintf(outfile,"key %x %x %x %x %d\n",
+                    key->scale,key->start,key->mult,key->add,key->error);
+        }
+    }
+
+    if (EOF == fclose(outfile)) {
+        fprintf(stderr,"error writing %s\n",temp_name);
+        exit(1);
+    }
+#ifdef __MINGW32__
+    /* rename won't replace a file on Windows */
+    remove(sr->checkpoint_name);
+#endif
+    if (0 != rename(temp_name,sr->checkpoint_name)) {
+        fprintf(stderr,"error renaming %s to %s\n",temp_name,sr->checkpoint_name);
+        exit(1);
+    }
+
+    free(temp_name);
+    sr->last_checkpoint = time(NULL);
+}
+
+/* returns 0 if the checkpoint was read, 1 if there isn't one, exits if it
+ * doesn't belong to this search */
+static int read_checkpoint(struct search_s * sr) {
+    FILE * infile = fopen(sr->checkpoint_name,"r");
+    char line[100];
+    int line_number = 0;
+    int matched = 0;
+
+    if (!infile) return 1;
+
+    while (fgets(line,sizeof(line),infile)) {
+        unsigned int a, b, c, d;
+        unsigned long h;
+        int error;
+
+        line_number++;
+        if (line_number == 1) {
+            if (strcmp(line,"guessadx checkpoint\n")) break;
+        } else if (3 == sscanf(line,"scales %x %x %lx",&a,&b,&h)) {
+            if (a != sr->scales_to_do || b != sr->bruteframe || h != sr->scales_hash) {
+                fprintf(stderr,"%s is from a different file\n",sr->checkpoint_name);
+                exit(1);
+            }
+            matched |= 1;
+        } else if (2 == sscanf(line,"range %x %x",&a,&b)) {
+            if (a != sr->start_scale || b != sr->end_scale) {
+                fprintf(stderr,"%s is for %x to %x, not %x to %x\n",
+                        sr->checkpoint_name,a,b,sr->start_scale,sr->end_scale);
+                exit(1);
+            }
+            matched |= 2;
+        } else if (matched == 3 && 2 == sscanf(line,"done %x %x",&a,&b) &&
+                a <= b && a >= sr->start_scale && b < sr->end_scale) {
+            for (;a<=b;a++) {
+                if (!sr->done[a]) sr->scales_done++;
+                sr->done[a] = 1;
+            }
+        } else if (matched == 3 && 5 == sscanf(line,"key %x %x %x %x %d",&a,&b,&c,&d,&error) &&
+                a < SCALE_GUESSES) {
+            store_key(sr,a,b,c,d,error);
+        } else {
+            break;
+        }
+    }
+
+    if (!feof(infile) || matched != 3) {
+        fprintf(stderr,"%s:%d: can't make sense of checkpoint\n",sr->checkpoint_name,line_number);
+        exit(1);
+    }
+    fclose(infile);
+
+    return 0;
+}
+
+/* take the next start guess until there are none left */
+static void * search_worker(void * v) {
+    struct search_s * sr = v;
+
+    for (;;) {
+        lock_search(sr);
+        /* skipping any done before a resume */
+        while (sr->next_scale < sr->end_scale && sr->done[sr->next_scale]) {
+            sr->next_scale++;
+        }
+        const int i = sr->next_scale++;
+        unlock_search(sr);
+
+        if (i >= sr->end_scale) break;
+
+        search_scale(sr, i);
+
+        lock_search(sr);
+        sr->done[i] = 1;
+        sr->scales_done++;
+        sr->scales_done_here++;
+        if (time(NULL) - sr->last_progress >= PROGRESS_SECONDS) {
+            report_progress(sr);
+        }
+        if (sr->checkpoint_name && time(NULL) - sr->last_checkpoint >= CHECKPOINT_SECONDS) {
+            write_checkpoint(sr);
+        }
+        unlock_search(sr);
+    }
+
+    return NULL;
+}
+
+/* least error first */
+static int compare_keys(const void * a, const void * b) {
+    const struct key_s * ka = a, * kb = b;
+    if (ka->error != kb->error) return ka->error < kb->error ? -1 : 1;
+    if (ka->start != kb->start) return ka->start < kb->start ? -1 : 1;
+    if (ka->mult != kb->mult) return ka->mult < kb->mult ? -1 : 1;
+    if (ka->add != kb->add) return ka->add < kb->add ? -1 : 1;
+    return 0;
+}
+
 int main(int argc, char ** argv) {
     FILE * infile = NULL;
     int bruteframe=0,bruteframecount=-1;
@@ -56,12 +478,49 @@ int main(int argc, char ** argv) {
     int isprime[PRIMES_UP_TO];
     int primecount;
     long node_id = 0, total_nodes = 1;
+    long threads = 1;
+    const char * checkpoint_name = NULL;
+    int resume = 0;
+    const char * binname = argv[0];
 
     /* parse command line */
 
+    while (argc >= 2 && argv[1][0] == '-') {
+        if (argc >= 3 && !strcmp(argv[1], "-j")) {
+            char *endptr;
+
+            errno = 0;
+            threads = strtol(argv[2], &endptr, 10);
+            if ( 0 != errno || 0 == strlen(argv[2]) ||
+                    argv[2] + strlen(argv[2]) != endptr || threads < 1 ) {
+                fprintf(stderr, "invalid thread count\n");
+                return 1;
+            }
+
+            argc -= 2;
+            argv += 2;
+        } else if (argc >= 3 && !strcmp(argv[1], "-c")) {
+            checkpoint_name = argv[2];
+            argc -= 2;
+            argv += 2;
+        } else if (!strcmp(argv[1], "--resume")) {
+            resume = 1;
+            argc -= 1;
+            argv += 1;
+        } else {
+            usage(binname);
+            return 1;
+        }
+    }
+
+    if (resume && !checkpoint_name) {
+        fprintf(stderr, "--resume needs a checkpoint file (-c)\n");
+        return 1;
+    }
+
     if (argc != 2) {
         if (argc != 4) {
-            usage(argv[0]);
+            usage(binname);
             return 1;
         } else {
             /* parse distributed measures */
@@ -202,8 +661,6 @@ int main(int argc, char ** argv) {
         unsigned short * scales;
         unsigned short * prescales = NULL;
         int scales_to_do;
-        static time_t starttime;
-        int noback=1;
 
         /* allocate storage for scales */
         scales_to_do = (bruteframecount > MAX_FRAMES ? MAX_FRAMES : bruteframecount);
@@ -249,94 +706,104 @@ int main(int argc, char ** argv) {
         }
 
         /* determine limits of search */
+        struct search_s sr;
         int scales_per_node = (0x2000+total_nodes-1) / total_nodes;
-        int start_scale = scales_per_node * node_id;
-        int end_scale = scales_per_node * (node_id+1);
-        if (end_scale > 0x2000) {
-            end_scale = 0x2000;
+        sr.start_scale = scales_per_node * node_id;
+        sr.end_scale = scales_per_node * (node_id+1);
+        if (sr.end_scale > 0x2000) {
+            sr.end_scale = 0x2000;
+        }
+
+        sr.scales = scales;
+        sr.scales_to_do = scales_to_do;
+        sr.prescales = prescales;
+        sr.bruteframe = bruteframe;
+        sr.primes = primes;
+        sr.primecount = primecount;
+
+        sr.add_groups = (primecount+LANES-1)/LANES;
+        sr.adds = calloc(sr.add_groups*LANES, sizeof(unsigned short));
+        if (!sr.adds) {
+            fprintf(stderr,"error allocating memory for increments\n");
+            return 1;
+        }
+        for (int k=0;k<primecount;k++) sr.adds[k] = primes[k];
+        sr.last_group_valid = 0;
+        for (int k=(sr.add_groups-1)*LANES;k<primecount;k++) {
+            sr.last_group_valid |= 1u<<(k%LANES);
         }
 
-        fprintf(stderr,"checking from %x to %x\n",start_scale,end_scale);
+        sr.next_scale = sr.start_scale;
+        sr.scales_done = 0;
+        sr.scales_done_here = 0;
+        memset(sr.done, 0, sizeof(sr.done));
+        sr.keys = NULL;
+        sr.key_count = 0;
+        sr.keys_allocated = 0;
+
+        sr.checkpoint_name = checkpoint_name;
+        sr.scales_hash = hash_scales(scales, scales_to_do, 2166136261UL);
+        sr.scales_hash = hash_scales(prescales, bruteframe, sr.scales_hash);
+
+        fprintf(stderr,"checking from %x to %x\n",sr.start_scale,sr.end_scale);
+        if (resume) {
+            if (0 == read_checkpoint(&sr)) {
+                fprintf(stderr,"resuming with %x done and %d keys found\n",
+                        sr.scales_done,sr.key_count);
+            } else {
+                fprintf(stderr,"no checkpoint %s, starting from scratch\n",checkpoint_name);
+            }
+        }
         fprintf(stderr,"\n");
-        starttime = time(NULL);
+        sr.starttime = time(NULL);
+        sr.last_progress = sr.starttime;
+        sr.last_checkpoint = sr.starttime;
+        report_progress(&sr);
 
         /* do it! */
 
-        /* guess possible low bits for start */
-        for (int i=start_scale;i<end_scale;i++) {
-            int start = i+(scales[0]&0x6000);
-            /* status report */
-            if (i>=start_scale+1) {
-                char messagebuf[100];
-                time_t etime = time(NULL)-starttime;
-                time_t donetime = scales_per_node*etime/(i-start_scale)-etime;
-
-                sprintf(messagebuf,"%4x %3d%% %8ld minute%c elapsed %8ld minute%c left (maybe)",
-                        i-start_scale,
-                        (i-start_scale)*100/scales_per_node,
-                        (etime/60),
-                        (etime/60)!=1 ? 's' : ' ',
-                        (donetime/60),
-                        (donetime/60)!=1 ? 's' : ' ');
-                if (!noback) {
-                    int i;
-                    for (i=0;i<strlen(messagebuf);i++)
-                        fprintf(stderr,"\b");
+#ifndef __MINGW32__
+        if (0 != pthread_mutex_init(&sr.lock, NULL)) {
+            fprintf(stderr,"pthread_mutex_init failed\n");
+            return 1;
+        }
+        if (threads > 1) {
+            pthread_t * thread_ids = malloc(sizeof(pthread_t)*threads);
+            if (!thread_ids) {
+                fprintf(stderr,"error allocating memory for threads\n");
+                return 1;
+            }
+            for (long t=0;t<threads;t++) {
+                if (0 != pthread_create(&thread_ids[t], NULL, search_worker, &sr)) {
+                    fprintf(stderr,"pthread_create failed\n");
+                    return 1;
                 }
-                fprintf(stderr,"%s",messagebuf);
-                fflush(stderr);
-                noback=0;
             }
+            for (long t=0;t<threads;t++) {
+                pthread_join(thread_ids[t], NULL);
+            }
+            free(thread_ids);
+        } else
+#endif
+        {
+            search_worker(&sr);
+        }
+
+        report_progress(&sr);
+        if (checkpoint_name) {
+            write_checkpoint(&sr);
+        }
+
+        /* all the keys, best first */
+        qsort(sr.keys, sr.key_count, sizeof(struct key_s), compare_keys);
+        for (int k=0;k<sr.key_count;k++) {
+            printf("-s %4x -m %4x -a %4x (error %d)\n",
+                    sr.keys[k].start,sr.keys[k].mult,sr.keys[k].add,sr.keys[k].error);
+        }
+        fflush(stdout);
 
-            /* guess multiplier */
-            /* it is assumed that only prime multipliers are used */
-            for (int j=0;j<primecount;j++) {
-                int mult = primes[j];
-
-                /* guess increment */
-                for (int k=0;k<primecount;k++) {
-                    int add = primes[k];
-                    int xor = start;
-                    int s;
-
-                    /* test */
-                    for (s=1;s<scales_to_do &&
-                            (scales[s]&0x6000)==
-                            ((xor = xor * mult + add)&0x6000);s++) {}
-
-                    /* if we tested all values, we have a match */
-                    if (s==scales_to_do) {
-                        fprintf(stderr,"\n");
-                        fflush(stderr);
-                        noback=1;
-
-                        /* if our "start" isn't actually on the first frame,
-                         * find possible real start values */
-                        if (bruteframe>0) {
-                            int realstart;
-                            int i;
-                            for (realstart = 0; realstart < 0x7fff; realstart++) {
-                                int xor = realstart;
-                                for (i=0;i<bruteframe &&
-                                        ((prescales[i]&0x6000)==(xor&0x6000) ||
-                                         prescales[i]==0);
-                                        i++) {
-                                    xor = xor * mult + add;
-                                }
-
-                                if (i==bruteframe && (xor&0x7fff)==start) {
-                                    printf("-s %4x -m %4x -a %4x (error %d)\n",realstart,mult,add,score(start,mult,add,scales,scales_to_do)+score(realstart,mult,add,prescales,bruteframe));
-                                }
-                            }
-                        } else {
-                            printf("-s %4x -m %4x -a %4x (error %d)\n",start,mult,add,score(start,mult,add,scales,scales_to_do));
-                        }
-                        fflush(stdout);
-                    }
-                } /* end add for loop */
-            } /* end mult for loop */
-        } /* end start for loop */
+        free(sr.keys);
+        free(sr.adds);
     } /* end key guess section */
-    fprintf(stderr,"\n");
     return 0;
 }
@@ -2,139 +2,54 @@
 #define _XMA_PARSE_H
 
 #include <iostream>
+#include <vector>
 
-#include "Bit_stream.h"
+// the parsing itself is shared with xmash, in ../../multi/xmash
+#include "xma_core.h"
 
 namespace Parse_XMA {
     using namespace std;
 
+    class Out_of_bits {};
+
     class Parse_error {
+        const xma_error error;
     public:
-        virtual void print_self(ostream& os) const = 0;
+        explicit Parse_error(const xma_error& e) : error(e) {}
         friend ostream& operator << (ostream& os, const Parse_error& pe) {
-            os << "Parse error: ";
-            pe.print_self(os);
-            return os;
-        }
-        virtual ~Parse_error() {}
-    };
-    class Bad_frame_sync : public Parse_error {
-        const unsigned int sync_val;
-    public:
-        explicit Bad_frame_sync(unsigned int v) : sync_val(v) {}
-        void print_self(ostream& os) const {
-            os << "unexpected \"frame sync\" " << hex << sync_val<< dec << endl;
-        }
-    };
-
-    class Early_packet_end : public Parse_error {
-    public:
-        void print_self(ostream& os) const {
-            os << "packet end indicated before end of packet" << endl;
-        }
-    };
-
-    class Missing_packet_end : public Parse_error {
-    public:
-        void print_self(ostream& os) const {
-            os << "packet end not seen before end of packet" << endl;
-        }
-    };
-
-    class Zero_frames_not_skipped : public Parse_error {
-    public:
-        void print_self(ostream &os) const {
-            os << "zero frames in this packet, but not set to skip it" << endl;
-        }
-    };
-
-    class Skip_mismatch : public Parse_error {
-        const unsigned int skip, overflow;
-    public:
-        Skip_mismatch(unsigned int s, unsigned int o) : skip(s), overflow(o) {}
-        void print_self(ostream &os) const {
-            os << "skip bits (" << skip << ") did not match previous packet overflow (" << overflow << ")" << endl;
+            char description[128];
+            format_xma_error(&pe.error, description, sizeof(description));
+            return os << description << endl;
         }
     };
 
-    class Skip_nonzero_frames : public Parse_error {
-    public:
-        void print_self(ostream &os) const {
-            os << "skipping entire packet with > 0 frames" << endl;
-        }
-    };
+    /// Reads the data front to back, so the stream needn't be seekable,
+    /// and hands it out a block at a time. At most one block and one
+    /// packet of lookahead are buffered, the lookahead tells whether
+    /// anything follows the block when the data size isn't known.
+    class Block_reader {
+        istream& is;
+        long remaining;             // bytes not yet read, -1 to read to EOF
+        vector<uint8_t> buf;
+        long buffered;              // bytes in buf
+        long handed_out;            // bytes at the front of buf given out last time
+        bool short_read;            // the stream ended before the data size
 
-    class Bad_sequence : public Parse_error {
+        void fill(long want);
     public:
-        void print_self(ostream &os) const {
-            os << "packet out of sequence" << endl;
-        }
-    };
-
-    enum {
-        packet_size_bytes = 0x800,
-        packet_header_size_bytes = 4,
-        frame_header_size_bits = 15,
-        frame_sync_size_bits = 15,
-        frame_skip_size_bits = 10,
-        frame_trailer_size_bits = 1,
-        samples_per_frame = 512
-    };
-
-    struct xma_packet_header {
-        Bit_uint<4> sequence_number;
-        Bit_uint<2> unk;
-        Bit_uint<15> skip_bits;
-        Bit_uint<11> packet_skip;
-
-        xma_packet_header(void) :
-            sequence_number(0),
-            unk(0),
-            skip_bits(0),
-            packet_skip(0) {}
-
-        friend Bit_stream& operator>> (Bit_stream& bs, xma_packet_header &ph) {
-            return bs >> ph.sequence_number >> ph.unk >> ph.skip_bits >> ph.packet_skip;
-        }
-
-        friend Bit_ostream& operator<< (Bit_ostream& bs, xma_packet_header &ph) {
-            return bs << ph.sequence_number << ph.unk << ph.skip_bits << ph.packet_skip;
-        }
-    };
-
-    struct xma2_packet_header {
-        Bit_uint<6> frame_count;
-        Bit_uint<15> skip_bits;
-        Bit_uint<3> metadata;
-        Bit_uint<8> packet_skip;
+        /// data_size -1 reads to the end of the stream
+        Block_reader(istream& _is, long data_size) :
+            is(_is), remaining(data_size), buf(), buffered(0), handed_out(0),
+            short_read(false) {}
 
-        xma2_packet_header(void) :
-            frame_count(0),
-            skip_bits(0),
-            metadata(0),
-            packet_skip(0) {}
-
-        friend Bit_stream& operator>> (Bit_stream& bs, xma2_packet_header &ph) {
-            return bs >> ph.frame_count >> ph.skip_bits >>
-                ph.metadata >> ph.packet_skip;
-        }
+        /// the next block of up to size bytes (size -1 for everything
+        /// left), returns the size of the block, 0 at the end. Throws
+        /// Out_of_bits if a given data size runs past the stream end.
+        long next(long size, const uint8_t ** block, bool * last);
     };
 
-    struct xma_build_context {
-        unsigned int bits_written;  // bits written this packet
-        unsigned int seqno;         // sequence number
-    };
-
-    /// return sample count
-    unsigned int parse_XMA_packets(istream& is, ostream& os, long offset, long data_size, bool stereo, bool strict, bool verbose, bool ignore_packet_skip);
-    unsigned int parse_XMA2_block(istream& is, ostream& os, long offset, long block_size, bool stereo, bool strict, bool verbose, bool ignore_packet_skip);
-    unsigned int parse_frames(Bit_stream& ps, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits, unsigned int max_bits, bool stereo, bool strict, bool verbose);
-
-    void init_build_XMA(Bit_ostream& bs, xma_build_context * ctx);
-    unsigned int build_XMA_from_XMA(istream& is, Bit_ostream& bs, long offset, long data_size, xma_build_context * ctx, bool stereo, bool strict, bool verbose, bool ignore_packet_skip);
-    unsigned int build_XMA_from_XMA2_block(istream& is, Bit_ostream& bs, long offset, long block_size, xma_build_context * ctx, bool stereo, bool strict, bool last, bool verbose, bool ignore_packet_skip);
-    void packetize(Bit_stream& frame_stream, Bit_ostream& out_stream, xma_build_context * ctx, unsigned int frame_count, bool strict, bool last);
-    void finish_build_XMA(Bit_ostream& bs, xma_build_context * ctx);
+    /// throw Out_of_bits or Parse_error for anything but XMA_OK
+    void check(xma_status status, const xma_error& err);
 }
 
 #endif // _XMA_PARSE
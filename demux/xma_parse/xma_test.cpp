@@ -1,9 +1,15 @@
 #include <fstream>
 #include <sstream>
+#include <vector>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#include <fcntl.h>
+#endif
 
 #include "xma_parse.h"
-#include "Bit_stream.h"
 
 using namespace std;
 
@@ -34,11 +40,11 @@ int main(int argc, char * argv[]) {
         cerr << ae.description << endl
 << "usage: xma_parse filename [-1|-2] [-o offset] [-b block size] [-d data size]" << endl
 << "       [-x output filename] [-r output filename] [-s] [-v]" << endl << endl
-<< "    filename is the input file" << endl
+<< "    filename is the input file, - to read from stdin (no seeking needed)" << endl
 << "    -1/-2 indicate that the input is XMA(1) or XMA2, default XMA2" << endl
 << "    -o is the offset to start parsing, default 0" << endl
 << "    -b is the block size to use for XMA2, default 8000" << endl
-<< "    -d is bytes from offset that are XMA data, default rest of file" << endl
+<< "    -d is bytes from offset that are XMA data, default rest of file or stdin" << endl
 << "    -x output file for dumping" << endl
 << "    -r output file for rebuilding to XMA(1)" << endl
 << "    -s strict processing, don't attempt to fix some issues" << endl
@@ -49,29 +55,58 @@ int main(int argc, char * argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    // Input file
-    ifstream is(input_filename, ios::binary);
+    // Input file, or a pipe
+    ifstream input_file;
+    const bool use_stdin = (0 == strcmp(input_filename, "-"));
 
-    if (!is) {
-        cerr << "error opening file!" << endl;
-        exit(EXIT_FAILURE);
+    if (use_stdin) {
+#ifdef _WIN32
+        _setmode(_fileno(stdin), _O_BINARY);
+#endif
+    } else {
+        input_file.open(input_filename, ios::binary);
+
+        if (!input_file) {
+            cerr << "error opening file!" << endl;
+            exit(EXIT_FAILURE);
+        }
     }
 
+    istream& is = use_stdin ? cin : input_file;
+
+    // size up the data if we can seek, otherwise read to the end
     if (-1 == data_size) {
         is.seekg(0, ios::end);
-        data_size = static_cast<long>(is.tellg()) - offset;
+        const streampos end = is.tellg();
+
+        if (is && end != streampos(-1)) {
+            data_size = static_cast<long>(end) - offset;
+        }
+        is.clear();
     }
 
+    // get to the start of the data
+    is.seekg(offset);
+    if (!is) {
+        is.clear();
+        is.ignore(offset);
+        if (is.gcount() != offset) {
+            cerr << "offset is past the end of the input!" << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    // -B with the size unknown is handled by taking everything at once
     if (-1 == block_size) {
         block_size = data_size;
     }
 
     // Output file for exported stream
-    ofstream os;
+    FILE * os = NULL;
 
     if (NULL != output_filename)
     {
-        os.open(output_filename, ios::binary);
+        os = fopen(output_filename, "wb");
 
         if (!os) {
             cerr << "error opening output file!" << endl;
@@ -80,11 +115,11 @@ int main(int argc, char * argv[]) {
     }
 
     // Output file for rebuilt stream
-    ofstream rs;
+    FILE * rs = NULL;
 
     if (NULL != rebuild_filename)
     {
-        rs.open(rebuild_filename, ios::binary);
+        rs = fopen(rebuild_filename, "wb");
 
         if (!rs) {
             cerr << "error opening rebuild output file!" << endl;
@@ -102,13 +137,21 @@ int main(int argc, char * argv[]) {
 
     cout << "offset: " << hex << offset << dec << endl;
     if (version == 2) {
-        cout << "block size: " << hex << block_size << dec << endl;
+        if (-1 == block_size) {
+            cout << "block size: all of the data" << endl;
+        } else {
+            cout << "block size: " << hex << block_size << dec << endl;
+        }
+    }
+    if (-1 == data_size) {
+        cout << "data size: until end of input" << endl;
+    } else {
+        cout << "data size: " << hex << data_size << dec << endl;
     }
-    cout << "data size: " << hex << data_size << dec << endl;
-    if (os.is_open()) {
+    if (os) {
         cout << "output filename: " << output_filename << endl;
     }
-    if (rs.is_open()) {
+    if (rs) {
         cout << "rebuild output filename: " << rebuild_filename << endl;
     }
     if (strict) {
@@ -122,43 +165,57 @@ int main(int argc, char * argv[]) {
     try {
         unsigned long total_sample_count = 0;
 
-        Bit_ostream out_bitstream(rs);
-
-        Parse_XMA::xma_build_context ctx;
-        if (rs.is_open()) {
+        const xma_options opt = {
+            (channels > 1), // stereo
+            strict,
+            verbose,
+            ignore_packet_skip,
+            true            // frame_skip
+        };
+        xma_error err;
+        Parse_XMA::Block_reader reader(is, data_size);
+
+        bitstream_writer * out_bitstream = NULL;
+        xma_build_context ctx;
+        if (rs) {
+            out_bitstream = init_bitstream_writer(rs);
             init_build_XMA(out_bitstream, &ctx);
         }
 
         if (version == 1) {
-            if (!rs.is_open() || os.is_open())
+            // no blocks to go by, all of the packets at once
+            const uint8_t * packets;
+            bool last;
+            const long packets_size = reader.next(-1, &packets, &last);
+
+            if (!rs || os)
             {
-                total_sample_count = Parse_XMA::parse_XMA_packets(is, os, offset, data_size, (channels > 1), strict, verbose, ignore_packet_skip);
+                total_sample_count = 0;
+                Parse_XMA::check(parse_XMA_packets(packets, packets_size, offset, os, &opt, &total_sample_count, &err), err);
             }
             
-            if (rs.is_open()) {
-                total_sample_count = Parse_XMA::build_XMA_from_XMA(is, out_bitstream, offset, data_size, &ctx, (channels > 1), strict, verbose, ignore_packet_skip);
+            if (rs) {
+                total_sample_count = 0;
+                Parse_XMA::check(build_XMA_from_XMA(packets, packets_size, offset, out_bitstream, &ctx, &opt, &total_sample_count, &err), err);
             }
         } else {
-            for (long block_offset = offset;
-                    block_offset < offset + data_size;
-                    block_offset += block_size ) {
-
-                long usable_block_size = block_size;
+            const uint8_t * block;
+            bool last;
 
-                if (block_offset + usable_block_size > offset + data_size)
-                {
-                    usable_block_size = offset + data_size - block_offset;
-                }
+            for (long block_offset = offset, usable_block_size;
+                    (usable_block_size = reader.next(block_size, &block, &last)) > 0;
+                    block_offset += usable_block_size ) {
 
                 unsigned long sample_count = 0;
 
-                if (!rs.is_open() || os.is_open()) {
-                    sample_count = Parse_XMA::parse_XMA2_block(is, os, block_offset, usable_block_size, (channels > 1), strict, verbose, ignore_packet_skip);
+                if (!rs || os) {
+                    Parse_XMA::check(parse_XMA2_block(block, usable_block_size, block_offset, os, &opt, &sample_count, NULL, &err), err);
                 }
 
-                if (rs.is_open()) {
-                    sample_count = Parse_XMA::build_XMA_from_XMA2_block(is, out_bitstream, block_offset, usable_block_size, &ctx,
-                            (channels > 1), strict, (block_offset + block_size >= offset + data_size), verbose, ignore_packet_skip);
+                if (rs) {
+                    sample_count = 0;
+                    Parse_XMA::check(build_XMA_from_XMA2_block(block, usable_block_size, block_offset, out_bitstream, &ctx,
+                            last, &opt, &sample_count, NULL, &err), err);
                 }
 
                 total_sample_count += sample_count;
@@ -168,13 +225,20 @@ int main(int argc, char * argv[]) {
             }
         }
 
-        if (rs.is_open()) {
+        if (rs) {
             finish_build_XMA(out_bitstream, &ctx);
+            flush_bitstream_writer(out_bitstream);
+            free_bitstream_writer(out_bitstream);
+            fclose(rs);
+        }
+
+        if (os) {
+            fclose(os);
         }
 
         cout << endl << total_sample_count << " samples (total)" << endl;
     }
-    catch (const Bit_stream::Out_of_bits& oob) {
+    catch (const Parse_XMA::Out_of_bits& oob) {
         cerr << "error reading bitstream" << endl;
         exit(EXIT_FAILURE);
     }
@@ -206,7 +270,7 @@ void Get_arguments::get(int argc, char * argv[], const char ** filename, const c
             switch (argv[argno][1]) {
                 case '1':
                     *version = 1;
-                    *block_size = Parse_XMA::packet_size_bytes;
+                    *block_size = packet_size_bytes;
                     continue;
                 case '2':
                     *version = 2;
@@ -0,0 +1,257 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#define _FILE_OFFSET_BITS 64
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#ifndef __MINGW32__
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+#include <sys/stat.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "byte_source.h"
+
+#ifndef __MINGW32__
+/* copy an unseekable input to an unlinked temporary file, return its fd */
+static int spool_to_temp(int fd)
+{
+    FILE *temp = tmpfile();
+    CHECK_ERRNO(!temp, "tmpfile");
+
+    const int temp_fd = dup(fileno(temp));
+    CHECK_ERRNO(temp_fd == -1, "dup");
+    CHECK_ERRNO(fclose(temp) != 0, "fclose");
+
+    unsigned char *buf = malloc(SOURCE_WINDOW_SIZE);
+    CHECK_ERRNO(!buf, "malloc");
+
+    for (;;)
+    {
+        ssize_t bytes_read = read(fd, buf, SOURCE_WINDOW_SIZE);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        CHECK_ERRNO(bytes_read == -1, "read");
+        if (bytes_read == 0) break;
+
+        for (ssize_t done = 0; done < bytes_read; )
+        {
+            ssize_t bytes_written = write(temp_fd, buf+done, bytes_read-done);
+            if (bytes_written == -1 && errno == EINTR) continue;
+            CHECK_ERRNO(bytes_written == -1, "write");
+            done += bytes_written;
+        }
+    }
+
+    free(buf);
+
+    return temp_fd;
+}
+#endif
+
+struct byte_source *open_byte_source(const char *name)
+{
+    struct byte_source *src = malloc(sizeof(struct byte_source));
+    CHECK_ERRNO(!src, "malloc");
+    memset(src, 0, sizeof(struct byte_source));
+
+    src->name = name;
+
+#ifdef __MINGW32__
+    src->file = fopen(name, "rb");
+    CHECK_ERRNO(!src->file, "fopen");
+
+    CHECK_ERRNO(fseek(src->file, 0, SEEK_END) != 0, "fseek");
+    src->size = ftell(src->file);
+    CHECK_ERRNO(src->size == -1, "ftell");
+#else
+    struct stat st;
+
+    src->fd = open(name, O_RDONLY);
+    CHECK_ERRNO(src->fd == -1, "open");
+
+    CHECK_ERRNO(fstat(src->fd, &st) != 0, "fstat");
+    if (!S_ISREG(st.st_mode))
+    {
+        const int temp_fd = spool_to_temp(src->fd);
+        CHECK_ERRNO(close(src->fd) != 0, "close");
+        src->fd = temp_fd;
+        CHECK_ERRNO(fstat(src->fd, &st) != 0, "fstat");
+    }
+
+    CHECK_ERROR(st.st_size > LONG_MAX, "file too large");
+    src->size = st.st_size;
+
+    if (src->size > 0 && (uintmax_t)src->size <= SIZE_MAX)
+    {
+        void *map = mmap(NULL, src->size, PROT_READ, MAP_SHARED, src->fd, 0);
+        if (map != MAP_FAILED)
+        {
+            src->map = map;
+        }
+    }
+#endif
+
+    return src;
+}
+
+#ifndef __MINGW32__
+struct byte_source *clone_byte_source(const struct byte_source *src)
+{
+    struct byte_source *clone = malloc(sizeof(struct byte_source));
+    CHECK_ERRNO(!clone, "malloc");
+    memset(clone, 0, sizeof(struct byte_source));
+
+    clone->name = src->name;
+    clone->size = src->size;
+    clone->map = src->map;
+    clone->fd = src->fd;
+    clone->borrowed = 1;
+
+    return clone;
+}
+#endif
+
+struct byte_source *open_memory_byte_source(const unsigned char *data, long base, long size)
+{
+    struct byte_source *src = malloc(sizeof(struct byte_source));
+    CHECK_ERRNO(!src, "malloc");
+    memset(src, 0, sizeof(struct byte_source));
+
+    src->name = "memory";
+    src->base = base;
+    src->size = base + size;
+    src->map = data;
+    src->borrowed = 1;
+
+    return src;
+}
+
+void close_byte_source(struct byte_source *src)
+{
+    if (!src)
+    {
+        return;
+    }
+
+    if (!src->borrowed)
+    {
+#ifdef __MINGW32__
+        CHECK_ERRNO(fclose(src->file) != 0, "fclose");
+#else
+        if (src->map)
+        {
+            CHECK_ERRNO(munmap((void *)src->map, src->size) != 0, "munmap");
+        }
+        CHECK_ERRNO(close(src->fd) != 0, "close");
+#endif
+    }
+
+    free(src->window);
+    free(src);
+}
+
+static void fill_window(struct byte_source *src, long offset, size_t size)
+{
+    size_t fill_size = SOURCE_WINDOW_SIZE;
+    if (fill_size < size) fill_size = size;
+    if (fill_size > src->size - offset) fill_size = src->size - offset;
+
+    if (fill_size > src->window_capacity)
+    {
+        unsigned char *window = realloc(src->window, fill_size);
+        CHECK_ERRNO(!window, "realloc");
+        src->window = window;
+        src->window_capacity = fill_size;
+    }
+
+#ifdef __MINGW32__
+    get_bytes_seek(offset, src->file, src->window, fill_size);
+#else
+    for (size_t done = 0; done < fill_size; )
+    {
+        ssize_t bytes_read = pread(src->fd, src->window+done,
+                fill_size-done, offset+done);
+        if (bytes_read == -1 && errno == EINTR) continue;
+        CHECK_ERRNO(bytes_read == -1, "pread");
+        CHECK_ERROR(bytes_read == 0, "unexpected EOF");
+        done += bytes_read;
+    }
+#endif
+
+    src->window_offset = offset;
+    src->window_size = fill_size;
+}
+
+const unsigned char *source_get(struct byte_source *src, long offset, size_t size)
+{
+    CHECK_ERROR(offset < src->base || offset > src->size ||
+            size > (unsigned long)(src->size - offset),
+            "read past end of file");
+
+    if (src->map)
+    {
+        return src->map + (offset - src->base);
+    }
+
+    if (!(offset >= src->window_offset &&
+          size <= src->window_size &&
+          offset - src->window_offset <= src->window_size - size))
+    {
+        fill_window(src, offset, size);
+    }
+
+    return src->window + (offset - src->window_offset);
+}
+
+uint8_t source_get_byte(struct byte_source *src, long offset)
+{
+    return *source_get(src, offset, 1);
+}
+
+uint16_t source_get_16_be(struct byte_source *src, long offset)
+{
+    return read_16_be(source_get(src, offset, 2));
+}
+
+uint32_t source_get_32_be(struct byte_source *src, long offset)
+{
+    return read_32_be(source_get(src, offset, 4));
+}
+
+uint32_t source_get_32_le(struct byte_source *src, long offset)
+{
+    return read_32_le(source_get(src, offset, 4));
+}
+
+uint64_t source_get_64_be(struct byte_source *src, long offset)
+{
+    return read_64_be(source_get(src, offset, 8));
+}
+
+void source_get_bytes(struct byte_source *src, long offset, unsigned char *buf, size_t byte_count)
+{
+    memcpy(buf, source_get(src, offset, byte_count), byte_count);
+}
+
+void source_dump(struct byte_source *src, FILE *outfile, long offset, size_t size)
+{
+    while (size > 0)
+    {
+        size_t bytes_to_copy = SOURCE_WINDOW_SIZE;
+        if (bytes_to_copy > size) bytes_to_copy = size;
+
+        put_bytes(outfile, source_get(src, offset, bytes_to_copy), bytes_to_copy);
+
+        offset += bytes_to_copy;
+        size -= bytes_to_copy;
+    }
+}
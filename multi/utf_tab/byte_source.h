@@ -0,0 +1,81 @@
+#ifndef _BYTE_SOURCE_H_INCLUDED
+#define _BYTE_SOURCE_H_INCLUDED
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "error_stuff.h"
+
+/* Random access input file.
+
+   Regular files are memory mapped, so source_get returns pointers into
+   the mapping that stay valid until close_byte_source. If mapping isn't
+   possible, reads go through a buffered window instead, and a pointer
+   from source_get is only valid until the next source_get call on the
+   same source. Pipes and other unseekable inputs are first spooled to a
+   temporary file.
+
+   A source can also wrap a buffer already in memory, standing in for the
+   part of a file starting at base. */
+struct byte_source
+{
+    const char *name;
+    long base;
+    long size;  /* offset of the end, base included */
+
+    /* whole file, if mapped */
+    const unsigned char *map;
+
+    /* window for unmapped reads */
+    unsigned char *window;
+    long window_offset;
+    size_t window_size;
+    size_t window_capacity;
+
+    /* clones and memory sources don't own the file or mapping */
+    int borrowed;
+
+#ifdef __MINGW32__
+    FILE *file;
+#else
+    int fd;
+#endif
+};
+
+/* window refill granularity for unmapped sources */
+#define SOURCE_WINDOW_SIZE 0x100000
+
+struct byte_source *open_byte_source(const char *name);
+void close_byte_source(struct byte_source *src);
+
+/* An independent read cursor on the same file, with its own window, so
+   each thread can read without locking. Close clones before the parent.
+   (not on mingw, where reads go through a shared FILE *) */
+#ifndef __MINGW32__
+struct byte_source *clone_byte_source(const struct byte_source *src);
+#endif
+
+struct byte_source *open_memory_byte_source(const unsigned char *data, long base, long size);
+
+/* bounds checked, fails if the range isn't entirely within the file */
+const unsigned char *source_get(struct byte_source *src, long offset, size_t size);
+
+static inline int source_is_mapped(const struct byte_source *src)
+{
+    return src->map != NULL;
+}
+
+uint8_t source_get_byte(struct byte_source *src, long offset);
+uint16_t source_get_16_be(struct byte_source *src, long offset);
+uint32_t source_get_32_be(struct byte_source *src, long offset);
+uint32_t source_get_32_le(struct byte_source *src, long offset);
+uint64_t source_get_64_be(struct byte_source *src, long offset);
+void source_get_bytes(struct byte_source *src, long offset, unsigned char *buf, size_t byte_count);
+
+/* copy a range of the source to outfile */
+void source_dump(struct byte_source *src, FILE *outfile, long offset, size_t size);
+
+#endif /* _BYTE_SOURCE_H_INCLUDED */
@@ -0,0 +1,303 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <limits.h>
+
+#include "cpk_compress.h"
+#include "util.h"
+#include "error_stuff.h"
+
+// Compress data into CRILAYLA blocks for CRI CPK filesystems
+
+/* The format, as seen by the decoder in cpk_uncompress.c:
+
+   0x00 "CRILAYLA"
+   0x08 uncompressed size, not counting the first 0x100 bytes (LE)
+   0x0C compressed bitstream size (LE)
+   0x10 bitstream
+   then the first 0x100 bytes of the data, uncompressed
+
+   The bitstream is read from its last byte backwards, MSB first, and
+   produces the data from its last byte backwards. So this works on the
+   data reversed, where it is ordinary LZ77: a 1 bit then a 13 bit
+   distance (minus 3) and a variable length length (minus 3), or a 0 bit
+   and a literal byte. */
+
+static const uint64_t CRILAYLA_signature = UINT64_C(0x4352494C41594C41);
+
+enum
+{
+    min_match = 3,
+    min_distance = 3,
+    max_distance = 0x1fff + 3,
+
+    hash_bits = 15,
+    hash_size = 1 << hash_bits,
+    /* power of two larger than the window */
+    chain_size = 0x4000,
+    chain_mask = chain_size - 1,
+};
+
+struct level_config
+{
+    int max_chain;      /* candidates to try per position */
+    long nice_length;   /* stop searching at a match this long */
+    int lazy;           /* check if the next position has a longer match */
+    long max_insert;    /* don't hash the insides of matches longer than this */
+};
+
+static const struct level_config level_configs[CRILAYLA_MAX_LEVEL+1] =
+{
+    {    0,     0, 0, 0 },        /* unused */
+    {    4,    16, 0, 8 },
+    {    8,    32, 0, 16 },
+    {   16,    64, 0, 64 },
+    {   16,    32, 1, LONG_MAX },
+    {   32,    64, 1, LONG_MAX },
+    {   64,   128, 1, LONG_MAX },
+    {  128,   256, 1, LONG_MAX },
+    {  512,  1024, 1, LONG_MAX },
+    { 4096, 65536, 1, LONG_MAX },
+};
+
+struct bit_writer
+{
+    unsigned char *buf;
+    long pos;
+    uint64_t bits;
+    int count;
+};
+
+/* only for up to 32 bits */
+static inline void put_bits(struct bit_writer * const w, const uint32_t value, const int bit_count)
+{
+    w->bits = (w->bits << bit_count) | value;
+    w->count += bit_count;
+    while (w->count >= 8)
+    {
+        w->count -= 8;
+        w->buf[w->pos++] = (w->bits >> w->count) & 0xff;
+    }
+}
+
+static void flush_bits(struct bit_writer * const w)
+{
+    if (w->count > 0)
+    {
+        put_bits(w, 0, 8 - w->count);
+    }
+}
+
+static void put_match(struct bit_writer * const w, long distance, long length)
+{
+    long v = length - min_match;
+
+    put_bits(w, 1, 1);
+    put_bits(w, distance - min_distance, 13);
+
+    /* levels of 2, 3, 5 and 8 bits, then as many 8 bit levels as needed,
+       each level that is all ones means there's another */
+    static const int vle_lens[3] = { 2, 3, 5 };
+    for (int i = 0; i < 3; i++)
+    {
+        const long level_max = (1 << vle_lens[i]) - 1;
+        if (v < level_max)
+        {
+            put_bits(w, v, vle_lens[i]);
+            return;
+        }
+        put_bits(w, level_max, vle_lens[i]);
+        v -= level_max;
+    }
+
+    while (v >= 255)
+    {
+        put_bits(w, 255, 8);
+        v -= 255;
+    }
+    put_bits(w, v, 8);
+}
+
+struct match_finder
+{
+    const unsigned char *data;
+    long size;
+    long next_insert;
+    int32_t *head;
+    int32_t *prev;
+};
+
+static inline uint32_t hash3(const unsigned char *p)
+{
+    const uint32_t v = ((uint32_t)p[0] << 16) | ((uint32_t)p[1] << 8) | p[2];
+    return (v * UINT32_C(2654435761)) >> (32 - hash_bits);
+}
+
+/* hash all positions before pos */
+static void insert_until(struct match_finder * const mf, const long pos)
+{
+    for (; mf->next_insert < pos; mf->next_insert++)
+    {
+        const long p = mf->next_insert;
+        if (p + min_match > mf->size) continue;
+
+        const uint32_t h = hash3(mf->data + p);
+        mf->prev[p & chain_mask] = mf->head[h];
+        mf->head[h] = p;
+    }
+}
+
+static long longest_match(struct match_finder * const mf, const long pos,
+        const struct level_config * const config, long *distance_p)
+{
+    const unsigned char * const data = mf->data;
+    const long max_length = mf->size - pos;
+    long best_length = min_match - 1;
+    int chain = config->max_chain;
+
+    if (max_length < min_match) return 0;
+
+    insert_until(mf, pos);
+
+    for (long candidate = mf->head[hash3(data + pos)];
+         candidate >= 0 && pos - candidate <= max_distance && chain > 0;
+         candidate = mf->prev[candidate & chain_mask], chain--)
+    {
+        if (pos - candidate < min_distance) continue;
+
+        /* quick reject on the byte that would make this one longer */
+        if (data[candidate + best_length] != data[pos + best_length]) continue;
+
+        long length = 0;
+        while (length < max_length && data[candidate + length] == data[pos + length])
+        {
+            length++;
+        }
+
+        if (length > best_length)
+        {
+            best_length = length;
+            *distance_p = pos - candidate;
+            if (length >= config->nice_length || length == max_length) break;
+        }
+    }
+
+    return best_length >= min_match ? best_length : 0;
+}
+
+long crilayla_compress(const unsigned char *input, long input_size, int level, unsigned char **output)
+{
+    if (input_size < 0x100) return -1;
+
+    CHECK_ERROR(level < CRILAYLA_MIN_LEVEL || level > CRILAYLA_MAX_LEVEL,
+            "bad compression level");
+    const struct level_config * const config = &level_configs[level];
+
+    const long data_size = input_size - 0x100;
+    CHECK_ERROR(data_size > UINT32_MAX, "input too large for CRILAYLA");
+
+    /* reverse the part to be compressed */
+    unsigned char *reversed = malloc(data_size + 1);
+    CHECK_ERRNO(!reversed, "malloc");
+    for (long i = 0; i < data_size; i++)
+    {
+        reversed[i] = input[input_size - 1 - i];
+    }
+
+    struct match_finder mf;
+    mf.data = reversed;
+    mf.size = data_size;
+    mf.next_insert = 0;
+    mf.head = malloc(sizeof(int32_t) * hash_size);
+    CHECK_ERRNO(!mf.head, "malloc");
+    mf.prev = malloc(sizeof(int32_t) * chain_size);
+    CHECK_ERRNO(!mf.prev, "malloc");
+    for (int i = 0; i < hash_size; i++)
+    {
+        mf.head[i] = -1;
+    }
+
+    /* a literal is 9 bits, nothing costs more per byte */
+    struct bit_writer w;
+    w.buf = malloc(data_size / 8 * 9 + 16);
+    CHECK_ERRNO(!w.buf, "malloc");
+    w.pos = 0;
+    w.bits = 0;
+    w.count = 0;
+
+    long pos = 0;
+    long length = 0, distance = 0;
+    int have_match = 0;
+
+    while (pos < data_size)
+    {
+        if (!have_match)
+        {
+            length = longest_match(&mf, pos, config, &distance);
+        }
+        have_match = 0;
+
+        if (length >= min_match)
+        {
+            if (config->lazy && length < config->nice_length)
+            {
+                long next_distance = 0;
+                const long next_length = longest_match(&mf, pos + 1, config, &next_distance);
+
+                if (next_length > length)
+                {
+                    /* better to take a literal here */
+                    put_bits(&w, reversed[pos], 9);
+                    pos++;
+                    length = next_length;
+                    distance = next_distance;
+                    have_match = 1;
+                    continue;
+                }
+            }
+
+            put_match(&w, distance, length);
+
+            if (length > config->max_insert)
+            {
+                mf.next_insert = pos + length;
+            }
+            pos += length;
+        }
+        else
+        {
+            /* verbatim byte, after a 0 bit */
+            put_bits(&w, reversed[pos], 9);
+            pos++;
+        }
+    }
+
+    flush_bits(&w);
+
+    free(mf.prev);
+    free(mf.head);
+    free(reversed);
+
+    /* assemble block, bitstream goes in backwards */
+    const long output_size = 0x10 + w.pos + 0x100;
+    unsigned char *out = malloc(output_size);
+    CHECK_ERRNO(!out, "malloc");
+
+    write_32_be(CRILAYLA_signature >> 32, out+0x00);
+    write_32_be(CRILAYLA_signature & 0xffffffff, out+0x04);
+    write_32_le(data_size, out+0x08);
+    write_32_le(w.pos, out+0x0C);
+    for (long i = 0; i < w.pos; i++)
+    {
+        out[0x10 + i] = w.buf[w.pos - 1 - i];
+    }
+    memcpy(out + 0x10 + w.pos, input, 0x100);
+
+    free(w.buf);
+
+    *output = out;
+
+    return output_size;
+}
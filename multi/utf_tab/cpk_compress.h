@@ -0,0 +1,16 @@
+#ifndef _CPK_COMPRESS_H_INCLUDED
+#define _CPK_COMPRESS_H_INCLUDED
+
+#include <stdio.h>
+
+#define CRILAYLA_MIN_LEVEL 1
+#define CRILAYLA_MAX_LEVEL 9
+#define CRILAYLA_DEFAULT_LEVEL 6
+
+/* Compress into a CRILAYLA block that uncompress() can decode.
+   The first 0x100 bytes are stored raw, as the format requires, so the
+   input must be at least that long; returns -1 if it isn't.
+   *output is malloc'd, the return value is its size. */
+long crilayla_compress(const unsigned char *input, long input_size, int level, unsigned char **output);
+
+#endif
@@ -6,7 +6,12 @@
 #include "error_stuff.h"
 #include "util.h"
 
-void analyze(reader_t *infile, long offset, long file_length);
+/* Find the key for a .cpk with an encrypted CpkHeader, as used by the
+   variants in cri_variant.c: each byte is xor'd with a key that starts at
+   some s and is multiplied by some m for every byte. The plaintext of the
+   start of the table is known, which gives enough bytes to check. */
+
+void analyze(struct byte_source *src, long offset);
 
 int main(int argc, char **argv)
 {
@@ -14,40 +19,38 @@ int main(int argc, char **argv)
     CHECK_ERROR(argc != 2, "Incorrect program usage\n\nusage: cpk_crypt file.cpk");
 
     /* open file */
-    reader_t *infile = open_reader_file(argv[1]);
-    CHECK_ERRNO(!infile, "fopen");
+    struct byte_source *src = open_byte_source(argv[1]);
 
-    long file_length = reader_length(infile);
+    analyze(src, 0);
 
-    analyze(infile, 0, file_length);
+    close_byte_source(src);
 
     exit(EXIT_SUCCESS);
 }
 
 static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
 
-void analyze(reader_t *infile, long offset, long file_length)
+void analyze(struct byte_source *src, long offset)
 {
     const long CpkHeader_offset = offset;
 
     /* check header */
     {
-        unsigned char buf[4];
         static const char CPK_signature[4] = "CPK "; /* intentionally unterminated */
-        get_bytes_seek(CpkHeader_offset, infile, buf, 4);
+        const unsigned char *buf = source_get(src, CpkHeader_offset, 4);
         CHECK_ERROR (memcmp(buf, CPK_signature, sizeof(CPK_signature)), "CPK signature not found");
     }
 
-    const long CpkHeader_size = get_32_le_seek(CpkHeader_offset+8, infile);
+    const long CpkHeader_size = source_get_32_le(src, CpkHeader_offset+8);
     /* check CpkHeader */
     {
         enum {bytes_to_check=0x18};
 
-        unsigned char buf[bytes_to_check];
-        get_bytes_seek(CpkHeader_offset+0x10, infile, buf, bytes_to_check);
+        const unsigned char *buf = source_get(src, CpkHeader_offset+0x10, bytes_to_check);
         CHECK_ERROR (!memcmp(buf, UTF_signature, sizeof(UTF_signature)), "@UTF table looks unencrypted");
 
         unsigned char expected_bytes[bytes_to_check];
+        memset(expected_bytes, 0, sizeof(expected_bytes));
         // signature
         memcpy(&expected_bytes[0], UTF_signature, 4);
         // CPK chunk size
@@ -0,0 +1,312 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include "cpk_index.h"
+#include "cri_variant.h"
+#include "util.h"
+#include "error_stuff.h"
+
+/* Index file layout, all little endian:
+
+   0x00 "CPKINDEX"
+   0x08 version
+   0x0C flags, 1 if from an ITOC
+   0x10 archive size (64-bit)
+   0x18 archive modification time (64-bit)
+   0x20 hash of the CPK header chunk and variant name
+   0x24 entry count
+   0x28 string table size
+   0x2C reserved
+   0x30 entries, 0x18 bytes each:
+        0x00 directory name offset, or 0xFFFFFFFF for none
+        0x04 file name offset
+        0x08 file offset (64-bit)
+        0x10 file size
+        0x14 extract size
+   then the string table, nul terminated names */
+
+static const char index_signature[8] = "CPKINDEX"; /* intentionally unterminated */
+
+enum
+{
+    index_version = 1,
+    index_header_size = 0x30,
+    index_entry_size = 0x18,
+};
+
+#define NO_NAME UINT32_C(0xFFFFFFFF)
+
+struct index_key
+{
+    uint64_t size;
+    int64_t mtime;
+    uint32_t hash;
+};
+
+static char *index_name(const struct byte_source *src)
+{
+    static const char index_postfix[] = ".idx";
+    char *name = malloc(strlen(src->name) + sizeof(index_postfix));
+    CHECK_ERRNO(!name, "malloc");
+
+    strcpy(name, src->name);
+    strcat(name, index_postfix);
+
+    return name;
+}
+
+static uint32_t fnv1a(uint32_t hash, const unsigned char *bytes, size_t size)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        hash ^= bytes[i];
+        hash *= UINT32_C(0x01000193);
+    }
+    return hash;
+}
+
+/* returns 0 if the archive can't be identified, as for a pipe */
+static int get_index_key(struct byte_source *src, struct index_key *key)
+{
+    struct stat st;
+
+    if (stat(src->name, &st) != 0 || !S_ISREG(st.st_mode) || src->size < 0x10)
+    {
+        return 0;
+    }
+
+    key->size = src->size;
+    key->mtime = st.st_mtime;
+
+    /* the CPK chunk holds the CpkHeader table, covers TOC offsets etc. */
+    long chunk_size = 0x10 + (long)source_get_32_le(src, 0x08);
+    if (chunk_size > src->size) chunk_size = src->size;
+
+    key->hash = fnv1a(UINT32_C(0x811c9dc5), source_get(src, 0, chunk_size), chunk_size);
+    key->hash = fnv1a(key->hash, (const unsigned char *)cri_variant()->name,
+            strlen(cri_variant()->name));
+
+    return 1;
+}
+
+static uint64_t read_64_le(const unsigned char bytes[8])
+{
+    return read_32_le(bytes) | (uint64_t)read_32_le(bytes+4) << 32;
+}
+
+static void write_64_le(uint64_t value, unsigned char bytes[8])
+{
+    write_32_le(value & 0xFFFFFFFF, bytes);
+    write_32_le(value >> 32, bytes+4);
+}
+
+static const char *index_string(const struct cpk_index *index, uint32_t offset, uint32_t strings_size)
+{
+    if (offset == NO_NAME)
+    {
+        return NULL;
+    }
+    CHECK_ERROR(offset >= strings_size, "index name out of range");
+    return index->strings + offset;
+}
+
+struct cpk_index *load_cpk_index(struct byte_source *src)
+{
+    struct index_key key;
+    unsigned char header[index_header_size];
+
+    if (!get_index_key(src, &key))
+    {
+        return NULL;
+    }
+
+    char *name = index_name(src);
+    FILE *infile = fopen(name, "rb");
+    free(name);
+    if (!infile)
+    {
+        return NULL;
+    }
+
+    struct cpk_index *index = NULL;
+
+    if (fread(header, 1, index_header_size, infile) != index_header_size ||
+        memcmp(header, index_signature, sizeof(index_signature)) ||
+        read_32_le(header+0x08) != index_version ||
+        read_64_le(header+0x10) != key.size ||
+        (int64_t)read_64_le(header+0x18) != key.mtime ||
+        read_32_le(header+0x20) != key.hash)
+    {
+        goto done;
+    }
+
+    const uint32_t entry_count = read_32_le(header+0x24);
+    const uint32_t strings_size = read_32_le(header+0x28);
+    const size_t entries_size = (size_t)entry_count * index_entry_size;
+
+    unsigned char *entry_bytes = malloc(entries_size + 1);
+    CHECK_ERRNO(!entry_bytes, "malloc");
+
+    index = malloc(sizeof(struct cpk_index));
+    CHECK_ERRNO(!index, "malloc");
+    index->entry_count = entry_count;
+    index->from_itoc = read_32_le(header+0x0C) & 1;
+    index->strings = malloc(strings_size + 1);
+    CHECK_ERRNO(!index->strings, "malloc");
+    index->entries = malloc(sizeof(struct cpk_entry) * (entry_count + 1));
+    CHECK_ERRNO(!index->entries, "malloc");
+    memset(index->entries, 0, sizeof(struct cpk_entry) * (entry_count + 1));
+
+    if (fread(entry_bytes, 1, entries_size, infile) != entries_size ||
+        fread(index->strings, 1, strings_size, infile) != strings_size)
+    {
+        free(entry_bytes);
+        free_cpk_index(index);
+        index = NULL;
+        goto done;
+    }
+    /* in case the last name isn't terminated */
+    index->strings[strings_size] = '\0';
+
+    for (uint32_t i = 0; i < entry_count; i++)
+    {
+        const unsigned char * const b = entry_bytes + (size_t)i * index_entry_size;
+        struct cpk_entry * const e = &index->entries[i];
+
+        e->dir_name = index_string(index, read_32_le(b+0x00), strings_size);
+        e->file_name = index_string(index, read_32_le(b+0x04), strings_size);
+        CHECK_ERROR(!e->file_name, "index entry has no file name");
+        e->file_offset = read_64_le(b+0x08);
+        e->file_size = read_32_le(b+0x10);
+        e->extract_size = read_32_le(b+0x14);
+    }
+
+    free(entry_bytes);
+
+done:
+    CHECK_ERRNO(fclose(infile) != 0, "fclose");
+
+    return index;
+}
+
+void save_cpk_index(struct byte_source *src, const struct cpk_entry *entries,
+        long entry_count, int from_itoc)
+{
+    struct index_key key;
+
+    if (!get_index_key(src, &key))
+    {
+        return;
+    }
+
+    /* lay out the strings, runs of the same directory share one copy */
+    uint32_t *name_offsets = malloc(sizeof(uint32_t) * 2 * (entry_count + 1));
+    CHECK_ERRNO(!name_offsets, "malloc");
+    size_t strings_size = 0;
+    for (long i = 0; i < entry_count; i++)
+    {
+        const struct cpk_entry * const e = &entries[i];
+
+        if (!e->dir_name)
+        {
+            name_offsets[i*2] = NO_NAME;
+        }
+        else if (i > 0 && entries[i-1].dir_name && !strcmp(e->dir_name, entries[i-1].dir_name))
+        {
+            name_offsets[i*2] = name_offsets[(i-1)*2];
+        }
+        else
+        {
+            name_offsets[i*2] = strings_size;
+            strings_size += strlen(e->dir_name) + 1;
+        }
+
+        name_offsets[i*2+1] = strings_size;
+        strings_size += strlen(e->file_name) + 1;
+    }
+    CHECK_ERROR(strings_size >= NO_NAME, "too many names for the index");
+
+    const size_t index_size = index_header_size + (size_t)entry_count * index_entry_size + strings_size;
+    unsigned char *buf = malloc(index_size);
+    CHECK_ERRNO(!buf, "malloc");
+    memset(buf, 0, index_header_size);
+
+    memcpy(buf, index_signature, sizeof(index_signature));
+    write_32_le(index_version, buf+0x08);
+    write_32_le(from_itoc ? 1 : 0, buf+0x0C);
+    write_64_le(key.size, buf+0x10);
+    write_64_le(key.mtime, buf+0x18);
+    write_32_le(key.hash, buf+0x20);
+    write_32_le(entry_count, buf+0x24);
+    write_32_le(strings_size, buf+0x28);
+
+    unsigned char * const strings = buf + index_header_size + (size_t)entry_count * index_entry_size;
+    for (long i = 0; i < entry_count; i++)
+    {
+        const struct cpk_entry * const e = &entries[i];
+        unsigned char * const b = buf + index_header_size + (size_t)i * index_entry_size;
+
+        write_32_le(name_offsets[i*2], b+0x00);
+        write_32_le(name_offsets[i*2+1], b+0x04);
+        write_64_le(e->file_offset, b+0x08);
+        write_32_le(e->file_size, b+0x10);
+        write_32_le(e->extract_size, b+0x14);
+
+        if (e->dir_name)
+        {
+            strcpy((char *)strings + name_offsets[i*2], e->dir_name);
+        }
+        strcpy((char *)strings + name_offsets[i*2+1], e->file_name);
+    }
+
+    free(name_offsets);
+
+    /* write under another name first so a reader never sees half of it */
+    char *name = index_name(src);
+    char *temp_name = malloc(strlen(name) + 5);
+    CHECK_ERRNO(!temp_name, "malloc");
+    strcpy(temp_name, name);
+    strcat(temp_name, ".tmp");
+
+    FILE *outfile = fopen(temp_name, "wb");
+    int ok = outfile != NULL;
+    if (ok)
+    {
+        ok = fwrite(buf, 1, index_size, outfile) == index_size;
+        ok = (fclose(outfile) == 0) && ok;
+#ifdef __MINGW32__
+        /* rename won't replace an existing file */
+        remove(name);
+#endif
+        ok = ok && rename(temp_name, name) == 0;
+        if (!ok)
+        {
+            remove(temp_name);
+        }
+    }
+
+    if (!ok)
+    {
+        printf("Warning: couldn't write index %s\n", name);
+    }
+
+    free(temp_name);
+    free(name);
+    free(buf);
+}
+
+void free_cpk_index(struct cpk_index *index)
+{
+    if (!index)
+    {
+        return;
+    }
+
+    free(index->entries);
+    free(index->strings);
+    free(index);
+}
@@ -0,0 +1,48 @@
+#ifndef _CPK_INDEX_H_INCLUDED
+#define _CPK_INDEX_H_INCLUDED
+
+#include "byte_source.h"
+
+/* one file in a CPK, resolved from the TOC or ITOC */
+struct cpk_entry
+{
+    const char *dir_name;   /* NULL from an ITOC */
+    const char *file_name;
+    char *file_name_buffer; /* ITOC names are made up, this owns them */
+    long file_offset;
+    long file_size;
+    long extract_size;      /* compressed if larger than file_size */
+
+    /* set when running in parallel */
+    char *path;
+    int superseded;
+
+    /* result */
+    long uncompressed_size;
+    int done;
+};
+
+/* For --list and --extract, the resolved file list is cached in a sidecar
+   file next to the archive (archive name + ".idx"), so listing or pulling a
+   few files out of a big CPK doesn't need the TOC again. It is only used if the archive size,
+   modification time, CPK header and build variant all still match. */
+struct cpk_index
+{
+    struct cpk_entry *entries;
+    long entry_count;
+    int from_itoc;
+
+    /* names point in here */
+    char *strings;
+};
+
+/* returns NULL if there is no index or it is out of date */
+struct cpk_index *load_cpk_index(struct byte_source *src);
+
+/* failing to write the index is only a warning */
+void save_cpk_index(struct byte_source *src, const struct cpk_entry *entries,
+        long entry_count, int from_itoc);
+
+void free_cpk_index(struct cpk_index *index);
+
+#endif /* _CPK_INDEX_H_INCLUDED */
@@ -0,0 +1,344 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include "cpk_compress.h"
+#include "cri_variant.h"
+#include "utf_tab.h"
+#include "util.h"
+#include "error_stuff.h"
+
+// Write a small CPK with a TOC, encrypted as the variant this is built
+// for would have it, and the files it holds next to it, for make check to
+// compare against what cpk_unpack gets out. For encrypted variants the key
+// cpk_crypt should find is printed, in the same form.
+
+struct test_column
+{
+    const char *name;
+    uint8_t type;   /* COLUMN_TYPE_*, always stored per row */
+};
+
+struct test_cell
+{
+    uint64_t number;
+    const char *string;
+};
+
+static unsigned char *append(unsigned char *buf, long *size, const void *bytes, long count)
+{
+    buf = realloc(buf, *size + count);
+    CHECK_ERRNO(!buf, "realloc");
+    memcpy(buf + *size, bytes, count);
+    *size += count;
+    return buf;
+}
+
+static void write_64_be(uint64_t value, unsigned char bytes[8])
+{
+    write_32_be(value >> 32, bytes);
+    write_32_be(value & UINT32_C(0xffffffff), bytes + 4);
+}
+
+/* a whole @UTF table, including the 8 byte header, *size gets its size */
+static unsigned char *build_utf(const char *table_name,
+        const struct test_column *columns, int column_count,
+        const struct test_cell *cells, long rows, long *size)
+{
+    unsigned char *schema = NULL, *row_data = NULL, *strings = NULL;
+    long schema_size = 0, row_data_size = 0, strings_size = 0;
+    int row_width = 0;
+
+    /* the table name comes first, at 7, cpk_crypt counts on that */
+    strings = append(strings, &strings_size, "<NULL>", 7);
+    const long name_offset = strings_size;
+    strings = append(strings, &strings_size, table_name, strlen(table_name) + 1);
+
+    for (int c = 0; c < column_count; c++)
+    {
+        unsigned char entry[5];
+        entry[0] = COLUMN_STORAGE_PERROW | columns[c].type;
+        write_32_be(strings_size, entry + 1);
+        schema = append(schema, &schema_size, entry, 5);
+        strings = append(strings, &strings_size, columns[c].name, strlen(columns[c].name) + 1);
+    }
+
+    for (long r = 0; r < rows; r++)
+    {
+        for (int c = 0; c < column_count; c++)
+        {
+            const struct test_cell *cell = &cells[r * column_count + c];
+            unsigned char value[8];
+            long width;
+
+            switch (columns[c].type)
+            {
+                case COLUMN_TYPE_STRING:
+                    write_32_be(strings_size, value);
+                    strings = append(strings, &strings_size, cell->string, strlen(cell->string) + 1);
+                    width = 4;
+                    break;
+                case COLUMN_TYPE_8BYTE:
+                    write_64_be(cell->number, value);
+                    width = 8;
+                    break;
+                case COLUMN_TYPE_4BYTE:
+                    write_32_be(cell->number, value);
+                    width = 4;
+                    break;
+                case COLUMN_TYPE_2BYTE:
+                    write_16_be(cell->number, value);
+                    width = 2;
+                    break;
+                default:
+                    CHECK_ERROR(1, "column type not supported");
+                    width = 0;
+            }
+
+            row_data = append(row_data, &row_data_size, value, width);
+            if (r == 0) row_width += width;
+        }
+    }
+
+    const long rows_offset = 0x18 + schema_size;
+    const long strings_offset = rows_offset + row_data_size;
+    const long data_offset = strings_offset + strings_size;
+
+    unsigned char header[0x20];
+    memcpy(header, "@UTF", 4);
+    write_32_be(data_offset, header + 0x04);
+    write_32_be(rows_offset, header + 0x08);
+    write_32_be(strings_offset, header + 0x0c);
+    write_32_be(data_offset, header + 0x10);
+    write_32_be(name_offset, header + 0x14);
+    write_16_be(column_count, header + 0x18);
+    write_16_be(row_width, header + 0x1a);
+    write_32_be(rows, header + 0x1c);
+
+    unsigned char *table = NULL;
+    *size = 0;
+    table = append(table, size, header, sizeof(header));
+    table = append(table, size, schema, schema_size);
+    table = append(table, size, row_data, row_data_size);
+    table = append(table, size, strings, strings_size);
+
+    free(schema);
+    free(row_data);
+    free(strings);
+
+    return table;
+}
+
+/* chunk header as in a real CPK, then the table, encrypted if need be */
+static void write_chunk(FILE *outfile, long offset, const char signature[4],
+        unsigned char *table, long table_size)
+{
+    const struct cri_variant * const variant = cri_variant();
+    unsigned char header[0x10] = {0};
+
+    memcpy(header, signature, 4);
+    header[4] = 0xff;
+    write_32_le(table_size, header + 8);
+
+    if (variant->utf_crypt)
+    {
+        cri_crypt(variant, table, table_size, variant->crypt_start);
+    }
+
+    put_bytes_seek(offset, outfile, header, sizeof(header));
+    put_bytes(outfile, table, table_size);
+}
+
+static void write_expected(const char *dir, const char *sub_dir, const char *name,
+        const unsigned char *data, long size)
+{
+    char path[1024];
+
+    /* parents are made before their subdirectories, by the order of the files */
+    snprintf(path, sizeof(path), "%s/%s", dir, sub_dir);
+    make_directory(dir);
+    make_directory(path);
+
+    snprintf(path, sizeof(path), "%s/%s/%s", dir, sub_dir, name);
+    FILE *outfile = fopen(path, "wb");
+    CHECK_ERRNO(!outfile, "fopen");
+    put_bytes(outfile, data, size);
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+}
+
+enum { file_count = 6, align = 0x800, toc_offset = 0x800 };
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+    {
+        fprintf(stderr, "usage: %s out.cpk expected_dir\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+
+    const struct cri_variant * const variant = cri_variant();
+    static const struct test_column toc_columns[] =
+    {
+        {"DirName", COLUMN_TYPE_STRING},
+        {"FileName", COLUMN_TYPE_STRING},
+        {"FileSize", COLUMN_TYPE_4BYTE},
+        {"ExtractSize", COLUMN_TYPE_4BYTE},
+        {"FileOffset", COLUMN_TYPE_8BYTE},
+        {"ID", COLUMN_TYPE_4BYTE},
+    };
+    enum { toc_column_count = sizeof(toc_columns)/sizeof(toc_columns[0]) };
+    static const char * const names[file_count] =
+        {"tiny.bin", "random.bin", "text.txt", "zeros.bin", "mixed.bin", "short.txt"};
+    static const char * const dir_names[file_count] =
+        {"a", "a", "b", "b", "b/c", "a"};
+    static const long sizes[file_count] = {0x40, 0x1234, 0x5000, 0x3000, 0x8123, 0x100};
+
+    unsigned char *contents[file_count];
+    unsigned char *stored[file_count];
+    long stored_sizes[file_count];
+    uint32_t seed = 12345;
+
+    for (int i = 0; i < file_count; i++)
+    {
+        contents[i] = malloc(sizes[i]);
+        CHECK_ERRNO(!contents[i], "malloc");
+
+        for (long j = 0; j < sizes[i]; j++)
+        {
+            seed = seed * 1103515245 + 12345;
+            switch (i)
+            {
+                case 1:  contents[i][j] = seed >> 16; break;
+                case 2:
+                case 5:  contents[i][j] = "the quick brown fox "[(j * 7 + (seed >> 28)) % 20]; break;
+                case 3:  contents[i][j] = 0; break;
+                default: contents[i][j] = (j % 3) ? contents[i][j - 1] : seed >> 24;
+            }
+        }
+
+        /* compress where it helps, as a CPK builder would */
+        stored[i] = contents[i];
+        stored_sizes[i] = sizes[i];
+        if (sizes[i] > 0x100)
+        {
+            unsigned char *compressed = NULL;
+            const long compressed_size = crilayla_compress(contents[i], sizes[i],
+                    CRILAYLA_DEFAULT_LEVEL, &compressed);
+            if (compressed_size > 0 && compressed_size < sizes[i])
+            {
+                stored[i] = compressed;
+                stored_sizes[i] = compressed_size;
+            }
+            else
+            {
+                free(compressed);
+            }
+        }
+    }
+
+    /* lay out the content after the TOC, sizes don't depend on offsets */
+    struct test_cell toc_cells[file_count * toc_column_count];
+    long toc_size;
+    long file_offsets[file_count];
+    unsigned char *toc;
+
+    memset(toc_cells, 0, sizeof(toc_cells));
+    for (int i = 0; i < file_count; i++)
+    {
+        struct test_cell * const row = &toc_cells[i * toc_column_count];
+        row[0].string = dir_names[i];
+        row[1].string = names[i];
+        row[2].number = stored_sizes[i];
+        row[3].number = sizes[i];
+        row[5].number = i;
+    }
+    toc = build_utf("CpkTocInfo", toc_columns, toc_column_count,
+            toc_cells, file_count, &toc_size);
+    free(toc);
+
+    const long content_offset = (toc_offset + 0x10 + toc_size + align - 1) & ~(long)(align - 1);
+    long content_end = content_offset;
+    for (int i = 0; i < file_count; i++)
+    {
+        file_offsets[i] = content_end;
+        content_end = (content_end + stored_sizes[i] + align - 1) & ~(long)(align - 1);
+        toc_cells[i * toc_column_count + 4].number = file_offsets[i] - toc_offset;
+    }
+    toc = build_utf("CpkTocInfo", toc_columns, toc_column_count,
+            toc_cells, file_count, &toc_size);
+
+    static const struct test_column header_columns[] =
+    {
+        {"ContentOffset", COLUMN_TYPE_8BYTE},
+        {"ContentSize", COLUMN_TYPE_8BYTE},
+        {"TocOffset", COLUMN_TYPE_8BYTE},
+        {"TocSize", COLUMN_TYPE_8BYTE},
+        {"ItocOffset", COLUMN_TYPE_8BYTE},
+        {"Files", COLUMN_TYPE_4BYTE},
+        {"Version", COLUMN_TYPE_2BYTE},
+        {"Align", COLUMN_TYPE_2BYTE},
+    };
+    enum { header_column_count = sizeof(header_columns)/sizeof(header_columns[0]) };
+    struct test_cell header_cells[header_column_count];
+    long header_size;
+
+    memset(header_cells, 0, sizeof(header_cells));
+    header_cells[0].number = content_offset;
+    header_cells[1].number = content_end - content_offset;
+    header_cells[2].number = toc_offset;
+    header_cells[3].number = toc_size + 0x10;
+    header_cells[4].number = 0;
+    header_cells[5].number = file_count;
+    header_cells[6].number = 7;
+    header_cells[7].number = align;
+    unsigned char *header = build_utf("CpkHeader", header_columns, header_column_count,
+            header_cells, 1, &header_size);
+    CHECK_ERROR(0x10 + header_size > toc_offset, "CpkHeader too big");
+
+    FILE *outfile = fopen(argv[1], "wb");
+    CHECK_ERRNO(!outfile, "fopen");
+
+    write_chunk(outfile, 0, "CPK ", header, header_size);
+    write_chunk(outfile, toc_offset, "TOC ", toc, toc_size);
+
+    for (int i = 0; i < file_count; i++)
+    {
+        unsigned char *data = malloc(stored_sizes[i]);
+        CHECK_ERRNO(!data, "malloc");
+        memcpy(data, stored[i], stored_sizes[i]);
+        if (variant->data_crypt)
+        {
+            cri_crypt(variant, data, stored_sizes[i], variant->crypt_start);
+        }
+        put_bytes_seek(file_offsets[i], outfile, data, stored_sizes[i]);
+        free(data);
+
+        write_expected(argv[2], dir_names[i], names[i], contents[i], sizes[i]);
+    }
+
+    /* pad out the last file */
+    {
+        const unsigned char zero = 0;
+        put_bytes_seek(content_end - 1, outfile, &zero, 1);
+    }
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+
+    if (variant->utf_crypt)
+    {
+        printf("s=%02x m=%02x\n", (unsigned int)variant->crypt_start,
+                (unsigned int)variant->crypt_mult);
+    }
+
+    for (int i = 0; i < file_count; i++)
+    {
+        if (stored[i] != contents[i]) free(stored[i]);
+        free(contents[i]);
+    }
+    free(toc);
+    free(header);
+
+    exit(EXIT_SUCCESS);
+}
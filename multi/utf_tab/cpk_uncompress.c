@@ -1,5 +1,6 @@
 #include <stdio.h>
 
+#include "byte_source.h"
 #include "cpk_uncompress.h"
 #include "util.h"
 #include "error_stuff.h"
@@ -8,8 +9,6 @@ const uint64_t CRILAYLA_sig = UINT64_C(0x4352494C41594C41);
 
 // Decompress compressed segments in CRI CPK filesystems
 
-long uncompress(FILE *infile, long offset, long size, FILE *outfile);
-
 #if 0
 int main(int argc, char **argv)
 {
@@ -18,22 +17,14 @@ int main(int argc, char **argv)
         fprintf(stderr,"Incorrect program usage\n\nusage: %s input output\n",argv[0]);
 
     /* open input file */
-    FILE *infile = fopen(argv[1], "rb");
-    CHECK_ERRNO(!infile, "fopen input");
+    struct byte_source *src = open_byte_source(argv[1]);
 
     /* open output file */
     FILE *outfile = fopen(argv[2], "w+b");
     CHECK_ERRNO(!outfile, "fopen output");
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0, SEEK_END) != 0, "fseek");
-    const long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
-
-    rewind(infile);
-
     long uncompressed_size = 
-        uncompress(infile, 0, file_length, outfile);
+        uncompress(src, 0, src->size, outfile);
 
     CHECK_ERROR( uncompressed_size < 0,
         "uncompress failed");
@@ -43,7 +34,7 @@ int main(int argc, char **argv)
 #endif
 
 // only for up to 16 bits
-static inline uint16_t get_next_bits(FILE *infile, long * const offset_p, uint8_t * const bit_pool_p, int * const bits_left_p, const int bit_count)
+static inline uint16_t get_next_bits(const unsigned char *input, long * const offset_p, uint8_t * const bit_pool_p, int * const bits_left_p, const int bit_count)
 {
     uint16_t out_bits = 0;
     int num_bits_produced = 0;
@@ -51,7 +42,8 @@ static inline uint16_t get_next_bits(FILE *infile, long * const offset_p, uint8_
     {
         if (0 == *bits_left_p)
         {
-            *bit_pool_p = get_byte_seek(*offset_p, infile);
+            CHECK_ERROR(*offset_p < 0, "compressed data underrun");
+            *bit_pool_p = input[*offset_p];
             *bits_left_p = 8;
             --*offset_p;
         }
@@ -74,31 +66,35 @@ static inline uint16_t get_next_bits(FILE *infile, long * const offset_p, uint8_
     return out_bits;
 }
 
-#define GET_NEXT_BITS(bit_count) get_next_bits(infile, &input_offset, &bit_pool, &bits_left, bit_count)
+#define GET_NEXT_BITS(bit_count) get_next_bits(input, &input_offset, &bit_pool, &bits_left, bit_count)
 
-long uncompress(FILE *infile, long offset, long input_size, FILE *outfile)
+long uncompress(struct byte_source *src, long offset, long input_size, FILE *outfile)
 {
     unsigned char *output_buffer = NULL;
+
+    CHECK_ERROR( input_size < 0x110, "compressed data too small");
+    const unsigned char * const input = source_get(src, offset, input_size);
+
     CHECK_ERROR( !(
-          (get_32_le_seek(offset+0x00, infile) == 0 &&
-           get_32_le_seek(offset+0x04, infile) == 0) ||
-          (get_64_be_seek(offset+0x00, infile) == CRILAYLA_sig)
+          (read_32_le(input+0x00) == 0 &&
+           read_32_le(input+0x04) == 0) ||
+          (read_64_be(input+0x00) == CRILAYLA_sig)
         ), "didn't find 0 or CRILAYLA signature for compressed data");
 
     const long uncompressed_size = 
-        get_32_le_seek(offset+0x08, infile);
+        read_32_le(input+0x08);
 
     const long uncompressed_header_offset =
-        offset + get_32_le_seek(offset+0x0C, infile)+0x10;
+        read_32_le(input+0x0C)+0x10;
 
-    CHECK_ERROR( uncompressed_header_offset + 0x100 != offset + input_size, "size mismatch");
+    CHECK_ERROR( uncompressed_header_offset + 0x100 != input_size, "size mismatch");
 
     output_buffer = malloc(uncompressed_size + 0x100);
     CHECK_ERROR(!output_buffer, "malloc");
 
-    get_bytes_seek(uncompressed_header_offset, infile, output_buffer, 0x100);
+    memcpy(output_buffer, input + uncompressed_header_offset, 0x100);
 
-    const long input_end = offset + input_size - 0x100 - 1;
+    const long input_end = input_size - 0x100 - 1;
     long input_offset = input_end;
     const long output_end = 0x100 + uncompressed_size - 1;
     uint8_t bit_pool = 0;
@@ -134,6 +130,8 @@ long uncompress(FILE *infile, long offset, long input_size, FILE *outfile)
             }
 
             //printf("0x%08lx backreference to 0x%lx, length 0x%lx\n", output_end-bytes_output, backreference_offset, backreference_length);
+            CHECK_ERROR(backreference_offset > output_end, "backreference out of range");
+            CHECK_ERROR(backreference_length > uncompressed_size - bytes_output, "backreference past start of output");
             for (int i=0;i<backreference_length;i++)
             {
                 output_buffer[output_end-bytes_output] = output_buffer[backreference_offset--];
@@ -154,3 +152,182 @@ long uncompress(FILE *infile, long offset, long input_size, FILE *outfile)
 
     return 0x100 + bytes_output;
 }
+
+/* Fast decoder
+
+   The bitstream is read backwards from the end of the compressed data,
+   most significant bit first, so the reader keeps the next bits at the
+   top of a 64-bit buffer and refills it a whole word at a time. */
+
+struct backward_bit_reader
+{
+    const unsigned char *input;
+    long pos;       /* next byte to load, counting down */
+    uint64_t bits;  /* left aligned */
+    int count;
+};
+
+static inline void bit_refill(struct backward_bit_reader * const r)
+{
+    if (r->pos >= 7)
+    {
+        /* input[pos] lands in the top byte, bits past count are just
+           the following bytes, which later refills will OR in again */
+        const unsigned char * const p = r->input + r->pos - 7;
+        const uint64_t word =
+            ((uint64_t)p[7] << 56) | ((uint64_t)p[6] << 48) |
+            ((uint64_t)p[5] << 40) | ((uint64_t)p[4] << 32) |
+            ((uint64_t)p[3] << 24) | ((uint64_t)p[2] << 16) |
+            ((uint64_t)p[1] << 8)  |  (uint64_t)p[0];
+
+        r->bits |= word >> r->count;
+        r->pos -= (63 - r->count) >> 3;
+        r->count |= 56;
+    }
+    else
+    {
+        while (r->count <= 56 && r->pos >= 0)
+        {
+            r->bits |= (uint64_t)r->input[r->pos--] << (56 - r->count);
+            r->count += 8;
+        }
+    }
+}
+
+/* only for up to 32 bits */
+static inline uint32_t bit_peek(const struct backward_bit_reader * const r, const int bit_count)
+{
+    return (uint32_t)(r->bits >> (64 - bit_count));
+}
+
+static inline void bit_skip(struct backward_bit_reader * const r, const int bit_count)
+{
+    CHECK_ERROR(r->count < bit_count, "compressed data underrun");
+    r->bits <<= bit_count;
+    r->count -= bit_count;
+}
+
+/* Backreference length codes, indexed by the 2+3+5 bits following the
+   offset: (length-3) << 4 | bits used. 41 means more 8 bit levels follow. */
+#define VLE_ENTRY(x) ( \
+    ((x) >> 8) < 3 ? ((((x) >> 8) << 4) | 2) : \
+    (((x) >> 5) & 7) < 7 ? (((3 + (((x) >> 5) & 7)) << 4) | 5) : \
+    (((10 + ((x) & 31)) << 4) | 10) )
+#define VLE_ENTRY4(x) VLE_ENTRY(x), VLE_ENTRY((x)+1), VLE_ENTRY((x)+2), VLE_ENTRY((x)+3)
+#define VLE_ENTRY16(x) VLE_ENTRY4(x), VLE_ENTRY4((x)+4), VLE_ENTRY4((x)+8), VLE_ENTRY4((x)+12)
+#define VLE_ENTRY64(x) VLE_ENTRY16(x), VLE_ENTRY16((x)+16), VLE_ENTRY16((x)+32), VLE_ENTRY16((x)+48)
+#define VLE_ENTRY256(x) VLE_ENTRY64(x), VLE_ENTRY64((x)+64), VLE_ENTRY64((x)+128), VLE_ENTRY64((x)+192)
+
+static const uint16_t vle_table[1024] = {
+    VLE_ENTRY256(0), VLE_ENTRY256(256), VLE_ENTRY256(512), VLE_ENTRY256(768)
+};
+
+enum { vle_continue = 41 };
+
+long uncompress_memory(const unsigned char *input, long input_size, unsigned char **output)
+{
+    unsigned char *output_buffer = NULL;
+
+    CHECK_ERROR( input_size < 0x110, "compressed data too small");
+    CHECK_ERROR( !(
+          (read_32_le(input+0x00) == 0 &&
+           read_32_le(input+0x04) == 0) ||
+          (read_64_be(input+0x00) == CRILAYLA_sig)
+        ), "didn't find 0 or CRILAYLA signature for compressed data");
+
+    const long uncompressed_size = read_32_le(input+0x08);
+    const long uncompressed_header_offset = read_32_le(input+0x0C)+0x10;
+
+    CHECK_ERROR( uncompressed_header_offset + 0x100 != input_size, "size mismatch");
+
+    output_buffer = malloc(uncompressed_size + 0x100);
+    CHECK_ERROR(!output_buffer, "malloc");
+
+    memcpy(output_buffer, input + uncompressed_header_offset, 0x100);
+
+    struct backward_bit_reader r;
+    r.input = input;
+    r.pos = input_size - 0x100 - 1;
+    r.bits = 0;
+    r.count = 0;
+
+    const long output_end = 0x100 + uncompressed_size - 1;
+    long out_pos = output_end;
+
+    while (out_pos >= 0x100)
+    {
+        bit_refill(&r);
+
+        if (bit_peek(&r, 1))
+        {
+            /* flag, 13 bit offset, first three length levels */
+            const uint32_t code = bit_peek(&r, 24);
+            const uint16_t vle = vle_table[code & 0x3ff];
+            const long backreference_distance = ((code >> 10) & 0x1fff) + 3;
+            long backreference_length = 3 + (vle >> 4);
+
+            bit_skip(&r, 14 + (vle & 0xf));
+
+            if ((vle >> 4) == vle_continue)
+            {
+                uint32_t this_level;
+                do
+                {
+                    bit_refill(&r);
+                    this_level = bit_peek(&r, 8);
+                    bit_skip(&r, 8);
+                    backreference_length += this_level;
+                } while (this_level == 255);
+            }
+
+            CHECK_ERROR(out_pos + backreference_distance > output_end, "backreference out of range");
+            CHECK_ERROR(backreference_length > out_pos - 0x100 + 1, "backreference past start of output");
+
+            /* copy downwards, the source is above the destination */
+            unsigned char *dst = output_buffer + out_pos;
+            const unsigned char *src = dst + backreference_distance;
+            long left = backreference_length;
+
+            if (backreference_distance >= 8)
+            {
+                /* a whole word back is always already written */
+                while (left >= 8)
+                {
+                    memcpy(dst - 7, src - 7, 8);
+                    dst -= 8;
+                    src -= 8;
+                    left -= 8;
+                }
+            }
+            while (left > 0)
+            {
+                *dst-- = *src--;
+                left--;
+            }
+
+            out_pos -= backreference_length;
+        }
+        else
+        {
+            // verbatim byte
+            output_buffer[out_pos--] = bit_peek(&r, 9) & 0xff;
+            bit_skip(&r, 9);
+        }
+    }
+
+    *output = output_buffer;
+
+    return 0x100 + uncompressed_size;
+}
+
+long uncompress_fast(struct byte_source *src, long offset, long input_size, FILE *outfile)
+{
+    unsigned char *output_buffer = NULL;
+    const long output_size = uncompress_memory(
+            source_get(src, offset, input_size), input_size, &output_buffer);
+
+    put_bytes_seek(0, outfile, output_buffer, output_size);
+    free(output_buffer);
+
+    return output_size;
+}
@@ -3,6 +3,15 @@
 
 #include <stdio.h>
 
-long uncompress(FILE *infile, long offset, long size, FILE *outfile);
+#include "byte_source.h"
+
+/* Both return the total uncompressed size, including the 0x100 byte
+   uncompressed header. uncompress is the straightforward reference
+   decoder, uncompress_fast produces the same output much faster. */
+long uncompress(struct byte_source *src, long offset, long size, FILE *outfile);
+long uncompress_fast(struct byte_source *src, long offset, long size, FILE *outfile);
+
+/* in-memory decode, *output is malloc'd */
+long uncompress_memory(const unsigned char *input, long input_size, unsigned char **output);
 
 #endif
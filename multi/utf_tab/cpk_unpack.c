@@ -1,153 +1,708 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <limits.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
 #include "utf_tab.h"
 #include "cpk_uncompress.h"
+#include "cri_variant.h"
+#include "cpk_index.h"
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CPK(FILE *infile, const char *base_name, long file_length);
+void analyze_CPK(struct byte_source *src, const char *base_name, long file_length,
+        int jobs, int list, const char *pattern);
+
+void usage(const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr,"Incorrect program usage\n\nusage: %s [-j threads] [--list | --extract pattern] file\n\n"
+            "--list            : list files without extracting\n"
+            "--extract pattern : only extract files whose dir/name matches,\n"
+            "                    * matches anything, ? any one character\n"
+            "With --list or --extract the file list is kept in file.idx for next time.\n",name);
+    exit(EXIT_FAILURE);
+}
 
 int main(int argc, char **argv)
 {
+    int jobs = 1;
+    int list = 0;
+    const char *pattern = NULL;
+    int argi = 1;
+
     printf("cpk_unpack " VERSION "\n\n");
-    if (argc != 2)
+
+    while (argi < argc - 1)
     {
-        fprintf(stderr,"Incorrect program usage\n\nusage: %s file\n",argv[0]);
-        exit(EXIT_FAILURE);
+        if (!strcmp(argv[argi], "-j") && argi + 1 < argc - 1)
+        {
+            jobs = read_long(argv[argi+1]);
+            CHECK_ERROR(jobs < 1, "thread count must be at least 1");
+            argi += 2;
+        }
+        else if (!strcmp(argv[argi], "--list"))
+        {
+            list = 1;
+            argi ++;
+        }
+        else if (!strcmp(argv[argi], "--extract") && argi + 1 < argc - 1)
+        {
+            pattern = argv[argi+1];
+            argi += 2;
+        }
+        else
+        {
+            usage(argv[0]);
+        }
+    }
+    if (argi != argc - 1 || (list && pattern))
+    {
+        usage(argv[0]);
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
-    CHECK_ERRNO(!infile, "fopen");
+    struct byte_source *src = open_byte_source(argv[argi]);
 
     const char *base_postfix = "_unpacked";
-    char *base_name = malloc(strlen(argv[1])+strlen(base_postfix)+1);
+    char *base_name = malloc(strlen(argv[argi])+strlen(base_postfix)+1);
     CHECK_ERRNO(!base_name, "malloc");
-    strcpy(base_name, strip_path(argv[1]));
+    strcpy(base_name, strip_path(argv[argi]));
     strcat(base_name, base_postfix);
 
     /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
-
-    rewind(infile);
+    long file_length = src->size;
 
-    analyze_CPK(infile, base_name, file_length);
+    analyze_CPK(src, base_name, file_length, jobs, list, pattern);
 
     free(base_name);
 
+    close_byte_source(src);
+
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CPK(FILE *infile, const char *base_name, long file_length)
+/* data encrypted from the start of the file, decrypt a copy */
+static void extract_encrypted(struct byte_source *src, struct cpk_entry *e, FILE *outfile)
 {
-    const long CpkHeader_offset = 0x0;
-    char *toc_string_table = NULL;
+    const struct cri_variant * const variant = cri_variant();
+    unsigned char *data = malloc(e->file_size);
+    CHECK_ERRNO(!data, "malloc");
 
-    /* check header */
+    source_get_bytes(src, e->file_offset, data, e->file_size);
+    cri_crypt(variant, data, e->file_size, variant->crypt_start);
+
+    if (e->extract_size > e->file_size)
     {
-        unsigned char buf[4];
-        static const char CPK_signature[4] = "CPK "; /* intentionally unterminated */
-        get_bytes_seek(CpkHeader_offset, infile, buf, 4);
-        CHECK_ERROR (memcmp(buf, CPK_signature, sizeof(CPK_signature)), "CPK signature not found");
+        unsigned char *output = NULL;
+        e->uncompressed_size = uncompress_memory(data, e->file_size, &output);
+        put_bytes(outfile, output, e->uncompressed_size);
+        free(output);
+    }
+    else
+    {
+        put_bytes(outfile, data, e->file_size);
     }
 
-    /* check CpkHeader */
+    free(data);
+}
+
+static void extract_entry(struct byte_source *src, struct cpk_entry *e, FILE *outfile)
+{
+    if (cri_variant()->data_crypt)
     {
-        struct utf_query_result result = query_utf_nofail(infile, CpkHeader_offset+0x10, NULL);
+        extract_encrypted(src, e, outfile);
+    }
+    else if (e->extract_size > e->file_size)
+    {
+        e->uncompressed_size =
+            uncompress_fast(src, e->file_offset, e->file_size, outfile);
+    }
+    else
+    {
+        source_dump(src, outfile, e->file_offset, e->file_size);
+    }
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+}
 
-        CHECK_ERROR (result.rows != 1, "wrong number of rows in CpkHeader");
+static void print_entry(const struct cpk_entry *e)
+{
+    if (e->dir_name)
+    {
+        printf("%s/%s 0x%lx %ld\n",
+                e->dir_name, e->file_name, (unsigned long)e->file_offset, e->file_size);
     }
+    else
+    {
+        printf("%s 0x%lx %ld\n",
+                e->file_name, (unsigned long)e->file_offset, e->file_size);
+    }
+}
 
-    /* get TOC offset */
-    long toc_offset = query_utf_8byte(infile, CpkHeader_offset+0x10, 0, "TocOffset");
+static void print_uncompressed(const struct cpk_entry *e)
+{
+    if (e->extract_size > e->file_size)
+    {
+        printf("   uncompressed to %ld\n", e->uncompressed_size);
 
-    /* get content offset */
-    long content_offset = query_utf_8byte(infile, CpkHeader_offset+0x10, 0, "ContentOffset");
+        CHECK_ERROR( e->uncompressed_size != e->extract_size ,
+                "uncompressed size != ExtractSize");
+    }
+}
 
-    /* get file count from CpkHeader */
-    long CpkHeader_count = query_utf_4byte(infile, CpkHeader_offset+0x10, 0, "Files");
+#ifndef __MINGW32__
+struct extract_pool
+{
+    struct byte_source *src;
+    struct cpk_entry *entries;
+    long entry_count;
+
+    pthread_mutex_t lock;
+    pthread_cond_t entry_done;
+    long next_entry;
+};
+
+static void *extract_worker(void *arg)
+{
+    struct extract_pool * const pool = arg;
+    struct byte_source * const src = clone_byte_source(pool->src);
+
+    for (;;)
+    {
+        long i;
+
+        CHECK_ERROR(pthread_mutex_lock(&pool->lock) != 0, "pthread_mutex_lock");
+        i = pool->next_entry++;
+        CHECK_ERROR(pthread_mutex_unlock(&pool->lock) != 0, "pthread_mutex_unlock");
+
+        if (i >= pool->entry_count) break;
+
+        struct cpk_entry * const e = &pool->entries[i];
+        FILE *outfile;
+        if (e->superseded)
+        {
+            /* still extract so it is checked and reported the same */
+            outfile = tmpfile();
+            CHECK_ERRNO(!outfile, "tmpfile");
+        }
+        else
+        {
+            outfile = fopen(e->path, "w+b");
+            CHECK_ERRNO(!outfile, "fopen");
+        }
+        extract_entry(src, e, outfile);
+
+        CHECK_ERROR(pthread_mutex_lock(&pool->lock) != 0, "pthread_mutex_lock");
+        e->done = 1;
+        CHECK_ERROR(pthread_cond_broadcast(&pool->entry_done) != 0, "pthread_cond_broadcast");
+        CHECK_ERROR(pthread_mutex_unlock(&pool->lock) != 0, "pthread_mutex_unlock");
+    }
+
+    close_byte_source(src);
+
+    return NULL;
+}
+
+static int compare_entry_paths(const void *a, const void *b)
+{
+    const struct cpk_entry * const ea = *(const struct cpk_entry * const *)a;
+    const struct cpk_entry * const eb = *(const struct cpk_entry * const *)b;
+    const int rc = strcmp(ea->path, eb->path);
+
+    if (rc) return rc;
+    return (ea > eb) - (ea < eb);
+}
+
+/* Workers take entries in TOC order, the main thread reports them in the
+   same order as they finish. All directories are created up front, and
+   where a path repeats only the last entry is written out, as the serial
+   run would leave it. */
+static void extract_parallel(struct byte_source *src, const char *base_name,
+        struct cpk_entry *entries, long entry_count, int jobs)
+{
+    struct extract_pool pool;
+    pthread_t *threads;
+
+    /* create directories */
+    for (long i = 0; i < entry_count; i++)
+    {
+        entries[i].path = make_path_in_directory(base_name,
+                entries[i].dir_name, '/', entries[i].file_name);
+        CHECK_ERRNO(!entries[i].path, "malloc");
+    }
+
+    /* find repeated paths */
+    {
+        struct cpk_entry **sorted = malloc(sizeof(struct cpk_entry *) * (entry_count+1));
+        CHECK_ERRNO(!sorted, "malloc");
+
+        for (long i = 0; i < entry_count; i++)
+        {
+            sorted[i] = &entries[i];
+        }
+        qsort(sorted, entry_count, sizeof(struct cpk_entry *), compare_entry_paths);
+        for (long i = 0; i + 1 < entry_count; i++)
+        {
+            if (!strcmp(sorted[i]->path, sorted[i+1]->path))
+            {
+                sorted[i]->superseded = 1;
+            }
+        }
+
+        free(sorted);
+    }
+
+    pool.src = src;
+    pool.entries = entries;
+    pool.entry_count = entry_count;
+    pool.next_entry = 0;
+    CHECK_ERROR(pthread_mutex_init(&pool.lock, NULL) != 0, "pthread_mutex_init");
+    CHECK_ERROR(pthread_cond_init(&pool.entry_done, NULL) != 0, "pthread_cond_init");
+
+    threads = malloc(sizeof(pthread_t) * jobs);
+    CHECK_ERRNO(!threads, "malloc");
+    for (int i = 0; i < jobs; i++)
+    {
+        CHECK_ERROR(pthread_create(&threads[i], NULL, extract_worker, &pool) != 0,
+                "pthread_create");
+    }
+
+    /* report in order */
+    for (long i = 0; i < entry_count; i++)
+    {
+        CHECK_ERROR(pthread_mutex_lock(&pool.lock) != 0, "pthread_mutex_lock");
+        while (!entries[i].done)
+        {
+            CHECK_ERROR(pthread_cond_wait(&pool.entry_done, &pool.lock) != 0,
+                    "pthread_cond_wait");
+        }
+        CHECK_ERROR(pthread_mutex_unlock(&pool.lock) != 0, "pthread_mutex_unlock");
+
+        print_entry(&entries[i]);
+        print_uncompressed(&entries[i]);
+    }
+
+    for (int i = 0; i < jobs; i++)
+    {
+        CHECK_ERROR(pthread_join(threads[i], NULL) != 0, "pthread_join");
+    }
+    free(threads);
+
+    pthread_cond_destroy(&pool.entry_done);
+    pthread_mutex_destroy(&pool.lock);
+
+    for (long i = 0; i < entry_count; i++)
+    {
+        free(entries[i].path);
+    }
+}
+#endif
+
+/* Files listed in a TOC, with names. toc must stay loaded while the
+   entries are in use. */
+static struct cpk_entry *load_toc_entries(struct byte_source *src,
+        long toc_offset, long content_offset, long CpkHeader_count,
+        struct utf_table **toc_p, long *entry_count_p)
+{
+    struct utf_table *toc;
 
     /* check TOC header */
     {
-        unsigned char buf[4];
         static const char TOC_signature[4] = "TOC "; /* intentionally unterminated */
-        get_bytes_seek(toc_offset, infile, buf, 4);
+        const unsigned char *buf = source_get(src, toc_offset, 4);
         CHECK_ERROR (memcmp(buf, TOC_signature, sizeof(TOC_signature)), "TOC signature not found");
     }
 
-    /* get TOC entry count, string table */
-    long toc_entries;
+    /* load TOC */
+    toc = load_utf_table_nofail(src, toc_offset+0x10);
+    long toc_entries = toc->rows;
+
+    /* check that counts match */
+    CHECK_ERROR( toc_entries != CpkHeader_count, "CpkHeader file count and TOC entry count do not match" );
+
+    const int FileName_column = utf_column_index_nofail(toc, "FileName");
+    const int DirName_column = utf_column_index_nofail(toc, "DirName");
+    const int FileSize_column = utf_column_index_nofail(toc, "FileSize");
+    const int ExtractSize_column = utf_column_index_nofail(toc, "ExtractSize");
+    const int FileOffset_column = utf_column_index_nofail(toc, "FileOffset");
+
+    /* resolve the whole TOC */
+    struct cpk_entry *entries = malloc(sizeof(struct cpk_entry) * (toc_entries+1));
+    CHECK_ERRNO(!entries, "malloc");
+    memset(entries, 0, sizeof(struct cpk_entry) * (toc_entries+1));
+
+    /* decode the columns whole */
+    uint32_t *file_names = malloc(sizeof(uint32_t) * (toc_entries+1));
+    uint32_t *dir_names = malloc(sizeof(uint32_t) * (toc_entries+1));
+    uint32_t *file_sizes = malloc(sizeof(uint32_t) * (toc_entries+1));
+    uint32_t *extract_sizes = malloc(sizeof(uint32_t) * (toc_entries+1));
+    uint64_t *file_offsets = malloc(sizeof(uint64_t) * (toc_entries+1));
+    CHECK_ERRNO(!file_names || !dir_names || !file_sizes ||
+            !extract_sizes || !file_offsets, "malloc");
+
+    utf_table_column_string(toc, FileName_column, file_names);
+    utf_table_column_string(toc, DirName_column, dir_names);
+    utf_table_column_4byte(toc, FileSize_column, file_sizes);
+    utf_table_column_4byte(toc, ExtractSize_column, extract_sizes);
+    utf_table_column_8byte(toc, FileOffset_column, file_offsets);
+
+    const uint64_t offset_base = content_offset < toc_offset ? content_offset : toc_offset;
+
+    for (long i = 0; i < toc_entries; i++)
     {
-        struct utf_query_result result = query_utf_nofail(infile, toc_offset+0x10, NULL);
+        struct cpk_entry * const e = &entries[i];
 
-        toc_entries = result.rows;
-        toc_string_table = load_utf_string_table(infile, toc_offset+0x10);
+        e->file_name = toc->string_table + file_names[i];
+        e->dir_name = toc->string_table + dir_names[i];
+        e->file_size = file_sizes[i];
+        e->extract_size = extract_sizes[i];
+
+        uint64_t file_offset_raw = file_offsets[i] + offset_base;
+        CHECK_ERROR( file_offset_raw > LONG_MAX, "File offset too large, will be unable to seek" );
+        e->file_offset = file_offset_raw;
     }
 
-    /* check that counts match */
-    CHECK_ERROR( toc_entries != CpkHeader_count, "CpkHeader file count and TOC entry count do not match" );
+    free(file_names);
+    free(dir_names);
+    free(file_sizes);
+    free(extract_sizes);
+    free(file_offsets);
 
-    /* extract files */
-    for (int i = 0; i < toc_entries; i++)
+    *toc_p = toc;
+    *entry_count_p = toc_entries;
+
+    return entries;
+}
+
+/* Files listed in an ITOC, which only has IDs and sizes, split into
+   DataL (16-bit sizes) and DataH (32-bit sizes) tables that are each in
+   ID order. The files are packed in ID order from the content offset. */
+static struct cpk_entry *load_itoc_entries(struct byte_source *src,
+        long itoc_offset, long content_offset, long align, long CpkHeader_count,
+        long *entry_count_p)
+{
+    const struct cri_variant * const variant = cri_variant();
+    struct utf_table *itoc, *datal, *datah;
+    long itoc_filesl, itoc_filesh;
+
+    /* check ITOC header */
     {
-        /* get file name */
-        const char *file_name = query_utf_string(infile, toc_offset+0x10, i,
-                "FileName", toc_string_table);
+        static const char ITOC_signature[4] = "ITOC"; /* intentionally unterminated */
+        const unsigned char *buf = source_get(src, itoc_offset, 4);
+        CHECK_ERROR (memcmp(buf, ITOC_signature, sizeof(ITOC_signature)), "ITOC signature not found");
+    }
+
+    /* get ITOC info */
+    itoc = load_utf_table_nofail(src, itoc_offset+0x10);
+    CHECK_ERROR( itoc->rows != 1, "Expected 1 ITOC entry" );
+
+    itoc_filesl = utf_table_4byte(itoc, 0, utf_column_index_nofail(itoc, "FilesL"));
+    itoc_filesh = utf_table_4byte(itoc, 0, utf_column_index_nofail(itoc, "FilesH"));
+    CHECK_ERROR( itoc_filesl + itoc_filesh != CpkHeader_count, "CpkHeader file count and ITOC file counts do not match" );
+
+    datal = load_utf_table_data(itoc, 0, utf_column_index_nofail(itoc, "DataL"));
+    datah = load_utf_table_data(itoc, 0, utf_column_index_nofail(itoc, "DataH"));
+    CHECK_ERROR( (datal ? datal->rows : 0) != itoc_filesl, "FilesL count does not match DataL rows");
+    CHECK_ERROR( (datah ? datah->rows : 0) != itoc_filesh, "FilesH count does not match DataH rows");
+
+    const int datal_ID = datal ? utf_column_index_nofail(datal, "ID") : -1;
+    const int datal_FileSize = datal ? utf_column_index_nofail(datal, "FileSize") : -1;
+    const int datal_ExtractSize = datal ? utf_column_index_nofail(datal, "ExtractSize") : -1;
+    const int datah_ID = datah ? utf_column_index_nofail(datah, "ID") : -1;
+    const int datah_FileSize = datah ? utf_column_index_nofail(datah, "FileSize") : -1;
+    const int datah_ExtractSize = datah ? utf_column_index_nofail(datah, "ExtractSize") : -1;
 
-        /* get directory name */
-        const char *dir_name = query_utf_string(infile, toc_offset+0x10, i,
-                "DirName", toc_string_table);
+    struct cpk_entry *entries = malloc(sizeof(struct cpk_entry) * (CpkHeader_count+1));
+    CHECK_ERRNO(!entries, "malloc");
+    memset(entries, 0, sizeof(struct cpk_entry) * (CpkHeader_count+1));
 
-        /* get file size */
-        long file_size = query_utf_4byte(infile, toc_offset+0x10, i,
-                "FileSize");
+    /* merge DataL and DataH by ID */
+    long file_offset = content_offset;
+    for (long i = 0, datal_i = 0, datah_i = 0; i < CpkHeader_count; i++)
+    {
+        struct cpk_entry * const e = &entries[i];
+        long next_l_id = -1, next_h_id = -1;
+        unsigned int id;
 
-        /* get extract size */
-        long extract_size = query_utf_4byte(infile, toc_offset+0x10, i,
-                "ExtractSize");
+        if (datal_i < itoc_filesl)
+        {
+            next_l_id = utf_table_2byte(datal, datal_i, datal_ID);
+        }
+        if (datah_i < itoc_filesh)
+        {
+            next_h_id = utf_table_2byte(datah, datah_i, datah_ID);
+        }
+        CHECK_ERROR(next_l_id != -1 && next_l_id == next_h_id,
+                "both DataL and DataH have the same ID");
 
-        /* get file offset */
-        uint64_t file_offset_raw = 
-            query_utf_8byte(infile, toc_offset+0x10, i, "FileOffset");
-        if (content_offset < toc_offset)
+        /* get file and extract size */
+        if (next_h_id == -1 || (next_l_id != -1 && next_l_id < next_h_id))
         {
-            file_offset_raw += content_offset;
+            /* L is 2 byte sizes */
+            e->file_size = utf_table_2byte(datal, datal_i, datal_FileSize);
+            e->extract_size = utf_table_2byte(datal, datal_i, datal_ExtractSize);
+            datal_i ++;
+
+            id = next_l_id;
         }
         else
         {
-            file_offset_raw += toc_offset;
+            e->file_size = utf_table_4byte(datah, datah_i, datah_FileSize);
+            e->extract_size = utf_table_4byte(datah, datah_i, datah_ExtractSize);
+            datah_i ++;
+
+            id = next_h_id;
         }
 
-        CHECK_ERROR( file_offset_raw > LONG_MAX, "File offset too large, will be unable to seek" );
-        long file_offset = file_offset_raw;
+        if (variant->itoc_sparse)
+        {
+            e->file_name_buffer = number_name("", ".bin", id, UINT16_MAX);
+        }
+        else
+        {
+            CHECK_ERROR(id != (unsigned long)i, "neither DataL nor DataH have the next ID");
+            e->file_name_buffer = number_name("", ".bin", id, CpkHeader_count);
+        }
+        e->file_name = e->file_name_buffer;
+        e->file_offset = file_offset;
 
-        printf("%s/%s 0x%lx %ld\n",
-                dir_name, file_name, (unsigned long)file_offset, file_size);
-        FILE *outfile = open_file_in_directory(base_name, dir_name, '/', file_name, "w+b");
-        CHECK_ERRNO(!outfile, "fopen");
+        if (align != 0)
+        {
+            file_offset += (e->file_size + align-1)/align*align;
+        }
+        else
+        {
+            file_offset += e->file_size;
+        }
+    }
 
-        if (extract_size > file_size)
+    free_utf_table(datah);
+    free_utf_table(datal);
+    free_utf_table(itoc);
+
+    *entry_count_p = CpkHeader_count;
+
+    return entries;
+}
+
+static void list_entries(const struct cpk_entry *entries, long entry_count)
+{
+    for (long i = 0; i < entry_count; i++)
+    {
+        const struct cpk_entry * const e = &entries[i];
+
+        if (e->dir_name)
+        {
+            printf("%s/", e->dir_name);
+        }
+        printf("%s 0x%lx %ld", e->file_name, (unsigned long)e->file_offset, e->file_size);
+        if (e->extract_size > e->file_size)
+        {
+            printf(" uncompressed %ld", e->extract_size);
+        }
+        printf("\n");
+    }
+}
+
+/* copies of the entries whose dir/name matches, returns how many */
+static long select_entries(const struct cpk_entry *entries, long entry_count,
+        const char *pattern, struct cpk_entry **selected_p)
+{
+    struct cpk_entry *selected = malloc(sizeof(struct cpk_entry) * (entry_count+1));
+    CHECK_ERRNO(!selected, "malloc");
+    long selected_count = 0;
+
+    for (long i = 0; i < entry_count; i++)
+    {
+        const struct cpk_entry * const e = &entries[i];
+        int match;
+
+        if (e->dir_name && e->dir_name[0] != '\0')
         {
-            long uncompressed_size =
-                uncompress(infile, file_offset, file_size, outfile);
-            printf("   uncompressed to %ld\n", uncompressed_size);
-            
-            CHECK_ERROR( uncompressed_size != extract_size ,
-                    "uncompressed size != ExtractSize");
+            char *path = malloc(strlen(e->dir_name) + 1 + strlen(e->file_name) + 1);
+            CHECK_ERRNO(!path, "malloc");
+            sprintf(path, "%s/%s", e->dir_name, e->file_name);
+            match = glob_match(pattern, path);
+            free(path);
         }
         else
         {
-            dump(infile, outfile, file_offset, file_size);
+            match = glob_match(pattern, e->file_name);
+        }
+
+        if (match)
+        {
+            selected[selected_count] = *e;
+            /* the original keeps ownership */
+            selected[selected_count].file_name_buffer = NULL;
+            selected_count ++;
         }
-        CHECK_ERRNO(fclose(outfile) != 0, "fclose");
     }
 
-    if (toc_string_table)
+    *selected_p = selected;
+
+    return selected_count;
+}
+
+/* resolve the TOC or ITOC, toc must stay loaded while the entries are in use */
+static struct cpk_entry *read_cpk_entries(struct byte_source *src,
+        struct utf_table **toc_p, long *entry_count_p, int *from_itoc_p)
+{
+    const long CpkHeader_offset = 0x0;
+    struct utf_table *CpkHeader = NULL;
+    struct cpk_entry *entries;
+
+    /* check header */
     {
-        free_utf_string_table(toc_string_table);
-        toc_string_table = NULL;
+        static const char CPK_signature[4] = "CPK "; /* intentionally unterminated */
+        const unsigned char *buf = source_get(src, CpkHeader_offset, 4);
+        CHECK_ERROR (memcmp(buf, CPK_signature, sizeof(CPK_signature)), "CPK signature not found");
     }
+
+    /* check CpkHeader */
+    CpkHeader = load_utf_table_nofail(src, CpkHeader_offset+0x10);
+    CHECK_ERROR (CpkHeader->rows != 1, "wrong number of rows in CpkHeader");
+
+    /* get TOC offset */
+    long toc_offset = utf_table_8byte(CpkHeader, 0,
+            utf_column_index_nofail(CpkHeader, "TocOffset"));
+
+    /* without a TOC, try an ITOC */
+    long itoc_offset = 0;
+    if (toc_offset == 0)
+    {
+        const int ItocOffset_column = utf_column_index(CpkHeader, "ItocOffset");
+        if (ItocOffset_column >= 0)
+        {
+            itoc_offset = utf_table_8byte(CpkHeader, 0, ItocOffset_column);
+        }
+        CHECK_ERROR (itoc_offset == 0, "neither TOC nor ITOC offset found");
+    }
+
+    /* get content offset */
+    long content_offset = utf_table_8byte(CpkHeader, 0,
+            utf_column_index_nofail(CpkHeader, "ContentOffset"));
+
+    /* get file count from CpkHeader */
+    long CpkHeader_count = utf_table_4byte(CpkHeader, 0,
+            utf_column_index_nofail(CpkHeader, "Files"));
+
+    if (toc_offset)
+    {
+        entries = load_toc_entries(src, toc_offset, content_offset,
+                CpkHeader_count, toc_p, entry_count_p);
+        *from_itoc_p = 0;
+    }
+    else
+    {
+        /* get alignment */
+        long align = utf_table_2byte(CpkHeader, 0,
+                utf_column_index_nofail(CpkHeader, "Align"));
+
+        entries = load_itoc_entries(src, itoc_offset, content_offset,
+                align, CpkHeader_count, entry_count_p);
+        *from_itoc_p = 1;
+    }
+
+    free_utf_table(CpkHeader);
+
+    return entries;
+}
+
+void analyze_CPK(struct byte_source *src, const char *base_name, long file_length,
+        int jobs, int list, const char *pattern)
+{
+    struct utf_table *toc = NULL;
+    struct cpk_index *index = NULL;
+    struct cpk_entry *entries = NULL;
+    long entry_count = 0;
+    int from_itoc = 0;
+
+    /* a saved file list saves reading the TOC, but a full extract reads
+       everything anyway so don't leave one behind for it */
+    const int use_index = list || pattern;
+
+    if (use_index)
+    {
+        index = load_cpk_index(src);
+    }
+    if (index)
+    {
+        entries = index->entries;
+        entry_count = index->entry_count;
+        from_itoc = index->from_itoc;
+    }
+    else
+    {
+        entries = read_cpk_entries(src, &toc, &entry_count, &from_itoc);
+        if (use_index)
+        {
+            save_cpk_index(src, entries, entry_count, from_itoc);
+        }
+    }
+
+    if (from_itoc)
+    {
+        printf("Using ITOC, no names available\n\n");
+    }
+
+    struct cpk_entry *selected = entries;
+    long selected_count = entry_count;
+    if (list)
+    {
+        list_entries(entries, entry_count);
+        selected_count = 0;
+    }
+    else if (pattern)
+    {
+        selected_count = select_entries(entries, entry_count, pattern, &selected);
+        CHECK_ERROR(selected_count == 0, "no files match");
+    }
+
+    /* extract files */
+#ifndef __MINGW32__
+    if (jobs > 1)
+    {
+        extract_parallel(src, base_name, selected, selected_count, jobs);
+    }
+    else
+#endif
+    {
+        for (long i = 0; i < selected_count; i++)
+        {
+            struct cpk_entry * const e = &selected[i];
+
+            print_entry(e);
+            FILE *outfile = open_file_in_directory(base_name, e->dir_name, '/', e->file_name, "w+b");
+            CHECK_ERRNO(!outfile, "fopen");
+
+            extract_entry(src, e, outfile);
+            print_uncompressed(e);
+        }
+    }
+
+    if (selected != entries)
+    {
+        free(selected);
+    }
+
+    if (index)
+    {
+        free_cpk_index(index);
+    }
+    else
+    {
+        for (long i = 0; i < entry_count; i++)
+        {
+            free(entries[i].file_name_buffer);
+        }
+        free(entries);
+    }
+
+    free_utf_table(toc);
 }
@@ -0,0 +1,51 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "error_stuff.h"
+#include "cri_variant.h"
+
+#ifndef CRI_VARIANT
+#define CRI_VARIANT "standard"
+#endif
+
+static const struct cri_variant cri_variants[] =
+{
+    /* name         utf_crypt start mult  data_crypt itoc_sparse */
+    { "standard",   0,  0x00, 0x00,  0,  1 },
+    /* odin.head.cpk (Valkyria Chronicles 2), the file data looks random
+       either way, so it isn't clear if it should be decrypted */
+    { "07b4",       1,  0x5f, 0x15,  0,  0 },
+    { "07b4_data",  1,  0x5f, 0x15,  1,  0 },
+    /* over.cpk, only an ITOC */
+    { "07b5",       1,  0x5f, 0x15,  0,  0 },
+    /* se.awb, only an ITOC */
+    { "07b6",       0,  0x00, 0x00,  0,  0 },
+    /* UNION.CPK, sparsely populated ITOC */
+    { "07b7",       0,  0x00, 0x00,  0,  1 },
+};
+
+const struct cri_variant *cri_variant(void)
+{
+    for (size_t i = 0; i < sizeof(cri_variants)/sizeof(cri_variants[0]); i++)
+    {
+        if (!strcmp(cri_variants[i].name, CRI_VARIANT))
+        {
+            return &cri_variants[i];
+        }
+    }
+
+    CHECK_ERROR(1, "unknown variant " CRI_VARIANT);
+    return NULL;
+}
+
+uint8_t cri_crypt(const struct cri_variant *variant, unsigned char *bytes, size_t size, uint8_t key)
+{
+    for (size_t i = 0; i < size; i++)
+    {
+        bytes[i] ^= key;
+        key *= variant->crypt_mult;
+    }
+
+    return key;
+}
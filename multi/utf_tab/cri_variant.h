@@ -0,0 +1,32 @@
+#ifndef _CRI_VARIANT_H_INCLUDED
+#define _CRI_VARIANT_H_INCLUDED
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Some titles use slightly different formats. Instead of a separate copy
+   of the tools for each, the differences are described by a variant,
+   chosen at build time with make VARIANT=name (see cri_variant.c). */
+struct cri_variant
+{
+    const char *name;
+
+    /* @UTF tables are xor'd with a key that is crypt_start at the
+       signature and is multiplied by crypt_mult for each following byte */
+    int utf_crypt;
+    uint8_t crypt_start;
+    uint8_t crypt_mult;
+
+    /* CPK file data is xor'd the same way, from the start of each file */
+    int data_crypt;
+
+    /* ITOC IDs may skip numbers, otherwise they must count up from 0 */
+    int itoc_sparse;
+};
+
+const struct cri_variant *cri_variant(void);
+
+/* xor with the key stream starting at key, returns the key for the next byte */
+uint8_t cri_crypt(const struct cri_variant *variant, unsigned char *bytes, size_t size, uint8_t key);
+
+#endif /* _CRI_VARIANT_H_INCLUDED */
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "byte_source.h"
+#include "cpk_compress.h"
+#include "cpk_uncompress.h"
+#include "utf_tab.h"
+#include "util.h"
+#include "error_stuff.h"
+
+void usage(const char *name)
+{
+    fflush(stdout);
+    fprintf(stderr,"Incorrect program usage\n\nusage: %s [-1..-9] input output\n\n"
+            "-1 : fastest\n"
+            "-9 : smallest (default -%d)\n", name, CRILAYLA_DEFAULT_LEVEL);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    int level = CRILAYLA_DEFAULT_LEVEL;
+    int argi = 1;
+
+    printf("crilayla_compress " VERSION "\n\n");
+
+    if (argc == 4 && argv[1][0] == '-' &&
+        argv[1][1] >= '0' + CRILAYLA_MIN_LEVEL && argv[1][1] <= '0' + CRILAYLA_MAX_LEVEL &&
+        argv[1][2] == '\0')
+    {
+        level = argv[1][1] - '0';
+        argi = 2;
+    }
+    else if (argc != 3)
+    {
+        usage(argv[0]);
+    }
+
+    /* open input file */
+    struct byte_source *src = open_byte_source(argv[argi]);
+    const unsigned char *input = source_get(src, 0, src->size);
+
+    const clock_t start = clock();
+
+    unsigned char *compressed = NULL;
+    const long compressed_size =
+        crilayla_compress(input, src->size, level, &compressed);
+    CHECK_ERROR(compressed_size < 0, "input too small to compress (under 0x100 bytes)");
+
+    const double seconds = (double)(clock() - start) / CLOCKS_PER_SEC;
+
+    /* check that it comes back the same, with the reference decoder */
+    {
+        struct byte_source *check_src =
+            open_memory_byte_source(compressed, 0, compressed_size);
+        FILE *check_file = tmpfile();
+        CHECK_ERRNO(!check_file, "tmpfile");
+
+        const long check_size = uncompress(check_src, 0, compressed_size, check_file);
+        CHECK_ERROR(check_size != src->size,
+                "compressed data did not decompress to the input");
+
+        unsigned char *check = malloc(check_size);
+        CHECK_ERRNO(!check, "malloc");
+        get_bytes_seek(0, check_file, check, check_size);
+        CHECK_ERROR(memcmp(check, input, check_size),
+                "compressed data did not decompress to the input");
+
+        free(check);
+        CHECK_ERRNO(fclose(check_file) != 0, "fclose");
+        close_byte_source(check_src);
+    }
+
+    /* open output file */
+    FILE *outfile = fopen(argv[argi+1], "wb");
+    CHECK_ERRNO(!outfile, "fopen output");
+    put_bytes(outfile, compressed, compressed_size);
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+
+    printf("%ld -> %ld bytes (%.1f%%), level %d, %.3f s",
+            src->size, compressed_size,
+            src->size ? 100.0 * compressed_size / src->size : 0.0,
+            level, seconds);
+    if (seconds > 0)
+    {
+        printf(", %.1f MB/s", src->size / seconds / 1e6);
+    }
+    printf("\n");
+
+    if (compressed_size >= src->size)
+    {
+        printf("Warning: compressed data is no smaller than the input, "
+                "a CPK would store this file uncompressed\n");
+    }
+
+    free(compressed);
+    close_byte_source(src);
+
+    exit(EXIT_SUCCESS);
+}
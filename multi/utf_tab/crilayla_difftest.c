@@ -0,0 +1,251 @@
+#define _POSIX_C_SOURCE 200809L
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "byte_source.h"
+#include "cpk_compress.h"
+#include "cpk_uncompress.h"
+#include "util.h"
+#include "error_stuff.h"
+
+// Differential test of the CRILAYLA decoders: uncompress() is the
+// reference, uncompress_memory() has to produce the same output, and fail
+// on the same inputs. Both exit on bad data, so each runs in a child.
+
+static uint64_t rng_state;
+
+static uint32_t rng(void)
+{
+    /* xorshift64* */
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return (uint32_t)((rng_state * UINT64_C(2685821657736338717)) >> 32);
+}
+
+enum decoder { DECODER_REFERENCE, DECODER_MEMORY };
+
+struct decode_result
+{
+    int ok;
+    unsigned char *output;
+    long output_size;
+};
+
+static struct decode_result run_decoder(enum decoder which,
+        const unsigned char *block, long block_size)
+{
+    struct decode_result result = {0, NULL, 0};
+    FILE *outfile = tmpfile();
+    CHECK_ERRNO(!outfile, "tmpfile");
+
+    fflush(stdout);
+    fflush(stderr);
+    const pid_t pid = fork();
+    CHECK_ERRNO(pid < 0, "fork");
+
+    if (pid == 0)
+    {
+        /* failures are expected, keep quiet about them */
+        CHECK_ERRNO(!freopen("/dev/null", "w", stderr), "freopen");
+
+        if (which == DECODER_REFERENCE)
+        {
+            struct byte_source *src = open_memory_byte_source(block, 0, block_size);
+            uncompress(src, 0, block_size, outfile);
+        }
+        else
+        {
+            unsigned char *output = NULL;
+            const long output_size = uncompress_memory(block, block_size, &output);
+            put_bytes_seek(0, outfile, output, output_size);
+        }
+
+        CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+        _exit(EXIT_SUCCESS);
+    }
+
+    int status;
+    CHECK_ERRNO(waitpid(pid, &status, 0) != pid, "waitpid");
+
+    result.ok = WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS;
+    if (result.ok)
+    {
+        CHECK_ERRNO(fseek(outfile, 0, SEEK_END) != 0, "fseek");
+        result.output_size = ftell(outfile);
+        result.output = malloc(result.output_size + 1);
+        CHECK_ERRNO(!result.output, "malloc");
+        get_bytes_seek(0, outfile, result.output, result.output_size);
+    }
+    CHECK_ERRNO(fclose(outfile) != 0, "fclose");
+
+    return result;
+}
+
+static long cases_run, cases_ok;
+
+static void check_block(const char *kind, long case_number,
+        const unsigned char *block, long block_size)
+{
+    struct decode_result ref = run_decoder(DECODER_REFERENCE, block, block_size);
+    struct decode_result mem = run_decoder(DECODER_MEMORY, block, block_size);
+
+    cases_run++;
+    if (ref.ok)
+    {
+        cases_ok++;
+    }
+
+    if (ref.ok != mem.ok)
+    {
+        fprintf(stderr, "%s case %ld: reference %s, uncompress_memory %s\n",
+                kind, case_number,
+                ref.ok ? "succeeded" : "failed",
+                mem.ok ? "succeeded" : "failed");
+        exit(EXIT_FAILURE);
+    }
+    if (ref.ok && (ref.output_size != mem.output_size ||
+                   memcmp(ref.output, mem.output, ref.output_size)))
+    {
+        fprintf(stderr, "%s case %ld: output differs\n", kind, case_number);
+        exit(EXIT_FAILURE);
+    }
+
+    free(ref.output);
+    free(mem.output);
+}
+
+/* something with a mix of literals, short and long matches */
+static void make_input(unsigned char *input, long input_size)
+{
+    const int style = rng() % 4;
+
+    for (long i = 0; i < input_size; )
+    {
+        if (style == 0 || i < 16 || rng() % 4 == 0)
+        {
+            input[i++] = (style == 1) ? 'a' + rng() % 4 : rng();
+        }
+        else
+        {
+            /* repeat from up to 0x2100 back, the longest offset */
+            long distance = 1 + rng() % (style == 3 ? 8 : 0x2100);
+            long length = 3 + rng() % (rng() % 8 ? 16 : 600);
+            if (distance > i) distance = i;
+            for (; length > 0 && i < input_size; length--, i++)
+            {
+                input[i] = input[i - distance];
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    long valid_cases = 200;
+    uint64_t seed = 1;
+
+    if (argc > 3)
+    {
+        fprintf(stderr, "usage: %s [cases] [seed]\n", argv[0]);
+        exit(EXIT_FAILURE);
+    }
+    if (argc > 1) valid_cases = read_long(argv[1]);
+    if (argc > 2) seed = read_long(argv[2]);
+    rng_state = seed * UINT64_C(0x9E3779B97F4A7C15) + 1;
+
+    for (long n = 0; n < valid_cases; n++)
+    {
+        const long input_size = 0x100 + rng() % (n % 10 ? 0x2000 : 0x40000);
+        unsigned char *input = malloc(input_size);
+        CHECK_ERRNO(!input, "malloc");
+        make_input(input, input_size);
+
+        unsigned char *block = NULL;
+        const long block_size = crilayla_compress(input, input_size,
+                CRILAYLA_MIN_LEVEL + n % CRILAYLA_MAX_LEVEL, &block);
+        CHECK_ERROR(block_size < 0, "crilayla_compress failed");
+
+        check_block("valid", n, block, block_size);
+
+        /* both have to get the input back, too */
+        {
+            unsigned char *output = NULL;
+            CHECK_ERROR(uncompress_memory(block, block_size, &output) != input_size ||
+                    memcmp(output, input, input_size),
+                    "valid block did not decompress to the input");
+            free(output);
+        }
+
+        /* bit flips, mostly in the compressed data */
+        unsigned char *bad = malloc(block_size);
+        CHECK_ERRNO(!bad, "malloc");
+        for (int k = 0; k < 4; k++)
+        {
+            memcpy(bad, block, block_size);
+            for (int flips = 1 + rng() % 3; flips > 0; flips--)
+            {
+                const long at = (rng() % 8 && block_size > 0x110) ?
+                    0x10 + rng() % (block_size - 0x110) :
+                    rng() % block_size;
+                bad[at] ^= 1 << (rng() % 8);
+            }
+            check_block("bit flip", n * 4 + k, bad, block_size);
+        }
+
+        /* truncated, the stream is read backwards so drop from the front
+           and keep the header consistent */
+        for (int k = 0; k < 2; k++)
+        {
+            const long body_size = block_size - 0x110;
+            const long drop = 1 + rng() % (body_size > 1 ? body_size : 1);
+            if (drop > body_size) break;
+
+            memcpy(bad, block, 0x10);
+            memcpy(bad + 0x10, block + 0x10 + drop, block_size - 0x10 - drop);
+            bad[0x0C] = (body_size - drop) & 0xff;
+            bad[0x0D] = ((body_size - drop) >> 8) & 0xff;
+            bad[0x0E] = ((body_size - drop) >> 16) & 0xff;
+            bad[0x0F] = ((body_size - drop) >> 24) & 0xff;
+            check_block("truncated", n * 2 + k, bad, block_size - drop);
+        }
+
+        free(bad);
+        free(block);
+        free(input);
+    }
+
+    /* random data behind a valid header */
+    for (long n = 0; n < valid_cases; n++)
+    {
+        const long body_size = rng() % 0x400;
+        const long uncompressed_size = rng() % 0x1000;
+        const long block_size = 0x110 + body_size;
+        unsigned char *block = malloc(block_size);
+        CHECK_ERRNO(!block, "malloc");
+
+        for (long i = 0; i < block_size; i++)
+        {
+            block[i] = rng();
+        }
+        memcpy(block, "CRILAYLA", 8);
+        for (int i = 0; i < 4; i++)
+        {
+            block[0x08 + i] = (uncompressed_size >> (i * 8)) & 0xff;
+            block[0x0C + i] = (body_size >> (i * 8)) & 0xff;
+        }
+
+        check_block("random", n, block, block_size);
+        free(block);
+    }
+
+    printf("%ld cases, %ld decoded, decoders agree\n", cases_run, cases_ok);
+
+    exit(EXIT_SUCCESS);
+}
@@ -5,7 +5,7 @@
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CSB(FILE *infile, long file_length);
+void analyze_CSB(struct byte_source *src, long file_length);
 
 int main(int argc, char **argv)
 {
@@ -17,50 +17,40 @@ int main(int argc, char **argv)
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
-    CHECK_ERRNO(!infile, "fopen");
+    struct byte_source *src = open_byte_source(argv[1]);
 
     /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+    long file_length = src->size;
 
-    rewind(infile);
+    analyze_CSB(src, file_length);
 
-    analyze_CSB(infile, file_length);
+    close_byte_source(src);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CSB(FILE *infile, long file_length)
+void analyze_CSB(struct byte_source *src, long file_length)
 {
     const long TBLCSB_offset = 0x0;
-    char *csb_string_table = NULL;
-    char *sdl_string_table = NULL;
+    struct utf_table *csb = NULL;
+    struct utf_table *sdl = NULL;
 
-    /* get TBLCSB entry count, string table, data offset */
-    int csb_rows;
-    long csb_data_offset;
-    {
-        struct utf_query_result result = query_utf_nofail(infile, TBLCSB_offset, NULL);
-        csb_rows = result.rows;
-        csb_data_offset = TBLCSB_offset + 8 + result.data_offset;
-
-        /* load string table */
-        csb_string_table = load_utf_string_table(infile, TBLCSB_offset);
+    /* load TBLCSB */
+    csb = load_utf_table_nofail(src, TBLCSB_offset);
+    long csb_data_offset = TBLCSB_offset + 8 + csb->data_offset;
 
-        /* check that this is in fact a TBLCSB table */
-        CHECK_ERROR(strcmp(csb_string_table + result.name_offset,
-                    "TBLCSB"), "first table in file is not TBLCSB");
-    }
+    /* check that this is in fact a TBLCSB table */
+    CHECK_ERROR(strcmp(csb->table_name, "TBLCSB"),
+            "first table in file is not TBLCSB");
 
     /* find entry for sound elements */
     int csb_sdl_index;
     {
-        for (csb_sdl_index = 0; csb_sdl_index < csb_rows; csb_sdl_index++)
+        const int name_column = utf_column_index_nofail(csb, "name");
+
+        for (csb_sdl_index = 0; csb_sdl_index < csb->rows; csb_sdl_index++)
         {
-            if (!strcmp(query_utf_string(infile, TBLCSB_offset,
-                    csb_sdl_index, "name", csb_string_table),
+            if (!strcmp(utf_table_string(csb, csb_sdl_index, name_column),
                         "SOUND_ELEMENT"))
             {
                 break;
@@ -68,40 +58,39 @@ void analyze_CSB(FILE *infile, long file_length)
 
         }
 
-        CHECK_ERROR(csb_sdl_index >= csb_rows, "SOUND_ELEMENT not found");
+        CHECK_ERROR(csb_sdl_index >= csb->rows, "SOUND_ELEMENT not found");
     }
     
     /* get sound element table offset */
-    long sdl_offset = csb_data_offset + query_utf_data(infile, TBLCSB_offset, csb_sdl_index, "utf").offset;
+    long sdl_offset = csb_data_offset + utf_table_data(csb, csb_sdl_index,
+            utf_column_index_nofail(csb, "utf")).offset;
 
-    /* get sound element entry count, string table, data offset */
-    int sdl_rows;
-    long sdl_data_offset;
-    {
-        struct utf_query_result result = query_utf_nofail(infile, sdl_offset, NULL);
-        sdl_rows = result.rows;
-        sdl_data_offset = sdl_offset + 8 + result.data_offset;
+    /* load sound element table */
+    sdl = load_utf_table_nofail(src, sdl_offset);
+    long sdl_data_offset = sdl_offset + 8 + sdl->data_offset;
 
-        /* load string table */
-        sdl_string_table = load_utf_string_table(infile, sdl_offset);
+    /* check that this is in fact a TBLSDL table */
+    CHECK_ERROR(strcmp(sdl->table_name, "TBLSDL"),
+            "SOUND_ELEMENT table in is not TBLSDL");
 
-        /* check that this is in fact a TBLSDL table */
-        CHECK_ERROR(strcmp(sdl_string_table + result.name_offset,
-                    "TBLSDL"), "SOUND_ELEMENT table in is not TBLSDL");
-    }
+    const int name_column = utf_column_index_nofail(sdl, "name");
+    const int data_column = utf_column_index_nofail(sdl, "data");
+
+    uint32_t *names = malloc(sizeof(uint32_t) * (sdl->rows+1));
+    struct offset_size_pair *datas = malloc(sizeof(struct offset_size_pair) * (sdl->rows+1));
+    CHECK_ERRNO(!names || !datas, "malloc");
+    utf_table_column_string(sdl, name_column, names);
+    utf_table_column_data(sdl, data_column, datas);
 
     /* extract files */
-    for (int i = 0; i < sdl_rows; i++)
+    for (int i = 0; i < sdl->rows; i++)
     {
         /* get file name */
-        const char *file_name = query_utf_string(infile, sdl_offset, i,
-                "name", sdl_string_table);
+        const char *file_name = sdl->string_table + names[i];
 
         /* get file size and offset */
-        struct offset_size_pair offset_size =
-            query_utf_data(infile, sdl_offset, i, "data");
-        long file_offset = sdl_data_offset + offset_size.offset;
-        long file_size = offset_size.size;
+        long file_offset = sdl_data_offset + datas[i].offset;
+        long file_size = datas[i].size;
 
         if (file_size == 0) {
             printf("%s size 0\n", file_name);
@@ -122,19 +111,15 @@ void analyze_CSB(FILE *infile, long file_length)
 
             /* check type, add extension */
             do {
-                char *file_string_table = NULL;
-                struct utf_query_result result = query_utf(infile, file_offset, NULL);
+                struct utf_table *file_table = load_utf_table(src, file_offset);
 
-                if (!result.valid) break;
+                if (!file_table) break;
 
-                /* load string table */
-                file_string_table = load_utf_string_table(infile, file_offset);
-
-                if (!strcmp(file_string_table + result.name_offset, "AAX"))
+                if (!strcmp(file_table->table_name, "AAX"))
                 {
                     strcat(out_file_name, ".aax");
                 }
-                free_utf_string_table(file_string_table);
+                free_utf_table(file_table);
             } while (0);
 
             printf("%s %lx %ld\n", out_file_name, (unsigned long)file_offset, file_size);
@@ -144,19 +129,12 @@ void analyze_CSB(FILE *infile, long file_length)
             free(out_file_name);
         }
 
-        dump(infile, outfile, file_offset, file_size);
+        source_dump(src, outfile, file_offset, file_size);
         CHECK_ERRNO(fclose(outfile) != 0, "fclose");
     }
 
-    if (csb_string_table)
-    {
-        free_utf_string_table(csb_string_table);
-        csb_string_table = NULL;
-    }
-
-    if (sdl_string_table)
-    {
-        free_utf_string_table(sdl_string_table);
-        sdl_string_table = NULL;
-    }
+    free(names);
+    free(datas);
+    free_utf_table(sdl);
+    free_utf_table(csb);
 }
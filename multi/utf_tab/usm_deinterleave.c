@@ -1,17 +1,29 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
 #include "utf_tab.h"
-#include "cpk_uncompress.h"
+#include "byte_source.h"
 #include "util.h"
 #include "error_stuff.h"
 
-void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int verbosity);
+struct input_stream;
+
+struct input_stream *open_input_stream(FILE *file);
+void close_input_stream(struct input_stream *in);
+void analyze_CRID(struct input_stream *in, const char *infile_name, int verbosity);
 
 void usage(void)
 {
     fflush(stdout);
     fprintf(stderr,
         "Incorrect program usage\n\nusage: usm_deinterleave file [-v|-vv|-q]\n\n"
+        "file: - to read from stdin, output is then named stdin_N\n"
         "-v  : verbose (header info)\n"
         "-vv : more verbose (header and block info)\n"
         "-q  : quiet (only output on error)\n");
@@ -65,28 +77,359 @@ int main(int argc, char **argv)
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
-    CHECK_ERRNO(!infile, "fopen");
+    FILE *infile = stdin;
+    const char *infile_name = "stdin";
+    if (strcmp(argv[1], "-"))
+    {
+        infile = fopen(argv[1], "rb");
+        CHECK_ERRNO(!infile, "fopen");
+        infile_name = argv[1];
+    }
+
+    struct input_stream *in = open_input_stream(infile);
 
-    /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+    analyze_CRID(in, infile_name, verbosity);
 
-    rewind(infile);
+    close_input_stream(in);
 
-    analyze_CRID(infile, argv[1], file_length, verbosity);
+    if (infile != stdin)
+    {
+        CHECK_ERRNO(fclose(infile) != 0, "fclose");
+    }
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int verbosity)
+/* Input is read strictly sequentially through one large buffer, so it
+   can be a pipe, and memory use doesn't depend on the file size. */
+
+#define INPUT_BUFFER_SIZE 0x400000
+
+struct input_stream
+{
+    FILE *file;
+    unsigned char *buf;
+    size_t capacity;
+    size_t start;   /* next unread byte */
+    size_t end;     /* end of valid data */
+    long offset;    /* file offset of buf[start] */
+};
+
+struct input_stream *open_input_stream(FILE *file)
+{
+    struct input_stream *in = malloc(sizeof(struct input_stream));
+    CHECK_ERRNO(!in, "malloc");
+
+    in->file = file;
+    in->capacity = INPUT_BUFFER_SIZE;
+    in->buf = malloc(in->capacity);
+    CHECK_ERRNO(!in->buf, "malloc");
+    in->start = in->end = 0;
+    in->offset = 0;
+
+    return in;
+}
+
+void close_input_stream(struct input_stream *in)
+{
+    free(in->buf);
+    free(in);
+}
+
+/* make at least size bytes available, returns how many are */
+static size_t input_fill(struct input_stream *in, size_t size)
+{
+    if (in->end - in->start >= size)
+    {
+        return in->end - in->start;
+    }
+
+    /* move what's left to the front, grow if one read won't fit */
+    memmove(in->buf, in->buf + in->start, in->end - in->start);
+    in->end -= in->start;
+    in->start = 0;
+
+    if (size > in->capacity)
+    {
+        unsigned char *buf = realloc(in->buf, size);
+        CHECK_ERRNO(!buf, "realloc");
+        in->buf = buf;
+        in->capacity = size;
+    }
+
+    while (in->end < size)
+    {
+        size_t bytes_read = fread(in->buf + in->end, 1, in->capacity - in->end, in->file);
+        if (bytes_read == 0)
+        {
+            CHECK_ERRNO(ferror(in->file), "fread");
+            break;
+        }
+        in->end += bytes_read;
+    }
+
+    return in->end - in->start;
+}
+
+/* consume size bytes, the pointer is good until the next call */
+static const unsigned char *input_get(struct input_stream *in, size_t size)
+{
+    CHECK_ERROR(input_fill(in, size) < size, "unexpected EOF");
+
+    const unsigned char *p = in->buf + in->start;
+    in->start += size;
+    in->offset += size;
+
+    return p;
+}
+
+/* read the rest of the input, returns its size */
+static long input_drain(struct input_stream *in)
+{
+    long remaining = 0;
+    size_t available;
+
+    while ((available = input_fill(in, 1)) > 0)
+    {
+        remaining += available;
+        in->start = in->end;
+    }
+
+    return remaining;
+}
+
+/* Each output stream has a ring buffer that the demuxer fills and a
+   writer thread drains, so writes overlap with parsing. */
+
+#define OUTPUT_RING_SIZE 0x100000
+
+struct stream_output
+{
+    FILE *file;
+#ifndef __MINGW32__
+    unsigned char *ring;
+    /* running totals, position in the ring is mod OUTPUT_RING_SIZE */
+    uint64_t queued;
+    uint64_t written;
+#endif
+};
+
+struct output_writer
+{
+    struct stream_output *outputs;
+    int count;
+#ifndef __MINGW32__
+    pthread_mutex_t lock;
+    pthread_cond_t has_data;
+    pthread_cond_t has_space;
+    int done;
+    pthread_t thread;
+#endif
+};
+
+#ifndef __MINGW32__
+static void *writer_thread(void *arg)
+{
+    struct output_writer * const w = arg;
+    int next = 0;
+
+    CHECK_ERROR(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+    for (;;)
+    {
+        /* find a stream with something queued, round robin */
+        struct stream_output *out = NULL;
+        for (int i = 0; i < w->count && !out; i++)
+        {
+            struct stream_output * const o = &w->outputs[(next + i) % w->count];
+            if (o->file && o->queued != o->written)
+            {
+                out = o;
+                next = (next + i + 1) % w->count;
+            }
+        }
+
+        if (!out)
+        {
+            if (w->done) break;
+            CHECK_ERROR(pthread_cond_wait(&w->has_data, &w->lock) != 0, "pthread_cond_wait");
+            continue;
+        }
+
+        /* write up to the end of the ring, without the lock */
+        const size_t ring_pos = out->written % OUTPUT_RING_SIZE;
+        size_t size = out->queued - out->written;
+        if (size > OUTPUT_RING_SIZE - ring_pos) size = OUTPUT_RING_SIZE - ring_pos;
+
+        CHECK_ERROR(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+        put_bytes(out->file, out->ring + ring_pos, size);
+        CHECK_ERROR(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+
+        out->written += size;
+        CHECK_ERROR(pthread_cond_signal(&w->has_space) != 0, "pthread_cond_signal");
+    }
+    CHECK_ERROR(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+
+    return NULL;
+}
+#endif
+
+static void start_writer(struct output_writer *w, struct stream_output *outputs, int count)
+{
+    w->outputs = outputs;
+    w->count = count;
+#ifndef __MINGW32__
+    for (int i = 0; i < count; i++)
+    {
+        outputs[i].ring = NULL;
+        outputs[i].queued = outputs[i].written = 0;
+        if (outputs[i].file)
+        {
+            outputs[i].ring = malloc(OUTPUT_RING_SIZE);
+            CHECK_ERRNO(!outputs[i].ring, "malloc");
+        }
+    }
+
+    w->done = 0;
+    CHECK_ERROR(pthread_mutex_init(&w->lock, NULL) != 0, "pthread_mutex_init");
+    CHECK_ERROR(pthread_cond_init(&w->has_data, NULL) != 0, "pthread_cond_init");
+    CHECK_ERROR(pthread_cond_init(&w->has_space, NULL) != 0, "pthread_cond_init");
+    CHECK_ERROR(pthread_create(&w->thread, NULL, writer_thread, w) != 0, "pthread_create");
+#endif
+}
+
+static void queue_output(struct output_writer *w, int idx, const unsigned char *data, size_t size)
+{
+    struct stream_output * const out = &w->outputs[idx];
+#ifdef __MINGW32__
+    put_bytes(out->file, data, size);
+#else
+    while (size > 0)
+    {
+        CHECK_ERROR(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+        while (out->queued - out->written == OUTPUT_RING_SIZE)
+        {
+            CHECK_ERROR(pthread_cond_wait(&w->has_space, &w->lock) != 0, "pthread_cond_wait");
+        }
+        const size_t ring_pos = out->queued % OUTPUT_RING_SIZE;
+        size_t chunk = OUTPUT_RING_SIZE - (out->queued - out->written);
+        CHECK_ERROR(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+
+        /* the writer never touches the free part of the ring */
+        if (chunk > OUTPUT_RING_SIZE - ring_pos) chunk = OUTPUT_RING_SIZE - ring_pos;
+        if (chunk > size) chunk = size;
+        memcpy(out->ring + ring_pos, data, chunk);
+
+        CHECK_ERROR(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+        out->queued += chunk;
+        CHECK_ERROR(pthread_cond_signal(&w->has_data) != 0, "pthread_cond_signal");
+        CHECK_ERROR(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+
+        data += chunk;
+        size -= chunk;
+    }
+#endif
+}
+
+/* flush everything queued and stop the writer */
+static void stop_writer(struct output_writer *w)
+{
+#ifndef __MINGW32__
+    CHECK_ERROR(pthread_mutex_lock(&w->lock) != 0, "pthread_mutex_lock");
+    w->done = 1;
+    CHECK_ERROR(pthread_cond_signal(&w->has_data) != 0, "pthread_cond_signal");
+    CHECK_ERROR(pthread_mutex_unlock(&w->lock) != 0, "pthread_mutex_unlock");
+
+    CHECK_ERROR(pthread_join(w->thread, NULL) != 0, "pthread_join");
+
+    pthread_cond_destroy(&w->has_space);
+    pthread_cond_destroy(&w->has_data);
+    pthread_mutex_destroy(&w->lock);
+
+    for (int i = 0; i < w->count; i++)
+    {
+        free(w->outputs[i].ring);
+        w->outputs[i].ring = NULL;
+    }
+#endif
+}
+
+/* stmid -> stream index, open addressing */
+struct stmid_map
+{
+    uint32_t *stmids;
+    int *indexes;   /* -1 for an empty slot */
+    unsigned int size;
+};
+
+static void stmid_map_init(struct stmid_map *map, int entries)
+{
+    map->size = 1;
+    while (map->size < entries * 2u)
+    {
+        map->size *= 2;
+    }
+
+    map->stmids = malloc(sizeof(uint32_t) * map->size);
+    CHECK_ERRNO(!map->stmids, "malloc");
+    map->indexes = malloc(sizeof(int) * map->size);
+    CHECK_ERRNO(!map->indexes, "malloc");
+    for (unsigned int i = 0; i < map->size; i++)
+    {
+        map->indexes[i] = -1;
+    }
+}
+
+static inline unsigned int stmid_slot(const struct stmid_map *map, uint32_t stmid)
+{
+    return (stmid * UINT32_C(2654435761)) >> 16 & (map->size - 1);
+}
+
+static void stmid_map_add(struct stmid_map *map, uint32_t stmid, int index)
+{
+    unsigned int slot = stmid_slot(map, stmid);
+
+    while (map->indexes[slot] != -1)
+    {
+        slot = (slot + 1) & (map->size - 1);
+    }
+    map->stmids[slot] = stmid;
+    map->indexes[slot] = index;
+}
+
+/* returns -1 if not found */
+static int stmid_map_find(const struct stmid_map *map, uint32_t stmid)
+{
+    unsigned int slot = stmid_slot(map, stmid);
+
+    while (map->indexes[slot] != -1)
+    {
+        if (map->stmids[slot] == stmid)
+        {
+            return map->indexes[slot];
+        }
+        slot = (slot + 1) & (map->size - 1);
+    }
+
+    return -1;
+}
+
+static void stmid_map_free(struct stmid_map *map)
+{
+    free(map->indexes);
+    free(map->stmids);
+}
+
+void analyze_CRID(struct input_stream *in, const char *infile_name, int verbosity)
 {
     long stream_count = 0;
     struct stream_info *streams = NULL;
-    char *CRIUSF_string_table = NULL;
+    unsigned char *CRIUSF_data = NULL;
+    struct byte_source *CRIUSF_src = NULL;
+    struct utf_table *CRIUSF = NULL;
+    struct stmid_map stmids = { NULL, NULL, 0 };
 
-    FILE **outfiles = NULL;
+    struct stream_output *outputs = NULL;
+    struct output_writer writer;
     char **outfile_names = NULL;
 
     enum
@@ -119,8 +462,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
     /* dispense justice! */
     do
     {
-        uint32_t stmid = get_32_be(infile);
-        uint32_t block_size = get_32_be(infile);
+        const long block_offset = in->offset;
+        const unsigned char *block_header = input_get(in, 0x20);
+        uint32_t stmid = read_32_be(block_header+0x00);
+        uint32_t block_size = read_32_be(block_header+0x04);
         uint32_t block_type;
         uint16_t header_size, footer_size;
         size_t payload_bytes;
@@ -134,14 +479,8 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         {
             CHECK_ERROR (0 == stream_count, "0 stream count should be impossible");
             /* find the stream */
-            for (stream_idx=1; stream_idx < stream_count; stream_idx++)
-            {
-                if (stmid == streams[stream_idx].stmid)
-                {
-                    break;
-                }
-            }
-            CHECK_ERROR (stream_idx == stream_count, "unknown stmid");
+            stream_idx = stmid_map_find(&stmids, stmid);
+            CHECK_ERROR (stream_idx < 0, "unknown stmid");
 
             CHECK_ERROR (!streams[stream_idx].alive, "stream was supposed to be ended");
 
@@ -150,24 +489,26 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
         if (verbosity >= verbose_blocks)
         {
-            printf("%08lx %d block_size: %08"PRIx32" ", (unsigned long)ftell(infile)-8, stream_idx, block_size);
+            printf("%08lx %d block_size: %08"PRIx32" ", (unsigned long)block_offset, stream_idx, block_size);
         }
 
         /* block control */
         {
-            header_size = get_16_be(infile);
-            footer_size = get_16_be(infile);
+            header_size = read_16_be(block_header+0x08);
+            footer_size = read_16_be(block_header+0x0a);
             if (verbosity >= verbose_blocks)
             {
                 printf("%04"PRIx16" %04"PRIx16"\n", header_size, footer_size);
             }
 
             CHECK_ERROR( 0x18 != header_size, "expected header size 0x18" );
+            CHECK_ERROR( block_size < (uint32_t)header_size + footer_size,
+                    "block smaller than its header and footer" );
             payload_bytes = block_size - header_size - footer_size;
         }
 
         /* block typs */
-        block_type = get_32_be(infile);
+        block_type = read_32_be(block_header+0x0c);
         if (verbosity >= verbose_blocks)
         {
             printf("type %08"PRIx32"\n", block_type);
@@ -177,10 +518,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         {
             uint32_t byte1,byte2,byte3,byte4;
 
-            byte1 = get_32_be(infile); /* granule (1/100 of a frame) */
-            byte2 = get_32_be(infile); /* samples (based on whole block size at avg bitrate) */
-            byte3 = get_32_be(infile);
-            byte4 = get_32_be(infile);
+            byte1 = read_32_be(block_header+0x10); /* granule (1/100 of a frame) */
+            byte2 = read_32_be(block_header+0x14); /* samples (based on whole block size at avg bitrate) */
+            byte3 = read_32_be(block_header+0x18);
+            byte4 = read_32_be(block_header+0x1c);
 
             if (verbosity >= verbose_blocks)
             {
@@ -195,34 +536,36 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                      (0    != byte4)), "block unknown bytes mismatch");
         }
 
+        const long payload_offset = in->offset;
+        const unsigned char *payload = input_get(in, payload_bytes);
+
         if (!streams_setup)
         {
             /* handle first block, which describes the subsequent streams */
 
-            long CRIUSF_offset = ftell(infile);
-            CHECK_ERROR (-1 == CRIUSF_offset, "ftell");
-
             /* seems like it ought to be type 2, but it's type 1 */
             CHECK_ERROR (1 != block_type, "CRID should be type 1");
 
+            /* keep a copy, the stream names point into it */
+            CRIUSF_data = malloc(payload_bytes);
+            CHECK_ERRNO (!CRIUSF_data, "malloc");
+            memcpy(CRIUSF_data, payload, payload_bytes);
+            CRIUSF_src = open_memory_byte_source(CRIUSF_data, payload_offset, payload_bytes);
+
             if (verbosity >= verbose_headers)
             {
-                analyze_utf(infile, CRIUSF_offset, 0, 1, NULL);
+                analyze_utf(CRIUSF_src, payload_offset, 0, 1, NULL);
             }
 
             /* check CRIUSF stream list */
             {
-                struct utf_query_result result = query_utf_nofail(infile, CRIUSF_offset, NULL);
-                long CRIUSF_data_offset;
+                CRIUSF = load_utf_table_nofail(CRIUSF_src, payload_offset);
 
-                CHECK_ERROR (result.rows < 1, "expected at least one row in CRIUSF");
-                stream_count = result.rows;
-                CRIUSF_data_offset = CRIUSF_offset + result.data_offset;
-
-                CRIUSF_string_table = load_utf_string_table(infile, CRIUSF_offset);
+                CHECK_ERROR (CRIUSF->rows < 1, "expected at least one row in CRIUSF");
+                stream_count = CRIUSF->rows;
 
                 /* check that we're actually looking at a CRIUSF table */
-                CHECK_ERROR (strcmp(&CRIUSF_string_table[result.name_offset],
+                CHECK_ERROR (strcmp(CRIUSF->table_name,
                             "CRIUSF_DIR_STREAM"), "expected CRIUSF_DIR_STREAM");
 
             }
@@ -230,6 +573,14 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             /* check streams */
             {
                 int i, j;
+                const int filename_column = utf_column_index_nofail(CRIUSF, "filename");
+                const int filesize_column = utf_column_index_nofail(CRIUSF, "filesize");
+                const int datasize_column = utf_column_index_nofail(CRIUSF, "datasize");
+                const int stmid_column    = utf_column_index_nofail(CRIUSF, "stmid");
+                const int chno_column     = utf_column_index_nofail(CRIUSF, "chno");
+                const int minchk_column   = utf_column_index_nofail(CRIUSF, "minchk");
+                const int minbuf_column   = utf_column_index_nofail(CRIUSF, "minbuf");
+                const int avbps_column    = utf_column_index_nofail(CRIUSF, "avbps");
 
                 streams = malloc(sizeof(struct stream_info)*stream_count);
                 CHECK_ERRNO (!streams, "malloc");
@@ -238,14 +589,14 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                 for (i = 0; i < stream_count; i ++)
                 {
                     struct stream_info * const s = &streams[i];
-                    s->filename = query_utf_string(infile, CRIUSF_offset, i, "filename", CRIUSF_string_table);
-                    s->filesize = query_utf_4byte(infile, CRIUSF_offset, i, "filesize");
-                    s->datasize = query_utf_4byte(infile, CRIUSF_offset, i, "datasize");
-                    s->stmid    = query_utf_4byte(infile, CRIUSF_offset, i, "stmid");
-                    s->chno     = query_utf_2byte(infile, CRIUSF_offset, i, "chno");
-                    s->minchk   = query_utf_2byte(infile, CRIUSF_offset, i, "minchk");
-                    s->minbuf   = query_utf_4byte(infile, CRIUSF_offset, i, "minbuf");
-                    s->avbps    = query_utf_4byte(infile, CRIUSF_offset, i, "avbps");
+                    s->filename = utf_table_string(CRIUSF, i, filename_column);
+                    s->filesize = utf_table_4byte(CRIUSF, i, filesize_column);
+                    s->datasize = utf_table_4byte(CRIUSF, i, datasize_column);
+                    s->stmid    = utf_table_4byte(CRIUSF, i, stmid_column);
+                    s->chno     = utf_table_2byte(CRIUSF, i, chno_column);
+                    s->minchk   = utf_table_2byte(CRIUSF, i, minchk_column);
+                    s->minbuf   = utf_table_4byte(CRIUSF, i, minbuf_column);
+                    s->avbps    = utf_table_4byte(CRIUSF, i, avbps_column);
 
                     if (0 == i)
                     {
@@ -287,13 +638,20 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                         CHECK_ERROR (s->stmid == streams[j].stmid, "duplicate stmid");
                     }
                 }
+
+                /* stream 0 is the CRID itself, it doesn't get blocks */
+                stmid_map_init(&stmids, stream_count);
+                for (i = 1; i < stream_count; i++)
+                {
+                    stmid_map_add(&stmids, streams[i].stmid, i);
+                }
             }
 
             /* open output files */
             {
                 int i;
-                outfiles = malloc(sizeof(FILE*)*stream_count);
-                CHECK_ERRNO (!outfiles, "malloc");
+                outputs = malloc(sizeof(struct stream_output)*stream_count);
+                CHECK_ERRNO (!outputs, "malloc");
                 outfile_names = malloc(sizeof(char*)*stream_count);
                 CHECK_ERRNO (!outfile_names, "malloc");
 
@@ -301,7 +659,7 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                 {
                     if (0 == i)
                     {
-                        outfiles[i] = NULL;
+                        outputs[i].file = NULL;
                         outfile_names[i] = NULL;
                     }
                     else
@@ -320,11 +678,13 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
                                 break;
                         }
                         outfile_names[i] = name;
-                        outfiles[i] = fopen(name, "wb");
+                        outputs[i].file = fopen(name, "wb");
 
-                        CHECK_ERRNO(!outfiles[i], "fopen");
+                        CHECK_ERRNO(!outputs[i].file, "fopen");
                     }
                 }
+
+                start_writer(&writer, outputs, stream_count);
             }
 
             /* initialize streams */
@@ -341,9 +701,6 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             }
 
             streams_setup = 1;
-
-            /* seek to footer for check below */
-            fseek(infile, CRIUSF_offset+payload_bytes, SEEK_SET);
         }
         else    /* stream setup already complete */
         {
@@ -352,30 +709,27 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
             {
 
                 case 0: /* data */
-                    dump_from_here(infile, outfiles[stream_idx], payload_bytes);
+                    queue_output(&writer, stream_idx, payload, payload_bytes);
                     streams[stream_idx].payload_bytes += payload_bytes;
                     break;
                 case 1: /* header */
                 case 3: /* metadata */
                     /* skip */
                     {
-                        long current_offset = ftell(infile);
-                        CHECK_ERROR (-1 == current_offset, "ftell");
                         if (
                             (block_type == 1 && verbosity >= verbose_headers) ||
                             (block_type == 3 && verbosity >= verbose_blocks))
                         {
-                            analyze_utf(infile, current_offset, 0, 1, NULL);
+                            struct byte_source *block_src =
+                                open_memory_byte_source(payload, payload_offset, payload_bytes);
+                            analyze_utf(block_src, payload_offset, 0, 1, NULL);
+                            close_byte_source(block_src);
                         }
-                        fseek(infile, current_offset+payload_bytes, SEEK_SET);
                     }
                     break;
                 case 2: /* stream metadata */
                     {
-                        char *metadata = malloc(payload_bytes);
-                        CHECK_ERROR (!metadata, "malloc");
-
-                        get_bytes(infile, (unsigned char *)metadata, payload_bytes);
+                        const char *metadata = (const char *)payload;
 
                         if (!strncmp(metadata, "#HEADER END     ===============", payload_bytes))
                         {
@@ -404,9 +758,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         /* check footer (0 padding) */
         {
             int i;
+            const unsigned char *footer = input_get(in, footer_size);
             for (i = 0; i < footer_size; i++)
             {
-                CHECK_ERROR (0 != get_byte(infile), "nonzero padding");
+                CHECK_ERROR (0 != footer[i], "nonzero padding");
             }
         }
     }
@@ -414,31 +769,38 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
 
     CHECK_ERROR (!streams_setup, "no CRID found");
 
-    if (ftell(infile) != file_length)
+    /* finish writing before closing anything */
+    stop_writer(&writer);
+
     {
-        printf("Warning: read only 0x%lx bytes of 0x%lx byte file\n",
-            (unsigned long)ftell(infile), (unsigned long)file_length);
+        const long offset = in->offset;
+        const long remaining = input_drain(in);
+        if (remaining != 0)
+        {
+            printf("Warning: read only 0x%lx bytes of 0x%lx byte file\n",
+                (unsigned long)offset, (unsigned long)(offset + remaining));
+        }
     }
 
     /* cleanup */
-    if (outfiles)
+    if (outputs)
     {
         int i;
         for (i=0; i < stream_count; i++)
         {
-            if (outfiles[i])
+            if (outputs[i].file)
             {
                 if (verbosity >= verbose_normal)
                 {
                     printf("%d: %s: read %ld bytes, %ld bytes payload\n",
                             i, outfile_names[i], streams[i].bytes_read, streams[i].payload_bytes);
                 }
-                int rc = fclose(outfiles[i]);
+                int rc = fclose(outputs[i].file);
                 CHECK_ERRNO (EOF == rc, "fclose");
             }
         }
 
-        free(outfiles);
+        free(outputs);
     }
 
     if (outfile_names)
@@ -461,9 +823,10 @@ void analyze_CRID(FILE *infile, const char *infile_name, long file_length, int v
         streams = NULL;
     }
 
-    if (CRIUSF_string_table)
-    {
-        free_utf_string_table(CRIUSF_string_table);
-        CRIUSF_string_table = NULL;
-    }
+    stmid_map_free(&stmids);
+
+    free_utf_table(CRIUSF);
+    CRIUSF = NULL;
+    close_byte_source(CRIUSF_src);
+    free(CRIUSF_data);
 }
@@ -0,0 +1,384 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "error_stuff.h"
+#include "util.h"
+#include "utf_tab.h"
+#include "utf_json.h"
+
+/* JSON output for @UTF tables
+
+   document (ndjson = 0):
+     {"table":"name","offset":N,"columns":[{"name":"x","type":"uint32",
+      "storage":"perrow"},...],"rows":[{"x":1,...},...]}
+   records (ndjson = 1), one line per row of the outer table:
+     {"table":"name","row":0,"values":{"x":1,...}}
+
+   Values are numbers for the integer and float columns (null for
+   infinities and NaN), strings for string columns, and for data columns
+   {"offset":N,"size":N} with "table":{document} added if the data is a
+   @UTF table. Zero storage columns are null. Bytes outside of printable
+   ASCII in strings are written as \u00XX, the names are usually
+   Shift-JIS and JSON has to be Unicode. */
+
+#define JSON_BUFFER_SIZE (1024*1024)
+
+/* largest single reservation, a number or an escaped byte */
+#define JSON_MAX_TOKEN 32
+
+struct json_writer
+{
+    FILE *outfile;
+    char *buffer;
+    size_t used;
+};
+
+static void json_flush(struct json_writer *w)
+{
+    put_bytes(w->outfile, (const unsigned char *)w->buffer, w->used);
+    w->used = 0;
+}
+
+/* make room for size bytes */
+static inline char *json_reserve(struct json_writer *w, size_t size)
+{
+    if (JSON_BUFFER_SIZE - w->used < size)
+    {
+        json_flush(w);
+    }
+
+    return w->buffer + w->used;
+}
+
+static inline void json_char(struct json_writer *w, char c)
+{
+    *json_reserve(w, 1) = c;
+    w->used ++;
+}
+
+static void json_bytes(struct json_writer *w, const char *bytes, size_t size)
+{
+    while (size > 0)
+    {
+        size_t chunk = JSON_BUFFER_SIZE - w->used;
+        if (chunk == 0)
+        {
+            json_flush(w);
+            continue;
+        }
+        if (chunk > size) chunk = size;
+
+        memcpy(w->buffer + w->used, bytes, chunk);
+        w->used += chunk;
+        bytes += chunk;
+        size -= chunk;
+    }
+}
+
+static void json_literal(struct json_writer *w, const char *text)
+{
+    json_bytes(w, text, strlen(text));
+}
+
+static void json_u64(struct json_writer *w, uint64_t value)
+{
+    char digits[20];
+    int count = 0;
+
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+
+    char *out = json_reserve(w, count);
+    for (int i = 0; i < count; i++)
+    {
+        out[i] = digits[count-1-i];
+    }
+    w->used += count;
+}
+
+static void json_i64(struct json_writer *w, int64_t value)
+{
+    if (value < 0)
+    {
+        json_char(w, '-');
+        json_u64(w, -(uint64_t)value);
+    }
+    else
+    {
+        json_u64(w, value);
+    }
+}
+
+static void json_float(struct json_writer *w, uint32_t bits)
+{
+    union {
+        float float_value;
+        uint32_t int_value;
+    } int_float;
+
+    /* infinities and NaN have no JSON representation */
+    if ((bits & UINT32_C(0x7f800000)) == UINT32_C(0x7f800000) || sizeof(float) != 4)
+    {
+        json_literal(w, "null");
+        return;
+    }
+
+    int_float.int_value = bits;
+    char *out = json_reserve(w, JSON_MAX_TOKEN);
+    w->used += snprintf(out, JSON_MAX_TOKEN, "%.9g", int_float.float_value);
+}
+
+static void json_string(struct json_writer *w, const char *text)
+{
+    static const char hex[16] = "0123456789abcdef";
+
+    json_char(w, '"');
+
+    for (;;)
+    {
+        /* copy the plain run in one go */
+        const char *run = text;
+        while (*text >= 0x20 && *text < 0x7f && *text != '"' && *text != '\\')
+        {
+            text ++;
+        }
+        json_bytes(w, run, text - run);
+
+        const unsigned char c = *text;
+        if (c == '\0')
+        {
+            break;
+        }
+
+        char *out = json_reserve(w, 6);
+        if (c == '"' || c == '\\')
+        {
+            out[0] = '\\';
+            out[1] = c;
+            w->used += 2;
+        }
+        else
+        {
+            memcpy(out, "\\u00", 4);
+            out[4] = hex[c >> 4];
+            out[5] = hex[c & 0xf];
+            w->used += 6;
+        }
+        text ++;
+    }
+
+    json_char(w, '"');
+}
+
+static const char *json_type_name(uint8_t type)
+{
+    switch (type & COLUMN_TYPE_MASK)
+    {
+        case COLUMN_TYPE_DATA:      return "data";
+        case COLUMN_TYPE_STRING:    return "string";
+        case COLUMN_TYPE_FLOAT:     return "float";
+        case COLUMN_TYPE_8BYTE:     return "uint64";
+        case COLUMN_TYPE_4BYTE2:    return "int32";
+        case COLUMN_TYPE_4BYTE:     return "uint32";
+        case COLUMN_TYPE_2BYTE2:    return "int16";
+        case COLUMN_TYPE_2BYTE:     return "uint16";
+        case COLUMN_TYPE_1BYTE2:    return "int8";
+        case COLUMN_TYPE_1BYTE:     return "uint8";
+        default:                    return "unknown";
+    }
+}
+
+static const char *json_storage_name(uint8_t type)
+{
+    switch (type & COLUMN_STORAGE_MASK)
+    {
+        case COLUMN_STORAGE_PERROW:     return "perrow";
+        case COLUMN_STORAGE_CONSTANT:   return "constant";
+        default:                        return "zero";
+    }
+}
+
+static void json_table(struct json_writer *w, const struct utf_table *table);
+
+static void json_data(struct json_writer *w, const struct utf_table *table,
+        int row, int column, const unsigned char *cell)
+{
+    const uint32_t data_offset = read_32_be(cell);
+    const uint32_t data_size = read_32_be(cell+4);
+
+    json_literal(w, "{\"offset\":");
+    json_u64(w, data_offset);
+    json_literal(w, ",\"size\":");
+    json_u64(w, data_size);
+
+    /* nested table, if it is in range and looks like one */
+    if (data_size != 0 &&
+        (uint64_t)table->data_offset + data_offset + data_size <= table->table_size)
+    {
+        struct utf_table *nested = load_utf_table_data(table, row, column);
+        if (nested)
+        {
+            json_literal(w, ",\"table\":");
+            json_table(w, nested);
+            free_utf_table(nested);
+        }
+    }
+
+    json_char(w, '}');
+}
+
+static void json_value(struct json_writer *w, const struct utf_table *table,
+        int row, int column)
+{
+    const struct utf_table_column * const c = &table->schema[column];
+    const unsigned char *cell;
+
+    switch (c->type & COLUMN_STORAGE_MASK)
+    {
+        case COLUMN_STORAGE_PERROW:
+            cell = table->table + table->rows_offset +
+                (uint32_t)row * table->row_width + c->offset;
+            break;
+        case COLUMN_STORAGE_CONSTANT:
+            cell = table->table + c->offset;
+            break;
+        default:
+            json_literal(w, "null");
+            return;
+    }
+
+    switch (c->type & COLUMN_TYPE_MASK)
+    {
+        case COLUMN_TYPE_DATA:
+            json_data(w, table, row, column, cell);
+            break;
+        case COLUMN_TYPE_STRING:
+            {
+                const uint32_t string_offset = read_32_be(cell);
+                CHECK_ERROR(string_offset > table->string_table_size,
+                        "string out of range");
+                json_string(w, table->string_table + string_offset);
+            }
+            break;
+        case COLUMN_TYPE_FLOAT:
+            json_float(w, read_32_be(cell));
+            break;
+        case COLUMN_TYPE_8BYTE:
+            json_u64(w, read_64_be(cell));
+            break;
+        case COLUMN_TYPE_4BYTE2:
+            json_i64(w, (int32_t)read_32_be(cell));
+            break;
+        case COLUMN_TYPE_4BYTE:
+            json_u64(w, read_32_be(cell));
+            break;
+        case COLUMN_TYPE_2BYTE2:
+            json_i64(w, (int16_t)read_16_be(cell));
+            break;
+        case COLUMN_TYPE_2BYTE:
+            json_u64(w, read_16_be(cell));
+            break;
+        case COLUMN_TYPE_1BYTE2:
+            json_i64(w, (int8_t)*cell);
+            break;
+        case COLUMN_TYPE_1BYTE:
+            json_u64(w, *cell);
+            break;
+    }
+}
+
+static void json_row(struct json_writer *w, const struct utf_table *table, int row)
+{
+    json_char(w, '{');
+    for (int j = 0; j < table->columns; j++)
+    {
+        if (j > 0)
+        {
+            json_char(w, ',');
+        }
+        json_string(w, table->schema[j].name);
+        json_char(w, ':');
+        json_value(w, table, row, j);
+    }
+    json_char(w, '}');
+}
+
+static void json_table(struct json_writer *w, const struct utf_table *table)
+{
+    json_literal(w, "{\"table\":");
+    json_string(w, table->table_name);
+    json_literal(w, ",\"offset\":");
+    json_u64(w, table->table_offset);
+
+    json_literal(w, ",\"columns\":[");
+    for (int j = 0; j < table->columns; j++)
+    {
+        const struct utf_table_column * const c = &table->schema[j];
+
+        if (j > 0)
+        {
+            json_char(w, ',');
+        }
+        json_literal(w, "{\"name\":");
+        json_string(w, c->name);
+        json_literal(w, ",\"type\":\"");
+        json_literal(w, json_type_name(c->type));
+        json_literal(w, "\",\"storage\":\"");
+        json_literal(w, json_storage_name(c->type));
+        json_literal(w, "\"}");
+    }
+
+    json_literal(w, "],\"rows\":[");
+    for (int i = 0; i < table->rows; i++)
+    {
+        if (i > 0)
+        {
+            json_char(w, ',');
+        }
+        json_row(w, table, i);
+    }
+    json_literal(w, "]}");
+}
+
+void write_utf_json(struct byte_source *src, long offset, FILE *outfile, int ndjson)
+{
+    struct json_writer w;
+
+    w.outfile = outfile;
+    w.used = 0;
+    w.buffer = malloc(JSON_BUFFER_SIZE);
+    CHECK_ERRNO(!w.buffer, "malloc");
+
+    struct utf_table *table = load_utf_table(src, offset);
+    CHECK_ERROR(!table, "not a @UTF table");
+
+    if (ndjson)
+    {
+        for (int i = 0; i < table->rows; i++)
+        {
+            json_literal(&w, "{\"table\":");
+            json_string(&w, table->table_name);
+            json_literal(&w, ",\"row\":");
+            json_u64(&w, i);
+            json_literal(&w, ",\"values\":");
+            json_row(&w, table, i);
+            json_literal(&w, "}\n");
+        }
+    }
+    else
+    {
+        json_table(&w, table);
+        json_char(&w, '\n');
+    }
+
+    json_flush(&w);
+
+    free_utf_table(table);
+    free(w.buffer);
+}
@@ -0,0 +1,15 @@
+#ifndef _UTF_JSON_H_INCLUDED
+#define _UTF_JSON_H_INCLUDED
+
+#include <stdio.h>
+
+#include "byte_source.h"
+
+/* Dump the @UTF table at offset as JSON, tables in data columns are
+   nested inline. With ndjson each row of the outer table is written as
+   a record on its own line instead of one big document. Output goes
+   straight out through a fixed buffer, so the table can have any number
+   of rows. */
+void write_utf_json(struct byte_source *src, long offset, FILE *outfile, int ndjson);
+
+#endif /* _UTF_JSON_H_INCLUDED */
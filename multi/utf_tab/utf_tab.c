@@ -7,410 +7,701 @@
 #include "error_stuff.h"
 #include "util.h"
 #include "utf_tab.h"
+#include "cri_variant.h"
 
-struct utf_query_result analyze_utf(FILE *infile, const long offset, int indent, int print, const struct utf_query *query)
+static unsigned int hash_column_name(const char *name)
 {
-    unsigned char buf[4];
-    struct utf_table_info table_info;
-    char *string_table = NULL;
-    struct utf_column_info * schema = NULL;
-    struct utf_query_result result;
-    
-    result.valid = 0;
-
-    if (print)
+    /* FNV-1a */
+    uint32_t hash = UINT32_C(0x811c9dc5);
+    for (; *name; name++)
     {
-        fprintf_indent(stdout, indent);
-        printf("{\n");
+        hash ^= (unsigned char)*name;
+        hash *= UINT32_C(0x01000193);
     }
+    return hash;
+}
 
-    indent += INDENT_LEVEL;
+static int column_width(uint8_t type)
+{
+    switch (type & COLUMN_TYPE_MASK)
+    {
+        case COLUMN_TYPE_8BYTE:
+        case COLUMN_TYPE_DATA:
+            return 8;
+        case COLUMN_TYPE_STRING:
+        case COLUMN_TYPE_FLOAT:
+        case COLUMN_TYPE_4BYTE2:
+        case COLUMN_TYPE_4BYTE:
+            return 4;
+        case COLUMN_TYPE_2BYTE2:
+        case COLUMN_TYPE_2BYTE:
+            return 2;
+        case COLUMN_TYPE_1BYTE2:
+        case COLUMN_TYPE_1BYTE:
+            return 1;
+        default:
+            return 0;
+    }
+}
 
-    table_info.table_offset = offset;
+/* returns NULL if there is no @UTF table at offset */
+struct utf_table *load_utf_table(struct byte_source *src, const long offset)
+{
+    const unsigned char *buf;
+    struct utf_table *table;
+    unsigned char header[8];
+    int encrypted = 0;
+    uint8_t key = 0;
 
     /* check header */
     static const char UTF_signature[4] = "@UTF"; /* intentionally unterminated */
-    get_bytes_seek(offset, infile, buf, 4);
+    buf = source_get(src, offset, 8);
     if (memcmp(buf, UTF_signature, sizeof(UTF_signature)))
     {
-        if (print)
+        const struct cri_variant * const variant = cri_variant();
+
+        if (!variant->utf_crypt)
         {
-            fprintf_indent(stdout, indent);
-            printf("not a @UTF table at %08" PRIx32 "\n", (uint32_t)offset);
+            return NULL;
         }
-        goto cleanup;
+
+        memcpy(header, buf, 8);
+        key = cri_crypt(variant, header, 8, variant->crypt_start);
+        if (memcmp(header, UTF_signature, sizeof(UTF_signature)))
+        {
+            return NULL;
+        }
+
+        buf = header;
+        encrypted = 1;
     }
 
-    /* get table size */
-    table_info.table_size = get_32_be(infile);
-
-    table_info.schema_offset = 0x20;
-    table_info.rows_offset = get_32_be(infile);
-    table_info.string_table_offset = get_32_be(infile);
-    table_info.data_offset = get_32_be(infile);
-    const uint32_t table_name_string = get_32_be(infile);
-    table_info.columns = get_16_be(infile);
-    table_info.row_width = get_16_be(infile);
-    table_info.rows = get_32_be(infile);
-
-    /* allocate for string table */
-    const int string_table_size =
-        table_info.data_offset-table_info.string_table_offset;
-    string_table = malloc(string_table_size+1);
-    CHECK_ERRNO(!string_table, "malloc");
-    table_info.string_table = string_table;
-    memset(string_table, 0, string_table_size+1);
+    table = malloc(sizeof(struct utf_table));
+    CHECK_ERRNO(!table, "malloc");
+    memset(table, 0, sizeof(struct utf_table));
+
+    table->table_offset = offset;
+    table->table_size = read_32_be(buf+4);
+    CHECK_ERROR(table->table_size < 0x18, "@UTF table too small");
+
+    /* load the whole table at once, no copy needed if mapped */
+    table->encrypted = encrypted;
+    if (source_is_mapped(src) && !encrypted)
+    {
+        table->table = source_get(src, offset+8, table->table_size);
+    }
+    else
+    {
+        table->table_buffer = malloc(table->table_size);
+        CHECK_ERRNO(!table->table_buffer, "malloc");
+        source_get_bytes(src, offset+8, table->table_buffer, table->table_size);
+        if (encrypted)
+        {
+            cri_crypt(cri_variant(), table->table_buffer, table->table_size, key);
+        }
+        table->table = table->table_buffer;
+    }
+
+    const unsigned char * const t = table->table;
+    table->rows_offset = read_32_be(t+0x00);
+    table->string_table_offset = read_32_be(t+0x04);
+    table->data_offset = read_32_be(t+0x08);
+    table->name_offset = read_32_be(t+0x0c);
+    table->columns = read_16_be(t+0x10);
+    table->row_width = read_16_be(t+0x12);
+    table->rows = read_32_be(t+0x14);
+
+    CHECK_ERROR(table->string_table_offset > table->data_offset ||
+            table->data_offset > table->table_size,
+            "string table out of range");
+    CHECK_ERROR(table->rows_offset > table->string_table_offset ||
+            (uint64_t)table->row_width * table->rows >
+            table->string_table_offset - table->rows_offset,
+            "rows out of range");
+
+    /* copy string table */
+    const uint32_t string_table_size =
+        table->data_offset - table->string_table_offset;
+    table->string_table = malloc(string_table_size+1);
+    CHECK_ERRNO(!table->string_table, "malloc");
+    memcpy(table->string_table, t + table->string_table_offset,
+            string_table_size);
+    table->string_table[string_table_size] = '\0';
+    table->string_table_size = string_table_size;
+
+    CHECK_ERROR(table->name_offset > string_table_size,
+            "table name out of range");
+    table->table_name = table->string_table + table->name_offset;
+
+    /* load schema, precompute column offsets */
+    table->schema = malloc(sizeof(struct utf_table_column) * (table->columns+1));
+    CHECK_ERRNO(!table->schema, "malloc");
+    {
+        uint32_t schema_offset = 0x18;
+        uint32_t row_offset = 0;
+        int i;
+
+        for (i = 0; i < table->columns; i++)
+        {
+            struct utf_table_column * const c = &table->schema[i];
+
+            CHECK_ERROR(schema_offset + 5 > table->rows_offset,
+                    "schema out of range");
+            c->type = t[schema_offset];
+            const uint32_t name_offset =
+                read_32_be(t+schema_offset+1);
+            CHECK_ERROR(name_offset > string_table_size,
+                    "column name out of range");
+            c->name = table->string_table + name_offset;
+            schema_offset += 5;
+
+            switch (c->type & COLUMN_STORAGE_MASK)
+            {
+                case COLUMN_STORAGE_PERROW:
+                    CHECK_ERROR(!column_width(c->type), "unknown normal type");
+                    c->offset = row_offset;
+                    row_offset += column_width(c->type);
+                    break;
+                case COLUMN_STORAGE_CONSTANT:
+                    CHECK_ERROR(!column_width(c->type), "unknown type for constant");
+                    c->offset = schema_offset;
+                    schema_offset += column_width(c->type);
+                    CHECK_ERROR(schema_offset > table->rows_offset,
+                            "schema out of range");
+                    break;
+                case COLUMN_STORAGE_ZERO:
+                    c->offset = 0;
+                    break;
+                default:
+                    CHECK_ERROR(1, "unknown storage class");
+            }
+        }
 
-    /* load schema */
-    schema = malloc(sizeof(struct utf_column_info) * table_info.columns);
-    CHECK_ERRNO(!schema, "malloc");
+        CHECK_ERROR(table->rows > 0 && row_offset != table->row_width,
+                "column widths do now add up to row width");
+    }
+
+    /* build column name hash, later duplicates win */
     {
         int i;
-        for (i = 0; i < table_info.columns; i++)
+
+        table->column_hash_size = 1;
+        while (table->column_hash_size < table->columns * 2u)
+        {
+            table->column_hash_size *= 2;
+        }
+
+        table->column_hash = malloc(sizeof(int) * table->column_hash_size);
+        CHECK_ERRNO(!table->column_hash, "malloc");
+        for (i = 0; i < table->column_hash_size; i++)
         {
-            schema[i].type = get_byte(infile);
-            schema[i].column_name = string_table + get_32_be(infile);
+            table->column_hash[i] = -1;
+        }
 
-            if ((schema[i].type & COLUMN_STORAGE_MASK) == COLUMN_STORAGE_CONSTANT)
+        for (i = 0; i < table->columns; i++)
+        {
+            const unsigned int mask = table->column_hash_size - 1;
+            unsigned int slot = hash_column_name(table->schema[i].name) & mask;
+
+            while (table->column_hash[slot] != -1 &&
+                   strcmp(table->schema[table->column_hash[slot]].name,
+                       table->schema[i].name))
             {
-                schema[i].constant_offset = ftell(infile);
-                switch (schema[i].type & COLUMN_TYPE_MASK)
-                {
-                    case COLUMN_TYPE_STRING:
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_8BYTE:
-                    case COLUMN_TYPE_DATA:
-                        get_32_be(infile);
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_FLOAT:
-                    case COLUMN_TYPE_4BYTE2:
-                    case COLUMN_TYPE_4BYTE:
-                        get_32_be(infile);
-                        break;
-                    case COLUMN_TYPE_2BYTE2:
-                    case COLUMN_TYPE_2BYTE:
-                        get_16_be(infile);
-                        break;
-                    case COLUMN_TYPE_1BYTE2:
-                    case COLUMN_TYPE_1BYTE:
-                        get_byte(infile);
-                        break;
-                    default:
-                        CHECK_ERROR(1, "unknown type for constant");
-                }
+                slot = (slot + 1) & mask;
             }
+
+            table->column_hash[slot] = i;
         }
     }
 
-    table_info.schema = schema;
+    return table;
+}
 
-    /* read string table */
-    get_bytes_seek(table_info.string_table_offset+8+offset,
-            infile, (unsigned char *)string_table, string_table_size);
-    table_info.table_name = table_info.string_table+table_name_string;
+struct utf_table *load_utf_table_nofail(struct byte_source *src, const long offset)
+{
+    struct utf_table *table = load_utf_table(src, offset);
 
-#if 0
-    if (print)
+    CHECK_ERROR (!table, "didn't find valid @UTF table where one was expected");
+
+    return table;
+}
+
+void free_utf_table(struct utf_table *table)
+{
+    if (!table)
     {
-        fprintf_table_info(stdout, &table_info, indent);
+        return;
     }
-#endif
 
-    /* fill in the default stuff */
-    result.valid = 1;
-    result.found = 0;
-    result.rows = table_info.rows;
-    result.name_offset = table_name_string;
-    result.string_table_offset = table_info.string_table_offset;
-    result.data_offset = table_info.data_offset;
+    free(table->column_hash);
+    free(table->schema);
+    free(table->string_table);
+    free(table->table_buffer);
+    free(table);
+}
 
-    /* explore the values */
-    if (query || print) {
-        int i, j;
+/* returns -1 if there is no such column */
+int utf_column_index(const struct utf_table *table, const char *name)
+{
+    const unsigned int mask = table->column_hash_size - 1;
+    unsigned int slot = hash_column_name(name) & mask;
 
-        for (i = 0; i < table_info.rows; i++)
+    while (table->column_hash[slot] != -1)
+    {
+        if (!strcmp(table->schema[table->column_hash[slot]].name, name))
         {
-            if (!print && query && i != query->index) continue;
+            return table->column_hash[slot];
+        }
+        slot = (slot + 1) & mask;
+    }
 
-            uint32_t row_offset =
-                table_info.table_offset + 8 + table_info.rows_offset +
-                i * table_info.row_width;
-            const uint32_t row_start_offset = row_offset;
+    return -1;
+}
 
-            if (print)
-            {
-                fprintf_indent(stdout, indent);
-                printf("%s[%d] = {\n", table_info.table_name, i);
-            }
-            indent += INDENT_LEVEL;
-            for (j = 0; j < table_info.columns; j++)
-            {
-                uint8_t type = table_info.schema[j].type;
-                long constant_offset = table_info.schema[j].constant_offset;
-                int constant = 0;
+int utf_column_index_nofail(const struct utf_table *table, const char *name)
+{
+    const int column = utf_column_index(table, name);
 
-                int qthis = (query && i == query->index &&
-                        !strcmp(table_info.schema[j].column_name, query->name));
+    CHECK_ERROR (column < 0, "key not found");
 
-                if (print)
-                {
-                    fprintf_indent(stdout, indent);
-#if 1
-                    printf("%08x %02x %s = ", row_offset-row_start_offset, type, table_info.schema[j].column_name);
-#else
-                    printf("%s = ", table_info.schema[j].column_name);
-#endif
-                }
+    return column;
+}
+
+/* the table as a source, for reading tables nested in its data */
+static struct byte_source *open_utf_table_source(const struct utf_table *table)
+{
+    return open_memory_byte_source(table->table, table->table_offset + 8, table->table_size);
+}
+
+/* returns NULL for zero storage columns */
+static const unsigned char *utf_cell(const struct utf_table *table,
+        int row, int column)
+{
+    CHECK_ERROR (row < 0 || row >= table->rows, "key not found");
+    CHECK_ERROR (column < 0 || column >= table->columns, "key not found");
+
+    const struct utf_table_column * const c = &table->schema[column];
+
+    switch (c->type & COLUMN_STORAGE_MASK)
+    {
+        case COLUMN_STORAGE_PERROW:
+            return table->table + table->rows_offset +
+                (uint32_t)row * table->row_width + c->offset;
+        case COLUMN_STORAGE_CONSTANT:
+            return table->table + c->offset;
+        default:
+            return NULL;
+    }
+}
+
+static inline int utf_column_type(const struct utf_table *table, int column)
+{
+    return table->schema[column].type & COLUMN_TYPE_MASK;
+}
+
+uint64_t utf_table_8byte(const struct utf_table *table, int row, int column)
+{
+    const unsigned char *cell = utf_cell(table, row, column);
+    CHECK_ERROR(utf_column_type(table, column) != COLUMN_TYPE_8BYTE, "value is not an 8 byte uint");
+    return cell ? read_64_be(cell) : 0;
+}
+
+uint32_t utf_table_4byte(const struct utf_table *table, int row, int column)
+{
+    const unsigned char *cell = utf_cell(table, row, column);
+    CHECK_ERROR(utf_column_type(table, column) != COLUMN_TYPE_4BYTE, "value is not a 4 byte uint");
+    return cell ? read_32_be(cell) : 0;
+}
+
+uint16_t utf_table_2byte(const struct utf_table *table, int row, int column)
+{
+    const unsigned char *cell = utf_cell(table, row, column);
+    CHECK_ERROR(utf_column_type(table, column) != COLUMN_TYPE_2BYTE, "value is not a 2 byte uint");
+    return cell ? read_16_be(cell) : 0;
+}
+
+const char *utf_table_string(const struct utf_table *table, int row, int column)
+{
+    const unsigned char *cell = utf_cell(table, row, column);
+    CHECK_ERROR(utf_column_type(table, column) != COLUMN_TYPE_STRING, "value is not a string");
+    const uint32_t string_offset = cell ? read_32_be(cell) : 0;
+    CHECK_ERROR(string_offset > table->string_table_size, "string out of range");
+    return table->string_table + string_offset;
+}
 
-                if (qthis)
+struct offset_size_pair utf_table_data(const struct utf_table *table, int row, int column)
+{
+    struct offset_size_pair result = {0, 0};
+    const unsigned char *cell = utf_cell(table, row, column);
+    CHECK_ERROR(utf_column_type(table, column) != COLUMN_TYPE_DATA, "value is not data");
+    if (cell)
+    {
+        result.offset = read_32_be(cell);
+        result.size = read_32_be(cell+4);
+    }
+    return result;
+}
+
+/* Copy a column out of the rows with a fixed stride, then swap the
+   whole array at once. Data columns are pairs of 4 byte values. */
+static void utf_column_values(const struct utf_table *table, int column,
+        int type, void *values)
+{
+    CHECK_ERROR (column < 0 || column >= table->columns, "key not found");
+    CHECK_ERROR (utf_column_type(table, column) != type, "wrong column type");
+
+    const struct utf_table_column * const c = &table->schema[column];
+    const size_t width = column_width(c->type);
+    const size_t rows = table->rows;
+    unsigned char * const out = values;
+
+    switch (c->type & COLUMN_STORAGE_MASK)
+    {
+        case COLUMN_STORAGE_PERROW:
+            {
+                const unsigned char *in = table->table + table->rows_offset + c->offset;
+                const size_t stride = table->row_width;
+
+                if (stride == width)
                 {
-                    result.found = 1;
-                    result.type = schema[j].type & COLUMN_TYPE_MASK;
+                    memcpy(out, in, rows * width);
+                    break;
                 }
 
-                switch (schema[j].type & COLUMN_STORAGE_MASK)
+                /* constant widths, so each copy is a single move */
+                switch (width)
                 {
-                    case COLUMN_STORAGE_PERROW:
+                    case 8:
+                        for (size_t i = 0; i < rows; i++, in += stride) memcpy(out + i*8, in, 8);
                         break;
-                    case COLUMN_STORAGE_CONSTANT:
-                        constant = 1;
+                    case 4:
+                        for (size_t i = 0; i < rows; i++, in += stride) memcpy(out + i*4, in, 4);
+                        break;
+                    case 2:
+                        for (size_t i = 0; i < rows; i++, in += stride) memcpy(out + i*2, in, 2);
                         break;
-                    case COLUMN_STORAGE_ZERO:
-                        if (print)
-                        {
-                            printf("UNDEFINED\n");
-                        }
-                        if (qthis)
-                        {
-                            memset(&result.value, 0,
-                                    sizeof(result.value));
-                        }
-                        continue;
                     default:
-                        CHECK_ERROR(1, "unknown storage class");
+                        for (size_t i = 0; i < rows; i++, in += stride) out[i] = *in;
+                        break;
                 }
+            }
+            break;
+        case COLUMN_STORAGE_CONSTANT:
+            for (size_t i = 0; i < rows; i++)
+            {
+                memcpy(out + i*width, table->table + c->offset, width);
+            }
+            break;
+        default:
+            memset(out, 0, rows * width);
+            return;
+    }
 
-                if (1)
-                {
-                    long data_offset;
-                    int bytes_read;
+    switch (type)
+    {
+        case COLUMN_TYPE_8BYTE:
+            be_to_host_64(out, rows);
+            break;
+        case COLUMN_TYPE_DATA:
+            be_to_host_32(out, rows * 2);
+            break;
+        case COLUMN_TYPE_4BYTE:
+        case COLUMN_TYPE_STRING:
+            be_to_host_32(out, rows);
+            break;
+        case COLUMN_TYPE_2BYTE:
+            be_to_host_16(out, rows);
+            break;
+    }
+}
+
+void utf_table_column_8byte(const struct utf_table *table, int column, uint64_t *values)
+{
+    utf_column_values(table, column, COLUMN_TYPE_8BYTE, values);
+}
+
+void utf_table_column_4byte(const struct utf_table *table, int column, uint32_t *values)
+{
+    utf_column_values(table, column, COLUMN_TYPE_4BYTE, values);
+}
+
+void utf_table_column_2byte(const struct utf_table *table, int column, uint16_t *values)
+{
+    utf_column_values(table, column, COLUMN_TYPE_2BYTE, values);
+}
+
+void utf_table_column_string(const struct utf_table *table, int column, uint32_t *values)
+{
+    utf_column_values(table, column, COLUMN_TYPE_STRING, values);
+
+    for (uint32_t i = 0; i < table->rows; i++)
+    {
+        CHECK_ERROR(values[i] > table->string_table_size, "string out of range");
+    }
+}
+
+void utf_table_column_data(const struct utf_table *table, int column, struct offset_size_pair *values)
+{
+    /* struct offset_size_pair is laid out as two uint32_t */
+    utf_column_values(table, column, COLUMN_TYPE_DATA, values);
+}
+
+/* returns NULL if the data is empty or not a @UTF table */
+struct utf_table *load_utf_table_data(const struct utf_table *table, int row, int column)
+{
+    const struct offset_size_pair data = utf_table_data(table, row, column);
+
+    if (data.size == 0)
+    {
+        return NULL;
+    }
+
+    CHECK_ERROR((uint64_t)table->data_offset + data.offset + data.size > table->table_size,
+            "data out of range");
+
+    struct byte_source *src = open_utf_table_source(table);
+    struct utf_table *data_table =
+        load_utf_table(src, table->table_offset + 8 + table->data_offset + data.offset);
+    close_byte_source(src);
+
+    return data_table;
+}
+
+static void print_utf_table(struct byte_source *src, const struct utf_table *table, int indent)
+{
+    int i, j;
+
+    for (i = 0; i < table->rows; i++)
+    {
+        const unsigned char * const row =
+            table->table + table->rows_offset + (uint32_t)i * table->row_width;
+        uint32_t row_offset = 0;
+
+        fprintf_indent(stdout, indent);
+        printf("%s[%d] = {\n", table->table_name, i);
+        indent += INDENT_LEVEL;
+        for (j = 0; j < table->columns; j++)
+        {
+            const struct utf_table_column * const c = &table->schema[j];
+            const unsigned char *data;
+            int constant = 0;
+
+            fprintf_indent(stdout, indent);
+#if 1
+            printf("%08x %02x %s = ", row_offset, c->type, c->name);
+#else
+            printf("%s = ", c->name);
+#endif
 
-                    if (constant)
+            switch (c->type & COLUMN_STORAGE_MASK)
+            {
+                case COLUMN_STORAGE_PERROW:
+                    data = row + c->offset;
+                    break;
+                case COLUMN_STORAGE_CONSTANT:
+                    data = table->table + c->offset;
+                    constant = 1;
+                    printf("constant ");
+                    break;
+                default:
+                    printf("UNDEFINED\n");
+                    continue;
+            }
+
+            switch (c->type & COLUMN_TYPE_MASK)
+            {
+                case COLUMN_TYPE_STRING:
                     {
-                        data_offset = constant_offset;
-                        if (print)
-                        {
-                            printf("constant ");
-                        }
+                        const uint32_t string_offset = read_32_be(data);
+                        CHECK_ERROR(string_offset > table->string_table_size,
+                                "string out of range");
+                        printf("\"%s\"\n", table->string_table + string_offset);
                     }
-                    else
+                    break;
+                case COLUMN_TYPE_DATA:
                     {
-                        data_offset = row_offset;
-                    }
+                        const uint32_t vardata_offset = read_32_be(data);
+                        const uint32_t vardata_size = read_32_be(data+4);
 
-                    switch (type & COLUMN_TYPE_MASK)
-                    {
-                        case COLUMN_TYPE_STRING:
-                            {
-                                uint32_t string_offset;
-                                string_offset = get_32_be_seek(data_offset, infile);
-                                bytes_read = 4;
-                                if (print)
-                                {
-                                    printf("\"%s\"\n", table_info.string_table + string_offset);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_string = string_offset;
-                                }
-                            }
-                            break;
-                        case COLUMN_TYPE_DATA:
-                            {
-                                uint32_t vardata_offset, vardata_size;
-
-                                vardata_offset = get_32_be_seek(data_offset, infile);
-                                vardata_size = get_32_be(infile);
-                                bytes_read = 8;
-                                if (print)
-                                {
-                                    printf("[0x%08" PRIx32 "]", vardata_offset);
-                                    printf(" (size 0x%08" PRIx32 ")\n", vardata_size);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_data.offset = vardata_offset;
-                                    result.value.value_data.size = vardata_size;
-                                }
-
-                                if (vardata_size != 0 && print)
-                                {
-                                    /* assume that the data is another table */
-                                    analyze_utf(infile,
-                                            table_info.table_offset + 8 +
-                                            table_info.data_offset +
-                                            vardata_offset,
-                                            indent,
-                                            print,
-                                            NULL
-                                            );
-                                }
-                            }
-                            break;
+                        printf("[0x%08" PRIx32 "]", vardata_offset);
+                        printf(" (size 0x%08" PRIx32 ")\n", vardata_size);
 
-                        case COLUMN_TYPE_8BYTE:
-                            {
-                                uint64_t value =
-                                    get_64_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("0x%" PRIx64 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u64 = value;
-                                }
-                                bytes_read = 8;
-                                break;
-                            }
-                        case COLUMN_TYPE_4BYTE2:
-                            if (print)
-                            {
-                                printf("type 2 ");
-                            }
-                        case COLUMN_TYPE_4BYTE:
-                            {
-                                uint32_t value =
-                                    get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId32 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u32 = value;
-                                }
-                                bytes_read = 4;
-                            }
-                            break;
-                        case COLUMN_TYPE_2BYTE2:
-                            if (print)
-                            {
-                                printf("type 2 ");
-                            }
-                        case COLUMN_TYPE_2BYTE:
-                            {
-                                uint16_t value = 
-                                    get_16_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId16 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u16 = value;
-                                }
-                                bytes_read = 2;
-                            }
-                            break;
-                        case COLUMN_TYPE_FLOAT:
-                            if (sizeof(float) == 4)
-                            {
-                                union {
-                                    float float_value;
-                                    uint32_t int_value;
-                                } int_float;
-
-                                int_float.int_value = get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%f\n", int_float.float_value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_float = int_float.float_value;
-                                }
-                            }
-                            else
-                            {
-                                get_32_be_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("float\n");
-                                }
-                                if (qthis)
-                                {
-                                    CHECK_ERROR(1, "float is wrong size, can't return");
-                                }
-                            }
-                            bytes_read = 4;
-                            break;
-                        case COLUMN_TYPE_1BYTE2:
-                            if (print)
+                        if (vardata_size != 0)
+                        {
+                            /* assume that the data is another table,
+                               an encrypted one continues the key stream
+                               so it has to come from the decrypted copy */
+                            struct byte_source *data_src = src;
+                            if (table->encrypted)
                             {
-                                printf("type 2 ");
+                                data_src = open_utf_table_source(table);
                             }
-                        case COLUMN_TYPE_1BYTE:
+                            analyze_utf(data_src,
+                                    table->table_offset + 8 +
+                                    table->data_offset +
+                                    vardata_offset,
+                                    indent,
+                                    1,
+                                    NULL
+                                    );
+                            if (data_src != src)
                             {
-                                uint8_t value =
-                                    get_byte_seek(data_offset, infile);
-                                if (print)
-                                {
-                                    printf("%" PRId8 "\n", value);
-                                }
-                                if (qthis)
-                                {
-                                    result.value.value_u8 = value;
-                                }
-                                bytes_read = 1;
+                                close_byte_source(data_src);
                             }
-                            break;
-                        default:
-                            CHECK_ERROR(1, "unknown normal type");
+                        }
                     }
+                    break;
+                case COLUMN_TYPE_8BYTE:
+                    printf("0x%" PRIx64 "\n", read_64_be(data));
+                    break;
+                case COLUMN_TYPE_4BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_4BYTE:
+                    printf("%" PRId32 "\n", read_32_be(data));
+                    break;
+                case COLUMN_TYPE_2BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_2BYTE:
+                    printf("%" PRId16 "\n", read_16_be(data));
+                    break;
+                case COLUMN_TYPE_FLOAT:
+                    if (sizeof(float) == 4)
+                    {
+                        union {
+                            float float_value;
+                            uint32_t int_value;
+                        } int_float;
 
-                    if (!constant)
+                        int_float.int_value = read_32_be(data);
+                        printf("%f\n", int_float.float_value);
+                    }
+                    else
                     {
-                        row_offset += bytes_read;
+                        printf("float\n");
                     }
-                } /* useless if end */
-            } /* column for loop end */
-            indent -= INDENT_LEVEL;
-            if (print)
+                    break;
+                case COLUMN_TYPE_1BYTE2:
+                    printf("type 2 ");
+                case COLUMN_TYPE_1BYTE:
+                    printf("%" PRId8 "\n", *data);
+                    break;
+            }
+
+            if (!constant)
             {
-                fprintf_indent(stdout,indent);
-                printf("}\n");
+                row_offset += column_width(c->type);
             }
+        } /* column for loop end */
+        indent -= INDENT_LEVEL;
+        fprintf_indent(stdout,indent);
+        printf("}\n");
+    } /* row for loop end */
+}
 
-            CHECK_ERROR(row_offset - row_start_offset != table_info.row_width,
-                    "column widths do now add up to row width");
+struct utf_query_result analyze_utf(struct byte_source *src, const long offset, int indent, int print, const struct utf_query *query)
+{
+    struct utf_table *table = NULL;
+    struct utf_query_result result;
 
-            if (query && !print && i >= query->index) break;
-        } /* row for loop end */
-    } /* explore values block end */
+    result.valid = 0;
 
-cleanup:
-    indent -= INDENT_LEVEL;
     if (print)
     {
         fprintf_indent(stdout, indent);
-        printf("}\n");
+        printf("{\n");
+    }
+
+    indent += INDENT_LEVEL;
+
+    table = load_utf_table(src, offset);
+    if (!table)
+    {
+        if (print)
+        {
+            fprintf_indent(stdout, indent);
+            printf("not a @UTF table at %08" PRIx32 "\n", (uint32_t)offset);
+        }
+        goto cleanup;
+    }
+
+    /* fill in the default stuff */
+    result.valid = 1;
+    result.found = 0;
+    result.rows = table->rows;
+    result.name_offset = table->name_offset;
+    result.string_table_offset = table->string_table_offset;
+    result.data_offset = table->data_offset;
+
+    if (print)
+    {
+        print_utf_table(src, table, indent);
     }
 
-    if (string_table)
+    if (query && query->index >= 0 && query->index < table->rows)
     {
-        free(string_table);
-        string_table = NULL;
+        const int column = utf_column_index(table, query->name);
+
+        if (column >= 0)
+        {
+            const unsigned char *data = utf_cell(table, query->index, column);
+
+            result.found = 1;
+            result.type = utf_column_type(table, column);
+            memset(&result.value, 0, sizeof(result.value));
+
+            if (data)
+            {
+                switch (result.type)
+                {
+                    case COLUMN_TYPE_STRING:
+                        result.value.value_string = read_32_be(data);
+                        break;
+                    case COLUMN_TYPE_DATA:
+                        result.value.value_data.offset = read_32_be(data);
+                        result.value.value_data.size = read_32_be(data+4);
+                        break;
+                    case COLUMN_TYPE_8BYTE:
+                        result.value.value_u64 = read_64_be(data);
+                        break;
+                    case COLUMN_TYPE_4BYTE2:
+                    case COLUMN_TYPE_4BYTE:
+                        result.value.value_u32 = read_32_be(data);
+                        break;
+                    case COLUMN_TYPE_2BYTE2:
+                    case COLUMN_TYPE_2BYTE:
+                        result.value.value_u16 = read_16_be(data);
+                        break;
+                    case COLUMN_TYPE_FLOAT:
+                        {
+                            union {
+                                float float_value;
+                                uint32_t int_value;
+                            } int_float;
+
+                            CHECK_ERROR(sizeof(float) != 4, "float is wrong size, can't return");
+                            int_float.int_value = read_32_be(data);
+                            result.value.value_float = int_float.float_value;
+                        }
+                        break;
+                    case COLUMN_TYPE_1BYTE2:
+                    case COLUMN_TYPE_1BYTE:
+                        result.value.value_u8 = *data;
+                        break;
+                }
+            }
+        }
     }
 
-    if (schema)
+cleanup:
+    indent -= INDENT_LEVEL;
+    if (print)
     {
-        free(schema);
-        schema = NULL;
+        fprintf_indent(stdout, indent);
+        printf("}\n");
     }
 
+    free_utf_table(table);
+
     return result;
 }
 
@@ -449,14 +740,14 @@ void fprintf_table_info(FILE *outfile, const struct utf_table_info *table_info,
             table_info->row_width * table_info->rows);
 }
 
-struct utf_query_result query_utf(FILE *infile, const long offset, const struct utf_query *query)
+struct utf_query_result query_utf(struct byte_source *src, const long offset, const struct utf_query *query)
 {
-    return analyze_utf(infile, offset, 0, 0, query);
+    return analyze_utf(src, offset, 0, 0, query);
 }
 
-struct utf_query_result query_utf_nofail(FILE *infile, const long offset, const struct utf_query *query)
+struct utf_query_result query_utf_nofail(struct byte_source *src, const long offset, const struct utf_query *query)
 {
-    const struct utf_query_result result = query_utf(infile, offset, query);
+    const struct utf_query_result result = query_utf(src, offset, query);
 
     CHECK_ERROR (!result.valid, "didn't find valid @UTF table where one was expected");
     CHECK_ERROR (query && !result.found, "key not found");
@@ -464,39 +755,39 @@ struct utf_query_result query_utf_nofail(FILE *infile, const long offset, const
     return result;
 }
 
-struct utf_query_result query_utf_key(FILE *infile, const long offset, int index, const char *name)
+struct utf_query_result query_utf_key(struct byte_source *src, const long offset, int index, const char *name)
 {
     struct utf_query query;
     query.index = index;
     query.name = name;
 
-    return query_utf_nofail(infile, offset, &query);
+    return query_utf_nofail(src, offset, &query);
 }
 
-uint64_t query_utf_8byte(FILE *infile, const long offset, int index, const char *name)
+uint64_t query_utf_8byte(struct byte_source *src, const long offset, int index, const char *name)
 {
-    struct utf_query_result result = query_utf_key(infile, offset, index, name);
+    struct utf_query_result result = query_utf_key(src, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_8BYTE, "value is not an 8 byte uint");
     return result.value.value_u64;
 }
 
-uint32_t query_utf_4byte(FILE *infile, const long offset, int index, const char *name)
+uint32_t query_utf_4byte(struct byte_source *src, const long offset, int index, const char *name)
 {
-    struct utf_query_result result = query_utf_key(infile, offset, index, name);
+    struct utf_query_result result = query_utf_key(src, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_4BYTE, "value is not a 4 byte uint");
     return result.value.value_u32;
 }
 
-uint16_t query_utf_2byte(FILE *infile, const long offset, int index, const char *name)
+uint16_t query_utf_2byte(struct byte_source *src, const long offset, int index, const char *name)
 {
-    struct utf_query_result result = query_utf_key(infile, offset, index, name);
+    struct utf_query_result result = query_utf_key(src, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_2BYTE, "value is not a 2 byte uint");
     return result.value.value_u16;
 }
 
-char *load_utf_string_table(FILE *infile, const long offset)
+char *load_utf_string_table(struct byte_source *src, const long offset)
 {
-    const struct utf_query_result result = query_utf_nofail(infile, offset, NULL);
+    const struct utf_query_result result = query_utf_nofail(src, offset, NULL);
 
     const size_t string_table_size = result.data_offset - result.string_table_offset;
     const long string_table_offset = offset + 8 + result.string_table_offset;
@@ -504,7 +795,7 @@ char *load_utf_string_table(FILE *infile, const long offset)
 
     CHECK_ERRNO (!string_table, "malloc");
     memset(string_table, 0, string_table_size+1);
-    get_bytes_seek(string_table_offset, infile,
+    source_get_bytes(src, string_table_offset,
             (unsigned char *)string_table, string_table_size);
 
     return string_table;
@@ -515,18 +806,18 @@ void free_utf_string_table(char *string_table)
     free(string_table);
 }
 
-const char *query_utf_string(FILE *infile, const long offset,
+const char *query_utf_string(struct byte_source *src, const long offset,
         int index, const char *name, const char *string_table)
 {
-    struct utf_query_result result = query_utf_key(infile, offset, index, name);
+    struct utf_query_result result = query_utf_key(src, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_STRING, "value is not a string");
     return string_table + result.value.value_string;
 }
 
-struct offset_size_pair query_utf_data(FILE *infile, const long offset,
+struct offset_size_pair query_utf_data(struct byte_source *src, const long offset,
         int index, const char *name)
 {
-    struct utf_query_result result = query_utf_key(infile, offset, index, name);
+    struct utf_query_result result = query_utf_key(src, offset, index, name);
     CHECK_ERROR(result.type != COLUMN_TYPE_DATA, "value is not data");
     return result.value.value_data;
 }
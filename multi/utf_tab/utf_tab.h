@@ -8,6 +8,7 @@
 #include <string.h>
 
 #include "error_stuff.h"
+#include "byte_source.h"
 
 /* common version across the suite */
 #define VERSION "0.7 beta 3"
@@ -48,35 +49,35 @@ struct utf_query_result
     uint32_t data_offset;
 };
 
-struct utf_query_result analyze_utf(FILE *infile, long offset, int indent,
+struct utf_query_result analyze_utf(struct byte_source *src, long offset, int indent,
         int print, const struct utf_query *query);
 
-struct utf_query_result query_utf(FILE *infile, long offset,
+struct utf_query_result query_utf(struct byte_source *src, long offset,
         const struct utf_query *query);
 
-struct utf_query_result query_utf_nofail(FILE *infile, const long offset,
+struct utf_query_result query_utf_nofail(struct byte_source *src, const long offset,
         const struct utf_query *query);
 
-struct utf_query_result query_utf_key(FILE *infile, const long offset,
+struct utf_query_result query_utf_key(struct byte_source *src, const long offset,
         int index, const char *name);
 
-uint64_t query_utf_8byte(FILE *infile, const long offset,
+uint64_t query_utf_8byte(struct byte_source *src, const long offset,
         int index, const char *name);
 
-uint32_t query_utf_4byte(FILE *infile, const long offset,
+uint32_t query_utf_4byte(struct byte_source *src, const long offset,
         int index, const char *name);
 
-uint16_t query_utf_2byte(FILE *infile, const long offset,
+uint16_t query_utf_2byte(struct byte_source *src, const long offset,
         int index, const char *name);
 
-char *load_utf_string_table(FILE *infile, const long offset);
+char *load_utf_string_table(struct byte_source *src, const long offset);
 
 void free_utf_string_table(char *string_table);
 
-const char *query_utf_string(FILE *infile, const long offset,
+const char *query_utf_string(struct byte_source *src, const long offset,
         int index, const char *name, const char *string_table);
 
-struct offset_size_pair query_utf_data(FILE *infile, const long offset,
+struct offset_size_pair query_utf_data(struct byte_source *src, const long offset,
         int index, const char *name);
 
 #define COLUMN_STORAGE_MASK         0xf0
@@ -125,4 +126,83 @@ struct utf_table_info
 
 void fprintf_table_info(FILE *outfile, const struct utf_table_info *table_info, int indent);
 
+/* A whole @UTF table loaded into memory once, for repeated queries.
+   Cell access is by (row, column index) and does no I/O; look up column
+   indexes by name once with utf_column_index before looping over rows. */
+struct utf_table_column
+{
+    uint8_t type;
+    const char *name;
+    /* for per-row columns, offset within the row,
+       for constant columns, offset within the table */
+    uint32_t offset;
+};
+
+struct utf_table
+{
+    long table_offset;
+    uint32_t table_size;
+    uint32_t rows_offset;
+    uint32_t string_table_offset;
+    uint32_t data_offset;
+    uint32_t name_offset;
+    const char *table_name;
+    uint16_t columns;
+    uint16_t row_width;
+    uint32_t rows;
+
+    /* table contents, starting after the 8 byte @UTF header,
+       points into the source if it is mapped, else into table_buffer */
+    const unsigned char *table;
+    /* decrypted into table_buffer, see cri_variant.h */
+    int encrypted;
+    unsigned char *table_buffer;
+    /* nul terminated copy of the string table */
+    char *string_table;
+    uint32_t string_table_size;
+
+    struct utf_table_column *schema;
+
+    /* column name hash, -1 for an empty slot */
+    int *column_hash;
+    unsigned int column_hash_size;
+};
+
+struct utf_table *load_utf_table(struct byte_source *src, long offset);
+
+struct utf_table *load_utf_table_nofail(struct byte_source *src, long offset);
+
+void free_utf_table(struct utf_table *table);
+
+int utf_column_index(const struct utf_table *table, const char *name);
+
+int utf_column_index_nofail(const struct utf_table *table, const char *name);
+
+uint64_t utf_table_8byte(const struct utf_table *table, int row, int column);
+
+uint32_t utf_table_4byte(const struct utf_table *table, int row, int column);
+
+uint16_t utf_table_2byte(const struct utf_table *table, int row, int column);
+
+const char *utf_table_string(const struct utf_table *table, int row, int column);
+
+struct offset_size_pair utf_table_data(const struct utf_table *table, int row, int column);
+
+/* Whole columns at once, for tables with many rows: values gets one
+   element per row in host order, constant columns are repeated and zero
+   columns are zeros. Strings come back as offsets into string_table. */
+void utf_table_column_8byte(const struct utf_table *table, int column, uint64_t *values);
+
+void utf_table_column_4byte(const struct utf_table *table, int column, uint32_t *values);
+
+void utf_table_column_2byte(const struct utf_table *table, int column, uint16_t *values);
+
+void utf_table_column_string(const struct utf_table *table, int column, uint32_t *values);
+
+void utf_table_column_data(const struct utf_table *table, int column, struct offset_size_pair *values);
+
+/* Load a table stored in a data column. It may point into the memory of
+   the containing table, so free it before that one. */
+struct utf_table *load_utf_table_data(const struct utf_table *table, int row, int column);
+
 #endif /* _UTF_TAB_H_INCLUDED */
@@ -1,41 +1,74 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "utf_tab.h"
+#include "utf_json.h"
 #include "error_stuff.h"
 #include "util.h"
 
-void analyze(FILE *infile, long offset, long file_length);
+void analyze(struct byte_source *src, long offset, long file_length);
 
 int main(int argc, char **argv)
 {
-    printf("utf_view " VERSION "\n\n");
-    CHECK_ERROR(argc != 2 && argc != 3, "Incorrect program usage\n\nusage: utf_tab file [offset]");
+    int json = 0, ndjson = 0;
+    int argi = 1;
+
+    /* structured output is meant for other programs, so no banner */
+    while (argi < argc && argv[argi][0] == '-' && argv[argi][1] == '-')
+    {
+        if (!strcmp(argv[argi], "--json"))
+        {
+            json = 1;
+        }
+        else if (!strcmp(argv[argi], "--ndjson"))
+        {
+            ndjson = 1;
+        }
+        else
+        {
+            break;
+        }
+        argi++;
+    }
+
+    if (!json && !ndjson)
+    {
+        printf("utf_view " VERSION "\n\n");
+    }
+    CHECK_ERROR((json && ndjson) || (argc - argi != 1 && argc - argi != 2),
+            "Incorrect program usage\n\nusage: utf_view [--json | --ndjson] file [offset]\n\n"
+            "--json   : the table as one JSON document\n"
+            "--ndjson : one JSON record per row");
 
     long offset = 0;
-    if (argc == 3)
+    if (argc - argi == 2)
     {
-        offset = read_long(argv[2]);
+        offset = read_long(argv[argi+1]);
     }
 
     /* open file */
-    FILE *infile = fopen(argv[1], "rb");
-    CHECK_ERRNO(!infile, "fopen");
+    struct byte_source *src = open_byte_source(argv[argi]);
 
     /* get file size */
-    CHECK_ERRNO(fseek(infile, 0 , SEEK_END) != 0, "fseek");
-    long file_length = ftell(infile);
-    CHECK_ERRNO(file_length == -1, "ftell");
+    long file_length = src->size;
 
-    rewind(infile);
+    if (json || ndjson)
+    {
+        write_utf_json(src, offset, stdout, ndjson);
+    }
+    else
+    {
+        analyze(src, offset, file_length);
+    }
 
-    analyze(infile, offset, file_length);
+    close_byte_source(src);
 
     exit(EXIT_SUCCESS);
 }
 
-void analyze(FILE *infile, long offset, long file_length)
+void analyze(struct byte_source *src, long offset, long file_length)
 {
     int indent = 0;
 
-    analyze_utf(infile, offset, indent, 1, NULL);
+    analyze_utf(src, offset, indent, 1, NULL);
 }
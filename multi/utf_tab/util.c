@@ -8,13 +8,17 @@
 #include <io.h>
 #endif
 #include <sys/stat.h>
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include "error_stuff.h"
 #include "util.h"
 
-FILE * open_file_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name, const char *perms)
+char * make_path_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name)
 {
-    FILE *f = NULL;
     int dir_len = 0;;
     char * full_name = NULL;
     int full_name_len = 0;
@@ -31,7 +35,7 @@ FILE * open_file_in_directory(const char *base_name, const char *dir_name, const
 
     if (!full_name)
     {
-        return f;
+        return full_name;
     }
 
     // start with the base (from name of archive)
@@ -65,6 +69,19 @@ FILE * open_file_in_directory(const char *base_name, const char *dir_name, const
     full_name[full_name_len++] = DIRSEP;
     strcpy(full_name+full_name_len, file_name);
 
+    return full_name;
+}
+
+FILE * open_file_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name, const char *perms)
+{
+    FILE *f = NULL;
+    char * full_name = make_path_in_directory(base_name, dir_name, orig_sep, file_name);
+
+    if (!full_name)
+    {
+        return f;
+    }
+
     f = fopen(full_name, perms);
 
     free(full_name);
@@ -96,6 +113,63 @@ const char *strip_path(const char *path)
     }
 }
 
+int glob_match(const char *pattern, const char *text)
+{
+    /* backtrack only to the last *, which is enough without classes */
+    const char *star = NULL;
+    const char *star_text = NULL;
+
+    while (*text)
+    {
+        if (*pattern == '*')
+        {
+            star = pattern++;
+            star_text = text;
+        }
+        else if (*pattern == '?' || *pattern == *text)
+        {
+            pattern++;
+            text++;
+        }
+        else if (star)
+        {
+            pattern = star + 1;
+            text = ++star_text;
+        }
+        else
+        {
+            return 0;
+        }
+    }
+
+    while (*pattern == '*')
+    {
+        pattern++;
+    }
+
+    return *pattern == '\0';
+}
+
+char * number_name(const char * name_head, const char * name_tail, unsigned int id, unsigned int max_id)
+{
+    CHECK_ERROR(id > max_id, "id > max");
+
+    int numberlen = 1;
+    for (unsigned int rest = max_id / 10; rest > 0; rest /= 10)
+    {
+        numberlen ++;
+    }
+    size_t namelen = strlen(name_head) + numberlen + strlen(name_tail) + 1;
+
+    char * name = malloc(namelen);
+    CHECK_ERRNO(!name, "malloc");
+
+    snprintf(name, namelen, "%s%0*u%s",
+        name_head, numberlen, id, name_tail);
+
+    return name;
+}
+
 void dump_from_here(FILE *infile, FILE *outfile, size_t size)
 {
     unsigned char buf[0x800];
@@ -122,31 +196,31 @@ void dump(FILE *infile, FILE *outfile, long offset, size_t size)
     dump_from_here(infile, outfile, size);
 }
 
-uint32_t read_32_le(unsigned char bytes[4])
+uint32_t read_32_le(const unsigned char bytes[4])
 {
     uint32_t result = 0;
     for (int i=3; i>=0; i--) result = (result << 8) | bytes[i];
     return result;
 }
-uint16_t read_16_le(unsigned char bytes[2])
+uint16_t read_16_le(const unsigned char bytes[2])
 {
     uint32_t result = 0;
     for (int i=1; i>=0; i--) result = (result << 8) | bytes[i];
     return result;
 }
-uint64_t read_64_be(unsigned char bytes[8])
+uint64_t read_64_be(const unsigned char bytes[8])
 {
     uint64_t result = 0;
     for (int i=0; i<8; i++) result = (result << 8) | bytes[i];
     return result;
 }
-uint32_t read_32_be(unsigned char bytes[4])
+uint32_t read_32_be(const unsigned char bytes[4])
 {
     uint32_t result = 0;
     for (int i=0; i<4; i++) result = (result << 8) | bytes[i];
     return result;
 }
-uint16_t read_16_be(unsigned char bytes[2])
+uint16_t read_16_be(const unsigned char bytes[2])
 {
     uint32_t result = 0;
     for (int i=0; i<2; i++) result = (result << 8) | bytes[i];
@@ -173,6 +247,100 @@ void write_16_le(uint16_t value, unsigned char bytes[2])
     for (int i=0; i<2; i++, value >>= 8) bytes[i] = value & 0xff;
 }
 
+/* In-place conversion of arrays of big endian values to host order,
+   the vector paths are only built for (little endian) x86. */
+void be_to_host_16(unsigned char *buf, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i shuffle = _mm256_setr_epi8(
+            1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14,
+            1,0,3,2,5,4,7,6,9,8,11,10,13,12,15,14);
+    for (; i + 16 <= count; i += 16)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i*2));
+        _mm256_storeu_si256((__m256i *)(buf + i*2), _mm256_shuffle_epi8(v, shuffle));
+    }
+#elif defined(__SSE2__)
+    for (; i + 8 <= count; i += 8)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i*2));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(buf + i*2), v);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const uint16_t value = read_16_be(buf + i*2);
+        memcpy(buf + i*2, &value, 2);
+    }
+}
+
+void be_to_host_32(unsigned char *buf, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i shuffle = _mm256_setr_epi8(
+            3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12,
+            3,2,1,0,7,6,5,4,11,10,9,8,15,14,13,12);
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i*4));
+        _mm256_storeu_si256((__m256i *)(buf + i*4), _mm256_shuffle_epi8(v, shuffle));
+    }
+#elif defined(__SSE2__)
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i*4));
+        /* swap the 16-bit halves, then the bytes within them */
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2,3,0,1));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2,3,0,1));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(buf + i*4), v);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const uint32_t value = read_32_be(buf + i*4);
+        memcpy(buf + i*4, &value, 4);
+    }
+}
+
+void be_to_host_64(unsigned char *buf, size_t count)
+{
+    size_t i = 0;
+
+#if defined(__AVX2__)
+    const __m256i shuffle = _mm256_setr_epi8(
+            7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8,
+            7,6,5,4,3,2,1,0,15,14,13,12,11,10,9,8);
+    for (; i + 4 <= count; i += 4)
+    {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(buf + i*8));
+        _mm256_storeu_si256((__m256i *)(buf + i*8), _mm256_shuffle_epi8(v, shuffle));
+    }
+#elif defined(__SSE2__)
+    for (; i + 2 <= count; i += 2)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(buf + i*8));
+        v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(0,1,2,3));
+        v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(0,1,2,3));
+        v = _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+        _mm_storeu_si128((__m128i *)(buf + i*8), v);
+    }
+#endif
+
+    for (; i < count; i++)
+    {
+        const uint64_t value = read_64_be(buf + i*8);
+        memcpy(buf + i*8, &value, 8);
+    }
+}
+
 uint8_t get_byte(FILE *infile)
 {
     unsigned char buf[1];
@@ -17,24 +17,40 @@
 
 void make_directory(const char *name);
 
+/* creates the directories along the way, returns a malloc'd path */
+char * make_path_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name);
+
 FILE * open_file_in_directory(const char *base_name, const char *dir_name, const char orig_sep, const char *file_name, const char *perms);
 
 const char * strip_path(const char * path);
 
+/* shell style pattern, * matches any run of characters (including /),
+   ? any one character; returns nonzero on a match */
+int glob_match(const char *pattern, const char *text);
+
+/* name_head, id padded with zeros to as many digits as max_id, name_tail;
+   returns a malloc'd string */
+char * number_name(const char * name_head, const char * name_tail, unsigned int id, unsigned int max_id);
+
 void dump(FILE *infile, FILE *outfile, long offset, size_t size);
 
 void dump_from_here(FILE *infile, FILE *outfile, size_t size);
 
-uint32_t read_32_le(unsigned char bytes[4]);
-uint16_t read_16_le(unsigned char bytes[2]);
-uint64_t read_64_be(unsigned char bytes[8]);
-uint32_t read_32_be(unsigned char bytes[4]);
-uint16_t read_16_be(unsigned char bytes[2]);
+uint32_t read_32_le(const unsigned char bytes[4]);
+uint16_t read_16_le(const unsigned char bytes[2]);
+uint64_t read_64_be(const unsigned char bytes[8]);
+uint32_t read_32_be(const unsigned char bytes[4]);
+uint16_t read_16_be(const unsigned char bytes[2]);
 void write_32_be(uint32_t value, unsigned char bytes[4]);
 void write_32_le(uint32_t value, unsigned char bytes[4]);
 void write_16_be(uint16_t value, unsigned char bytes[2]);
 void write_16_le(uint16_t value, unsigned char bytes[2]);
 
+/* in place, count values */
+void be_to_host_16(unsigned char *buf, size_t count);
+void be_to_host_32(unsigned char *buf, size_t count);
+void be_to_host_64(unsigned char *buf, size_t count);
+
 uint8_t get_byte(FILE *infile);
 uint8_t get_byte_seek(long offset, FILE *infile);
 uint16_t get_16_be(FILE *infile);
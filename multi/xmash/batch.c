@@ -0,0 +1,471 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __MINGW32__
+#include <io.h>
+#define NULL_DEVICE "NUL"
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <pthread.h>
+#define NULL_DEVICE "/dev/null"
+#endif
+
+#include "batch.h"
+#include "util.h"
+#include "error_stuff.h"
+
+// run xmash over a whole directory tree
+
+struct batch_file
+{
+    char *path;
+    char *sub_dir;
+    long size;
+    int format;
+};
+
+struct batch_run
+{
+    const char *root;
+    batch_file_callback_t *cb;
+    void *cbv;
+    const char * const *format_names;
+
+    struct batch_file *files;
+    long file_count;
+    long files_allocated;
+
+    FILE *report;
+#ifndef __MINGW32__
+    pthread_mutex_t report_lock;
+#endif
+};
+
+// a joined with b by DIRSEP, either may be empty
+static char *join_path(const char *a, const char *b)
+{
+    const size_t a_len = strlen(a);
+    const size_t b_len = strlen(b);
+    char *joined = malloc(a_len + 1 + b_len + 1);
+    CHECK_ERRNO(!joined, "malloc");
+
+    strcpy(joined, a);
+    if (a_len > 0 && b_len > 0)
+    {
+        joined[a_len] = DIRSEP;
+        strcpy(joined + a_len + 1, b);
+    }
+    else
+    {
+        strcpy(joined + a_len, b);
+    }
+
+    return joined;
+}
+
+static void add_file(struct batch_run *run, char *path, const char *sub_dir, long size)
+{
+    if (run->file_count == run->files_allocated)
+    {
+        run->files_allocated = run->files_allocated ? run->files_allocated * 2 : 64;
+        run->files = realloc(run->files, sizeof(struct batch_file) * run->files_allocated);
+        CHECK_ERRNO(!run->files, "realloc");
+    }
+
+    struct batch_file *f = &run->files[run->file_count++];
+    f->path = path;
+    f->sub_dir = join_path(sub_dir, "");
+    f->size = size;
+    f->format = -1;
+}
+
+// collect everything under root/sub_dir, symlinks aren't followed so a
+// link loop can't run away with us
+static void walk_directory(struct batch_run *run, const char *sub_dir)
+{
+    char *dir_path = join_path(run->root, sub_dir);
+    DIR *dir = opendir(dir_path);
+
+    if (!dir)
+    {
+        fprintf(stderr, "couldn't open directory %s, skipping\n", dir_path);
+        free(dir_path);
+        return;
+    }
+
+    for (struct dirent *de; NULL != (de = readdir(dir)); )
+    {
+        if (!strcmp(de->d_name, ".") || !strcmp(de->d_name, ".."))
+        {
+            continue;
+        }
+
+        char *child_sub_dir = join_path(sub_dir, de->d_name);
+        char *path = join_path(dir_path, de->d_name);
+        struct stat st;
+
+#ifdef __MINGW32__
+        const int rc = stat(path, &st);
+#else
+        const int rc = lstat(path, &st);
+#endif
+        if (0 != rc)
+        {
+            fprintf(stderr, "couldn't stat %s, skipping\n", path);
+            free(path);
+        }
+        else if (S_ISDIR(st.st_mode))
+        {
+            free(path);
+            walk_directory(run, child_sub_dir);
+        }
+        else if (S_ISREG(st.st_mode))
+        {
+            add_file(run, path, sub_dir, st.st_size);
+        }
+        else
+        {
+            free(path);
+        }
+
+        free(child_sub_dir);
+    }
+
+    closedir(dir);
+    free(dir_path);
+}
+
+static int compare_paths(const void *a, const void *b)
+{
+    const struct batch_file *fa = a, *fb = b;
+    return strcmp(fa->path, fb->path);
+}
+
+// hand the file's contents to the callback, returns the format
+static int process_file(const struct batch_run *run, const struct batch_file *f)
+{
+    int format = -1;
+
+    if (f->size == 0)
+    {
+        return -1;
+    }
+
+#ifndef __MINGW32__
+    // mapped, so the pages can go back to the cache as soon as they've
+    // been looked at and only what's in use counts against memory
+    const int fd = open(f->path, O_RDONLY);
+    if (-1 == fd)
+    {
+        return -1;
+    }
+
+    struct stat st;
+    if (0 != fstat(fd, &st) || st.st_size == 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    const long size = st.st_size;
+    void *data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (MAP_FAILED == data)
+    {
+        return -1;
+    }
+
+    format = run->cb(data, size, f->path, f->sub_dir, run->cbv);
+
+    munmap(data, size);
+#else
+    FILE *infile = fopen(f->path, "rb");
+    if (!infile)
+    {
+        return -1;
+    }
+
+    long size;
+    uint8_t *data = get_whole_file(infile, &size);
+    fclose(infile);
+
+    format = run->cb(data, size, f->path, f->sub_dir, run->cbv);
+
+    free(data);
+#endif
+
+    return format;
+}
+
+static void do_file(struct batch_run *run, long i)
+{
+    struct batch_file *f = &run->files[i];
+
+    f->format = process_file(run, f);
+
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_lock(&run->report_lock), "pthread_mutex_lock");
+#endif
+    fprintf(run->report, "%-14s %s\n",
+            (f->format >= 0) ? run->format_names[f->format] : "failed", f->path);
+    fflush(run->report);
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_unlock(&run->report_lock), "pthread_mutex_unlock");
+#endif
+}
+
+#ifndef __MINGW32__
+// Files vary in size by orders of magnitude, so a fixed split of the list
+// leaves threads idle at the end. Each worker starts with an even share
+// of the list as a range and works from the front of it; when it runs
+// dry it takes the back half of some other worker's range.
+
+struct batch_worker
+{
+    pthread_mutex_t lock;
+    long next;
+    long end;
+
+    int id;
+    struct batch_pool *pool;
+};
+
+struct batch_pool
+{
+    struct batch_run *run;
+    struct batch_worker *workers;
+    int threads;
+};
+
+// returns the next file for this worker, -1 when there are none left
+static long take_file(struct batch_worker *w)
+{
+    struct batch_pool *pool = w->pool;
+    long i = -1;
+
+    CHECK_ERROR(0 != pthread_mutex_lock(&w->lock), "pthread_mutex_lock");
+    if (w->next < w->end)
+    {
+        i = w->next++;
+    }
+    CHECK_ERROR(0 != pthread_mutex_unlock(&w->lock), "pthread_mutex_unlock");
+
+    for (int k = 1; i == -1 && k < pool->threads; k++)
+    {
+        struct batch_worker *victim = &pool->workers[(w->id + k) % pool->threads];
+        long start = 0, count = 0;
+
+        CHECK_ERROR(0 != pthread_mutex_lock(&victim->lock), "pthread_mutex_lock");
+        count = (victim->end - victim->next + 1) / 2;
+        if (count > 0)
+        {
+            start = victim->end - count;
+            victim->end = start;
+        }
+        CHECK_ERROR(0 != pthread_mutex_unlock(&victim->lock), "pthread_mutex_unlock");
+
+        if (count > 0)
+        {
+            CHECK_ERROR(0 != pthread_mutex_lock(&w->lock), "pthread_mutex_lock");
+            w->next = start + 1;
+            w->end = start + count;
+            CHECK_ERROR(0 != pthread_mutex_unlock(&w->lock), "pthread_mutex_unlock");
+            i = start;
+        }
+    }
+
+    return i;
+}
+
+static void *batch_worker(void *v)
+{
+    struct batch_worker *w = v;
+
+    for (long i; -1 != (i = take_file(w)); )
+    {
+        do_file(w->pool->run, i);
+    }
+
+    return NULL;
+}
+
+static void run_batch_pool(struct batch_run *run, int threads)
+{
+    struct batch_pool pool;
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+    CHECK_ERRNO(!thread_ids, "malloc");
+
+    pool.run = run;
+    pool.threads = threads;
+    pool.workers = malloc(sizeof(struct batch_worker) * threads);
+    CHECK_ERRNO(!pool.workers, "malloc");
+
+    for (int i = 0; i < threads; i++)
+    {
+        struct batch_worker *w = &pool.workers[i];
+
+        CHECK_ERROR(0 != pthread_mutex_init(&w->lock, NULL), "pthread_mutex_init");
+        w->next = run->file_count * i / threads;
+        w->end = run->file_count * (i + 1) / threads;
+        w->id = i;
+        w->pool = &pool;
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        CHECK_ERROR(0 != pthread_create(&thread_ids[i], NULL, batch_worker, &pool.workers[i]), "pthread_create");
+    }
+    for (int i = 0; i < threads; i++)
+    {
+        CHECK_ERROR(0 != pthread_join(thread_ids[i], NULL), "pthread_join");
+    }
+
+    for (int i = 0; i < threads; i++)
+    {
+        pthread_mutex_destroy(&pool.workers[i].lock);
+    }
+    free(pool.workers);
+    free(thread_ids);
+}
+#endif
+
+static double seconds_now(void)
+{
+#ifndef __MINGW32__
+    struct timespec ts;
+    CHECK_ERRNO(0 != clock_gettime(CLOCK_MONOTONIC, &ts), "clock_gettime");
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+    // wall clock time on Windows
+    return (double)clock() / CLOCKS_PER_SEC;
+#endif
+}
+
+// The extractors print as they go, from several threads at once that
+// would be an unreadable mess, so stdout is pointed at the null device
+// and the report goes where stdout used to.
+static FILE *take_over_stdout(void)
+{
+    fflush(stdout);
+#ifdef __MINGW32__
+    FILE *report = _fdopen(_dup(_fileno(stdout)), "w");
+#else
+    FILE *report = fdopen(dup(fileno(stdout)), "w");
+#endif
+    CHECK_ERRNO(!report, "duplicating stdout");
+    CHECK_ERRNO(!freopen(NULL_DEVICE, "w", stdout), "freopen " NULL_DEVICE);
+
+    return report;
+}
+
+long run_batch(const char *root, int threads, batch_file_callback_t *cb, void *cbv,
+        const char * const *format_names, int format_count)
+{
+    struct batch_run run;
+    long failed = 0;
+    double total_bytes = 0;
+
+    run.root = root;
+    run.cb = cb;
+    run.cbv = cbv;
+    run.format_names = format_names;
+    run.files = NULL;
+    run.file_count = 0;
+    run.files_allocated = 0;
+
+    walk_directory(&run, "");
+    qsort(run.files, run.file_count, sizeof(struct batch_file), compare_paths);
+
+    run.report = take_over_stdout();
+
+    const double start_time = seconds_now();
+
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_init(&run.report_lock, NULL), "pthread_mutex_init");
+    if (threads > run.file_count)
+    {
+        threads = run.file_count;
+    }
+    if (threads > 1)
+    {
+        run_batch_pool(&run, threads);
+    }
+    else
+#endif
+    {
+        for (long i = 0; i < run.file_count; i++)
+        {
+            do_file(&run, i);
+        }
+    }
+
+    const double elapsed = seconds_now() - start_time;
+
+    // summary
+    long *format_counts = calloc(format_count, sizeof(long));
+    CHECK_ERRNO(!format_counts, "calloc");
+
+    for (long i = 0; i < run.file_count; i++)
+    {
+        total_bytes += run.files[i].size;
+        if (run.files[i].format >= 0)
+        {
+            format_counts[run.files[i].format] ++;
+        }
+        else
+        {
+            failed ++;
+        }
+    }
+
+    fprintf(run.report, "------------------\n");
+    for (int i = 0; i < format_count; i++)
+    {
+        fprintf(run.report, "%-14s %ld\n", format_names[i], format_counts[i]);
+    }
+    fprintf(run.report, "%-14s %ld\n", "failed", failed);
+    fprintf(run.report, "%ld files, %.1f MB in %.2f s",
+            run.file_count, total_bytes / (1024 * 1024), elapsed);
+    if (elapsed > 0)
+    {
+        fprintf(run.report, " (%.1f MB/s)", total_bytes / (1024 * 1024) / elapsed);
+    }
+    fprintf(run.report, "\n");
+
+    if (failed > 0)
+    {
+        fprintf(run.report, "\nfailed:\n");
+        for (long i = 0; i < run.file_count; i++)
+        {
+            if (run.files[i].format < 0)
+            {
+                fprintf(run.report, "%s\n", run.files[i].path);
+            }
+        }
+    }
+
+    CHECK_ERRNO(EOF == fclose(run.report), "fclose report");
+
+#ifndef __MINGW32__
+    pthread_mutex_destroy(&run.report_lock);
+#endif
+    for (long i = 0; i < run.file_count; i++)
+    {
+        free(run.files[i].path);
+        free(run.files[i].sub_dir);
+    }
+    free(run.files);
+    free(format_counts);
+
+    return failed;
+}
@@ -0,0 +1,18 @@
+#ifndef _BATCH_H_INCLUDED
+#define _BATCH_H_INCLUDED
+
+#include <stdint.h>
+
+// called for each file with its contents, sub_dir is the directory the
+// file is in relative to the root ("" at the root); returns an index
+// into the format names, or -1 if nothing could be done with the file
+typedef int batch_file_callback_t(const uint8_t *data, long size, const char *path, const char *sub_dir, void *cbv);
+
+// Run cb over every file under root, on that many threads. Files are
+// mapped rather than read in where possible. Whatever the callbacks
+// print on stdout is discarded; stdout gets a line per file and a
+// summary instead. Returns the number of files that failed.
+long run_batch(const char *root, int threads, batch_file_callback_t *cb, void *cbv,
+        const char * const *format_names, int format_count);
+
+#endif // _BATCH_H_INCLUDED
@@ -6,9 +6,12 @@
 #include "util.h"
 #include "bitstream.h"
 
+// Both directions keep up to 64 bits in a word, MSB aligned, and move
+// whole bytes between it and memory.
+
 struct bitstream_reader
 {
-    const uint8_t *pool;
+    const uint8_t *pool;    // bytes not yet in the cache
     size_t pool_size;
 
     // parameters of the layout
@@ -17,8 +20,11 @@ struct bitstream_reader
 
     // current state
     size_t consecutive_bits_left;
-    uint8_t bit_buffer;
-    unsigned int bits_left; // in buffer
+    uint64_t cache;
+    unsigned int cache_bits;
+
+    // set when a read ran off the end, reads then return zeroes
+    int underflow;
 };
 
 struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_size, size_t consecutive_bits, size_t skip_bits)
@@ -31,69 +37,179 @@ struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_
     bs->consecutive_bits = bs->consecutive_bits_left = consecutive_bits;
     bs->skip_bits = skip_bits;
 
-    bs->bits_left = 0;
+    bs->cache = 0;
+    bs->cache_bits = 0;
+    bs->underflow = 0;
 
     return bs;
 }
 
-unsigned int get_bit(struct bitstream_reader *bs)
+// top up the cache with as many whole bytes as fit
+static void refill(struct bitstream_reader *bs)
 {
-    if (bs->consecutive_bits && bs->consecutive_bits_left == 0)
+    if (bs->pool_size >= 8)
     {
-        // hit the end of a packet, skip over the skip bits
-        bs->consecutive_bits_left = bs->skip_bits;
-        // recursive call to throw away bits
-        while (bs->consecutive_bits_left) get_bit(bs);
+        const unsigned int bytes = (64 - bs->cache_bits) / 8;
 
-        bs->consecutive_bits_left = bs->consecutive_bits;
+        bs->cache |= read_64_be(bs->pool) >> bs->cache_bits;
+        bs->cache_bits += bytes * 8;
+        if (bs->cache_bits < 64)
+        {
+            // drop the partial byte that came along
+            bs->cache &= ~(UINT64_MAX >> bs->cache_bits);
+        }
+        bs->pool += bytes;
+        bs->pool_size -= bytes;
     }
+    else
+    {
+        while (bs->cache_bits <= 56 && bs->pool_size > 0)
+        {
+            bs->cache |= (uint64_t)*(bs->pool++) << (56 - bs->cache_bits);
+            bs->cache_bits += 8;
+            bs->pool_size --;
+        }
+    }
+}
 
-    if (0 == bs->bits_left)
+// at most 57 bits, ignoring the packet layout
+static uint64_t take_bits(struct bitstream_reader *bs, unsigned int bits)
+{
+    if (0 == bits)
     {
-        CHECK_ERROR(0 == bs->pool_size, "bitstream underflow");
-        bs->bit_buffer = *(bs->pool++);
-        bs->bits_left = 8;
+        return 0;
+    }
 
-        bs->pool_size --;
+    if (bs->cache_bits < bits)
+    {
+        refill(bs);
+        if (bs->cache_bits < bits)
+        {
+            bs->underflow = 1;
+            bs->cache = 0;
+            bs->cache_bits = 0;
+            return 0;
+        }
     }
-    bs->bits_left --;
-    if (bs->consecutive_bits) bs->consecutive_bits_left --;
-    return ( ( bs->bit_buffer & ( 1 << bs->bits_left ) ) != 0);
+
+    const uint64_t value = bs->cache >> (64 - bits);
+    bs->cache <<= bits;
+    bs->cache_bits -= bits;
+
+    return value;
+}
+
+// any number of bits, ignoring the packet layout
+static void drop_bits(struct bitstream_reader *bs, size_t bits)
+{
+    if (bits <= bs->cache_bits)
+    {
+        if (bits > 0)
+        {
+            bs->cache = (bits < 64) ? bs->cache << bits : 0;
+            bs->cache_bits -= bits;
+        }
+        return;
+    }
+
+    // empty the cache and step over whole bytes in the pool
+    bits -= bs->cache_bits;
+    bs->cache = 0;
+    bs->cache_bits = 0;
+
+    if (bits / 8 > bs->pool_size)
+    {
+        bs->underflow = 1;
+        bs->pool_size = 0;
+        return;
+    }
+    bs->pool += bits / 8;
+    bs->pool_size -= bits / 8;
+
+    take_bits(bs, bits % 8);
+}
+
+// bits that can be read before the next packet boundary
+static inline size_t packet_bits_left(struct bitstream_reader *bs, size_t bits)
+{
+    if (!bs->consecutive_bits)
+    {
+        return bits;
+    }
+
+    if (0 == bs->consecutive_bits_left)
+    {
+        // hit the end of a packet, skip over the skip bits
+        drop_bits(bs, bs->skip_bits);
+        bs->consecutive_bits_left = bs->consecutive_bits;
+    }
+
+    return (bits < bs->consecutive_bits_left) ? bits : bs->consecutive_bits_left;
+}
+
+unsigned int get_bit(struct bitstream_reader *bs)
+{
+    return get_bits(bs, 1);
 }
 
 uint32_t get_bits(struct bitstream_reader *bs, unsigned int bits)
 {
     CHECK_ERROR( bits > 32, "max 32 bits" );
 
-    uint32_t total = 0;
+    uint64_t total = 0;
 
-    for (unsigned int i = 0; i < bits; i++)
+    while (bits > 0)
     {
-        total <<= 1;
+        const unsigned int chunk = packet_bits_left(bs, bits);
 
-        if (get_bit(bs))
-        {
-            total |= 1;
-        }
+        total = (total << chunk) | take_bits(bs, chunk);
+
+        if (bs->consecutive_bits) bs->consecutive_bits_left -= chunk;
+        bits -= chunk;
     }
 
     return total;
 }
 
+void discard_bits(struct bitstream_reader *bs, size_t bits)
+{
+    while (bits > 0 && !bs->underflow)
+    {
+        const size_t chunk = packet_bits_left(bs, bits);
+
+        drop_bits(bs, chunk);
+
+        if (bs->consecutive_bits) bs->consecutive_bits_left -= chunk;
+        bits -= chunk;
+    }
+}
+
+int bitstream_underflow(const struct bitstream_reader *bs)
+{
+    return bs->underflow;
+}
+
 void free_bitstream_reader(struct bitstream_reader *bs)
 {
     free(bs);
 }
 
+////////////////
+
+#define WRITER_BUFFER_SIZE 0x10000
+
 struct bitstream_writer
 {
-    FILE *outfile;
+    FILE *outfile;  // NULL to keep everything in the buffer
 
-    uint8_t bit_buffer;
-    unsigned int bits_used;
-};
+    uint64_t cache;
+    unsigned int cache_bits;
 
-////////////////
+    // whole bytes waiting to be written
+    uint8_t *buffer;
+    size_t buffer_used;
+    size_t buffer_size;
+};
 
 struct bitstream_writer *init_bitstream_writer(FILE *outfile)
 {
@@ -102,51 +218,127 @@ struct bitstream_writer *init_bitstream_writer(FILE *outfile)
     CHECK_ERRNO(!bs, "malloc");
 
     bs->outfile = outfile;
-    
-    bs->bit_buffer = 0;
-    bs->bits_used = 0;
+
+    bs->cache = 0;
+    bs->cache_bits = 0;
+
+    bs->buffer = malloc(WRITER_BUFFER_SIZE);
+    CHECK_ERRNO(!bs->buffer, "malloc");
+    bs->buffer_used = 0;
+    bs->buffer_size = WRITER_BUFFER_SIZE;
 
     return bs;
 }
 
-void put_bit(struct bitstream_writer *bs, unsigned int val)
+struct bitstream_writer *init_bitstream_writer_memory(void)
+{
+    return init_bitstream_writer(NULL);
+}
+
+static void write_buffer(struct bitstream_writer *bs)
 {
-    if (8 == bs->bits_used)
+    if (!bs->outfile)
     {
-        flush_bitstream_writer(bs);
+        // in memory, just grow
+        uint8_t *buffer = realloc(bs->buffer, bs->buffer_size * 2);
+        CHECK_ERRNO(!buffer, "realloc");
+        bs->buffer = buffer;
+        bs->buffer_size *= 2;
+        return;
     }
 
-    if (val)
+    put_bytes(bs->outfile, bs->buffer, bs->buffer_used);
+    bs->buffer_used = 0;
+}
+
+// move whole bytes from the cache to the buffer
+static void drain(struct bitstream_writer *bs)
+{
+    if (bs->buffer_size - bs->buffer_used < 8)
     {
-        bs->bit_buffer |= (0x80 >> bs->bits_used);
+        write_buffer(bs);
     }
 
-    bs->bits_used ++;
+    const unsigned int bytes = bs->cache_bits / 8;
+
+    write_32_be(bs->cache >> 32, bs->buffer + bs->buffer_used);
+    write_32_be(bs->cache, bs->buffer + bs->buffer_used + 4);
+    bs->buffer_used += bytes;
+
+    bs->cache = (bytes < 8) ? bs->cache << (bytes * 8) : 0;
+    bs->cache_bits -= bytes * 8;
+}
+
+void put_bit(struct bitstream_writer *bs, unsigned int val)
+{
+    put_bits(bs, (val != 0), 1);
 }
 
 void put_bits(struct bitstream_writer *bs, uint32_t val, unsigned int bits)
 {
     CHECK_ERROR( bits > 32, "max 32 bits" );
 
-    for (unsigned int i = 0; i < bits; i++)
+    if (0 == bits)
+    {
+        return;
+    }
+
+    if (bs->cache_bits + bits > 64)
     {
-        put_bit(bs, val & (1 << (bits-1-i)));
+        drain(bs);
     }
+
+    const uint64_t masked = val & (UINT32_MAX >> (32 - bits));
+    bs->cache |= masked << (64 - bs->cache_bits - bits);
+    bs->cache_bits += bits;
 }
 
-void flush_bitstream_writer(struct bitstream_writer *bs)
+void copy_bits(struct bitstream_reader *ibs, struct bitstream_writer *obs, size_t bits)
 {
-    if (0 != bs->bits_used)
+    // a bad length could ask for a lot, give up once the input is gone
+    for (; bits >= 32 && !ibs->underflow; bits -= 32)
     {
-        int rc = fputc(bs->bit_buffer, bs->outfile);
-        CHECK_FILE(EOF == rc, bs->outfile, "fputc");
+        put_bits(obs, get_bits(ibs, 32), 32);
+    }
+    put_bits(obs, get_bits(ibs, bits), bits);
+}
+
+void append_bitstream_writer(struct bitstream_writer *bs, const struct bitstream_writer *src)
+{
+    CHECK_ERROR(src->outfile, "can only append from memory");
 
-        bs->bit_buffer = 0;
-        bs->bits_used = 0;
+    size_t i = 0;
+    for (; i + 4 <= src->buffer_used; i += 4)
+    {
+        put_bits(bs, read_32_be(src->buffer + i), 32);
+    }
+    for (; i < src->buffer_used; i++)
+    {
+        put_bits(bs, src->buffer[i], 8);
+    }
+
+    // then what is still in the cache, put_bits keeps the low bits
+    if (src->cache_bits > 32)
+    {
+        put_bits(bs, src->cache >> 32, 32);
+        put_bits(bs, (src->cache << 32) >> (96 - src->cache_bits), src->cache_bits - 32);
     }
+    else if (src->cache_bits > 0)
+    {
+        put_bits(bs, src->cache >> (64 - src->cache_bits), src->cache_bits);
+    }
+}
+
+void flush_bitstream_writer(struct bitstream_writer *bs)
+{
+    // pad out the last byte with zeroes
+    bs->cache_bits = (bs->cache_bits + 7) & ~7u;
+    drain(bs);
+    write_buffer(bs);
 }
 
 void free_bitstream_writer(struct bitstream_writer *bs)
 {
+    free(bs->buffer);
     free(bs);
 }
@@ -2,6 +2,11 @@
 #define _BITSTREAM_H_INCLUDED
 
 #include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 // MSB first
 
@@ -11,15 +16,29 @@ struct bitstream_reader;
 struct bitstream_reader *init_bitstream_reader(const uint8_t *pool, size_t pool_size, size_t consecutive_bits, size_t skip_bits);
 unsigned int get_bit(struct bitstream_reader *bs);
 uint32_t get_bits(struct bitstream_reader *bs, unsigned int bits);
+void discard_bits(struct bitstream_reader *bs, size_t bits);
+// reading past the end of the pool doesn't stop the program, it sets
+// this and later reads return zeroes
+int bitstream_underflow(const struct bitstream_reader *bs);
 void free_bitstream_reader(struct bitstream_reader *bs);
 
 // bitstream writing
 struct bitstream_writer;
 
 struct bitstream_writer *init_bitstream_writer(FILE *outfile);
+struct bitstream_writer *init_bitstream_writer_memory(void);
 void put_bit(struct bitstream_writer *bs, unsigned int val);
 void put_bits(struct bitstream_writer *bs, uint32_t val, unsigned int bits);
 void flush_bitstream_writer(struct bitstream_writer *bs);
 void free_bitstream_writer(struct bitstream_writer *bs);
 
+// move bits straight from a reader to a writer
+void copy_bits(struct bitstream_reader *ibs, struct bitstream_writer *obs, size_t bits);
+// add everything written so far to an in-memory writer, no padding
+void append_bitstream_writer(struct bitstream_writer *bs, const struct bitstream_writer *src);
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* _BISTREAM_H_INCLUDED */
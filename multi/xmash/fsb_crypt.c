@@ -0,0 +1,235 @@
+#include <stdint.h>
+#include <string.h>
+#if (defined(__x86_64__) || defined(__i386__)) && \
+    ((defined(__GNUC__) && __GNUC__ >= 5) || defined(__clang__))
+// the vector versions are compiled for their own target, so the intrinsics
+// are usable without -mavx2 and friends
+#define X86_VERSIONS
+#define TARGET(isa) __attribute__((target(isa)))
+#include <immintrin.h>
+#endif
+#include "fsb_crypt.h"
+#include "error_stuff.h"
+
+#define R2(n) n, n + 2*64, n + 1*64, n + 3*64
+#define R4(n) R2(n), R2(n + 2*16), R2(n + 1*16), R2(n + 3*16)
+#define R6(n) R4(n), R4(n + 2*4), R4(n + 1*4), R4(n + 3*4)
+const uint8_t fsb_swap_table[0x100] = {R6(0), R6(2), R6(1), R6(3)};
+#undef R2
+#undef R4
+#undef R6
+
+/* The key laid out enough times to be a whole number of vectors, so the
+   same run lines up with every stretch of that length. Returns its size. */
+enum {key_repeats = 32};
+
+static long key_pattern(uint8_t pattern[FSB_MAX_KEY_LENGTH * key_repeats],
+        const uint8_t *key, long key_length)
+{
+    CHECK_ERROR(key_length < 1 || key_length > FSB_MAX_KEY_LENGTH, "bad key length");
+
+    const long pattern_size = key_length * key_repeats;
+    for (long j = 0; j < pattern_size; j++)
+    {
+        pattern[j] = key[j % key_length];
+    }
+
+    return pattern_size;
+}
+
+/* what's left after the last whole pattern */
+static void xor_key_tail(uint8_t *data, long size, const uint8_t *pattern)
+{
+    for (long i = 0; i < size; i++)
+    {
+        data[i] ^= pattern[i];
+    }
+}
+
+// generic
+
+static int always_supported(void)
+{
+    return 1;
+}
+
+static void swap_bits_table(uint8_t *out, const uint8_t *in, long size)
+{
+    for (long i = 0; i < size; i++)
+    {
+        out[i] = fsb_swap_table[in[i]];
+    }
+}
+
+static void xor_key_words(uint8_t *data, long size, const uint8_t *key, long key_length)
+{
+    uint8_t pattern[FSB_MAX_KEY_LENGTH * key_repeats];
+    const long pattern_size = key_pattern(pattern, key, key_length);
+    long i = 0;
+
+    for (; i + pattern_size <= size; i += pattern_size)
+    {
+        for (long j = 0; j < pattern_size; j += 8)
+        {
+            uint64_t v, k;
+            memcpy(&v, data + i + j, 8);
+            memcpy(&k, pattern + j, 8);
+            v ^= k;
+            memcpy(data + i + j, &v, 8);
+        }
+    }
+
+    xor_key_tail(data + i, size - i, pattern);
+}
+
+#ifdef X86_VERSIONS
+
+static int sse2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse2");
+}
+
+static int ssse3_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("ssse3");
+}
+
+static int avx2_supported(void)
+{
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+}
+
+/* swap nibbles, then pairs, then bits, masking off what the 16-bit shifts
+   carry over from the neighboring byte */
+TARGET("sse2")
+static void swap_bits_sse2(uint8_t *out, const uint8_t *in, long size)
+{
+    const __m128i m0f = _mm_set1_epi8(0x0f);
+    const __m128i m33 = _mm_set1_epi8(0x33);
+    const __m128i m55 = _mm_set1_epi8(0x55);
+    long i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 4), m0f), _mm_slli_epi16(_mm_and_si128(v, m0f), 4));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 2), m33), _mm_slli_epi16(_mm_and_si128(v, m33), 2));
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 1), m55), _mm_slli_epi16(_mm_and_si128(v, m55), 1));
+        _mm_storeu_si128((__m128i *)(out + i), v);
+    }
+
+    swap_bits_table(out + i, in + i, size - i);
+}
+
+/* look up each nibble reversed, and swap them */
+#define NIBBLES_REVERSED 0x0, 0x8, 0x4, 0xc, 0x2, 0xa, 0x6, 0xe, 0x1, 0x9, 0x5, 0xd, 0x3, 0xb, 0x7, 0xf
+
+TARGET("ssse3")
+static void swap_bits_ssse3(uint8_t *out, const uint8_t *in, long size)
+{
+    const __m128i reversed = _mm_setr_epi8(NIBBLES_REVERSED);
+    const __m128i low_nibbles = _mm_set1_epi8(0x0f);
+    long i = 0;
+
+    for (; i + 16 <= size; i += 16)
+    {
+        const __m128i v = _mm_loadu_si128((const __m128i *)(in + i));
+        const __m128i lo = _mm_shuffle_epi8(reversed, _mm_and_si128(v, low_nibbles));
+        const __m128i hi = _mm_shuffle_epi8(reversed, _mm_and_si128(_mm_srli_epi16(v, 4), low_nibbles));
+        _mm_storeu_si128((__m128i *)(out + i), _mm_or_si128(_mm_slli_epi16(lo, 4), hi));
+    }
+
+    swap_bits_table(out + i, in + i, size - i);
+}
+
+TARGET("avx2")
+static void swap_bits_avx2(uint8_t *out, const uint8_t *in, long size)
+{
+    const __m256i reversed = _mm256_setr_epi8(NIBBLES_REVERSED, NIBBLES_REVERSED);
+    const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+    long i = 0;
+
+    for (; i + 32 <= size; i += 32)
+    {
+        const __m256i v = _mm256_loadu_si256((const __m256i *)(in + i));
+        const __m256i lo = _mm256_shuffle_epi8(reversed, _mm256_and_si256(v, low_nibbles));
+        const __m256i hi = _mm256_shuffle_epi8(reversed, _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibbles));
+        _mm256_storeu_si256((__m256i *)(out + i), _mm256_or_si256(_mm256_slli_epi16(lo, 4), hi));
+    }
+
+    swap_bits_table(out + i, in + i, size - i);
+}
+
+#undef NIBBLES_REVERSED
+
+TARGET("sse2")
+static void xor_key_sse2(uint8_t *data, long size, const uint8_t *key, long key_length)
+{
+    uint8_t pattern[FSB_MAX_KEY_LENGTH * key_repeats];
+    const long pattern_size = key_pattern(pattern, key, key_length);
+    long i = 0;
+
+    for (; i + pattern_size <= size; i += pattern_size)
+    {
+        for (long j = 0; j < pattern_size; j += 16)
+        {
+            const __m128i v = _mm_loadu_si128((const __m128i *)(data + i + j));
+            const __m128i k = _mm_loadu_si128((const __m128i *)(pattern + j));
+            _mm_storeu_si128((__m128i *)(data + i + j), _mm_xor_si128(v, k));
+        }
+    }
+
+    xor_key_tail(data + i, size - i, pattern);
+}
+
+TARGET("avx2")
+static void xor_key_avx2(uint8_t *data, long size, const uint8_t *key, long key_length)
+{
+    uint8_t pattern[FSB_MAX_KEY_LENGTH * key_repeats];
+    const long pattern_size = key_pattern(pattern, key, key_length);
+    long i = 0;
+
+    for (; i + pattern_size <= size; i += pattern_size)
+    {
+        for (long j = 0; j < pattern_size; j += 32)
+        {
+            const __m256i v = _mm256_loadu_si256((const __m256i *)(data + i + j));
+            const __m256i k = _mm256_loadu_si256((const __m256i *)(pattern + j));
+            _mm256_storeu_si256((__m256i *)(data + i + j), _mm256_xor_si256(v, k));
+        }
+    }
+
+    xor_key_tail(data + i, size - i, pattern);
+}
+
+#endif // X86_VERSIONS
+
+static const struct fsb_crypt_version versions[] =
+{
+#ifdef X86_VERSIONS
+    {"avx2", avx2_supported, swap_bits_avx2, xor_key_avx2},
+    {"ssse3", ssse3_supported, swap_bits_ssse3, xor_key_sse2},
+    {"sse2", sse2_supported, swap_bits_sse2, xor_key_sse2},
+#endif
+    {"generic", always_supported, swap_bits_table, xor_key_words},
+};
+
+const struct fsb_crypt_version *fsb_crypt_versions(int *count)
+{
+    *count = sizeof(versions)/sizeof(versions[0]);
+    return versions;
+}
+
+const struct fsb_crypt_version *fsb_crypt_best(void)
+{
+    int i;
+    for (i = 0; !versions[i].supported(); i++)
+    {
+        // generic is always last and always supported
+    }
+
+    return &versions[i];
+}
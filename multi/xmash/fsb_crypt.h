@@ -0,0 +1,37 @@
+#ifndef _FSB_CRYPT_H_INCLUDED
+#define _FSB_CRYPT_H_INCLUDED
+
+#include <stdint.h>
+
+// FMOD's FSB encryption: every byte has its bits reversed, and is xor'd
+// with a repeating key.
+
+// bit reversed byte for each byte
+extern const uint8_t fsb_swap_table[0x100];
+
+// There are a few versions of the whole file passes. The x86 vector ones
+// are built whatever the compiler flags, and only used if the CPU has the
+// instructions for them.
+struct fsb_crypt_version
+{
+    const char *name;
+
+    // 1 if this CPU can run it
+    int (*supported)(void);
+
+    // out may be the same as in
+    void (*swap_bits)(uint8_t *out, const uint8_t *in, long size);
+
+    // key_length at most FSB_MAX_KEY_LENGTH
+    void (*xor_key)(uint8_t *data, long size, const uint8_t *key, long key_length);
+};
+
+enum {FSB_MAX_KEY_LENGTH = 0x40};
+
+// every version built, best first, *count gets how many
+const struct fsb_crypt_version *fsb_crypt_versions(int *count);
+
+// the best version this CPU can run
+const struct fsb_crypt_version *fsb_crypt_best(void);
+
+#endif // _FSB_CRYPT_H_INCLUDED
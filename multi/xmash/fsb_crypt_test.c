@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include "fsb_crypt.h"
+#include "error_stuff.h"
+
+// Check every version of the FSB bit swap and key xor this CPU can run
+// against a byte at a time, at each size up to a few vectors past the
+// longest pattern and at unaligned offsets.
+
+enum {max_size = 3000, max_offset = 33};
+
+static uint8_t reverse_bits(uint8_t b)
+{
+    uint8_t r = 0;
+    for (int i = 0; i < 8; i++)
+    {
+        r |= ((b >> i) & 1) << (7 - i);
+    }
+    return r;
+}
+
+int main(void)
+{
+    static uint8_t input[max_size + max_offset];
+    static uint8_t expected[max_size + max_offset];
+    static uint8_t output[max_size + max_offset];
+    uint8_t key[FSB_MAX_KEY_LENGTH];
+    uint32_t seed = 1;
+    int count;
+    const struct fsb_crypt_version *versions = fsb_crypt_versions(&count);
+
+    for (int i = 0; i < 0x100; i++)
+    {
+        CHECK_ERROR(fsb_swap_table[i] != reverse_bits(i), "fsb_swap_table is wrong");
+    }
+
+    for (long i = 0; i < max_size + max_offset; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        input[i] = seed >> 16;
+    }
+    for (int i = 0; i < FSB_MAX_KEY_LENGTH; i++)
+    {
+        seed = seed * 1103515245 + 12345;
+        key[i] = seed >> 16;
+    }
+
+    for (int v = 0; v < count; v++)
+    {
+        const struct fsb_crypt_version *version = &versions[v];
+
+        if (!version->supported())
+        {
+            printf("%s: not supported here, skipped\n", version->name);
+            continue;
+        }
+
+        for (long size = 0; size <= max_size; size++)
+        {
+            const long offset = size % max_offset;
+            const uint8_t *in = input + offset;
+
+            // out of place, and in place
+            for (long i = 0; i < size; i++)
+            {
+                expected[i] = reverse_bits(in[i]);
+            }
+            memset(output, 0, sizeof(output));
+            version->swap_bits(output + offset, in, size);
+            if (memcmp(output + offset, expected, size))
+            {
+                fprintf(stderr, "%s: swap_bits wrong for size %ld\n", version->name, size);
+                exit(EXIT_FAILURE);
+            }
+            memcpy(output + offset, in, size);
+            version->swap_bits(output + offset, output + offset, size);
+            if (memcmp(output + offset, expected, size))
+            {
+                fprintf(stderr, "%s: swap_bits wrong in place for size %ld\n", version->name, size);
+                exit(EXIT_FAILURE);
+            }
+
+            for (int key_length = 1; key_length <= FSB_MAX_KEY_LENGTH; key_length++)
+            {
+                // sizes past the longest pattern are only worth it for a few
+                if (size > 300 && key_length % 7 != 0 && key_length != FSB_MAX_KEY_LENGTH)
+                {
+                    continue;
+                }
+
+                for (long i = 0; i < size; i++)
+                {
+                    expected[i] = in[i] ^ key[i % key_length];
+                }
+                memcpy(output + offset, in, size);
+                version->xor_key(output + offset, size, key, key_length);
+                if (memcmp(output + offset, expected, size))
+                {
+                    fprintf(stderr, "%s: xor_key wrong for size %ld, key length %d\n",
+                            version->name, size, key_length);
+                    exit(EXIT_FAILURE);
+                }
+            }
+        }
+
+        printf("%s: ok\n", version->name);
+    }
+
+    printf("best here: %s\n", fsb_crypt_best()->name);
+
+    exit(EXIT_SUCCESS);
+}
@@ -33,7 +33,7 @@ int try_multistream_fsb(const uint8_t *infile, long file_size, subfile_callback_
     enum fsb_type_t fsb_type;
 
     /* read header */
-    CHECK_ERROR(file_size < 4, "too small to be FSB");
+    if (file_size < 4) return 1;
 
     {
         if (!memcmp(&infile[0],fsb3headmagic,4))
@@ -1,8 +1,17 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdint.h>
+#include <stdbool.h>
 #include <limits.h>
 #include <ctype.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 #include "guessfsb.h"
+#include "fsb_crypt.h"
 #include "error_stuff.h"
 #include "util.h"
 
@@ -14,9 +23,33 @@ enum {FSB_TYPES = 2};
 const int header_sizes[FSB_TYPES] = {0x18, 0x30};
 const uint8_t fsb_magics[FSB_TYPES][4] = {"FSB3", "FSB4"};
 
+enum {max_key_length = FSB_MAX_KEY_LENGTH};
+enum {min_key_length = 0x10};
+
+struct fsb_key_store
+{
+    char *file_name;
+
+    struct known_key
+    {
+        long hits;
+        int length;
+        uint8_t key[max_key_length];
+    } *keys;
+
+    int key_count;
+    bool changed;
+
+#ifndef __MINGW32__
+    // batches guess on several threads at once
+    pthread_mutex_t lock;
+#endif
+};
+
 struct guessfsb_state
 {
-    uint8_t swap_table[0x100];
+    // whole file passes, the best this CPU has
+    const struct fsb_crypt_version *crypt;
 
     struct match_s
     {
@@ -26,8 +59,15 @@ struct guessfsb_state
 
     int match_count;
 
-    uint8_t *indata;
+    // the file as given, keys are tested by swapping the bytes they cover
+    const uint8_t *infile;
     long file_size;
+
+    // swapped copy to decrypt for the callback, made for the first key
+    // that passes test_key, most files never get one
+    uint8_t *indata;
+
+    struct fsb_key_store *keys;
 };
 
 #if 0
@@ -40,15 +80,17 @@ static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, vo
 static int test_key(struct guessfsb_state *s, const uint8_t *key,
              const int key_length);
 
-static int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
+static int test_table(const struct guessfsb_state *s, const uint8_t *key, const int key_length,
                const uint_fast32_t stream_count,
                const uint_fast32_t header_size,
                const uint_fast32_t table_size,
                const uint_fast32_t body_size);
 
-static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length);
+static inline uint8_t swapped_byte(const struct guessfsb_state *s, const long offset);
 
-static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length);
+static inline uint_fast32_t read_32_le_xor(const struct guessfsb_state *s, const long offset, const uint8_t *key, const int key_length);
+
+static inline uint_fast16_t read_16_le_xor(const struct guessfsb_state *s, const long offset, const uint8_t *key, const int key_length);
 
 static void print_key(const uint8_t *key, const int key_length, const int count);
 
@@ -56,42 +98,45 @@ static int process_matching_key(struct guessfsb_state *s, uint8_t const * key, l
 
 static void decrypt_file(struct guessfsb_state *s, uint8_t const * key, long key_length);
 
+static int try_decrypted(struct guessfsb_state *s, uint8_t const * key, long key_length, good_key_callback_t *cb, void *cbv);
+
+static int try_known_keys(struct guessfsb_state *s, good_key_callback_t *cb, void *cbv);
+
+static void learn_key(struct fsb_key_store *keys, uint8_t const * key, long key_length);
+
 // interface
 
-int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *cb, void *cbv)
+int guess_fsb_keys(const uint8_t *infile, long file_size, struct fsb_key_store *keys, good_key_callback_t *cb, void *cbv)
 {
     int success = 0;
-    struct guessfsb_state *s = malloc(sizeof(struct guessfsb_state));
-    CHECK_ERRNO(!s, "malloc");
 
-    // initialize bit swap table
-    for (unsigned int i = 0; i < 0x100; i++)
+    // too small for a header and one table entry
+    if (file_size < header_sizes[0] + 0x28)
     {
-        s->swap_table[i] =
-            (i&0x01) << 7 |
-            (i&0x02) << 5 |
-            (i&0x04) << 3 |
-            (i&0x08) << 1 |
-            (i&0x10) >> 1 |
-            (i&0x20) >> 3 |
-            (i&0x40) >> 5 |
-            (i&0x80) >> 7;
+        return 1;
     }
 
-    s->indata = malloc(file_size);
-    CHECK_ERRNO(!s->indata, "malloc for guessfsb indata");
+    struct guessfsb_state *s = malloc(sizeof(struct guessfsb_state));
+    CHECK_ERRNO(!s, "malloc");
+
+    s->crypt = fsb_crypt_best();
+
+    s->infile = infile;
     s->file_size = file_size;
+    s->indata = NULL;
 
     s->matches = NULL;
     s->match_count = 0;
 
-    // swap everything up front
-    for (long i=0; i < s->file_size; i++)
-        s->indata[i] = s->swap_table[infile[i]];
+    s->keys = keys;
 
+    // keys that worked before are a much better bet than anything else
+    if (keys && 0 == try_known_keys(s, cb, cbv))
+    {
+        success = 1;
+    }
     // guess!
-
-    if (0 == analyze_padding(s, cb, cbv))
+    else if (0 == analyze_padding(s, cb, cbv))
     {
         success = 1;
     }
@@ -236,7 +281,7 @@ int test_key(struct guessfsb_state *s, const uint8_t *key,
 
     // attempted decrypted magic
     for (int i=0;i<4;i++)
-        fsb_magic[i] = key[i%key_length] ^ s->indata[i];
+        fsb_magic[i] = key[i%key_length] ^ swapped_byte(s, i);
 
     int fsb_type;
     for (fsb_type=0; fsb_type < FSB_TYPES; fsb_type++)
@@ -249,21 +294,21 @@ int test_key(struct guessfsb_state *s, const uint8_t *key,
     }
     if (fsb_type == FSB_TYPES) return 0;
 
-    stream_count = read_32_le_xor(s->indata, 4, key, key_length);
-    table_size = read_32_le_xor(s->indata, 8, key, key_length);
-    body_size = read_32_le_xor(s->indata, 0xc, key, key_length);
+    stream_count = read_32_le_xor(s, 4, key, key_length);
+    table_size = read_32_le_xor(s, 8, key, key_length);
+    body_size = read_32_le_xor(s, 0xc, key, key_length);
 
     if (s->file_size != 0 &&
         header_size + table_size + body_size != s->file_size) return 0;
     if (stream_count < 1) return 0;
     if (stream_count * 0x28 > table_size) return 0;
 
-    return test_table(s->indata, key, key_length, stream_count, header_size,
+    return test_table(s, key, key_length, stream_count, header_size,
             table_size, body_size);
 }
 
 // test a key on the header table, 0 for failure, 1 for success
-int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
+int test_table(const struct guessfsb_state *s, const uint8_t *key, const int key_length,
                const uint_fast32_t stream_count,
                const uint_fast32_t header_size,
                const uint_fast32_t table_size,
@@ -281,8 +326,12 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
     for (file_num = 0; file_num < stream_count;
             file_num ++)
     {
+        // the entry has to fit in the table before reading it
+        if (entry_offset + 0x28 > header_size + table_size)
+            return 0;
+
         uint_fast16_t entry_size = 
-            read_16_le_xor(indata, entry_offset,
+            read_16_le_xor(s, entry_offset,
                     key, key_length);
 #if 0
         printf("[%d] entry_size = %"PRIxFAST16"\n",
@@ -294,7 +343,7 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
             return 0;
 
         uint_fast32_t entry_file_size =
-            read_32_le_xor(indata, entry_offset + 0x24,
+            read_32_le_xor(s, entry_offset + 0x24,
                     key, key_length);
 #if 0
         printf("[%d] entry_file_size = %"PRIxFAST16"\n",
@@ -353,84 +402,151 @@ int test_table(const uint8_t *indata, const uint8_t *key, const int key_length,
     return 0;
 }
 
-// Assume a constant byte for padding somewhere in the file
-static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, void *cbv)
+// A stretch of the file that repeats with a period that could be a key
+// length, as constant padding does once encrypted
+struct repeat_s
 {
-    printf("Trying padding...\n"
-           "This should complete in less than a second, if not you should\n"
-           "probably give up.\n\n");
+    long end;       // last byte
+    long length;    // bytes that match the byte a period back
+    int period;
+};
 
-    int byte_count[0x100] = {0};
-    enum {max_key_length = 0x40};
-    enum {min_key_length = 0x10};
+// Find all the stretches in one pass. A stretch at least a period long
+// takes in one of every min_key_length bytes, so only those are compared
+// against each period back, and a match is then followed out both ways.
+// Swapping bits doesn't change which bytes are equal, so this works on
+// the file as given.
+// Returns the count, the stretches are allocated in *repeats_p.
+static long find_repeats(const struct guessfsb_state *s, struct repeat_s **repeats_p)
+{
+    const uint8_t *indata = s->infile;
+    long stretch_start[max_key_length+1];
+    long stretch_end[max_key_length+1];
+    struct repeat_s *repeats = NULL;
+    long repeat_count = 0;
+    long repeats_allocated = 0;
+
+    for (int period = min_key_length; period <= max_key_length; period++)
+    {
+        stretch_start[period] = -1;
+        stretch_end[period] = -1;
+    }
 
-    for (long repeat_end = 0; repeat_end < s->file_size; repeat_end++)
+    for (long p = min_key_length; p < s->file_size; p += min_key_length)
     {
-        if (0 != byte_count[s->indata[repeat_end]])
+        for (int period = min_key_length; period <= max_key_length; period++)
         {
-            // check for match ending here
-            for (long repeat_length = min_key_length;
-                    repeat_length <= max_key_length;
-                    repeat_length++)
+            if (p <= stretch_end[period] || p - period < 1 ||
+                indata[p] != indata[p-period])
+            {
+                continue;
+            }
 
+            long start = p, end = p;
+            while (start-1-period >= 1 && indata[start-1] == indata[start-1-period])
             {
+                start--;
+            }
+            while (end+1 < s->file_size && indata[end+1] == indata[end+1-period])
+            {
+                end++;
+            }
+            stretch_start[period] = start;
+            stretch_end[period] = end;
 
-                long checked_length = 0;
-                for (long check_offset = repeat_end;
-                        checked_length < repeat_length &&
-                        check_offset-repeat_length > 0 &&
-                        s->indata[check_offset] == s->indata[check_offset-repeat_length];
-                        checked_length++, check_offset--) ;
+            if (end - start + 1 < period)
+            {
+                continue;
+            }
 
-                if (checked_length == repeat_length)
+            // a multiple of a shorter period just gives that key repeated
+            int divisor;
+            for (divisor = min_key_length; divisor < period; divisor++)
+            {
+                if (period % divisor == 0 &&
+                    stretch_start[divisor] <= start && stretch_end[divisor] >= end)
                 {
-                    int key_length = repeat_length;
+                    break;
+                }
+            }
+            if (divisor < period)
+            {
+                continue;
+            }
 
-                    uint8_t key[max_key_length];
+            if (repeat_count == repeats_allocated)
+            {
+                repeats_allocated = repeats_allocated ? repeats_allocated * 2 : 16;
+                repeats = realloc(repeats, repeats_allocated * sizeof(struct repeat_s));
+                CHECK_ERRNO(!repeats, "realloc");
+            }
+            repeats[repeat_count].end = end;
+            repeats[repeat_count].length = end - start + 1;
+            repeats[repeat_count].period = period;
+            repeat_count ++;
+        }
+    }
 
-                    // assume that repeated bytes are constant padding
-                    for (int pad=0; pad <= 255; pad++)
-                    {
-                        for (int i=0; i < key_length; i++)
-                        {
-                            key[(repeat_end-i)%key_length] = 
-                                s->indata[repeat_end-i] ^ pad;
-                        }
+    *repeats_p = repeats;
+    return repeat_count;
+}
 
-                        if (test_key(s, key, key_length))
-                        {
-                            if (process_matching_key(s, key, key_length))
-                            {
-                                // decrypt file in place to give to callback
-                                decrypt_file(s, key, key_length);
-
-                                // invoke callback
-                                if (0 == cb(s->indata, s->file_size, cbv))
-                                {
-                                    // callback was satisfied with the file
-                                    return 0;
-                                }
-
-                                printf("Trying padding again...\n");
-                                // reencrypt so we can continue
-                                decrypt_file(s, key, key_length);
-                            }
-                        }
-                    } // end loop through paddings
-                } // end repeat detected
-            } // end repeat length loop
-        } // end if we've seen this character
+// longest stretches first, they're the likeliest to be padding
+static int compare_repeats(const void *a, const void *b)
+{
+    const struct repeat_s *ra = a, *rb = b;
 
-        if (repeat_end-min_key_length+1 >= 0)
-        {
-            byte_count[s->indata[repeat_end-min_key_length+1]] ++;
-        }
+    if (ra->length != rb->length) return (ra->length < rb->length) - (ra->length > rb->length);
+    if (ra->period != rb->period) return (ra->period > rb->period) - (ra->period < rb->period);
+    return (ra->end > rb->end) - (ra->end < rb->end);
+}
+
+// Assume a constant byte for padding somewhere in the file
+static int analyze_padding(struct guessfsb_state *s, good_key_callback_t *cb, void *cbv)
+{
+    printf("Trying padding...\n"
+           "This should complete in less than a second, if not you should\n"
+           "probably give up.\n\n");
+
+    struct repeat_s *repeats;
+    const long repeat_count = find_repeats(s, &repeats);
+
+    qsort(repeats, repeat_count, sizeof(struct repeat_s), compare_repeats);
 
-        if (repeat_end-max_key_length*2 >= 0)
+    for (long r = 0; r < repeat_count; r++)
+    {
+        const long repeat_end = repeats[r].end;
+        const int key_length = repeats[r].period;
+
+        uint8_t key[max_key_length];
+
+        // assume that repeated bytes are constant padding
+        for (int pad=0; pad <= 255; pad++)
         {
-            byte_count[s->indata[repeat_end-max_key_length*2]] --;
-        }
-    }
+            for (int i=0; i < key_length; i++)
+            {
+                key[(repeat_end-i)%key_length] =
+                    swapped_byte(s, repeat_end-i) ^ pad;
+            }
+
+            if (test_key(s, key, key_length))
+            {
+                if (process_matching_key(s, key, key_length))
+                {
+                    if (0 == try_decrypted(s, key, key_length, cb, cbv))
+                    {
+                        // callback was satisfied with the file
+                        free(repeats);
+                        return 0;
+                    }
+
+                    printf("Trying padding again...\n");
+                }
+            }
+        } // end loop through paddings
+    } // end loop through repeats
+
+    free(repeats);
 
     return 1;
 }
@@ -458,17 +574,22 @@ void print_key(const uint8_t *key, const int key_length, const int count)
     fflush(stdout);
 }
 
-static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length)
+static inline uint8_t swapped_byte(const struct guessfsb_state *s, const long offset)
+{
+    return fsb_swap_table[s->infile[offset]];
+}
+
+static inline uint_fast32_t read_32_le_xor(const struct guessfsb_state *s, const long offset, const uint8_t *key, const int key_length)
 {
     uint_fast32_t b1,b2,b3,b4;
     int key_offset = offset % key_length;
-    b1 = bytes[offset + 0] ^ key[key_offset ++];
+    b1 = swapped_byte(s, offset + 0) ^ key[key_offset ++];
     if (key_offset == key_length) key_offset = 0;
-    b2 = bytes[offset + 1] ^ key[key_offset ++];
+    b2 = swapped_byte(s, offset + 1) ^ key[key_offset ++];
     if (key_offset == key_length) key_offset = 0;
-    b3 = bytes[offset + 2] ^ key[key_offset ++];
+    b3 = swapped_byte(s, offset + 2) ^ key[key_offset ++];
     if (key_offset == key_length) key_offset = 0;
-    b4 = bytes[offset + 3] ^ key[key_offset];
+    b4 = swapped_byte(s, offset + 3) ^ key[key_offset];
 
     return 
         ((uint_fast32_t)b4) << 24 |
@@ -477,38 +598,46 @@ static inline uint_fast32_t read_32_le_xor(const uint8_t *bytes, const long offs
         ((uint_fast32_t)b1);
 }
 
-static inline uint_fast16_t read_16_le_xor(const uint8_t *bytes, const long offset, const uint8_t *key, const int key_length)
+static inline uint_fast16_t read_16_le_xor(const struct guessfsb_state *s, const long offset, const uint8_t *key, const int key_length)
 {
     uint_fast16_t b1,b2;
     int key_offset = offset % key_length;
-    b1 = bytes[offset + 0] ^ key[key_offset ++];
+    b1 = swapped_byte(s, offset + 0) ^ key[key_offset ++];
     if (key_offset == key_length) key_offset = 0;
-    b2 = bytes[offset + 1] ^ key[key_offset];
+    b2 = swapped_byte(s, offset + 1) ^ key[key_offset];
 
     return 
         ((uint_fast32_t)b2) <<  8 |
         ((uint_fast32_t)b1);
 }
 
+// return 1 if key is just old_key repeated (or old_key itself)
+static int repeats_key(uint8_t const * key, long key_length, uint8_t const * old_key, long old_key_length)
+{
+    // if the new match is a multiple of the old match's length
+    if (key_length >= old_key_length &&
+        key_length % old_key_length == 0)
+    {
+        int j;
+        // check that it isn't just repetition
+        for (j=0; j < key_length / old_key_length; j++)
+        {
+            if ( memcmp(old_key, key + j*old_key_length,
+                    old_key_length) ) break;
+        }
+        if ( j == key_length / old_key_length ) return 1;
+    }
+
+    return 0;
+}
+
 // return 1 if unique, 0 otherwise
 static int matched_already(struct guessfsb_state *s, uint8_t const * key, long key_length)
 {
     // check that we're not repeating keys
     for (int i=0; i < s->match_count; i++)
     {
-        // if the new match is a multiple of the old match's length
-        if (key_length >= s->matches[i].length &&
-            key_length % s->matches[i].length == 0)
-        {
-            int j;
-            // check that it isn't just repetition
-            for (j=0; j < key_length / s->matches[i].length; j++)
-            {
-                if ( memcmp(s->matches[i].key, key + j*s->matches[i].length, 
-                        s->matches[i].length) ) break;
-            }
-            if ( j == key_length / s->matches[i].length ) return 1;
-        }
+        if (repeats_key(key, key_length, s->matches[i].key, s->matches[i].length)) return 1;
     }
 
     return 0;
@@ -535,8 +664,224 @@ static int process_matching_key(struct guessfsb_state *s,
 
 static void decrypt_file(struct guessfsb_state *s, uint8_t const * key, long key_length)
 {
-    for (long i = 0; i < s->file_size; i++)
+    s->crypt->xor_key(s->indata, s->file_size, key, key_length);
+}
+
+// decrypt file in place to give to callback, returns 0 if the callback was
+// satisfied with it, otherwise reencrypts so we can continue
+static int try_decrypted(struct guessfsb_state *s, uint8_t const * key, long key_length, good_key_callback_t *cb, void *cbv)
+{
+    if (!s->indata)
+    {
+        s->indata = malloc(s->file_size);
+        CHECK_ERRNO(!s->indata, "malloc for guessfsb indata");
+        s->crypt->swap_bits(s->indata, s->infile, s->file_size);
+    }
+
+    decrypt_file(s, key, key_length);
+
+    if (0 == cb(s->indata, s->file_size, cbv))
+    {
+        if (s->keys)
+        {
+            learn_key(s->keys, key, key_length);
+        }
+        return 0;
+    }
+
+    decrypt_file(s, key, key_length);
+
+    return 1;
+}
+
+// key store
+
+static void lock_store(struct fsb_key_store *keys)
+{
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_lock(&keys->lock), "pthread_mutex_lock");
+#endif
+}
+
+static void unlock_store(struct fsb_key_store *keys)
+{
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_unlock(&keys->lock), "pthread_mutex_unlock");
+#endif
+}
+
+// returns 0 if one of the known keys worked
+static int try_known_keys(struct guessfsb_state *s, good_key_callback_t *cb, void *cbv)
+{
+    // other threads may add keys as we go, so take a copy of each
+    for (int i = 0; ; i++)
     {
-        s->indata[i] ^= key[i%key_length];
+        uint8_t key[max_key_length];
+        int key_length;
+
+        lock_store(s->keys);
+        if (i >= s->keys->key_count)
+        {
+            unlock_store(s->keys);
+            break;
+        }
+        key_length = s->keys->keys[i].length;
+        memcpy(key, s->keys->keys[i].key, key_length);
+        unlock_store(s->keys);
+
+        // just the header and table, the same check as for guesses
+        if (test_key(s, key, key_length) &&
+            process_matching_key(s, key, key_length))
+        {
+            printf("Trying known key...\n");
+            if (0 == try_decrypted(s, key, key_length, cb, cbv))
+            {
+                return 0;
+            }
+        }
     }
+
+    return 1;
+}
+
+static void learn_key(struct fsb_key_store *keys, uint8_t const * key, long key_length)
+{
+    lock_store(keys);
+
+    int i;
+    for (i = 0; i < keys->key_count; i++)
+    {
+        if (repeats_key(key, key_length, keys->keys[i].key, keys->keys[i].length))
+        {
+            break;
+        }
+    }
+
+    if (i == keys->key_count)
+    {
+        keys->key_count ++;
+        keys->keys = realloc(keys->keys, keys->key_count*sizeof(struct known_key));
+        CHECK_ERRNO(!keys->keys, "realloc");
+
+        keys->keys[i].hits = 0;
+        keys->keys[i].length = key_length;
+        memcpy(keys->keys[i].key, key, key_length);
+    }
+
+    keys->keys[i].hits ++;
+    keys->changed = true;
+
+    unlock_store(keys);
+}
+
+static int hex_digit_value(char c)
+{
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// one key per line: hits, then the key in hex
+struct fsb_key_store *open_fsb_key_store(const char *file_name)
+{
+    struct fsb_key_store *keys = malloc(sizeof(struct fsb_key_store));
+    CHECK_ERRNO(!keys, "malloc");
+
+    keys->file_name = malloc(strlen(file_name)+1);
+    CHECK_ERRNO(!keys->file_name, "malloc");
+    strcpy(keys->file_name, file_name);
+
+    keys->keys = NULL;
+    keys->key_count = 0;
+    keys->changed = false;
+#ifndef __MINGW32__
+    CHECK_ERROR(0 != pthread_mutex_init(&keys->lock, NULL), "pthread_mutex_init");
+#endif
+
+    FILE *infile = fopen(file_name, "r");
+    if (!infile)
+    {
+        // nothing learned yet
+        return keys;
+    }
+
+    char line[32 + max_key_length*2];
+    for (int line_number = 1; fgets(line, sizeof(line), infile); line_number++)
+    {
+        if (line[0] == '#' || line[0] == '\n' || line[0] == '\r')
+        {
+            continue;
+        }
+
+        struct known_key k;
+        char *p;
+
+        k.hits = strtol(line, &p, 10);
+        k.length = 0;
+        while (*p == ' ' || *p == '\t')
+        {
+            p++;
+        }
+        while (k.length < max_key_length &&
+               hex_digit_value(p[0]) >= 0 && hex_digit_value(p[1]) >= 0)
+        {
+            k.key[k.length++] = hex_digit_value(p[0]) << 4 | hex_digit_value(p[1]);
+            p += 2;
+        }
+
+        if (p == line || k.hits < 0 || k.length == 0 ||
+            (*p != '\n' && *p != '\r' && *p != '\0'))
+        {
+            fprintf(stderr, "%s:%d: can't make sense of key, ignoring it\n", file_name, line_number);
+            continue;
+        }
+
+        keys->key_count ++;
+        keys->keys = realloc(keys->keys, keys->key_count*sizeof(struct known_key));
+        CHECK_ERRNO(!keys->keys, "realloc");
+        keys->keys[keys->key_count-1] = k;
+    }
+
+    fclose(infile);
+
+    return keys;
+}
+
+static int compare_hits(const void *a, const void *b)
+{
+    const struct known_key *ka = a, *kb = b;
+    return (ka->hits < kb->hits) - (ka->hits > kb->hits);
+}
+
+void close_fsb_key_store(struct fsb_key_store *keys)
+{
+    if (keys->changed)
+    {
+        // most used first, so they're tried first next time
+        qsort(keys->keys, keys->key_count, sizeof(struct known_key), compare_hits);
+
+        FILE *outfile = fopen(keys->file_name, "w");
+        CHECK_ERRNO(!outfile, "fopen key store");
+
+        fprintf(outfile, "# FSB keys that have worked: times used, key in hex\n");
+        for (int i = 0; i < keys->key_count; i++)
+        {
+            fprintf(outfile, "%ld ", keys->keys[i].hits);
+            for (int j = 0; j < keys->keys[i].length; j++)
+            {
+                fprintf(outfile, "%02" PRIx8, keys->keys[i].key[j]);
+            }
+            fprintf(outfile, "\n");
+        }
+
+        CHECK_ERRNO(EOF == fclose(outfile), "fclose key store");
+    }
+
+#ifndef __MINGW32__
+    pthread_mutex_destroy(&keys->lock);
+#endif
+    free(keys->keys);
+    free(keys->file_name);
+    free(keys);
 }
@@ -6,6 +6,15 @@
 // should return 1 to check more keys, 0 to finish
 typedef int good_key_callback_t(const uint8_t *, long file_size, void *);
 
-int guess_fsb_keys(const uint8_t *infile, long file_size, good_key_callback_t *cb, void *cbv);
+// A file of keys that have worked before, with how often. They're tried
+// before any guessing, and keys that work are added. A missing file is
+// just an empty store.
+struct fsb_key_store;
+struct fsb_key_store *open_fsb_key_store(const char *file_name);
+// write the file back if anything changed, and free the store
+void close_fsb_key_store(struct fsb_key_store *keys);
+
+// keys may be NULL to always guess
+int guess_fsb_keys(const uint8_t *infile, long file_size, struct fsb_key_store *keys, good_key_callback_t *cb, void *cbv);
 
 #endif // _GUESSFSB_H_INCLUDED
@@ -30,6 +30,8 @@ int try_xma_riff(const uint8_t *infile, long file_size, subfile_callback_t *cb,
     int i;
 
     /* check header */
+    if (file_size < 12)
+        goto fail;
     if ((uint32_t)read_32_be(&infile[0])!=0x52494646) /* "RIFF" */
         goto fail;
     /* check for WAVE form */
@@ -0,0 +1,674 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "xma_core.h"
+#include "util.h"
+#include "error_stuff.h"
+#include "bitstream.h"
+
+// based on xma_parse 0.12
+
+struct xma_packet_header
+{
+    unsigned sequence_number: 4;
+    unsigned unknown        : 2;
+    unsigned skip_bits      : 15;
+    unsigned packet_skip    : 11;
+};
+
+struct xma2_packet_header
+{
+    unsigned frame_count    : 6;
+    unsigned skip_bits      : 15;
+    unsigned metadata       : 3;
+    unsigned packet_skip    : 8;
+};
+
+static enum xma_status xma_fail(struct xma_error *err, enum xma_status status, unsigned int value, unsigned int expected)
+{
+    if (err)
+    {
+        err->status = status;
+        err->value = value;
+        err->expected = expected;
+    }
+
+    return status;
+}
+
+static void read_XMA_packet_header(struct bitstream_reader *ibs, struct xma_packet_header *h)
+{
+    h->sequence_number = get_bits(ibs, 4);
+    h->unknown = get_bits(ibs, 2);
+    h->skip_bits = get_bits(ibs, 15);
+    h->packet_skip = get_bits(ibs, 11);
+}
+
+static void read_XMA2_packet_header(struct bitstream_reader *ibs, struct xma2_packet_header *h)
+{
+    h->frame_count = get_bits(ibs, 6);
+    h->skip_bits = get_bits(ibs, 15);
+    h->metadata = get_bits(ibs, 3);
+    h->packet_skip = get_bits(ibs, 8);
+}
+
+static void write_XMA_packet_header(struct bitstream_writer *obs, const struct xma_packet_header *h)
+{
+    put_bits(obs, h->sequence_number, 4);
+    put_bits(obs, h->unknown, 2);
+    put_bits(obs, h->skip_bits, 15);
+    put_bits(obs, h->packet_skip, 11);
+}
+
+// frames of a packet, the reader is past the packet header and skip bits
+static struct bitstream_reader *init_frame_reader(const uint8_t *data, long data_size, long packet_offset, unsigned int packet_skip)
+{
+    return init_bitstream_reader(
+        // where's the data
+        data + packet_offset + packet_header_size_bytes,
+        // should never reach past the end of the data
+        data_size - (packet_offset + packet_header_size_bytes),
+        // consecutive
+        (packet_size_bytes - packet_header_size_bytes) * 8,
+        // skip
+        (packet_header_size_bytes + packet_skip * packet_size_bytes) * 8
+    );
+}
+
+// copy a packet out for dumping, what runs past the end of the data is zero
+static void copy_dump_packet(const uint8_t *data, long data_size, long packet_offset, uint8_t *buf)
+{
+    long size = data_size - packet_offset;
+    if (size > packet_size_bytes) size = packet_size_bytes;
+
+    memcpy(buf, data + packet_offset, size);
+    memset(buf + size, 0, packet_size_bytes - size);
+    buf[3] = 0; // zero packet skip, since we're packing consecutively
+}
+
+// with known_frame_count false read until a frame says it ends the packet
+static enum xma_status parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int *total_bits_p, unsigned int *frames_p, unsigned int *samples_p, unsigned int max_bits, const struct xma_options *opt, struct xma_error *err)
+{
+    bool packet_end_seen = false;
+    unsigned int sample_count = 0;
+    unsigned int total_bits = 0;
+    unsigned int frame_number;
+
+    if (known_frame_count && frame_count == 0) {
+        return xma_fail(err, XMA_ZERO_FRAMES_NOT_SKIPPED, 0, 0);
+    }
+
+    for (frame_number = 0;
+         !known_frame_count || frame_number < frame_count;
+         frame_number++)
+    {
+        unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
+        total_bits += frame_bits;
+
+        unsigned int bits_left = frame_bits - frame_header_size_bits;
+
+        if (opt->verbose)
+        {
+            printf("   Frame #%u\n", frame_number);
+            printf("   Size %u\n", frame_bits);
+        }
+
+        // sync
+        {
+            unsigned int sync = get_bits(ibs, frame_sync_size_bits);
+            if (bitstream_underflow(ibs))
+            {
+                return xma_fail(err, XMA_OUT_OF_BITS, 0, 0);
+            }
+            if (sync != 0x7f00)
+            {
+                return xma_fail(err, XMA_BAD_FRAME_SYNC, sync, 0);
+            }
+            bits_left -= frame_sync_size_bits;
+        }
+
+        if (opt->frame_skip)
+        {
+            if (opt->stereo) {
+                get_bit(ibs);
+                bits_left --;
+            }
+
+            // skip
+            if (get_bit(ibs)) {
+                // skip at start
+                if (get_bit(ibs)) {
+                    unsigned int skip_start = get_bits(ibs, frame_skip_size_bits);
+                    if (opt->verbose) {
+                        printf("Skip %u samples at start\n", skip_start);
+                    }
+                    bits_left -= frame_skip_size_bits;
+                    sample_count -= skip_start;
+                }
+                bits_left --;
+                // skip at end
+                if (get_bit(ibs)) {
+                    unsigned int skip_end = get_bits(ibs, frame_skip_size_bits);
+                    if (opt->verbose) {
+                        printf("Skip %u samples at end\n", skip_end);
+                    }
+                    bits_left -= frame_skip_size_bits;
+                    sample_count -= skip_end;
+                }
+                bits_left --;
+            }
+            bits_left --;
+        }
+
+        if (opt->verbose) {
+            for (; bits_left >= 4 + frame_trailer_size_bits && !bitstream_underflow(ibs); bits_left -= 4) {
+                printf("%x", (unsigned int)get_bits(ibs, 4));
+            }
+            printf(" ");
+            for (; bits_left > frame_trailer_size_bits && !bitstream_underflow(ibs); bits_left--) {
+                printf("%c", (get_bit(ibs) ? '1' : '0'));
+            }
+            printf("\n");
+        } else if (bits_left > frame_trailer_size_bits) {
+            // payload isn't looked at, step over it
+            discard_bits(ibs, bits_left - frame_trailer_size_bits);
+            bits_left = frame_trailer_size_bits;
+        }
+
+        // trailer
+        {
+            const unsigned int trailer = get_bit(ibs);
+
+            if (bitstream_underflow(ibs))
+            {
+                return xma_fail(err, XMA_OUT_OF_BITS, 0, 0);
+            }
+
+            if (!trailer)
+            {
+                if (opt->strict && known_frame_count &&
+                    frame_number != frame_count-1)
+                {
+                    return xma_fail(err, XMA_EARLY_PACKET_END, 0, 0);
+                }
+                packet_end_seen = true;
+            }
+
+            sample_count += samples_per_frame;
+
+            bits_left -= frame_trailer_size_bits;
+
+            if (!known_frame_count && packet_end_seen)
+            {
+                frame_number ++;
+                break;
+            }
+
+            // FIX: detect end with bit count
+            if (!opt->strict && !known_frame_count && total_bits >= max_bits) {
+                if (opt->verbose) {
+                    printf("abandon frame due to bit count (total=%u max=%u)\n", total_bits, max_bits);
+                }
+                frame_number ++;
+                break;
+            }
+        }
+    }
+
+    // FIX: don't fail if packet end missing
+    if (opt->strict && !packet_end_seen)
+    {
+        return xma_fail(err, XMA_MISSING_PACKET_END, 0, 0);
+    }
+
+    if (opt->verbose) {
+        printf("\n");
+    }
+
+    *total_bits_p = total_bits;
+    *frames_p = frame_number;
+    *samples_p = sample_count;
+
+    return XMA_OK;
+}
+
+static enum xma_status packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs, struct xma_build_context *ctx, unsigned int frame_count, bool strict, bool last, struct xma_error *err)
+{
+    bool packet_end_seen = false;
+    unsigned int bits_written = ctx->bits_written;
+    unsigned int seqno = ctx->seqno;
+
+    if (frame_count == 0) {
+        return xma_fail(err, XMA_ZERO_FRAMES_NOT_SKIPPED, 0, 0);
+    }
+
+    for (unsigned int frame_number = 0;
+         frame_number < frame_count;
+         frame_number++) {
+        unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
+
+        if (bits_written + frame_bits >= packet_size_bytes * 8) {
+            unsigned int bits_this_packet = (packet_size_bytes * 8) - bits_written;
+            unsigned int overflow_bits = frame_bits - bits_this_packet;
+
+            struct xma_packet_header ph;
+            ph.sequence_number = seqno;
+            seqno = (seqno + 1) % 16;
+            ph.unknown = 2;
+            ph.skip_bits = overflow_bits;
+            ph.packet_skip = 0;
+
+            // bits of frame header before packet end
+            unsigned int frame_header_size_bits_left = frame_header_size_bits;
+            {
+                unsigned int header_bits = frame_header_size_bits_left;
+                if (header_bits > bits_this_packet) header_bits = bits_this_packet;
+
+                put_bits(obs, frame_bits >> (frame_header_size_bits_left - header_bits), header_bits);
+                bits_this_packet -= header_bits;
+                frame_header_size_bits_left -= header_bits;
+            }
+
+            if (overflow_bits == 0) {
+                // frame fits packet exactly
+
+                // payload bits before packet end
+                copy_bits(ibs, obs, bits_this_packet-1);
+                // trailer bit, no more frames in packet
+                put_bit(obs, 0);
+            } else {
+                // payload bits
+                copy_bits(ibs, obs, bits_this_packet);
+            }
+
+            write_XMA_packet_header(obs, &ph);
+
+            bits_written = packet_header_size_bytes * 8;
+
+            if (overflow_bits != 0) {
+                // bits of frame header in new packet
+                put_bits(obs, frame_bits, frame_header_size_bits_left);
+                bits_written += frame_header_size_bits_left;
+                overflow_bits -= frame_header_size_bits_left;
+                frame_header_size_bits_left = 0;
+
+                // payload bits in new packet
+                copy_bits(ibs, obs, overflow_bits - 1);
+                bits_written += overflow_bits - 1;
+
+                // trailer bit, no more frames in packet
+                put_bit(obs, 0);
+                bits_written ++;
+            }
+        } else {
+            put_bits(obs, frame_bits, frame_header_size_bits);
+            copy_bits(ibs, obs, frame_bits - frame_header_size_bits - 1);
+
+            // trailer bit
+            if (last && frame_number == frame_count-1) {
+                // no more frames
+                put_bit(obs, 0);
+            } else {
+                // more frames in packet
+                put_bit(obs, 1);
+            }
+
+            bits_written += frame_bits;
+        }
+
+        // trailer
+        {
+            const unsigned int trailer = get_bit(ibs);
+
+            if (bitstream_underflow(ibs))
+            {
+                return xma_fail(err, XMA_OUT_OF_BITS, 0, 0);
+            }
+
+            if (!trailer)
+            {
+                if (strict && frame_number != frame_count-1)
+                {
+                    return xma_fail(err, XMA_EARLY_PACKET_END, 0, 0);
+                }
+                packet_end_seen = true;
+            }
+        }
+    }
+
+    if (strict && !packet_end_seen)
+    {
+        return xma_fail(err, XMA_MISSING_PACKET_END, 0, 0);
+    }
+
+    ctx->seqno = seqno;
+    ctx->bits_written = bits_written;
+
+    return XMA_OK;
+}
+
+// overflow into the next packet, given where the frames started in this one
+static unsigned int packet_overflow_bits(unsigned int skip_bits, unsigned int total_bits)
+{
+    int overflow_temp = (skip_bits + total_bits) - ((packet_size_bytes - packet_header_size_bytes) * 8);
+
+    return (overflow_temp > 0) ? overflow_temp : 0;
+}
+
+// XMA packets, dumped if dump is set, rebuilt if obs is set
+static enum xma_status do_XMA_packets(const uint8_t *data, long data_size, long offset, FILE *dump, struct bitstream_writer *obs, struct xma_build_context *ctx, const struct xma_options *opt, unsigned long *samples_p, struct xma_error *err)
+{
+    long packet_offset = 0;
+    unsigned long sample_count = 0;
+    unsigned int last_packet_overflow_bits = 0;
+    unsigned int seqno = 0;
+    uint8_t buf[packet_size_bytes];
+    enum xma_status status = XMA_OK;
+
+    while (packet_offset < data_size) {
+        struct xma_packet_header ph;
+        unsigned int frames_this_packet = 0;
+
+        if (packet_offset + packet_header_size_bytes > data_size)
+        {
+            status = xma_fail(err, XMA_OUT_OF_BITS, 0, 0);
+            break;
+        }
+
+        {
+            struct bitstream_reader *ibs = init_bitstream_reader(data+packet_offset, packet_header_size_bytes, 0, 0);
+            read_XMA_packet_header(ibs, &ph);
+            free_bitstream_reader(ibs);
+        }
+
+        if (opt->verbose) {
+            printf("Sequence #%u (offset %lx)\n", ph.sequence_number, (unsigned long)(offset + packet_offset));
+            printf("Unknown         %u\n", ph.unknown);
+            printf("Skip Bits       %u\n", ph.skip_bits);
+            printf("Packet Skip     %u%s\n", ph.packet_skip,
+                (opt->ignore_packet_skip ? (obs ? " (ignored)" : " (ignore)") : ""));
+        }
+
+        if (opt->ignore_packet_skip) {
+            ph.packet_skip = 0;
+        }
+
+        if (opt->strict && ph.sequence_number != seqno) {
+            status = xma_fail(err, XMA_BAD_SEQUENCE, 0, 0);
+            break;
+        }
+
+        if (16384 == ph.skip_bits)
+        {
+            if (ph.unknown != 0) {
+                printf("Unknown = %u, expected 0\n", ph.unknown);
+            }
+
+            last_packet_overflow_bits = 0;
+        }
+        else
+        {
+            unsigned int total_bits, samples_this_packet;
+
+            if (ph.unknown != 2) {
+                printf("Unknown = %u, expected 2\n", ph.unknown);
+            }
+
+            struct bitstream_reader *ibs = init_frame_reader(data, data_size, packet_offset, ph.packet_skip);
+
+            // skip initial bits (overflow from a previous packet)
+            discard_bits(ibs, ph.skip_bits);
+
+            if (ph.skip_bits != last_packet_overflow_bits)
+            {
+                free_bitstream_reader(ibs);
+                status = xma_fail(err, XMA_SKIP_MISMATCH, ph.skip_bits, last_packet_overflow_bits);
+                break;
+            }
+
+            status = parse_frames(ibs, 0, false, &total_bits, &frames_this_packet, &samples_this_packet, (packet_size_bytes - packet_header_size_bytes)*8 - ph.skip_bits, opt, err);
+            free_bitstream_reader(ibs);
+            if (XMA_OK != status)
+            {
+                break;
+            }
+
+            sample_count += samples_this_packet;
+            last_packet_overflow_bits = packet_overflow_bits(ph.skip_bits, total_bits);
+        }
+
+        // We've successfully examined this packet, dump it out
+        if (dump) {
+            copy_dump_packet(data, data_size, packet_offset, buf);
+
+            // FIX: fix sequence number
+            if (seqno != ph.sequence_number && !opt->strict) {
+                buf[0] = (buf[0] & 0xf) | (seqno << 4);
+                if (opt->verbose) {
+                    printf("fixing sequence number (was %u, output %u)\n", ph.sequence_number, seqno);
+                }
+            }
+            put_bytes(dump, buf, packet_size_bytes);
+        }
+
+        // Do packet if not skipping
+        if (obs && ph.skip_bits != 16384) {
+            struct bitstream_reader *ibs = init_frame_reader(data, data_size, packet_offset, ph.packet_skip);
+
+            // skip initial bits (overflow from a previous packet)
+            discard_bits(ibs, ph.skip_bits);
+
+            status = packetize(ibs, obs, ctx, frames_this_packet, opt->strict,
+                    ((unsigned long)packet_offset + (ph.packet_skip + 1) * packet_size_bytes >= (unsigned long)data_size), err);
+            free_bitstream_reader(ibs);
+            if (XMA_OK != status)
+            {
+                break;
+            }
+        }
+
+        seqno = (seqno + 1) % 16;
+
+        packet_offset += (ph.packet_skip + 1) * packet_size_bytes;
+    }
+
+    if (samples_p)
+    {
+        *samples_p += sample_count;
+    }
+
+    return status;
+}
+
+// one XMA2 block, dumped if dump is set, rebuilt if obs is set
+static enum xma_status do_XMA2_block(const uint8_t *block, long block_size, long offset, FILE *dump, struct bitstream_writer *obs, struct xma_build_context *ctx, bool last, const struct xma_options *opt, unsigned long *samples_p, unsigned long *frame_bits_p, struct xma_error *err)
+{
+    long packet_offset = 0;
+    unsigned long sample_count = 0;
+    unsigned int last_packet_overflow_bits = 0;
+    uint8_t buf[packet_size_bytes];
+    enum xma_status status = XMA_OK;
+
+    for (unsigned packet_number = 0; packet_offset < block_size; packet_number++) {
+        struct xma2_packet_header ph;
+
+        if (packet_offset + packet_header_size_bytes > block_size)
+        {
+            status = xma_fail(err, XMA_OUT_OF_BITS, 0, 0);
+            break;
+        }
+
+        {
+            struct bitstream_reader *ibs = init_bitstream_reader(block+packet_offset, packet_header_size_bytes, 0, 0);
+            read_XMA2_packet_header(ibs, &ph);
+            free_bitstream_reader(ibs);
+        }
+
+        if (opt->verbose) {
+            printf("Packet #%u (offset %lx)\n", packet_number, (unsigned long)(offset + packet_offset));
+            printf("Frame Count     %u\n", ph.frame_count);
+            printf("Skip Bits       %u\n", ph.skip_bits);
+            printf("Metadata        %u\n", ph.metadata);
+            printf("Packet Skip     %u%s\n", ph.packet_skip, (opt->ignore_packet_skip ? " (ignored)" : ""));
+        }
+
+        if (opt->ignore_packet_skip)
+        {
+            ph.packet_skip = 0;
+        }
+
+        // At the end of a block no frame may start in a packet, signalled
+        // with invalidly large skip_bits so we skip everything
+        if (ph.skip_bits == 0x7fff) {
+            if (ph.frame_count != 0) {
+                status = xma_fail(err, XMA_SKIP_NONZERO_FRAMES, 0, 0);
+                break;
+            }
+            last_packet_overflow_bits = 0;
+        } else {
+            unsigned int total_bits, frames, packet_sample_count;
+
+            struct bitstream_reader *ibs = init_frame_reader(block, block_size, packet_offset, ph.packet_skip);
+
+            // skip initial bits (overflow from a previous packet)
+            discard_bits(ibs, ph.skip_bits);
+
+            if (ph.skip_bits != last_packet_overflow_bits) {
+                free_bitstream_reader(ibs);
+                status = xma_fail(err, XMA_SKIP_MISMATCH, ph.skip_bits, last_packet_overflow_bits);
+                break;
+            }
+
+            status = parse_frames(ibs, ph.frame_count, true, &total_bits, &frames, &packet_sample_count, (packet_size_bytes - packet_header_size_bytes)*8 - ph.skip_bits, opt, err);
+            free_bitstream_reader(ibs);
+            if (XMA_OK != status)
+            {
+                break;
+            }
+
+            sample_count += packet_sample_count;
+            if (frame_bits_p)
+            {
+                *frame_bits_p += total_bits;
+            }
+
+            last_packet_overflow_bits = packet_overflow_bits(ph.skip_bits, total_bits);
+        }
+
+        // We've successfully examined this packet, dump it out
+        if (dump) {
+            copy_dump_packet(block, block_size, packet_offset, buf);
+            put_bytes(dump, buf, packet_size_bytes);
+        }
+
+        // Do packet if not skipping
+        if (obs && ph.skip_bits != 0x7fff) {
+            struct bitstream_reader *ibs = init_frame_reader(block, block_size, packet_offset, ph.packet_skip);
+
+            // skip initial bits (overflow from a previous packet)
+            discard_bits(ibs, ph.skip_bits);
+
+            status = packetize(ibs, obs, ctx, ph.frame_count, opt->strict,
+                    last && ((unsigned long)packet_offset + (ph.packet_skip + 1) * packet_size_bytes >= (unsigned long)block_size), err);
+            free_bitstream_reader(ibs);
+            if (XMA_OK != status)
+            {
+                break;
+            }
+        }
+
+        // advance to next packet
+        packet_offset += (ph.packet_skip + 1) * packet_size_bytes;
+    }
+
+    if (samples_p)
+    {
+        *samples_p += sample_count;
+    }
+
+    return status;
+}
+
+enum xma_status parse_XMA_packets(const uint8_t *data, long data_size, long offset, FILE *dump, const struct xma_options *opt, unsigned long *samples_p, struct xma_error *err)
+{
+    return do_XMA_packets(data, data_size, offset, dump, NULL, NULL, opt, samples_p, err);
+}
+
+enum xma_status parse_XMA2_block(const uint8_t *block, long block_size, long offset, FILE *dump, const struct xma_options *opt, unsigned long *samples_p, unsigned long *frame_bits_p, struct xma_error *err)
+{
+    return do_XMA2_block(block, block_size, offset, dump, NULL, NULL, false, opt, samples_p, frame_bits_p, err);
+}
+
+void init_build_XMA(struct bitstream_writer *obs, struct xma_build_context *ctx)
+{
+    // first packet
+    struct xma_packet_header h = {
+        .sequence_number = 0,
+        .unknown = 2,
+        .skip_bits = 0,
+        .packet_skip = 0};
+    write_XMA_packet_header(obs, &h);
+
+    ctx->bits_written = packet_header_size_bytes * 8;
+    ctx->seqno = 1;
+}
+
+enum xma_status build_XMA_from_XMA(const uint8_t *data, long data_size, long offset, struct bitstream_writer *obs, struct xma_build_context *ctx, const struct xma_options *opt, unsigned long *samples_p, struct xma_error *err)
+{
+    return do_XMA_packets(data, data_size, offset, NULL, obs, ctx, opt, samples_p, err);
+}
+
+enum xma_status build_XMA_from_XMA2_block(const uint8_t *block, long block_size, long offset, struct bitstream_writer *obs, struct xma_build_context *ctx, bool last, const struct xma_options *opt, unsigned long *samples_p, unsigned long *frame_bits_p, struct xma_error *err)
+{
+    return do_XMA2_block(block, block_size, offset, NULL, obs, ctx, last, opt, samples_p, frame_bits_p, err);
+}
+
+// pad out with ones
+void finish_build_XMA(struct bitstream_writer *obs, struct xma_build_context *ctx)
+{
+    for (; ctx->bits_written + 32 <= packet_size_bytes * 8; ctx->bits_written += 32) {
+        put_bits(obs, UINT32_MAX, 32);
+    }
+    if (ctx->bits_written < packet_size_bytes * 8) {
+        put_bits(obs, UINT32_MAX, packet_size_bytes * 8 - ctx->bits_written);
+        ctx->bits_written = packet_size_bytes * 8;
+    }
+}
+
+void format_xma_error(const struct xma_error *err, char *buf, size_t buf_size)
+{
+    const char *description = "none";
+
+    switch (err->status)
+    {
+        case XMA_OK:
+            break;
+        case XMA_OUT_OF_BITS:
+            description = "ran out of data in the middle of a packet";
+            break;
+        case XMA_BAD_FRAME_SYNC:
+            snprintf(buf, buf_size, "Parse error: unexpected \"frame sync\" %x", err->value);
+            return;
+        case XMA_EARLY_PACKET_END:
+            description = "packet end indicated before end of packet";
+            break;
+        case XMA_MISSING_PACKET_END:
+            description = "packet end not seen before end of packet";
+            break;
+        case XMA_ZERO_FRAMES_NOT_SKIPPED:
+            description = "zero frames in this packet, but not set to skip it";
+            break;
+        case XMA_SKIP_MISMATCH:
+            snprintf(buf, buf_size, "Parse error: skip bits (%u) did not match previous packet overflow (%u)", err->value, err->expected);
+            return;
+        case XMA_SKIP_NONZERO_FRAMES:
+            description = "skipping entire packet with > 0 frames";
+            break;
+        case XMA_BAD_SEQUENCE:
+            description = "packet out of sequence";
+            break;
+    }
+
+    snprintf(buf, buf_size, "Parse error: %s", description);
+}
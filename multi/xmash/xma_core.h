@@ -0,0 +1,84 @@
+#ifndef _XMA_CORE_H
+#define _XMA_CORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "bitstream.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// XMA and XMA2 packet parsing, and rebuilding as XMA, shared by xmash and
+// xma_parse. Streams are parsed from memory, a block (XMA2) or the whole
+// data (XMA) at a time, and parse problems come back as a status rather
+// than ending the program. offset is only for messages, it is where the
+// data starts in the file.
+
+enum {
+    packet_size_bytes = 0x800,
+    packet_header_size_bytes = 4,
+    frame_header_size_bits = 15,
+    frame_sync_size_bits = 15,
+    frame_skip_size_bits = 10,
+    frame_trailer_size_bits = 1,
+    samples_per_frame = 512
+};
+
+enum xma_status {
+    XMA_OK = 0,
+    XMA_OUT_OF_BITS,
+    XMA_BAD_FRAME_SYNC,
+    XMA_EARLY_PACKET_END,
+    XMA_MISSING_PACKET_END,
+    XMA_ZERO_FRAMES_NOT_SKIPPED,
+    XMA_SKIP_MISMATCH,
+    XMA_SKIP_NONZERO_FRAMES,
+    XMA_BAD_SEQUENCE
+};
+
+struct xma_error
+{
+    enum xma_status status;
+    unsigned int value;     // frame sync, or packet skip bits
+    unsigned int expected;  // overflow from the previous packet
+};
+
+struct xma_options
+{
+    bool stereo;
+    bool strict;                // don't attempt to fix some issues
+    bool verbose;               // stream structure and content to stdout
+    bool ignore_packet_skip;
+    bool frame_skip;            // read the per-frame sample skip, and subtract it
+};
+
+struct xma_build_context
+{
+    unsigned int bits_written;  // bits written this packet
+    unsigned int seqno;         // sequence number
+};
+
+// sample counts are added to *samples_p, frame sizes in bits to *frame_bits_p
+// (either may be NULL), dump gets a copy of each packet with packet skip zeroed
+
+enum xma_status parse_XMA_packets(const uint8_t *data, long data_size, long offset, FILE *dump, const struct xma_options *opt, unsigned long *samples_p, struct xma_error *err);
+enum xma_status parse_XMA2_block(const uint8_t *block, long block_size, long offset, FILE *dump, const struct xma_options *opt, unsigned long *samples_p, unsigned long *frame_bits_p, struct xma_error *err);
+
+void init_build_XMA(struct bitstream_writer *obs, struct xma_build_context *ctx);
+enum xma_status build_XMA_from_XMA(const uint8_t *data, long data_size, long offset, struct bitstream_writer *obs, struct xma_build_context *ctx, const struct xma_options *opt, unsigned long *samples_p, struct xma_error *err);
+// last is set for the last block of the stream
+enum xma_status build_XMA_from_XMA2_block(const uint8_t *block, long block_size, long offset, struct bitstream_writer *obs, struct xma_build_context *ctx, bool last, const struct xma_options *opt, unsigned long *samples_p, unsigned long *frame_bits_p, struct xma_error *err);
+// fill out the last packet
+void finish_build_XMA(struct bitstream_writer *obs, struct xma_build_context *ctx);
+
+// "Parse error: ..." for a failed status
+void format_xma_error(const struct xma_error *err, char *buf, size_t buf_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // _XMA_CORE_H
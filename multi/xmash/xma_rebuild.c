@@ -1,41 +1,30 @@
+#ifndef __MINGW32__
+#define _POSIX_C_SOURCE 200809L
+#endif
+
 #include <stdio.h>
 #include <stdbool.h>
+#ifndef __MINGW32__
+#include <pthread.h>
+#endif
 
 #include "xma_rebuild.h"
 #include "util.h"
 #include "error_stuff.h"
 #include "bitstream.h"
 
-// rebuild XMA2 streams as XMA
-// based on xma_parse 0.12
-
-struct xma_build_context
-{
-    unsigned int bits_written;  // bits written this packet
-    unsigned int seqno;         // sequence number
-};
+// rebuild XMA2 streams as XMA, the parsing is in xma_core
 
-struct xma_packet_header
-{
-    unsigned sequence_number: 4;
-    unsigned unknown        : 2;
-    unsigned skip_bits      : 15;
-    unsigned packet_skip    : 11;
+// as xmash has always parsed, without the frame skip fields (so the
+// channel count doesn't matter either)
+static const struct xma_options rebuild_options = {
+    .stereo = false,
+    .strict = true,
+    .verbose = false,
+    .ignore_packet_skip = false,
+    .frame_skip = false
 };
 
-struct xma2_packet_header
-{
-    unsigned frame_count    : 6;
-    unsigned skip_bits      : 15;
-    unsigned metadata       : 3;
-    unsigned packet_skip    : 8;
-};
-
-static void write_XMA_packet_header(struct bitstream_writer *obs, const struct xma_packet_header *h);
-static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_writer *obs, long offset, long block_size, struct xma_build_context *ctx, bool stereo, bool strict, bool last, bool verbose);
-static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, bool stereo, bool strict, bool verbose);
-static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool strict, bool last);
-
 uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels)
 {
     uint8_t *h = malloc(xma_header_size);
@@ -76,60 +65,42 @@ uint8_t *make_xma_header(uint32_t srate, uint32_t size, int channels)
     return h;
 }
 
-int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, long block_size, int channels, long *samples_p)
+static int build_XMA_from_XMA2_serial(const uint8_t *indata, long data_size, FILE *outfile, long block_size, long *samples_p)
 {
-    long total_sample_count = 0;
+    unsigned long total_sample_count = 0;
 
     struct xma_build_context ctx;
     struct bitstream_writer *obs;
 
     // initialize
     obs = init_bitstream_writer(outfile);
-    {
-        struct xma_packet_header h = {
-            .sequence_number = 0,
-            .unknown = 2,
-            .skip_bits = 0,
-            .packet_skip = 0};
-        write_XMA_packet_header(obs, &h);
-    }
-    ctx.bits_written = packet_header_size_bytes * 8;
-    ctx.seqno = 1;
+    init_build_XMA(obs, &ctx);
 
     // handle blocks
     for (long block_offset = 0;
         block_offset < data_size;
         block_offset += block_size) {
 
-        long sample_count = 0;
         long usable_block_size = block_size;
-        bool strict = true, verbose = false;
 
         if (block_offset + usable_block_size > data_size)
         {
             usable_block_size = data_size - block_offset;
         }
 
-        sample_count = build_XMA_from_XMA2_block(indata, obs, block_offset, usable_block_size, &ctx, (channels > 1),
-            strict, (block_offset + block_size >= data_size), verbose);
-
-        if (-1 == sample_count)
+        if (XMA_OK != build_XMA_from_XMA2_block(indata + block_offset, usable_block_size, block_offset,
+                obs, &ctx, (block_offset + block_size >= data_size), &rebuild_options,
+                &total_sample_count, NULL, NULL))
         {
+            // keep what was rebuilt so far, as it would have been written
+            flush_bitstream_writer(obs);
+            free_bitstream_writer(obs);
             return 1;
         }
-
-        total_sample_count += sample_count;
-
-        if (verbose) {
-            printf("\n%ld samples (block) (%ld total)\n\n", sample_count, total_sample_count);
-        }
     }
 
     // finish
-    // pad with ones
-    for (; ctx.bits_written < packet_size_bytes * 8; ctx.bits_written ++) {
-        put_bit(obs, 1);
-    }
+    finish_build_XMA(obs, &ctx);
     flush_bitstream_writer(obs);
     free_bitstream_writer(obs);
 
@@ -141,386 +112,226 @@ int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, lo
     return 0;
 }
 
-static void write_XMA_packet_header(struct bitstream_writer *obs, const struct xma_packet_header *h)
-{
-    put_bits(obs, h->sequence_number, 4);
-    put_bits(obs, h->unknown, 2);
-    put_bits(obs, h->skip_bits, 15);
-    put_bits(obs, h->packet_skip, 11);
-}
+#ifndef __MINGW32__
+// Blocks are rebuilt independently in two passes. The first parses each
+// block for its sample count and the total size of its frames. Output
+// packets are a plain run of frame bits with a header every
+// packet_size_bytes, so the frame bits before a block say where it
+// starts in the output and with what sequence number. The second pass
+// packetizes each block from there into memory, and the blocks are
+// then written out in order.
 
-static void read_XMA2_packet_header(struct bitstream_reader *ibs, struct xma2_packet_header *h)
+struct xma_block_job
 {
-    h->frame_count = get_bits(ibs, 6);
-    h->skip_bits = get_bits(ibs, 15);
-    h->metadata = get_bits(ibs, 3);
-    h->packet_skip = get_bits(ibs, 8);
-}
+    long offset;
+    long size;
+    bool last;
 
-static long build_XMA_from_XMA2_block(const uint8_t *indata, struct bitstream_writer *obs, long offset, long block_size, struct xma_build_context *ctx, bool stereo, bool strict, bool last, bool verbose)
-{
-    long last_offset = offset + block_size;
-    unsigned int sample_count = 0;
-    unsigned int last_packet_overflow_bits = 0;
+    enum xma_status status;
+    unsigned long sample_count;
+    unsigned long frame_bits;
 
-    for (unsigned packet_number = 0; offset < last_offset; packet_number++) {
-        struct xma2_packet_header ph;
+    struct xma_build_context ctx;       // state at the start of the block
+    struct xma_build_context end_ctx;   // and at the end, after packetizing
+    struct bitstream_writer *obs;
+};
 
-        {
-            struct bitstream_reader *ibs = init_bitstream_reader(indata+offset, packet_header_size_bytes, 0, 0);
-            read_XMA2_packet_header(ibs, &ph);
-            free_bitstream_reader(ibs);
-        }
+struct xma_block_pool
+{
+    const uint8_t *indata;
+    bool packetize;     // second pass
 
-        if (verbose) {
-            printf("Packet #%u (offset 0x%lx)\n", packet_number, (unsigned long)offset);
-            printf("Frame Count     %u\n", ph.frame_count);
-            printf("Skip Bits       %u\n", ph.skip_bits);
-            printf("Metadata        %u\n", ph.metadata);
-            printf("Packet Skip     %u\n", ph.packet_skip);
-        }
+    struct xma_block_job *jobs;
+    long job_count;
 
-#if 0
-        if (ignore_packet_skip)
-        {
-            ph.packet_skip = 0;
-        }
-#endif
+    pthread_mutex_t lock;
+    long next_job;
+};
 
-        struct bitstream_reader *ibs = init_bitstream_reader(
-            // where's the data
-            indata + offset + packet_header_size_bytes,
-            // should never reach past end of block
-            last_offset - (offset + packet_header_size_bytes),
-            // consecutive
-            (packet_size_bytes - packet_header_size_bytes) * 8,
-            // skip
-            (packet_header_size_bytes + ph.packet_skip * packet_size_bytes) * 8
-        );
-
-        // At the end of a block no frame may start in a packet, signalled
-        // with invalidly large skip_bits so we skip everything
-        if (ph.skip_bits == 0x7fff) {
-            if (ph.frame_count != 0) {
-                //throw Skip_nonzero_frames();
-                free_bitstream_reader(ibs);
-                return -1;
-            }
-            last_packet_overflow_bits = 0;
-        } else {
-            unsigned int total_bits;
-            long packet_sample_count;
-
-            // skip initial bits (overflow from a previous packet)
-            for (unsigned int i = 0; i < ph.skip_bits; i++) get_bit(ibs);
-
-            if (ph.skip_bits != last_packet_overflow_bits) {
-                //throw Skip_mismatch(ph.skip_bits,last_packet_overflow_bits);
-                free_bitstream_reader(ibs);
-                return -1;
-            }
+static void *xma_block_worker(void *v)
+{
+    struct xma_block_pool *pool = v;
 
-            packet_sample_count = parse_frames(ibs, ph.frame_count, true, &total_bits, (packet_size_bytes - packet_header_size_bytes)*8 - ph.skip_bits, stereo, strict, verbose);
-            if (-1 == packet_sample_count)
-            {
-                free_bitstream_reader(ibs);
-                return -1;
-            }
-            sample_count += packet_sample_count;
+    for (;;)
+    {
+        CHECK_ERROR(0 != pthread_mutex_lock(&pool->lock), "pthread_mutex_lock");
+        const long i = pool->next_job++;
+        CHECK_ERROR(0 != pthread_mutex_unlock(&pool->lock), "pthread_mutex_unlock");
 
-            int overflow_temp = last_packet_overflow_bits = (ph.skip_bits + total_bits) - ((packet_size_bytes - packet_header_size_bytes) * 8);
-            if (overflow_temp > 0) {
-                last_packet_overflow_bits = overflow_temp;
-            } else {
-                last_packet_overflow_bits = 0;
-            }
+        if (i >= pool->job_count)
+        {
+            break;
         }
 
-        free_bitstream_reader(ibs);
+        struct xma_block_job *job = &pool->jobs[i];
 
-        // We've successfully examined this packet, dump it out
+        job->sample_count = 0;
+        if (!pool->packetize)
         {
-            struct bitstream_reader *dump_ibs = init_bitstream_reader(
-                // where's the data
-                indata + offset + packet_header_size_bytes,
-                // should never reach past end of block
-                last_offset - (offset + packet_header_size_bytes),
-                // consecutive
-                (packet_size_bytes - packet_header_size_bytes) * 8,
-                // skip
-                (packet_header_size_bytes + ph.packet_skip * packet_size_bytes) * 8
-            );
-
-            // Do packet if not skipping
-            if (ph.skip_bits != 0x7fff) {
-                // skip initial bits (overflow from a previous packet)
-                for (unsigned int i = 0; i < ph.skip_bits; i++) get_bit(dump_ibs);
-
-                if (0 != packetize(dump_ibs, obs, ctx, ph.frame_count, strict,
-                        last && ((unsigned long)offset + (ph.packet_skip + 1) * packet_size_bytes >= (unsigned long)last_offset) ))
-                {
-                    free_bitstream_reader(dump_ibs);
-                    return -1;
-                }
-            }
-
-            free_bitstream_reader(dump_ibs);
+            job->frame_bits = 0;
+            job->status = parse_XMA2_block(pool->indata + job->offset, job->size,
+                job->offset, NULL, &rebuild_options, &job->sample_count,
+                &job->frame_bits, NULL);
+        }
+        else
+        {
+            job->obs = init_bitstream_writer_memory();
+            job->end_ctx = job->ctx;
+            job->status = build_XMA_from_XMA2_block(pool->indata + job->offset, job->size,
+                job->offset, job->obs, &job->end_ctx, job->last, &rebuild_options,
+                &job->sample_count, NULL, NULL);
         }
-
-        // advance to next packet
-        offset += (ph.packet_skip + 1) * packet_size_bytes;
     }
 
-    return sample_count;
+    return NULL;
 }
 
-static long parse_frames(struct bitstream_reader *ibs, unsigned int frame_count, bool known_frame_count, unsigned int * total_bits_p, unsigned int max_bits, bool stereo, bool strict, bool verbose) {
-    bool packet_end_seen = false;
-    unsigned int sample_count = 0;
-    unsigned int total_bits = 0;
+static void run_xma_block_pool(struct xma_block_pool *pool, int threads)
+{
+    pthread_t *thread_ids = malloc(sizeof(pthread_t) * threads);
+    CHECK_ERRNO(!thread_ids, "malloc");
 
-    if (known_frame_count && frame_count == 0) {
-        //throw Zero_frames_not_skipped();
-        return -1;
+    pool->next_job = 0;
+    for (int i = 0; i < threads; i++)
+    {
+        CHECK_ERROR(0 != pthread_create(&thread_ids[i], NULL, xma_block_worker, pool), "pthread_create");
     }
-
-    for (unsigned int frame_number = 0;
-         !known_frame_count || frame_number < frame_count;
-         frame_number++)
+    for (int i = 0; i < threads; i++)
     {
+        CHECK_ERROR(0 != pthread_join(thread_ids[i], NULL), "pthread_join");
+    }
 
-        unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
-        total_bits += frame_bits;
+    free(thread_ids);
+}
 
-        unsigned int bits_left = frame_bits - frame_header_size_bits;
+// returns -1 if the serial build should be used instead
+static int build_XMA_from_XMA2_parallel(const uint8_t *indata, long data_size, FILE *outfile, long block_size, long *samples_p, int threads)
+{
+    struct xma_block_pool pool;
+    int rc = -1;
 
-        if (verbose)
-        {
-            printf("   Frame #%u\n", frame_number);
-            printf("   Size %u\n", frame_bits);
-        }
+    pool.indata = indata;
+    pool.job_count = (data_size + block_size - 1) / block_size;
+    pool.jobs = calloc(pool.job_count, sizeof(struct xma_block_job));
+    CHECK_ERRNO(!pool.jobs, "calloc");
+    CHECK_ERROR(0 != pthread_mutex_init(&pool.lock, NULL), "pthread_mutex_init");
 
-        // sync
+    for (long i = 0; i < pool.job_count; i++)
+    {
+        struct xma_block_job *job = &pool.jobs[i];
+
+        job->offset = i * block_size;
+        job->size = block_size;
+        if (job->offset + job->size > data_size)
         {
-            unsigned int sync = get_bits(ibs, frame_sync_size_bits);
-            if (sync!= 0x7f00)
-            {
-                //throw Bad_frame_sync(sync);
-                return -1;
-            }
-            bits_left -= frame_sync_size_bits;
+            job->size = data_size - job->offset;
         }
+        job->last = (job->offset + block_size >= data_size);
+    }
 
-#if 0
-        if (stereo) {
-            get_bit(ibs);
-            bits_left --;
-        }
-#endif
+    if (threads > pool.job_count)
+    {
+        threads = pool.job_count;
+    }
 
-#if 0
-        // skip
-        if (get_bit(ibs)) {
-#if 0
-            // skip at start
-            if (get_bit(ibs)) {
-                unsigned int skip_start = get_bits(ibs, frame_skip_size_bits);
-                if (verbose) {
-                    printf("Skip %u samples at start\n", skip_start);
-                }
-                bits_left -= frame_skip_size_bits;
-                sample_count -= skip_start;
-            }
-            bits_left --;
-#endif
-#if 0
-            // skip at end
-            if (get_bit(ibs)) {
-                unsigned int skip_end = get_bits(ibs, frame_skip_size_bits);
-                if (verbose) {
-                    printf("Skip %u samples at end\n", skip_end);
-                }
-                bits_left -= frame_skip_size_bits;
-                sample_count -= skip_end;
-            }
-            bits_left --;
-#endif
-        }
-        bits_left --;
-#endif
+    // pass one: parse
+    pool.packetize = false;
+    run_xma_block_pool(&pool, threads);
 
-        for (; bits_left >= 4 + frame_trailer_size_bits; bits_left -= 4) {
-            unsigned int nybble = get_bits(ibs, 4);
-            if (verbose) {
-                printf("%1x\n", nybble);
-            }
-        }
-        if (verbose) {
-            printf(" ");
-        }
-        for (; bits_left > frame_trailer_size_bits; bits_left--) {
-            unsigned int bit = get_bit(ibs);
-            if (verbose) {
-                printf("%c", (bit ? '1' : '0'));
-            }
-        }
+    // where each block starts, and the total sample count
+    unsigned long total_sample_count = 0;
+    {
+        const unsigned long packet_frame_bits = (packet_size_bytes - packet_header_size_bytes) * 8;
+        unsigned long frame_bits = 0;
 
-        // trailer
+        for (long i = 0; i < pool.job_count; i++)
         {
-            if (!get_bit(ibs))
+            struct xma_block_job *job = &pool.jobs[i];
+
+            if (XMA_OK != job->status)
             {
-                if (strict && known_frame_count &&
-                    frame_number != frame_count-1)
-                {
-                    //throw Early_packet_end();
-                    return -1;
-                }
-                packet_end_seen = true;
+                // let the serial build fail in the usual way
+                goto done;
             }
 
-            sample_count += samples_per_frame;
+            job->ctx.bits_written = packet_header_size_bytes * 8 + frame_bits % packet_frame_bits;
+            job->ctx.seqno = (1 + frame_bits / packet_frame_bits) % 16;
 
-            bits_left -= frame_trailer_size_bits;
-
-            if (!known_frame_count && packet_end_seen) break;
-
-            // FIX: detect end with bit count
-            if (!strict && !known_frame_count && total_bits >= max_bits) {
-                if (verbose) {
-                    printf("abandon frame due to bit count (total=%u max=%u)\n", total_bits, max_bits);
-                }
-                break;
-            }
+            frame_bits += job->frame_bits;
+            total_sample_count += job->sample_count;
         }
     }
 
-    // FIX: don't fail if packet end missing
-    if (strict && !packet_end_seen)
+    // pass two: packetize
+    pool.packetize = true;
+    run_xma_block_pool(&pool, threads);
+
+    for (long i = 0; i < pool.job_count; i++)
     {
-        //throw Missing_packet_end();
-        return -1;
-    }
+        const struct xma_block_job *job = &pool.jobs[i];
 
-    if (verbose) {
-        printf("\n");
+        if (XMA_OK != job->status)
+        {
+            goto done;
+        }
+        if (i + 1 < pool.job_count)
+        {
+            CHECK_ERROR(job->end_ctx.bits_written != job[1].ctx.bits_written ||
+                        job->end_ctx.seqno != job[1].ctx.seqno,
+                        "block layout mismatch");
+        }
     }
 
-    if (total_bits_p)
+    // stitch together
     {
-        *total_bits_p = total_bits;
-    }
-
-    return sample_count;
-}
+        struct xma_build_context ctx;
+        struct bitstream_writer *obs = init_bitstream_writer(outfile);
 
-static int packetize(struct bitstream_reader *ibs, struct bitstream_writer *obs, struct xma_build_context * ctx, unsigned int frame_count, bool strict, bool last) {
-    bool packet_end_seen = false;
-    unsigned int bits_written = ctx->bits_written;
-    unsigned int seqno = ctx->seqno;
+        init_build_XMA(obs, &ctx);
+        for (long i = 0; i < pool.job_count; i++)
+        {
+            append_bitstream_writer(obs, pool.jobs[i].obs);
+        }
+        ctx = pool.jobs[pool.job_count-1].end_ctx;
 
-    if (frame_count == 0) {
-        //throw Zero_frames_not_skipped();
-        return -1;
+        finish_build_XMA(obs, &ctx);
+        flush_bitstream_writer(obs);
+        free_bitstream_writer(obs);
     }
 
-    for (unsigned int frame_number = 0;
-         frame_number < frame_count;
-         frame_number++) {
-        unsigned int frame_bits = get_bits(ibs, frame_header_size_bits);
-
-        if (bits_written + frame_bits >= packet_size_bytes * 8) {
-            unsigned int bits_this_packet = (packet_size_bytes * 8) - bits_written;
-            unsigned int overflow_bits = frame_bits - bits_this_packet;
-
-            struct xma_packet_header ph;
-            ph.sequence_number = seqno;
-            seqno = (seqno + 1) % 16;
-            ph.unknown = 2;
-            ph.skip_bits = overflow_bits;
-            ph.packet_skip = 0;
-
-            // bits of frame header before packet end
-            unsigned int frame_header_size_bits_left = frame_header_size_bits;
-            for (; bits_this_packet > 0 && frame_header_size_bits_left > 0; bits_this_packet --, frame_header_size_bits_left --) {
-                put_bit(obs, 0 != (frame_bits & (1 << (frame_header_size_bits_left - 1))) );
-            }
-
-            if (overflow_bits == 0) {
-                // frame fits packet exactly
-
-                // payload bits before packet end
-                for (unsigned int i = 0; i < bits_this_packet-1; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
-                // trailer bit, no more frames in packet
-                put_bit(obs, 0);
-            } else {
-                // payload bits 
-                for (unsigned int i = 0; i < bits_this_packet; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
-            }
-
-            write_XMA_packet_header(obs, &ph);
-
-            bits_written = packet_header_size_bytes * 8;
-
-            if (overflow_bits != 0) {
-                // bits of frame header in new packet
-                for (; frame_header_size_bits_left > 0; frame_header_size_bits_left --, bits_written ++, overflow_bits --) {
-                    put_bit(obs, 0 != (frame_bits & (1 << (frame_header_size_bits_left - 1))) );
-                }
-
-                // payload bits in new packet
-                for (unsigned int i = 0; i < overflow_bits - 1; i++) {
-                    put_bit(obs, get_bit(ibs));
-                }
-                bits_written += overflow_bits - 1;
-
-                // trailer bit, no more frames in packet
-                put_bit(obs, 0);
-                bits_written ++;
-            }
-        } else {
-            put_bits(obs, frame_bits, frame_header_size_bits);
-            for (unsigned int i = 0; i < frame_bits - frame_header_size_bits - 1; i++) {
-                put_bit(obs, get_bit(ibs));
-            }
-
-            // trailer bit
-            if (last && frame_number == frame_count-1) {
-                // no more frames
-                put_bit(obs, 0);
-            } else {
-                // more frames in packet
-                put_bit(obs, 1);
-            }
-
-            bits_written += frame_bits;
-        }
+    if (samples_p)
+    {
+        *samples_p = total_sample_count;
+    }
+    rc = 0;
 
-        // trailer
+done:
+    for (long i = 0; i < pool.job_count; i++)
+    {
+        if (pool.jobs[i].obs)
         {
-            if (!get_bit(ibs))
-            {
-                if (strict && frame_number != frame_count-1)
-                {
-                    //throw Early_packet_end();
-                    return -1;
-                }
-                packet_end_seen = true;
-            }
+            free_bitstream_writer(pool.jobs[i].obs);
         }
     }
+    free(pool.jobs);
+    pthread_mutex_destroy(&pool.lock);
+
+    return rc;
+}
+#endif
 
-    if (strict && !packet_end_seen)
+int build_XMA_from_XMA2(const uint8_t *indata, long data_size, FILE *outfile, long block_size, int channels, long *samples_p, int threads)
+{
+#ifndef __MINGW32__
+    if (threads > 1 && data_size > block_size)
     {
-        //throw Missing_packet_end();
-        return -1;
+        const int rc = build_XMA_from_XMA2_parallel(indata, data_size, outfile, block_size, samples_p, threads);
+        if (-1 != rc)
+        {
+            return rc;
+        }
     }
+#endif
 
-    ctx->seqno = seqno;
-    ctx->bits_written = bits_written;
-
-    return 0;
+    return build_XMA_from_XMA2_serial(indata, data_size, outfile, block_size, samples_p);
 }
@@ -7,6 +7,7 @@
 #include "riffext.h"
 #include "bnkext.h"
 #include "xma_rebuild.h"
+#include "batch.h"
 
 // XMAsh - decrypt, demux, and rebuild FSB XMA2
 // also minimal RIFF and WWise bnk support
@@ -17,42 +18,123 @@
 #define BIN_NAME "xmash"
 
 const char *dir_name;
+int rebuild_threads = 1;
+struct fsb_key_store *known_keys = NULL;
 
 struct main_info {
     const char *file_name;
+    const char *sub_dir;    // relative to -o, in a batch
 };
 
+enum {
+    FORMAT_FSB,
+    FORMAT_RIFF,
+    FORMAT_WWISE_BNK,
+    FORMAT_ENCRYPTED_FSB,
+    FORMAT_COUNT
+};
+
+static const char * const format_names[FORMAT_COUNT] = {
+    "FSB",
+    "RIFF",
+    "Wwise bnk",
+    "encrypted FSB"
+};
+
+int try_formats(const uint8_t *indata, long file_size, struct main_info *mip);
+int batch_callback(const uint8_t *indata, long size, const char *path, const char *sub_dir, void *v);
 int try_key_callback(const uint8_t * d, long size, void *v);
+FILE *open_output(const struct main_info *mip, const char *name);
 int subfile_callback(const uint8_t * infile, long size, int streams, int *stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v);
 
 void usage(void);
 
 int main(int argc, char **argv)
 {
-    long file_size;
-    uint8_t *indata;
-
-    int success = 0;
+    const char *infile_name = NULL;
+    const char *batch_root = NULL;
+    int threads = 1;
+    int argi;
 
-    struct main_info mi;
-
-    if (argc != 2 && (argc != 4 || (argc == 4 && strcmp(argv[2], "-o"))))
+    if (argc < 2)
     {
         usage();
     }
 
-    char * infile_name = argv[1];
-
-    if (argc == 4)
+    if (!strcmp(argv[1], "-r"))
     {
-        dir_name = argv[3];
+        if (argc < 3)
+        {
+            usage();
+        }
+        batch_root = argv[2];
+        argi = 3;
     }
     else
     {
-        dir_name = NULL;
+        infile_name = argv[1];
+        argi = 2;
+    }
+
+    dir_name = NULL;
+    for (; argi < argc; argi += 2)
+    {
+        if (argi + 1 >= argc)
+        {
+            usage();
+        }
+
+        if (!strcmp(argv[argi], "-o"))
+        {
+            dir_name = argv[argi+1];
+        }
+        else if (!strcmp(argv[argi], "-k"))
+        {
+            if (known_keys)
+            {
+                usage();
+            }
+            known_keys = open_fsb_key_store(argv[argi+1]);
+        }
+        else if (!strcmp(argv[argi], "-j"))
+        {
+            threads = atoi(argv[argi+1]);
+            if (threads < 1)
+            {
+                usage();
+            }
+        }
+        else
+        {
+            usage();
+        }
+    }
+
+    if (batch_root)
+    {
+        // the threads go to whole files, each file is rebuilt serially
+        const long failed = run_batch(batch_root, threads, batch_callback, NULL, format_names, FORMAT_COUNT);
+
+        if (known_keys)
+        {
+            close_fsb_key_store(known_keys);
+        }
+
+        if (0 == failed)
+        {
+            return 0;
+        }
+        return 1;
     }
 
+    rebuild_threads = threads;
+
+    long file_size;
+    uint8_t *indata;
+    struct main_info mi;
+
     mi.file_name = strip_path(infile_name);
+    mi.sub_dir = NULL;
 
     {
         FILE *infile;
@@ -64,54 +146,81 @@ int main(int argc, char **argv)
 
     printf("%s\n\n", infile_name);
 
+    const int format = try_formats(indata, file_size, &mi);
+
+    free(indata);
+
+    if (known_keys)
+    {
+        close_fsb_key_store(known_keys);
+    }
+
+    if (-1 != format)
+    {
+        return 0;
+    }
+    else
+    {
+        return 1;
+    }
+}
+
+// returns the format that worked, or -1
+int try_formats(const uint8_t *indata, long file_size, struct main_info *mip)
+{
     // try without decrypting
-    if (0 == try_multistream_fsb(indata, file_size, subfile_callback, &mi))
+    if (0 == try_multistream_fsb(indata, file_size, subfile_callback, mip))
     {
         printf("success without decryption!\n");
-        success = 1;
+        return FORMAT_FSB;
     }
     // try RIFF
-    else if (0 == try_xma_riff(indata, file_size, subfile_callback, &mi))
+    else if (0 == try_xma_riff(indata, file_size, subfile_callback, mip))
     {
         printf("success with RIFF!\n");
-        success = 1;
+        return FORMAT_RIFF;
     }
-    else if (0 == try_wwbnk(indata, file_size, subfile_callback, &mi))
+    else if (0 == try_wwbnk(indata, file_size, subfile_callback, mip))
     {
         printf("success with WWise\n");
-        success = 1;
+        return FORMAT_WWISE_BNK;
     }
     // try via guessfsb
-    else if (0 == guess_fsb_keys(indata, file_size, try_key_callback, &mi))
+    else if (0 == guess_fsb_keys(indata, file_size, known_keys, try_key_callback, mip))
     {
         printf("success!\n");
-        success = 1;
-    }
-    else
-    {
-        printf("failure.\n");
+        return FORMAT_ENCRYPTED_FSB;
     }
 
-    free(indata);
+    printf("failure.\n");
+    return -1;
+}
 
-    if (success)
-    {
-        return 0;
-    }
-    else
-    {
-        return 1;
-    }
+// called for each file in a batch, outputs mirror the tree under -o
+int batch_callback(const uint8_t *indata, long size, const char *path, const char *sub_dir, void *v)
+{
+    struct main_info mi;
+
+    mi.file_name = strip_path(path);
+    mi.sub_dir = sub_dir;
+
+    printf("%s\n\n", path);
+
+    return try_formats(indata, size, &mi);
 }
 
 void usage()
 {
     fprintf(stderr, "XMAsh " VERSION " - decrypt, demux, and rebuild FSB, Wwise .bnk, RIFF XMA2\n");
     fprintf(stderr, "usage:\n"
-                    "  " BIN_NAME " input.fsb.xen [-o dir]\n"
-                    "  " BIN_NAME " input.fsb [-o dir]\n"
-                    "  " BIN_NAME " input.xma [-o dir]\n"
-                    "  " BIN_NAME " input.bnk [-o dir]\n");
+                    "  " BIN_NAME " input.fsb.xen [-o dir] [-j threads] [-k keyfile]\n"
+                    "  " BIN_NAME " input.fsb [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " input.xma [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " input.bnk [-o dir] [-j threads]\n"
+                    "  " BIN_NAME " -r dir [-o dir] [-j threads] [-k keyfile]\n"
+                    "-j rebuilds the blocks of each stream on that many threads\n"
+                    "-k tries the FSB keys in keyfile first, and adds any that work\n"
+                    "-r tries every file under dir, -j files at a time, and prints a report\n");
     exit(EXIT_FAILURE);
 }
 
@@ -121,6 +230,28 @@ int try_key_callback(const uint8_t * indata, long size, void *v)
     return try_multistream_fsb(indata, size, subfile_callback, v);
 }
 
+// outputs go in -o, or the current directory
+FILE *open_output(const struct main_info *mip, const char *name)
+{
+    FILE *outfile;
+
+    if (mip->sub_dir)
+    {
+        outfile = open_file_in_directory(dir_name ? dir_name : ".", mip->sub_dir, DIRSEP, name, "wb");
+    }
+    else if (dir_name)
+    {
+        outfile = open_file_in_directory(dir_name, NULL, DIRSEP, name, "wb");
+    }
+    else
+    {
+        outfile = fopen(name, "wb");
+    }
+    CHECK_ERRNO(!outfile, "fopen output");
+
+    return outfile;
+}
+
 // called for each subfile in an FSB (or a RIFF body)
 int subfile_callback(const uint8_t * infile, long size, int streams, int * stream_channels, long samples, long srate, long block_size, long loop_start, long loop_end, const char *stream_name, void *v)
 {
@@ -140,14 +271,7 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         printf("dumping %s\n", strname);
 
         // just dump
-        if (dir_name)
-        {
-            outfile = open_file_in_directory(dir_name, NULL, DIRSEP, strname, "wb");
-        }
-        else
-        {
-            outfile = fopen(strname, "wb");
-        }
+        outfile = open_output(mip, strname);
         put_bytes(outfile, infile, size);
         fclose(outfile);
         free(strname);
@@ -165,17 +289,7 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         char *strname = number_name(name_base, ".xma", str+1, streams);
         printf("%s\n", strname);
 
-        FILE *outfile;
-        
-        if (dir_name)
-        {
-            outfile = open_file_in_directory(dir_name, NULL, DIRSEP, strname, "wb");
-        }
-        else
-        {
-            outfile = fopen(strname, "wb");
-        }
-        CHECK_ERRNO(!outfile, "fopen output");
+        FILE *outfile = open_output(mip, strname);
         CHECK_ERRNO(
             -1 == fseek(outfile, xma_header_size, SEEK_SET), "fseek past header");
 
@@ -194,7 +308,7 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         if (0 != build_XMA_from_XMA2(infile + data_offset,
                                      data_size,
                                      outfile, block_size, channels,
-                                     &parsed_samples))
+                                     &parsed_samples, rebuild_threads))
         {
             // encountered an error while parsing
             fclose(outfile);
@@ -237,18 +351,7 @@ int subfile_callback(const uint8_t * infile, long size, int streams, int * strea
         if (loop_end > 0)
         {
             char *pos_name = number_name(name_base, ".pos", str+1, streams);
-            FILE *posfile;
-            
-            if (dir_name)
-            {
-                posfile = open_file_in_directory(dir_name, NULL, DIRSEP, pos_name, "wb");
-            }
-            else
-            {
-                posfile = fopen(pos_name,"wb");
-            }
-
-            CHECK_ERRNO(!posfile, "fopen .pos");
+            FILE *posfile = open_output(mip, pos_name);
             put_32_le(loop_start, posfile);
             put_32_le(loop_end, posfile);
             fclose(posfile);
@@ -1,3 +1,3 @@
 ZIPNAME=${1:?}
 
-zip xmash$ZIPNAME.zip bitstream.c bitstream.h fsbext.c fsbext.h guessfsb.c guessfsb.h riffext.c util.c xma_rebuild.c xmash.c error_stuff.h util.h Makefile Makefile.common Makefile.mingw riffext.h xma_rebuild.h xmash.exe bnkext.c bnkext.h zip.sh
+zip xmash$ZIPNAME.zip bitstream.c bitstream.h fsbext.c fsbext.h guessfsb.c guessfsb.h fsb_crypt.c fsb_crypt.h fsb_crypt_test.c riffext.c util.c xma_rebuild.c xmash.c error_stuff.h util.h Makefile Makefile.common Makefile.mingw riffext.h xma_rebuild.h xmash.exe bnkext.c bnkext.h zip.sh